@@ -18,40 +18,119 @@
 
 #include "CloseHandle.h"
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <libnetdevice/can.h>
 #include <libnetdevice/libnetdevice.h>
 #include <linux/can.h>
 #include <linux/can/error.h>
 #include <linux/can/raw.h>
 
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <tuple>
+
 namespace android::hardware::automotive::can::V1_0::implementation {
 
 /** Whether to log sent/received packets. */
 static constexpr bool kSuperVerbose = false;
 
-Return<Result> CanBus::send(const CanMessage& message) {
-    std::lock_guard<std::mutex> lck(mIsUpGuard);
-    if (!mIsUp) return Result::INTERFACE_DOWN;
+/** Maximum number of messages delivered to a single listener before yielding to other ones. */
+static constexpr size_t kDeliveryBatchSize = 32;
 
-    if (UNLIKELY(kSuperVerbose)) {
-        LOG(VERBOSE) << "Sending " << toString(message);
+static constexpr size_t kDefaultDeliveryQueueSize = 256;
+static constexpr unsigned kDefaultDeliveryThreads = 2;
+static constexpr unsigned kMaxDeliveryThreads = 16;
+
+/**
+ * Read listener delivery settings.
+ *
+ * vendor.can.delivery.queue_size - per-listener queue size, in frames
+ * vendor.can.delivery.overflow - "drop_oldest" (default) or "drop_newest"
+ * vendor.can.delivery.threads - delivery threads per interface
+ */
+static CanBus::DeliveryConfig getDeliveryConfig() {
+    CanBus::DeliveryConfig config = {};
+    config.queueSize = base::GetUintProperty<size_t>("vendor.can.delivery.queue_size",
+                                                     kDefaultDeliveryQueueSize);
+    if (config.queueSize == 0) config.queueSize = 1;
+
+    const auto overflow = base::GetProperty("vendor.can.delivery.overflow", "drop_oldest");
+    if (overflow == "drop_newest") {
+        config.overflowPolicy = CanBus::OverflowPolicy::DROP_NEWEST;
+    } else {
+        if (overflow != "drop_oldest") LOG(WARNING) << "Invalid overflow policy: " << overflow;
+        config.overflowPolicy = CanBus::OverflowPolicy::DROP_OLDEST;
     }
 
+    config.threads = base::GetUintProperty<unsigned>("vendor.can.delivery.threads",
+                                                     kDefaultDeliveryThreads, kMaxDeliveryThreads);
+    if (config.threads == 0) config.threads = 1;
+    return config;
+}
+
+/**
+ * Convert HIDL message to a SocketCAN frame.
+ *
+ * \param message Message to convert
+ * \param frame Frame to fill in
+ * \return OK on success, PAYLOAD_TOO_LONG if the message doesn't fit in a frame
+ */
+static Result toFrame(const CanMessage& message, struct canfd_frame& frame) {
     if (message.payload.size() > CAN_MAX_DLEN) return Result::PAYLOAD_TOO_LONG;
 
-    struct canfd_frame frame = {};
+    frame = {};
     frame.can_id = message.id;
     if (message.isExtendedId) frame.can_id |= CAN_EFF_FLAG;
     if (message.remoteTransmissionRequest) frame.can_id |= CAN_RTR_FLAG;
     frame.len = message.payload.size();
     memcpy(frame.data, message.payload.data(), message.payload.size());
+    return Result::OK;
+}
+
+Return<Result> CanBus::send(const CanMessage& message) {
+    std::lock_guard<std::mutex> lck(mIsUpGuard);
+    if (!mIsUp) return Result::INTERFACE_DOWN;
+
+    if (UNLIKELY(kSuperVerbose)) {
+        LOG(VERBOSE) << "Sending " << toString(message);
+    }
+
+    struct canfd_frame frame;
+    const auto res = toFrame(message, frame);
+    if (res != Result::OK) return res;
 
     if (!mSocket->send(frame)) return Result::TRANSMISSION_FAILURE;
 
     return Result::OK;
 }
 
+Result CanBus::sendBatch(const std::vector<CanMessage>& messages, size_t* sent) {
+    if (sent != nullptr) *sent = 0;
+
+    std::lock_guard<std::mutex> lck(mIsUpGuard);
+    if (!mIsUp) return Result::INTERFACE_DOWN;
+
+    // Validate all messages first, so it's either none or (as long as the bus is healthy) all.
+    mTxFrames.resize(messages.size());
+    for (size_t i = 0; i < messages.size(); i++) {
+        if (UNLIKELY(kSuperVerbose)) {
+            LOG(VERBOSE) << "Sending " << toString(messages[i]);
+        }
+        const auto res = toFrame(messages[i], mTxFrames[i]);
+        if (res != Result::OK) return res;
+    }
+
+    const auto count = mSocket->send(mTxFrames.data(), mTxFrames.size());
+    if (sent != nullptr) *sent = count;
+    if (count != messages.size()) return Result::TRANSMISSION_FAILURE;
+
+    return Result::OK;
+}
+
 Return<void> CanBus::listen(const hidl_vec<CanMessageFilter>& filter,
                             const sp<ICanMessageListener>& listenerCb, listen_cb _hidl_cb) {
     std::lock_guard<std::mutex> lck(mIsUpGuard);
@@ -68,16 +147,38 @@ Return<void> CanBus::listen(const hidl_vec<CanMessageFilter>& filter,
     std::lock_guard<std::mutex> lckListeners(mMsgListenersGuard);
 
     sp<CloseHandle> closeHandle = new CloseHandle([this, listenerCb]() {
-        std::lock_guard<std::mutex> lck(mMsgListenersGuard);
-        std::erase_if(mMsgListeners, [&](const auto& e) { return e.callback == listenerCb; });
+        std::vector<std::shared_ptr<CanMessageListener>> closed;
+        {
+            std::lock_guard<std::mutex> lck(mMsgListenersGuard);
+            std::erase_if(mMsgListeners, [&](const auto& e) {
+                if (e->callback != listenerCb) return false;
+                // Frames still waiting in the delivery queue won't be delivered.
+                e->closed = true;
+                closed.push_back(e);
+                return true;
+            });
+            rebuildListenerIndexLocked();
+        }
+        /* Don't hold mMsgListenersGuard while waiting, since the callback may close other
+         * listeners. */
+        for (auto& listener : closed) waitForDelivery(*listener);
     });
-    mMsgListeners.emplace_back(CanMessageListener{listenerCb, filter, closeHandle});
-    auto& listener = mMsgListeners.back();
+    auto listener = std::make_shared<CanMessageListener>();
+    listener->callback = listenerCb;
+    listener->filter = filter;
+    listener->closeHandle = closeHandle;
+    {
+        std::lock_guard<std::mutex> lckQueue(listener->queueGuard);
+        listener->queue.resize(mDeliveryConfig.queueSize);
+    }
 
     // fix message IDs to have all zeros on bits not covered by mask
-    std::for_each(listener.filter.begin(), listener.filter.end(),
+    std::for_each(listener->filter.begin(), listener->filter.end(),
                   [](auto& rule) { rule.id &= rule.mask; });
 
+    mMsgListeners.emplace_back(std::move(listener));
+    rebuildListenerIndexLocked();
+
     _hidl_cb(Result::OK, closeHandle);
     return {};
 }
@@ -136,12 +237,23 @@ ICanController::Result CanBus::up() {
     using namespace std::placeholders;
     CanSocket::ReadCallback rdcb = std::bind(&CanBus::onRead, this, _1, _2);
     CanSocket::ErrorCallback errcb = std::bind(&CanBus::onError, this, _1);
-    mSocket = CanSocket::open(mIfname, rdcb, errcb);
-    if (!mSocket) {
+    mDeliveryConfig = getDeliveryConfig();
+    mDeliveryPool = std::make_unique<DeliveryPool>(mDeliveryConfig.threads, mIfname);
+
+    auto socket = CanSocket::open(mIfname, rdcb, errcb);
+    if (!socket) {
+        mDeliveryPool.reset();
         if (mDownAfterUse) netdevice::down(mIfname);
         return ICanController::Result::UNKNOWN_ERROR;
     }
 
+    {
+        std::scoped_lock lckListeners(mMsgListenersGuard, mErrListenersGuard);
+        mSocket = std::move(socket);
+        updateKernelFiltersLocked();
+        updateKernelErrorFilterLocked();
+    }
+
     mIsUp = true;
     return ICanController::Result::OK;
 }
@@ -152,7 +264,7 @@ void CanBus::clearMsgListeners() {
         std::lock_guard<std::mutex> lck(mMsgListenersGuard);
         std::transform(mMsgListeners.begin(), mMsgListeners.end(),
                        std::back_inserter(listenersToClose),
-                       [](const auto& e) { return e.closeHandle; });
+                       [](const auto& e) { return e->closeHandle; });
     }
 
     for (auto& weakListener : listenersToClose) {
@@ -185,10 +297,12 @@ Return<sp<ICloseHandle>> CanBus::listenForErrors(const sp<ICanErrorListener>& li
 
     std::lock_guard<std::mutex> errLck(mErrListenersGuard);
     mErrListeners.emplace_back(listener);
+    updateKernelErrorFilterLocked();
 
     return new CloseHandle([this, listener]() {
         std::lock_guard<std::mutex> lck(mErrListenersGuard);
         std::erase(mErrListeners, listener);
+        updateKernelErrorFilterLocked();
     });
 }
 
@@ -203,7 +317,16 @@ bool CanBus::down() {
 
     clearMsgListeners();
     clearErrListeners();
-    mSocket.reset();
+
+    /* The socket is destroyed without holding listener guards, because its reader thread may be
+     * waiting for one of them while being joined. */
+    std::unique_ptr<CanSocket> socket;
+    {
+        std::scoped_lock lckListeners(mMsgListenersGuard, mErrListenersGuard);
+        socket = std::move(mSocket);
+    }
+    socket.reset();
+    mDeliveryPool.reset();
 
     bool success = true;
 
@@ -264,6 +387,110 @@ static bool match(const hidl_vec<CanMessageFilter>& filter, CanMessageId id, boo
     return !anyNonExcludeRulePresent || anyNonExcludeRuleSatisfied;
 }
 
+/**
+ * Check whether a filter rule matches exactly one message ID (per frame format).
+ *
+ * \param rule Filter rule to check
+ * \return true if the rule's mask covers all ID bits
+ */
+static bool isExactRule(const CanMessageFilter& rule) {
+    if ((rule.mask & CAN_EFF_MASK) == CAN_EFF_MASK) return true;
+    return rule.extendedFormat == FilterFlag::NOT_SET &&
+           (rule.mask & CAN_SFF_MASK) == CAN_SFF_MASK;
+}
+
+void CanBus::rebuildListenerIndexLocked() {
+    auto index = std::make_shared<ListenerIndex>();
+
+    for (const auto& listener : mMsgListeners) {
+        const auto& filter = listener->filter;
+        const bool indexable =
+                filter.size() > 0 && std::all_of(filter.begin(), filter.end(), [](auto& rule) {
+                    return !rule.exclude && isExactRule(rule);
+                });
+        if (!indexable) {
+            index->masked.push_back(listener);
+            continue;
+        }
+
+        for (const auto& rule : filter) {
+            auto& candidates = index->exact[rule.id];
+            // Multiple rules of a single listener may share the same ID (i.e. differ by flags).
+            if (!candidates.empty() && candidates.back() == listener) continue;
+            candidates.push_back(listener);
+        }
+    }
+
+    std::atomic_store(&mListenerIndex, std::shared_ptr<const ListenerIndex>(std::move(index)));
+    updateKernelFiltersLocked();
+}
+
+/**
+ * Convert an include rule to a SocketCAN kernel filter.
+ *
+ * RTR and frame format flags are only part of the kernel mask if the rule cares about them.
+ */
+static struct can_filter toKernelFilter(const CanMessageFilter& rule) {
+    struct can_filter kfilter = {};
+    kfilter.can_id = rule.id & CAN_EFF_MASK;
+    kfilter.can_mask = rule.mask & CAN_EFF_MASK;
+    if (rule.rtr != FilterFlag::DONT_CARE) {
+        kfilter.can_mask |= CAN_RTR_FLAG;
+        if (rule.rtr == FilterFlag::SET) kfilter.can_id |= CAN_RTR_FLAG;
+    }
+    if (rule.extendedFormat != FilterFlag::DONT_CARE) {
+        kfilter.can_mask |= CAN_EFF_FLAG;
+        if (rule.extendedFormat == FilterFlag::SET) kfilter.can_id |= CAN_EFF_FLAG;
+    }
+    return kfilter;
+}
+
+void CanBus::updateKernelFiltersLocked() {
+    if (!mSocket) return;
+
+    /* The kernel filter is a union of all listeners' include rules. Exclude rules can't be
+     * expressed this way (the kernel ORs all filters), so they are still applied in onRead. */
+    std::vector<struct can_filter> kfilters;
+    bool acceptAll = false;
+    for (const auto& listener : mMsgListeners) {
+        const auto& filter = listener->filter;
+        const bool anyInclude = std::any_of(filter.begin(), filter.end(),
+                                            [](auto& rule) { return !rule.exclude; });
+        if (!anyInclude) {
+            acceptAll = true;
+            break;
+        }
+        for (const auto& rule : filter) {
+            if (!rule.exclude) kfilters.push_back(toKernelFilter(rule));
+        }
+    }
+
+    std::sort(kfilters.begin(), kfilters.end(), [](const auto& a, const auto& b) {
+        return std::tie(a.can_id, a.can_mask) < std::tie(b.can_id, b.can_mask);
+    });
+    kfilters.erase(std::unique(kfilters.begin(), kfilters.end(),
+                               [](const auto& a, const auto& b) {
+                                   return a.can_id == b.can_id && a.can_mask == b.can_mask;
+                               }),
+                   kfilters.end());
+
+    if (acceptAll || kfilters.size() > CAN_RAW_FILTER_MAX) {
+        kfilters = {{.can_id = 0, .can_mask = 0}};
+    }
+
+    if (!mSocket->setFilters(kfilters)) {
+        LOG(WARNING) << "Falling back to user space filtering on " << mIfname;
+        mSocket->setFilters({{.can_id = 0, .can_mask = 0}});
+    }
+}
+
+void CanBus::updateKernelErrorFilterLocked() {
+    if (!mSocket) return;
+
+    // Error frames are only ever used to notify error listeners.
+    mSocket->setErrorFilter(mErrListeners.empty() ? 0 : CAN_ERR_MASK);
+}
+
 void CanBus::notifyErrorListeners(ErrorEvent err, bool isFatal) {
     std::lock_guard<std::mutex> lck(mErrListenersGuard);
     for (auto& listener : mErrListeners) {
@@ -305,27 +532,156 @@ void CanBus::onRead(const struct canfd_frame& frame, std::chrono::nanoseconds ti
         return;
     }
 
-    CanMessage message = {};
-    message.id = frame.can_id & CAN_EFF_MASK;  // mask out eff/rtr/err flags
-    message.payload = hidl_vec<uint8_t>(frame.data, frame.data + frame.len);
-    message.timestamp = timestamp.count();
-    message.isExtendedId = (frame.can_id & CAN_EFF_FLAG) != 0;
-    message.remoteTransmissionRequest = (frame.can_id & CAN_RTR_FLAG) != 0;
+    const auto index = std::atomic_load(&mListenerIndex);
+    if (index == nullptr) return;
+
+    const CanMessageId id = frame.can_id & CAN_EFF_MASK;  // mask out eff/rtr/err flags
+    const bool isExtendedId = (frame.can_id & CAN_EFF_FLAG) != 0;
+    const bool isRtr = (frame.can_id & CAN_RTR_FLAG) != 0;
+
+    const auto exactIt = index->exact.find(id);
+    const bool anyExact = exactIt != index->exact.end();
+    if (!anyExact && index->masked.empty()) return;
 
     if (UNLIKELY(kSuperVerbose)) {
-        LOG(VERBOSE) << "Got message " << toString(message);
+        LOG(VERBOSE) << "Got frame " << std::hex << frame.can_id;
     }
 
-    std::lock_guard<std::mutex> lck(mMsgListenersGuard);
-    for (auto& listener : mMsgListeners) {
-        if (!match(listener.filter, message.id, message.remoteTransmissionRequest,
-                   message.isExtendedId))
-            continue;
-        if (!listener.callback->onReceive(message).isOk() && !listener.failedOnce) {
-            listener.failedOnce = true;
+    const PendingFrame pending = {frame, timestamp};
+    auto& pool = *mDeliveryPool;
+
+    /* Indexed listeners only have include rules with a full mask, so the ID is already matched;
+     * match() is still needed for the RTR and frame format flags. */
+    if (anyExact) {
+        for (const auto& listener : exactIt->second) {
+            if (!match(listener->filter, id, isRtr, isExtendedId)) continue;
+            enqueue(pool, listener, pending);
+        }
+    }
+    for (const auto& listener : index->masked) {
+        if (!match(listener->filter, id, isRtr, isExtendedId)) continue;
+        enqueue(pool, listener, pending);
+    }
+}
+
+void CanBus::enqueue(DeliveryPool& pool, const std::shared_ptr<CanMessageListener>& listener,
+                     const PendingFrame& pending) {
+    bool schedule;
+    {
+        std::lock_guard<std::mutex> lck(listener->queueGuard);
+        auto& queue = listener->queue;
+        if (listener->queueSize == queue.size()) {
+            listener->dropped++;
+            mDroppedTotal++;
+            // A full queue always has a delivery job scheduled, no need to check it.
+            if (mDeliveryConfig.overflowPolicy == OverflowPolicy::DROP_NEWEST) return;
+            listener->queueHead = (listener->queueHead + 1) % queue.size();
+            listener->queueSize--;
+        }
+        queue[(listener->queueHead + listener->queueSize) % queue.size()] = pending;
+        listener->queueSize++;
+
+        schedule = !listener->deliveryScheduled;
+        listener->deliveryScheduled = true;
+    }
+    if (schedule) pool.post([this, &pool, listener]() { deliver(pool, listener); });
+}
+
+void CanBus::deliver(DeliveryPool& pool, const std::shared_ptr<CanMessageListener>& listener) {
+    std::array<PendingFrame, kDeliveryBatchSize> batch;
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lck(listener->queueGuard);
+        listener->delivering = true;
+        listener->deliveringThread = std::this_thread::get_id();
+        auto& queue = listener->queue;
+        while (count < batch.size() && listener->queueSize > 0) {
+            batch[count++] = queue[listener->queueHead];
+            listener->queueHead = (listener->queueHead + 1) % queue.size();
+            listener->queueSize--;
+        }
+    }
+
+    for (size_t i = 0; i < count && !listener->closed; i++) {
+        auto& pending = batch[i];
+        auto& frame = pending.frame;
+
+        /* The payload is only read while the (synchronous) callback is executed, so there is no
+         * need to copy it to a separate heap buffer. */
+        CanMessage message = {};
+        message.id = frame.can_id & CAN_EFF_MASK;  // mask out eff/rtr/err flags
+        message.payload.setToExternal(frame.data, frame.len);
+        message.timestamp = pending.timestamp.count();
+        message.isExtendedId = (frame.can_id & CAN_EFF_FLAG) != 0;
+        message.remoteTransmissionRequest = (frame.can_id & CAN_RTR_FLAG) != 0;
+
+        if (UNLIKELY(kSuperVerbose)) {
+            LOG(VERBOSE) << "Delivering message " << toString(message);
+        }
+
+        const bool ok = listener->callback->onReceive(message).isOk();
+        if (!ok && !listener->failedOnce.exchange(true)) {
             LOG(WARNING) << "Failed to notify listener about message";
         }
+        listener->delivered++;
+    }
+
+    bool done;
+    {
+        std::lock_guard<std::mutex> lck(listener->queueGuard);
+        listener->delivering = false;
+        done = listener->closed || listener->queueSize == 0;
+        if (done) listener->deliveryScheduled = false;
+    }
+    listener->deliveryDone.notify_all();
+    if (done) return;
+
+    // Yield to other listeners before delivering the next batch.
+    pool.post([this, &pool, listener]() { deliver(pool, listener); });
+}
+
+/**
+ * Wait until a delivery job in progress stops calling a closed listener.
+ *
+ * A listener closed from within its own callback doesn't wait, since the delivery job can't finish
+ * before the callback returns.
+ */
+void CanBus::waitForDelivery(CanMessageListener& listener) {
+    std::unique_lock<std::mutex> lck(listener.queueGuard);
+    listener.deliveryDone.wait(lck, [&listener]() {
+        return !listener.delivering || listener.deliveringThread == std::this_thread::get_id();
+    });
+}
+
+void CanBus::dump(int fd) {
+    std::string out;
+    {
+        std::lock_guard<std::mutex> lck(mIsUpGuard);
+        out += base::StringPrintf("%s: %s\n", mIfname.c_str(), mIsUp ? "up" : "down");
+        if (mIsUp) {
+            out += base::StringPrintf(
+                    "  delivery: queue size %zu, %s, %u thread(s), %" PRIu64 " frame(s) dropped\n",
+                    mDeliveryConfig.queueSize,
+                    mDeliveryConfig.overflowPolicy == OverflowPolicy::DROP_NEWEST ? "drop newest"
+                                                                                  : "drop oldest",
+                    mDeliveryConfig.threads, mDroppedTotal.load());
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lck(mMsgListenersGuard);
+        for (const auto& listener : mMsgListeners) {
+            size_t queued;
+            {
+                std::lock_guard<std::mutex> lckQueue(listener->queueGuard);
+                queued = listener->queueSize;
+            }
+            out += base::StringPrintf("  listener %p: %zu filter rule(s), %zu queued, %" PRIu64
+                                      " delivered, %" PRIu64 " dropped\n",
+                                      listener->callback.get(), listener->filter.size(), queued,
+                                      listener->delivered.load(), listener->dropped.load());
+        }
     }
+    base::WriteStringToFd(out, fd);
 }
 
 void CanBus::onError(int errnoVal) {
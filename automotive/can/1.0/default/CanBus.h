@@ -17,6 +17,7 @@
 #pragma once
 
 #include "CanSocket.h"
+#include "DeliveryPool.h"
 
 #include <android-base/unique_fd.h>
 #include <android/hardware/automotive/can/1.0/ICanBus.h>
@@ -24,7 +25,10 @@
 #include <utils/Mutex.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <thread>
+#include <unordered_map>
 
 namespace android::hardware::automotive::can::V1_0::implementation {
 
@@ -38,10 +42,45 @@ struct CanBus : public ICanBus {
                         const sp<ICanMessageListener>& listener, listen_cb _hidl_cb) override;
     Return<sp<ICloseHandle>> listenForErrors(const sp<ICanErrorListener>& listener) override;
 
+    /**
+     * Send multiple messages, in order.
+     *
+     * This is a bulk counterpart to send() (i.e. for diagnostics flashing or UDS block transfers),
+     * which queues all frames on the socket with batched system calls. It's not part of the
+     * ICanBus@1.0 interface, so it's only available in-process.
+     *
+     * \param messages Messages to send
+     * \param sent Number of messages actually sent (optional)
+     * \return OK if all messages were sent, an error otherwise
+     */
+    Result sendBatch(const std::vector<CanMessage>& messages, size_t* sent = nullptr);
+
     void setErrorCallback(ErrorCallback errcb);
     ICanController::Result up();
     bool down();
 
+    /**
+     * Write interface state and listener delivery statistics.
+     *
+     * \param fd File descriptor to write to
+     */
+    void dump(int fd);
+
+    /** What to do with a received frame when a listener's delivery queue is full. */
+    enum class OverflowPolicy {
+        DROP_OLDEST,
+        DROP_NEWEST,
+    };
+
+    /** Asynchronous listener delivery settings, read from system properties on up(). */
+    struct DeliveryConfig {
+        /** Maximum number of frames waiting for delivery, per listener. */
+        size_t queueSize;
+        OverflowPolicy overflowPolicy;
+        /** Number of threads calling listeners, per interface. */
+        unsigned threads;
+    };
+
   protected:
     /**
      * Blank constructor, since some interface types (such as SLCAN) don't get a name until after
@@ -75,29 +114,100 @@ struct CanBus : public ICanBus {
     std::string mIfname;
 
   private:
+    /** Frame received from the socket, waiting to be delivered to a listener. */
+    struct PendingFrame {
+        struct canfd_frame frame;
+        std::chrono::nanoseconds timestamp;
+    };
+
+    /**
+     * Message listener with its delivery queue.
+     *
+     * Frames are queued by the reader thread and delivered by the delivery pool, so a slow
+     * listener doesn't throttle reception for the other ones. At most one delivery job per
+     * listener is scheduled at a time, which keeps messages in order.
+     */
     struct CanMessageListener {
         sp<ICanMessageListener> callback;
         hidl_vec<CanMessageFilter> filter;
         wp<ICloseHandle> closeHandle;
-        bool failedOnce = false;
+        std::atomic<bool> failedOnce = false;
+        std::atomic<bool> closed = false;
+
+        std::mutex queueGuard;
+        /** Fixed capacity ring buffer of frames waiting for delivery. */
+        std::vector<PendingFrame> queue GUARDED_BY(queueGuard);
+        size_t queueHead GUARDED_BY(queueGuard) = 0;
+        size_t queueSize GUARDED_BY(queueGuard) = 0;
+        bool deliveryScheduled GUARDED_BY(queueGuard) = false;
+        /** Set while a delivery job calls the listener, so closing can wait for it to finish. */
+        bool delivering GUARDED_BY(queueGuard) = false;
+        std::thread::id deliveringThread GUARDED_BY(queueGuard);
+        std::condition_variable deliveryDone;
+
+        std::atomic<uint64_t> delivered = 0;
+        std::atomic<uint64_t> dropped = 0;
     };
+
+    /**
+     * Immutable snapshot of message listeners, compiled from their filters.
+     *
+     * Listeners whose filters consist only of include rules with a full ID mask are indexed by
+     * the message ID, so only candidates for a given frame are visited. All other listeners (no
+     * filter, partial masks or exclude rules) need the full match pass on every frame.
+     */
+    struct ListenerIndex {
+        std::unordered_map<CanMessageId, std::vector<std::shared_ptr<CanMessageListener>>> exact;
+        std::vector<std::shared_ptr<CanMessageListener>> masked;
+    };
+
     void clearMsgListeners();
+    static void waitForDelivery(CanMessageListener& listener);
+    void rebuildListenerIndexLocked() REQUIRES(mMsgListenersGuard);
+    void updateKernelFiltersLocked() REQUIRES(mMsgListenersGuard);
+    void updateKernelErrorFilterLocked() REQUIRES(mErrListenersGuard);
     void clearErrListeners();
 
     void notifyErrorListeners(ErrorEvent err, bool isFatal);
 
     void onRead(const struct canfd_frame& frame, std::chrono::nanoseconds timestamp);
+    void enqueue(DeliveryPool& pool, const std::shared_ptr<CanMessageListener>& listener,
+                 const PendingFrame& pending);
+    void deliver(DeliveryPool& pool, const std::shared_ptr<CanMessageListener>& listener);
     void onError(int errnoVal);
 
     std::mutex mMsgListenersGuard;
-    std::vector<CanMessageListener> mMsgListeners GUARDED_BY(mMsgListenersGuard);
+    std::vector<std::shared_ptr<CanMessageListener>> mMsgListeners GUARDED_BY(mMsgListenersGuard);
+
+    /**
+     * Listener index used by the reader thread. It's replaced as a whole (with atomic shared_ptr
+     * operations) whenever mMsgListeners changes, so onRead doesn't need mMsgListenersGuard.
+     */
+    std::shared_ptr<const ListenerIndex> mListenerIndex;
 
     std::mutex mErrListenersGuard;
     std::vector<sp<ICanErrorListener>> mErrListeners GUARDED_BY(mErrListenersGuard);
 
+    /**
+     * The socket is replaced while holding mIsUpGuard and both listener guards, so it's safe to
+     * access it while holding any of them (i.e. to update kernel filters from a close handle).
+     */
     std::unique_ptr<CanSocket> mSocket;
     bool mDownAfterUse;
 
+    /** TX frame buffer for sendBatch(), reused between calls. */
+    std::vector<struct canfd_frame> mTxFrames GUARDED_BY(mIsUpGuard);
+
+    /**
+     * Delivery pool exists for the whole time the socket does (it's created before and destroyed
+     * after it), so the reader thread doesn't need any lock to use it.
+     */
+    DeliveryConfig mDeliveryConfig;
+    std::unique_ptr<DeliveryPool> mDeliveryPool;
+
+    /** Frames dropped due to full delivery queues, including listeners that are already gone. */
+    std::atomic<uint64_t> mDroppedTotal = 0;
+
     /**
      * Guard for up flag is required to be held for entire time when the interface is being used
      * (i.e. message being sent), because we don't want the interface to be torn down while
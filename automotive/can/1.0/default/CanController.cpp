@@ -313,4 +313,21 @@ Return<bool> CanController::downInterface(const hidl_string& name) {
     return success;
 }
 
+Return<void> CanController::debug(const hidl_handle& fd, const hidl_vec<hidl_string>&) {
+    if (fd.getNativeHandle() == nullptr || fd->numFds < 1) {
+        LOG(ERROR) << "Invalid debug file descriptor";
+        return {};
+    }
+
+    std::vector<sp<CanBus>> buses;
+    {
+        std::lock_guard<std::mutex> lck(mCanBusesGuard);
+        for (const auto& [name, bus] : mCanBuses) buses.push_back(bus);
+    }
+
+    // Don't hold mCanBusesGuard while dumping, so a stuck bus won't block up/down calls.
+    for (const auto& bus : buses) bus->dump(fd->data[0]);
+    return {};
+}
+
 }  // namespace android::hardware::automotive::can::V1_0::implementation
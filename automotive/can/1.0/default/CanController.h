@@ -28,6 +28,8 @@ struct CanController : public ICanController {
     Return<ICanController::Result> upInterface(const ICanController::BusConfig& config) override;
     Return<bool> downInterface(const hidl_string& name) override;
 
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) override;
+
   private:
     std::mutex mCanBusesGuard;
     std::map<std::string, sp<CanBus>> mCanBuses GUARDED_BY(mCanBusesGuard);
@@ -20,8 +20,11 @@
 #include <libnetdevice/can.h>
 #include <libnetdevice/libnetdevice.h>
 #include <linux/can.h>
+#include <linux/can/raw.h>
+#include <poll.h>
 #include <utils/SystemClock.h>
 
+#include <algorithm>
 #include <chrono>
 
 namespace android::hardware::automotive::can::V1_0::implementation {
@@ -34,6 +37,18 @@ using namespace std::chrono_literals;
  *       down the interface. */
 static constexpr auto kReadPooling = 100ms;
 
+/** Maximum number of frames passed to a single sendmmsg(2) call. */
+static constexpr size_t kTxBatchSize = 64;
+
+/**
+ * How long a batched send waits for the interface TX queue to drain, before giving up.
+ *
+ * SocketCAN reports a full queue with ENOBUFS, which doesn't reliably wake up poll(2) on POLLOUT,
+ * so the queue state is re-checked every kTxRetryInterval.
+ */
+static constexpr auto kTxBackpressureTimeout = 100ms;
+static constexpr auto kTxRetryInterval = 1ms;
+
 std::unique_ptr<CanSocket> CanSocket::open(const std::string& ifname, ReadCallback rdcb,
                                            ErrorCallback errcb) {
     auto sock = netdevice::can::socket(ifname);
@@ -77,6 +92,62 @@ bool CanSocket::send(const struct canfd_frame& frame) {
     return true;
 }
 
+bool CanSocket::setFilters(const std::vector<struct can_filter>& filters) {
+    const auto res = setsockopt(mSocket.get(), SOL_CAN_RAW, CAN_RAW_FILTER, filters.data(),
+                                filters.size() * sizeof(struct can_filter));
+    if (res < 0) {
+        PLOG(ERROR) << "Can't set CAN_RAW_FILTER";
+        return false;
+    }
+    return true;
+}
+
+bool CanSocket::setErrorFilter(can_err_mask_t mask) {
+    if (setsockopt(mSocket.get(), SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &mask, sizeof(mask)) < 0) {
+        PLOG(ERROR) << "Can't set CAN_RAW_ERR_FILTER";
+        return false;
+    }
+    return true;
+}
+
+size_t CanSocket::send(const struct canfd_frame* frames, size_t count) {
+    std::lock_guard<std::mutex> lck(mTxGuard);
+    mTxMessages.resize(kTxBatchSize);
+    mTxVectors.resize(kTxBatchSize);
+
+    size_t sent = 0;
+    auto deadline = std::chrono::steady_clock::now() + kTxBackpressureTimeout;
+    while (sent < count) {
+        const auto chunk = std::min(count - sent, kTxBatchSize);
+        for (size_t i = 0; i < chunk; i++) {
+            mTxVectors[i].iov_base = const_cast<struct canfd_frame*>(&frames[sent + i]);
+            mTxVectors[i].iov_len = CAN_MTU;
+            mTxMessages[i] = {};
+            mTxMessages[i].msg_hdr.msg_iov = &mTxVectors[i];
+            mTxMessages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const auto res = sendmmsg(mSocket.get(), mTxMessages.data(), chunk, 0);
+        if (res > 0) {
+            sent += res;
+            deadline = std::chrono::steady_clock::now() + kTxBackpressureTimeout;
+            continue;
+        }
+        if (res < 0 && (errno == ENOBUFS || errno == EAGAIN)) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                LOG(DEBUG) << "CanSocket TX queue didn't drain, sent " << sent << "/" << count;
+                break;
+            }
+            struct pollfd pfd = {.fd = mSocket.get(), .events = POLLOUT};
+            poll(&pfd, 1, std::chrono::milliseconds(kTxRetryInterval).count());
+            continue;
+        }
+        PLOG(DEBUG) << "CanSocket sendmmsg failed";
+        break;
+    }
+    return sent;
+}
+
 static struct timeval toTimeval(std::chrono::microseconds t) {
     struct timeval tv;
     tv.tv_sec = t / 1s;
@@ -20,10 +20,15 @@
 #include <android-base/unique_fd.h>
 #include <linux/can.h>
 
+#include <sys/socket.h>
+#include <utils/Mutex.h>
+
 #include <atomic>
 #include <chrono>
 #include <functional>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 namespace android::hardware::automotive::can::V1_0::implementation {
 
@@ -52,6 +57,34 @@ struct CanSocket {
      */
     bool send(const struct canfd_frame& frame);
 
+    /**
+     * Send multiple CAN frames, in order, with as few system calls as possible.
+     *
+     * If the interface TX queue is full, this waits for it to drain (up to a timeout) instead of
+     * failing right away.
+     *
+     * \param frames Frames to send
+     * \param count Number of frames to send
+     * \return Number of frames sent, less than count in case of failure
+     */
+    size_t send(const struct canfd_frame* frames, size_t count);
+
+    /**
+     * Set kernel-side filters for received data frames (CAN_RAW_FILTER).
+     *
+     * \param filters Frames matching any of the filters are received; an empty list blocks all
+     * \return true in case of success, false otherwise
+     */
+    bool setFilters(const std::vector<struct can_filter>& filters);
+
+    /**
+     * Set kernel-side mask of error classes received as error frames (CAN_RAW_ERR_FILTER).
+     *
+     * \param mask Error class mask, 0 to block all error frames
+     * \return true in case of success, false otherwise
+     */
+    bool setErrorFilter(can_err_mask_t mask);
+
   private:
     CanSocket(base::unique_fd socket, ReadCallback rdcb, ErrorCallback errcb);
     void readerThread();
@@ -60,6 +93,12 @@ struct CanSocket {
     ErrorCallback mErrorCallback;
 
     const base::unique_fd mSocket;
+
+    /** Scratch buffers for batched sends, reused between calls. */
+    std::mutex mTxGuard;
+    std::vector<struct mmsghdr> mTxMessages GUARDED_BY(mTxGuard);
+    std::vector<struct iovec> mTxVectors GUARDED_BY(mTxGuard);
+
     std::thread mReaderThread;
     std::atomic<bool> mStopReaderThread = false;
     std::atomic<bool> mReaderThreadFinished = false;
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DeliveryPool.h"
+
+#include <android-base/logging.h>
+
+#include <pthread.h>
+
+namespace android::hardware::automotive::can::V1_0::implementation {
+
+DeliveryPool::DeliveryPool(unsigned threads, const std::string& name) {
+    CHECK(threads > 0) << "Delivery pool needs at least one thread";
+
+    mWorkers.reserve(threads);
+    for (unsigned i = 0; i < threads; i++) {
+        mWorkers.emplace_back(&DeliveryPool::workerThread, this);
+        // Thread names are limited to 15 characters.
+        const auto threadName = (name + "/" + std::to_string(i)).substr(0, 15);
+        pthread_setname_np(mWorkers.back().native_handle(), threadName.c_str());
+    }
+}
+
+DeliveryPool::~DeliveryPool() {
+    {
+        std::lock_guard<std::mutex> lck(mJobsGuard);
+        mStop = true;
+        mJobs.clear();
+    }
+    mJobsAvailable.notify_all();
+
+    for (auto& worker : mWorkers) worker.join();
+}
+
+void DeliveryPool::post(Job job) {
+    {
+        std::lock_guard<std::mutex> lck(mJobsGuard);
+        if (mStop) return;
+        mJobs.push_back(std::move(job));
+    }
+    mJobsAvailable.notify_one();
+}
+
+void DeliveryPool::workerThread() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lck(mJobsGuard);
+            mJobsAvailable.wait(lck, [this]() { return mStop || !mJobs.empty(); });
+            if (mStop) return;
+            job = std::move(mJobs.front());
+            mJobs.pop_front();
+        }
+        job();
+    }
+}
+
+}  // namespace android::hardware::automotive::can::V1_0::implementation
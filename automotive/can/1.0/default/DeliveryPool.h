@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/macros.h>
+#include <utils/Mutex.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android::hardware::automotive::can::V1_0::implementation {
+
+/**
+ * Fixed-size pool of threads running listener delivery jobs.
+ *
+ * Jobs are executed in the order they were posted, but jobs posted from a single source may run
+ * concurrently - it's up to the caller to make sure only one job per listener is pending.
+ */
+struct DeliveryPool {
+    using Job = std::function<void()>;
+
+    /**
+     * Start the pool.
+     *
+     * \param threads Number of worker threads, at least one
+     * \param name Thread name prefix, for debugging
+     */
+    DeliveryPool(unsigned threads, const std::string& name);
+
+    /** Stop the pool, dropping all jobs that didn't start yet. */
+    virtual ~DeliveryPool();
+
+    /**
+     * Schedule a job.
+     *
+     * \param job Job to run on one of the worker threads
+     */
+    void post(Job job);
+
+  private:
+    void workerThread();
+
+    std::mutex mJobsGuard;
+    std::condition_variable mJobsAvailable;
+    std::deque<Job> mJobs GUARDED_BY(mJobsGuard);
+    bool mStop GUARDED_BY(mJobsGuard) = false;
+
+    std::vector<std::thread> mWorkers;
+
+    DISALLOW_COPY_AND_ASSIGN(DeliveryPool);
+};
+
+}  // namespace android::hardware::automotive::can::V1_0::implementation
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CanBusVirtual.h"
+
+#include <benchmark/benchmark.h>
+#include <libnetdevice/libnetdevice.h>
+
+/**
+ * Frames per second sent through CanBus on a vcan interface, one send() per frame versus
+ * sendBatch() of a given size.
+ *
+ * Needs to run as root, to create the vcan interface:
+ * adb shell /data/benchmarktest64/automotiveCanV1.0_benchmark/automotiveCanV1.0_benchmark
+ */
+namespace android::hardware::automotive::can::V1_0::implementation {
+
+static constexpr char kIfname[] = "vcanbench0";
+
+class CanBusBench : public benchmark::Fixture {
+  public:
+    void SetUp(benchmark::State& state) override {
+        netdevice::useSocketDomain(AF_CAN);
+        mBus = new CanBusVirtual(kIfname);
+        if (mBus->up() != ICanController::Result::OK) {
+            state.SkipWithError("Can't bring up vcan interface (not running as root?)");
+        }
+    }
+
+    void TearDown(benchmark::State&) override {
+        mBus->down();
+        mBus.clear();
+    }
+
+  protected:
+    static CanMessage makeMessage(unsigned i) {
+        CanMessage msg = {};
+        msg.id = 0x100 + (i % 0x100);
+        msg.payload = {1, 2, 3, 4, 5, 6, 7, uint8_t(i)};
+        return msg;
+    }
+
+    sp<CanBusVirtual> mBus;
+};
+
+BENCHMARK_DEFINE_F(CanBusBench, Single)(benchmark::State& state) {
+    const auto msg = makeMessage(0);
+    for (auto _ : state) {
+        if (mBus->send(msg) != Result::OK) {
+            state.SkipWithError("send failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_REGISTER_F(CanBusBench, Single);
+
+BENCHMARK_DEFINE_F(CanBusBench, Batch)(benchmark::State& state) {
+    std::vector<CanMessage> messages;
+    for (int64_t i = 0; i < state.range(0); i++) messages.push_back(makeMessage(i));
+
+    for (auto _ : state) {
+        if (mBus->sendBatch(messages) != Result::OK) {
+            state.SkipWithError("sendBatch failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * messages.size());
+}
+BENCHMARK_REGISTER_F(CanBusBench, Batch)->RangeMultiplier(4)->Range(4, 256);
+
+}  // namespace android::hardware::automotive::can::V1_0::implementation
+
+BENCHMARK_MAIN();
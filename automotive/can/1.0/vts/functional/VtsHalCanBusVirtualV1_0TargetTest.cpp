@@ -60,6 +60,8 @@ struct CanMessageListener : public can::V1_0::ICanMessageListener {
         mCloseHandle = closeHandle;
     }
 
+    void close() { mCloseHandle->close(); }
+
     std::vector<can::V1_0::CanMessage> fetchMessages(std::chrono::milliseconds timeout,
                                                      unsigned atLeast = 1) {
         std::unique_lock<std::mutex> lk(mMessagesGuard);
@@ -77,6 +79,19 @@ struct CanMessageListener : public can::V1_0::ICanMessageListener {
     std::vector<can::V1_0::CanMessage> mMessages GUARDED_BY(mMessagesGuard);
 };
 
+/** Listener taking a long time to process every message. */
+struct SlowCanMessageListener : public CanMessageListener {
+    SlowCanMessageListener(std::chrono::milliseconds delay) : mDelay(delay) {}
+
+    Return<void> onReceive(const can::V1_0::CanMessage& msg) override {
+        std::this_thread::sleep_for(mDelay);
+        return CanMessageListener::onReceive(msg);
+    }
+
+  private:
+    const std::chrono::milliseconds mDelay;
+};
+
 struct Bus {
     DISALLOW_COPY_AND_ASSIGN(Bus);
 
@@ -108,8 +123,11 @@ struct Bus {
     sp<ICanBus> get() { return mBus; }
 
     sp<CanMessageListener> listen(const hidl_vec<CanMessageFilter>& filter) {
-        sp<CanMessageListener> listener = new CanMessageListener();
+        return listen(filter, new CanMessageListener());
+    }
 
+    sp<CanMessageListener> listen(const hidl_vec<CanMessageFilter>& filter,
+                                  sp<CanMessageListener> listener) {
         Result result;
         sp<ICloseHandle> closeHandle;
         mBus->listen(filter, listener, hidl_utils::fill(&result, &closeHandle)).assertOk();
@@ -236,6 +254,54 @@ TEST_P(CanBusVirtualHalTest, SendAndRecv) {
     ASSERT_EQ(msg, messages[0]);
 }
 
+TEST_P(CanBusVirtualHalTest, SlowListenerDoesNotThrottleOthers) {
+    if (mBusNames.size() < 2u) GTEST_SKIP() << "Not testable with less than two CAN buses.";
+    auto bus1 = makeBus();
+    auto bus2 = makeBus();
+
+    static constexpr unsigned kMessageCount = 50;
+    auto slowListener = bus2.listen({}, new SlowCanMessageListener(50ms));
+    auto fastListener = bus2.listen({});
+
+    std::vector<CanMessage> expected;
+    for (unsigned i = 0; i < kMessageCount; i++) {
+        CanMessage msg = {};
+        msg.id = 0x100 + i;
+        msg.payload = {uint8_t(i)};
+        bus1.send(msg);
+        expected.push_back(msg);
+    }
+
+    // Slow listener would need 2.5s to process all messages, the fast one shouldn't wait for it.
+    auto messages = fastListener->fetchMessages(500ms, kMessageCount);
+    clearTimestamps(messages);
+    ASSERT_EQ(expected, messages);
+
+    auto slowMessages = slowListener->fetchMessages(100ms);
+    ASSERT_LT(slowMessages.size(), kMessageCount);
+}
+
+TEST_P(CanBusVirtualHalTest, NoMessagesAfterClose) {
+    if (mBusNames.size() < 2u) GTEST_SKIP() << "Not testable with less than two CAN buses.";
+    auto bus1 = makeBus();
+    auto bus2 = makeBus();
+
+    static constexpr unsigned kMessageCount = 10;
+    auto listener = bus2.listen({}, new SlowCanMessageListener(20ms));
+    for (unsigned i = 0; i < kMessageCount; i++) {
+        CanMessage msg = {};
+        msg.id = 0x100 + i;
+        bus1.send(msg);
+    }
+    ASSERT_FALSE(listener->fetchMessages(500ms).empty());
+
+    // A message being delivered while closing is received before close() returns.
+    listener->close();
+    listener->fetchMessages(0ms);
+
+    ASSERT_TRUE(listener->fetchMessages(200ms).empty());
+}
+
 TEST_P(CanBusVirtualHalTest, DownOneOfTwo) {
     if (mBusNames.size() < 2u) GTEST_SKIP() << "Not testable with less than two CAN buses.";
 
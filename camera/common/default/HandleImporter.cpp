@@ -33,25 +33,19 @@ using aidl::android::hardware::graphics::common::PlaneLayoutComponent;
 using aidl::android::hardware::graphics::common::PlaneLayoutComponentType;
 using aidl::android::hardware::graphics::common::Smpte2086;
 
-HandleImporter::HandleImporter() : mInitialized(false) {}
+HandleImporter::HandleImporter() {}
 
-void HandleImporter::initializeLocked() {
-    if (mInitialized) {
-        return;
-    }
-
-    GraphicBufferMapper::preloadHal();
-    mInitialized = true;
-    return;
-}
-
-void HandleImporter::cleanup() {
-    mInitialized = false;
+GraphicBufferMapper& HandleImporter::mapper() {
+    std::call_once(mInitFlag, [this] {
+        GraphicBufferMapper::preloadHal();
+        mMapper = &GraphicBufferMapper::get();
+    });
+    return *mMapper;
 }
 
 bool HandleImporter::importBufferInternal(buffer_handle_t& handle) {
     buffer_handle_t importedHandle;
-    auto status = GraphicBufferMapper::get().importBufferNoValidate(handle, &importedHandle);
+    auto status = mapper().importBufferNoValidate(handle, &importedHandle);
     if (status != OK) {
         ALOGE("%s: mapper importBuffer failed: %d", __FUNCTION__, status);
         return false;
@@ -63,14 +57,9 @@ bool HandleImporter::importBufferInternal(buffer_handle_t& handle) {
 
 android_ycbcr HandleImporter::lockYCbCr(buffer_handle_t& buf, uint64_t cpuUsage,
                                         const android::Rect& accessRegion) {
-    Mutex::Autolock lock(mLock);
-
-    if (!mInitialized) {
-        initializeLocked();
-    }
     android_ycbcr layout;
 
-    status_t status = GraphicBufferMapper::get().lockYCbCr(buf, cpuUsage, accessRegion, &layout);
+    status_t status = mapper().lockYCbCr(buf, cpuUsage, accessRegion, &layout);
 
     if (status != OK) {
         ALOGE("%s: failed to lockYCbCr error %d!", __FUNCTION__, status);
@@ -79,9 +68,9 @@ android_ycbcr HandleImporter::lockYCbCr(buffer_handle_t& buf, uint64_t cpuUsage,
     return layout;
 }
 
-std::vector<PlaneLayout> getPlaneLayouts(buffer_handle_t& buf) {
+std::vector<PlaneLayout> getPlaneLayouts(GraphicBufferMapper& mapper, buffer_handle_t& buf) {
     std::vector<PlaneLayout> planeLayouts;
-    status_t status = GraphicBufferMapper::get().getPlaneLayouts(buf, &planeLayouts);
+    status_t status = mapper.getPlaneLayouts(buf, &planeLayouts);
     if (status != OK) {
         ALOGE("%s: failed to get PlaneLayouts! Status %d", __FUNCTION__, status);
     }
@@ -98,11 +87,6 @@ bool HandleImporter::importBuffer(buffer_handle_t& handle) {
         return true;
     }
 
-    Mutex::Autolock lock(mLock);
-    if (!mInitialized) {
-        initializeLocked();
-    }
-
     return importBufferInternal(handle);
 }
 
@@ -111,12 +95,7 @@ void HandleImporter::freeBuffer(buffer_handle_t handle) {
         return;
     }
 
-    Mutex::Autolock lock(mLock);
-    if (!mInitialized) {
-        initializeLocked();
-    }
-
-    status_t status = GraphicBufferMapper::get().freeBuffer(handle);
+    status_t status = mapper().freeBuffer(handle);
     if (status != OK) {
         ALOGE("%s: mapper freeBuffer failed. Status %d", __FUNCTION__, status);
     }
@@ -152,14 +131,8 @@ void* HandleImporter::lock(buffer_handle_t& buf, uint64_t cpuUsage, size_t size)
 
 void* HandleImporter::lock(buffer_handle_t& buf, uint64_t cpuUsage,
                            const android::Rect& accessRegion) {
-    Mutex::Autolock lock(mLock);
-
-    if (!mInitialized) {
-        initializeLocked();
-    }
-
     void* ret = nullptr;
-    status_t status = GraphicBufferMapper::get().lock(buf, cpuUsage, accessRegion, &ret);
+    status_t status = mapper().lock(buf, cpuUsage, accessRegion, &ret);
     if (status != OK) {
         ALOGE("%s: failed to lock error %d!", __FUNCTION__, status);
     }
@@ -176,13 +149,7 @@ status_t HandleImporter::getMonoPlanarStrideBytes(buffer_handle_t& buf, uint32_t
         return BAD_VALUE;
     }
 
-    Mutex::Autolock lock(mLock);
-
-    if (!mInitialized) {
-        initializeLocked();
-    }
-
-    std::vector<PlaneLayout> planeLayouts = getPlaneLayouts(buf);
+    std::vector<PlaneLayout> planeLayouts = getPlaneLayouts(mapper(), buf);
     if (planeLayouts.size() != 1) {
         ALOGE("%s: Unexpected number of planes %zu!", __FUNCTION__, planeLayouts.size());
         return BAD_VALUE;
@@ -196,7 +163,7 @@ status_t HandleImporter::getMonoPlanarStrideBytes(buffer_handle_t& buf, uint32_t
 int HandleImporter::unlock(buffer_handle_t& buf) {
     int releaseFence = -1;
 
-    status_t status = GraphicBufferMapper::get().unlockAsync(buf, &releaseFence);
+    status_t status = mapper().unlockAsync(buf, &releaseFence);
     if (status != OK) {
         ALOGE("%s: failed to unlock error %d!", __FUNCTION__, status);
     }
@@ -205,13 +172,8 @@ int HandleImporter::unlock(buffer_handle_t& buf) {
 }
 
 bool HandleImporter::isSmpte2086Present(const buffer_handle_t& buf) {
-    Mutex::Autolock lock(mLock);
-
-    if (!mInitialized) {
-        initializeLocked();
-    }
     std::optional<ui::Smpte2086> metadata;
-    status_t status = GraphicBufferMapper::get().getSmpte2086(buf, &metadata);
+    status_t status = mapper().getSmpte2086(buf, &metadata);
     if (status != OK) {
         ALOGE("%s: Mapper failed to get Smpte2094_40 metadata! Status: %d", __FUNCTION__, status);
         return false;
@@ -221,14 +183,8 @@ bool HandleImporter::isSmpte2086Present(const buffer_handle_t& buf) {
 }
 
 bool HandleImporter::isSmpte2094_10Present(const buffer_handle_t& buf) {
-    Mutex::Autolock lock(mLock);
-
-    if (!mInitialized) {
-        initializeLocked();
-    }
-
     std::optional<std::vector<uint8_t>> metadata;
-    status_t status = GraphicBufferMapper::get().getSmpte2094_10(buf, &metadata);
+    status_t status = mapper().getSmpte2094_10(buf, &metadata);
     if (status != OK) {
         ALOGE("%s: Mapper failed to get Smpte2094_40 metadata! Status: %d", __FUNCTION__, status);
         return false;
@@ -238,14 +194,8 @@ bool HandleImporter::isSmpte2094_10Present(const buffer_handle_t& buf) {
 }
 
 bool HandleImporter::isSmpte2094_40Present(const buffer_handle_t& buf) {
-    Mutex::Autolock lock(mLock);
-
-    if (!mInitialized) {
-        initializeLocked();
-    }
-
     std::optional<std::vector<uint8_t>> metadata;
-    status_t status = GraphicBufferMapper::get().getSmpte2094_40(buf, &metadata);
+    status_t status = mapper().getSmpte2094_40(buf, &metadata);
     if (status != OK) {
         ALOGE("%s: Mapper failed to get Smpte2094_40 metadata! Status: %d", __FUNCTION__, status);
         return false;
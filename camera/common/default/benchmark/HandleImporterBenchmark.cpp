@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <HandleImporter.h>
+
+#include <benchmark/benchmark.h>
+#include <hardware/gralloc.h>
+#include <ui/GraphicBufferAllocator.h>
+#include <unistd.h>
+
+/**
+ * Lock/unlock and import/free throughput of the process wide HandleImporter with 1 to 8 threads,
+ * each standing in for a camera stream mapping its own buffers:
+ * adb shell /data/benchmarktest64/camera.common-handle_importer_benchmark/camera.common-handle_importer_benchmark
+ */
+namespace android::hardware::camera::common::helper {
+
+namespace {
+const uint32_t kWidth = 640;
+const uint32_t kHeight = 480;
+const uint64_t kUsage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN;
+
+// Shared by all threads, like the static importer of the camera sessions
+HandleImporter sHandleImporter;
+
+// A gralloc buffer owned by one benchmark thread
+class TestBuffer {
+  public:
+    explicit TestBuffer(int32_t format) {
+        uint32_t stride = 0;
+        if (GraphicBufferAllocator::get().allocateRawHandle(kWidth, kHeight, format,
+                                                            /*layerCount*/ 1, kUsage, &mHandle,
+                                                            &stride, "HandleImporterBench") != OK) {
+            mHandle = nullptr;
+        }
+    }
+    ~TestBuffer() {
+        if (mHandle != nullptr) {
+            GraphicBufferAllocator::get().free(mHandle);
+        }
+    }
+
+    buffer_handle_t handle() const { return mHandle; }
+
+  private:
+    buffer_handle_t mHandle = nullptr;
+};
+
+void closeReleaseFence(int fence) {
+    if (fence >= 0) {
+        close(fence);
+    }
+}
+}  // anonymous namespace
+
+static void BM_LockYCbCr(benchmark::State& state) {
+    TestBuffer buffer(HAL_PIXEL_FORMAT_YCBCR_420_888);
+    buffer_handle_t handle = buffer.handle();
+    if (handle == nullptr || !sHandleImporter.importBuffer(handle)) {
+        state.SkipWithError("buffer allocation failed");
+        return;
+    }
+    const android::Rect region(kWidth, kHeight);
+    for (auto _ : state) {
+        android_ycbcr layout = sHandleImporter.lockYCbCr(handle, kUsage, region);
+        benchmark::DoNotOptimize(layout.y);
+        closeReleaseFence(sHandleImporter.unlock(handle));
+    }
+    sHandleImporter.freeBuffer(handle);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LockYCbCr)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_LockBlob(benchmark::State& state) {
+    TestBuffer buffer(HAL_PIXEL_FORMAT_BLOB);
+    buffer_handle_t handle = buffer.handle();
+    if (handle == nullptr || !sHandleImporter.importBuffer(handle)) {
+        state.SkipWithError("buffer allocation failed");
+        return;
+    }
+    for (auto _ : state) {
+        void* data = sHandleImporter.lock(handle, kUsage, size_t(kWidth));
+        benchmark::DoNotOptimize(data);
+        closeReleaseFence(sHandleImporter.unlock(handle));
+    }
+    sHandleImporter.freeBuffer(handle);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LockBlob)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_ImportFree(benchmark::State& state) {
+    TestBuffer buffer(HAL_PIXEL_FORMAT_YCBCR_420_888);
+    if (buffer.handle() == nullptr) {
+        state.SkipWithError("buffer allocation failed");
+        return;
+    }
+    for (auto _ : state) {
+        buffer_handle_t handle = buffer.handle();
+        if (!sHandleImporter.importBuffer(handle)) {
+            state.SkipWithError("importBuffer failed");
+            break;
+        }
+        sHandleImporter.freeBuffer(handle);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ImportFree)->ThreadRange(1, 8)->UseRealTime();
+
+}  // namespace android::hardware::camera::common::helper
+
+BENCHMARK_MAIN();
@@ -20,15 +20,20 @@
 #include <cutils/native_handle.h>
 #include <system/graphics.h>
 #include <ui/Rect.h>
-#include <utils/Mutex.h>
+#include <mutex>
 
 namespace android {
+
+class GraphicBufferMapper;
+
 namespace hardware {
 namespace camera {
 namespace common {
 namespace helper {
 
 // Borrowed from graphics HAL. Use this until gralloc mapper HAL is working
+// Thread safe without serializing callers: the mapper is thread safe itself, and only its
+// initialization is guarded.
 class HandleImporter {
   public:
     HandleImporter();
@@ -62,14 +67,14 @@ class HandleImporter {
     bool isSmpte2094_40Present(const buffer_handle_t& buf);
 
   private:
-    void initializeLocked();
-    void cleanup();
+    // Loads the mapper HAL on first use
+    GraphicBufferMapper& mapper();
 
     bool importBufferInternal(buffer_handle_t& handle);
-    int unlockInternal(buffer_handle_t& buf);
 
-    Mutex mLock;
-    bool mInitialized;
+    std::once_flag mInitFlag;
+    // GraphicBufferMapper::get() takes a process wide lock, so keep the instance
+    GraphicBufferMapper* mMapper = nullptr;
 };
 
 }  // namespace helper
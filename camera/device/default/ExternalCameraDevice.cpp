@@ -35,17 +35,31 @@ namespace implementation {
 using ::aidl::android::hardware::camera::common::Status;
 
 namespace {
-// Only support MJPEG for now as it seems to be the one supports higher fps
+// MJPEG usually supports higher fps at large sizes. Uncompressed YUYV/NV12 skip the JPEG decode
+// and are preferred for the sizes where they reach the MJPEG frame rates.
 // Other formats to consider in the future:
 // * V4L2_PIX_FMT_YVU420 (== YV12)
 // * V4L2_PIX_FMT_YVYU (YVYU: can be converted to YV12 or other YUV420_888 formats)
-const std::array<uint32_t, /*size*/ 2> kSupportedFourCCs{
-        {V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_Z16}};  // double braces required in C++11
+const std::array<uint32_t, /*size*/ 4> kSupportedFourCCs{
+        {V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUYV,
+         V4L2_PIX_FMT_Z16}};  // double braces required in C++11
 
 constexpr int MAX_RETRY = 5;                  // Allow retry v4l2 open failures a few times.
 constexpr int OPEN_RETRY_SLEEP_US = 100'000;  // 100ms * MAX_RETRY = 0.5 seconds
 
 const std::regex kDevicePathRE("/dev/video([0-9]+)");
+
+bool isColorFourcc(uint32_t fourcc) {
+    return fourcc == V4L2_PIX_FMT_MJPEG || isUncompressedColorFourcc(fourcc);
+}
+
+double getMaxFramesPerSecond(const SupportedV4L2Format& fmt) {
+    double maxFps = 0;
+    for (const auto& fr : fmt.frameRates) {
+        maxFps = std::max(maxFps, fr.getFramesPerSecond());
+    }
+    return maxFps;
+}
 }  // namespace
 
 std::string ExternalCameraDevice::kDeviceVersion = "1.1";
@@ -131,24 +145,24 @@ ndk::ScopedAStatus ExternalCameraDevice::open(
     }
 
     int numAttempt = 0;
-    unique_fd fd(::open(mDevicePath.c_str(), O_RDWR));
-    while (fd.get() < 0 && numAttempt < MAX_RETRY) {
+    std::unique_ptr<V4l2Device> device = openV4l2Device();
+    while (device == nullptr && numAttempt < MAX_RETRY) {
         // Previous retry attempts failed. Retry opening the device at most MAX_RETRY times
         ALOGW("%s: v4l2 device %s open failed, wait 33ms and try again", __FUNCTION__,
               mDevicePath.c_str());
         usleep(OPEN_RETRY_SLEEP_US);  // sleep and try again
-        fd.reset(::open(mDevicePath.c_str(), O_RDWR));
+        device = openV4l2Device();
         numAttempt++;
     }
 
-    if (fd.get() < 0) {
+    if (device == nullptr) {
         ALOGE("%s: v4l2 device open %s failed: %s", __FUNCTION__, mDevicePath.c_str(),
               strerror(errno));
         return fromStatus(Status::INTERNAL_ERROR);
     }
 
     session = createSession(in_callback, mCfg, mSupportedFormats, mCroppingType,
-                            mCameraCharacteristics, mCameraId, std::move(fd));
+                            mCameraCharacteristics, mCameraId, std::move(device));
     if (session == nullptr) {
         ALOGE("%s: camera device session allocation failed", __FUNCTION__);
         return fromStatus(Status::INTERNAL_ERROR);
@@ -185,9 +199,17 @@ std::shared_ptr<ExternalCameraDeviceSession> ExternalCameraDevice::createSession
         const std::shared_ptr<ICameraDeviceCallback>& cb, const ExternalCameraConfig& cfg,
         const std::vector<SupportedV4L2Format>& sortedFormats, const CroppingType& croppingType,
         const common::V1_0::helper::CameraMetadata& chars, const std::string& cameraId,
-        unique_fd v4l2Fd) {
+        std::unique_ptr<V4l2Device> v4l2Device) {
     return ndk::SharedRefBase::make<ExternalCameraDeviceSession>(
-            cb, cfg, sortedFormats, croppingType, chars, cameraId, std::move(v4l2Fd));
+            cb, cfg, sortedFormats, croppingType, chars, cameraId, std::move(v4l2Device));
+}
+
+std::unique_ptr<V4l2Device> ExternalCameraDevice::openV4l2Device() {
+    unique_fd fd(::open(mDevicePath.c_str(), O_RDWR));
+    if (fd.get() < 0) {
+        return nullptr;
+    }
+    return std::make_unique<KernelV4l2Device>(std::move(fd));
 }
 
 bool ExternalCameraDevice::isInitFailed() {
@@ -207,13 +229,13 @@ bool ExternalCameraDevice::isInitFailedLocked() {
     return mInitFailed;
 }
 
-void ExternalCameraDevice::initSupportedFormatsLocked(int fd) {
-    std::vector<SupportedV4L2Format> horizontalFmts =
-            getCandidateSupportedFormatsLocked(fd, HORIZONTAL, mCfg.fpsLimits, mCfg.depthFpsLimits,
-                                               mCfg.minStreamSize, mCfg.depthEnabled);
-    std::vector<SupportedV4L2Format> verticalFmts =
-            getCandidateSupportedFormatsLocked(fd, VERTICAL, mCfg.fpsLimits, mCfg.depthFpsLimits,
-                                               mCfg.minStreamSize, mCfg.depthEnabled);
+void ExternalCameraDevice::initSupportedFormatsLocked(V4l2Device& device) {
+    std::vector<SupportedV4L2Format> horizontalFmts = getCandidateSupportedFormatsLocked(
+            device, HORIZONTAL, mCfg.fpsLimits, mCfg.depthFpsLimits, mCfg.minStreamSize,
+            mCfg.depthEnabled);
+    std::vector<SupportedV4L2Format> verticalFmts = getCandidateSupportedFormatsLocked(
+            device, VERTICAL, mCfg.fpsLimits, mCfg.depthFpsLimits, mCfg.minStreamSize,
+            mCfg.depthEnabled);
 
     size_t horiSize = horizontalFmts.size();
     size_t vertSize = verticalFmts.size();
@@ -270,8 +292,8 @@ status_t ExternalCameraDevice::initCameraCharacteristics() {
     }
 
     // init camera characteristics
-    unique_fd fd(::open(mDevicePath.c_str(), O_RDWR));
-    if (fd.get() < 0) {
+    std::unique_ptr<V4l2Device> device = openV4l2Device();
+    if (device == nullptr) {
         ALOGE("%s: v4l2 device open %s failed", __FUNCTION__, mDevicePath.c_str());
         return DEAD_OBJECT;
     }
@@ -284,14 +306,14 @@ status_t ExternalCameraDevice::initCameraCharacteristics() {
         return ret;
     }
 
-    ret = initCameraControlsCharsKeys(fd.get(), &mCameraCharacteristics);
+    ret = initCameraControlsCharsKeys(*device, &mCameraCharacteristics);
     if (ret != OK) {
         ALOGE("%s: init camera control characteristics key failed: errorno %d", __FUNCTION__, ret);
         mCameraCharacteristics.clear();
         return ret;
     }
 
-    ret = initOutputCharsKeys(fd.get(), &mCameraCharacteristics);
+    ret = initOutputCharsKeys(*device, &mCameraCharacteristics);
     if (ret != OK) {
         ALOGE("%s: init output characteristics key failed: errorno %d", __FUNCTION__, ret);
         mCameraCharacteristics.clear();
@@ -332,6 +354,8 @@ status_t ExternalCameraDevice::initAvailableCapabilities(
                 hasDepth = true;
                 break;
             case V4L2_PIX_FMT_MJPEG:
+            case V4L2_PIX_FMT_NV12:
+            case V4L2_PIX_FMT_YUYV:
                 hasColor = true;
                 break;
             default:
@@ -583,7 +607,7 @@ status_t ExternalCameraDevice::initDefaultCharsKeys(
 }
 
 status_t ExternalCameraDevice::initCameraControlsCharsKeys(
-        int, ::android::hardware::camera::common::V1_0::helper::CameraMetadata* metadata) {
+        V4l2Device&, ::android::hardware::camera::common::V1_0::helper::CameraMetadata* metadata) {
     // android.sensor.info.sensitivityRange   -> V4L2_CID_ISO_SENSITIVITY
     // android.sensor.info.exposureTimeRange  -> V4L2_CID_EXPOSURE_ABSOLUTE
     // android.sensor.info.maxFrameDuration   -> TBD
@@ -624,8 +648,9 @@ status_t ExternalCameraDevice::initCameraControlsCharsKeys(
 }
 
 status_t ExternalCameraDevice::initOutputCharsKeys(
-        int fd, ::android::hardware::camera::common::V1_0::helper::CameraMetadata* metadata) {
-    initSupportedFormatsLocked(fd);
+        V4l2Device& device,
+        ::android::hardware::camera::common::V1_0::helper::CameraMetadata* metadata) {
+    initSupportedFormatsLocked(device);
     if (mSupportedFormats.empty()) {
         ALOGE("%s: Init supported format list failed", __FUNCTION__);
         return UNKNOWN_ERROR;
@@ -636,7 +661,7 @@ status_t ExternalCameraDevice::initOutputCharsKeys(
 
     // For V4L2_PIX_FMT_Z16
     std::array<int, /*size*/ 1> halDepthFormats{{HAL_PIXEL_FORMAT_Y16}};
-    // For V4L2_PIX_FMT_MJPEG
+    // For V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_NV12 and V4L2_PIX_FMT_YUYV
     std::array<int, /*size*/ 3> halFormats{{HAL_PIXEL_FORMAT_BLOB, HAL_PIXEL_FORMAT_YCbCr_420_888,
                                             HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED}};
 
@@ -646,6 +671,8 @@ status_t ExternalCameraDevice::initOutputCharsKeys(
                 hasDepth = true;
                 break;
             case V4L2_PIX_FMT_MJPEG:
+            case V4L2_PIX_FMT_NV12:
+            case V4L2_PIX_FMT_YUYV:
                 hasColor = true;
                 break;
             default:
@@ -722,7 +749,9 @@ status_t ExternalCameraDevice::initOutputCharsKeysByFormat(
     std::vector<int64_t> stallDurations;
 
     for (const auto& supportedFormat : mSupportedFormats) {
-        if (supportedFormat.fourcc != fourcc) {
+        // All color 4CCs map to the same halFormats
+        bool sameKind = isColorFourcc(fourcc) && isColorFourcc(supportedFormat.fourcc);
+        if (supportedFormat.fourcc != fourcc && !sameKind) {
             // Skip 4CCs not meant for the halFormats
             continue;
         }
@@ -807,7 +836,7 @@ status_t ExternalCameraDevice::calculateMinFps(
 #undef ARRAY_SIZE
 #undef UPDATE
 
-void ExternalCameraDevice::getFrameRateList(int fd, double fpsUpperBound,
+void ExternalCameraDevice::getFrameRateList(V4l2Device& device, double fpsUpperBound,
                                             SupportedV4L2Format* format) {
     format->frameRates.clear();
 
@@ -819,7 +848,7 @@ void ExternalCameraDevice::getFrameRateList(int fd, double fpsUpperBound,
     };
 
     for (frameInterval.index = 0;
-         TEMP_FAILURE_RETRY(ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frameInterval)) == 0;
+         TEMP_FAILURE_RETRY(device.ioctl(VIDIOC_ENUM_FRAMEINTERVALS, &frameInterval)) == 0;
          ++frameInterval.index) {
         if (frameInterval.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
             if (frameInterval.discrete.numerator != 0) {
@@ -848,7 +877,7 @@ void ExternalCameraDevice::getFrameRateList(int fd, double fpsUpperBound,
 }
 
 void ExternalCameraDevice::updateFpsBounds(
-        int fd, CroppingType cropType,
+        V4l2Device& device, CroppingType cropType,
         const std::vector<ExternalCameraConfig::FpsLimitation>& fpsLimits,
         SupportedV4L2Format format, std::vector<SupportedV4L2Format>& outFmts) {
     double fpsUpperBound = -1.0;
@@ -869,14 +898,14 @@ void ExternalCameraDevice::updateFpsBounds(
         return;
     }
 
-    getFrameRateList(fd, fpsUpperBound, &format);
+    getFrameRateList(device, fpsUpperBound, &format);
     if (!format.frameRates.empty()) {
         outFmts.push_back(format);
     }
 }
 
 std::vector<SupportedV4L2Format> ExternalCameraDevice::getCandidateSupportedFormatsLocked(
-        int fd, CroppingType cropType,
+        V4l2Device& device, CroppingType cropType,
         const std::vector<ExternalCameraConfig::FpsLimitation>& fpsLimits,
         const std::vector<ExternalCameraConfig::FpsLimitation>& depthFpsLimits,
         const Size& minStreamSize, bool depthEnabled) {
@@ -886,7 +915,7 @@ std::vector<SupportedV4L2Format> ExternalCameraDevice::getCandidateSupportedForm
     };
     int ret = 0;
     while (ret == 0) {
-        ret = TEMP_FAILURE_RETRY(ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc));
+        ret = TEMP_FAILURE_RETRY(device.ioctl(VIDIOC_ENUM_FMT, &fmtdesc));
         ALOGV("index:%d,ret:%d, format:%c%c%c%c", fmtdesc.index, ret, fmtdesc.pixelformat & 0xFF,
               (fmtdesc.pixelformat >> 8) & 0xFF, (fmtdesc.pixelformat >> 16) & 0xFF,
               (fmtdesc.pixelformat >> 24) & 0xFF);
@@ -905,7 +934,7 @@ std::vector<SupportedV4L2Format> ExternalCameraDevice::getCandidateSupportedForm
 
         // Found supported format
         v4l2_frmsizeenum frameSize{.index = 0, .pixel_format = fmtdesc.pixelformat};
-        for (; TEMP_FAILURE_RETRY(ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frameSize)) == 0;
+        for (; TEMP_FAILURE_RETRY(device.ioctl(VIDIOC_ENUM_FRAMESIZES, &frameSize)) == 0;
              ++frameSize.index) {
             if (frameSize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
                 ALOGV("index:%d, format:%c%c%c%c, w %d, h %d", frameSize.index,
@@ -931,18 +960,59 @@ std::vector<SupportedV4L2Format> ExternalCameraDevice::getCandidateSupportedForm
                         .fourcc = fmtdesc.pixelformat};
 
                 if (format.fourcc == V4L2_PIX_FMT_Z16 && depthEnabled) {
-                    updateFpsBounds(fd, cropType, depthFpsLimits, format, outFmts);
+                    updateFpsBounds(device, cropType, depthFpsLimits, format, outFmts);
                 } else {
-                    updateFpsBounds(fd, cropType, fpsLimits, format, outFmts);
+                    updateFpsBounds(device, cropType, fpsLimits, format, outFmts);
                 }
             }
         }
         fmtdesc.index++;
     }
+    pickColorFormats(&outFmts);
     trimSupportedFormats(cropType, &outFmts);
     return outFmts;
 }
 
+void ExternalCameraDevice::pickColorFormats(std::vector<SupportedV4L2Format>* pFmts) {
+    // Keep a single color format per size. An uncompressed format is picked over MJPEG when the
+    // USB bandwidth allows it to run as fast, NV12 is preferred over YUYV as it is smaller.
+    auto rank = [](const SupportedV4L2Format& fmt) {
+        switch (fmt.fourcc) {
+            case V4L2_PIX_FMT_NV12:
+                return 2;
+            case V4L2_PIX_FMT_YUYV:
+                return 1;
+            default:
+                return 0;
+        }
+    };
+    auto isBetter = [&](const SupportedV4L2Format& a, const SupportedV4L2Format& b) {
+        double aFps = getMaxFramesPerSecond(a);
+        double bFps = getMaxFramesPerSecond(b);
+        if (aFps != bFps) {
+            return aFps > bFps;
+        }
+        return rank(a) > rank(b);
+    };
+
+    std::vector<SupportedV4L2Format> out;
+    for (const auto& fmt : *pFmts) {
+        if (!isColorFourcc(fmt.fourcc)) {
+            out.push_back(fmt);
+            continue;
+        }
+        auto it = std::find_if(out.begin(), out.end(), [&](const SupportedV4L2Format& o) {
+            return isColorFourcc(o.fourcc) && o.width == fmt.width && o.height == fmt.height;
+        });
+        if (it == out.end()) {
+            out.push_back(fmt);
+        } else if (isBetter(fmt, *it)) {
+            *it = fmt;
+        }
+    }
+    *pFmts = std::move(out);
+}
+
 void ExternalCameraDevice::trimSupportedFormats(CroppingType cropType,
                                                 std::vector<SupportedV4L2Format>* pFmts) {
     std::vector<SupportedV4L2Format>& sortedFmts = *pFmts;
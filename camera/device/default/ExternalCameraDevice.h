@@ -70,17 +70,22 @@ class ExternalCameraDevice : public BnCameraDevice {
     // Should be of the form <major>.<minor>
     static std::string kDeviceVersion;
 
+  protected:
+    // Open the V4L2 device at the device path, returns nullptr on failure. Tests and benchmarks
+    // override this to run the HAL on a fake V4L2 device.
+    virtual std::unique_ptr<V4l2Device> openV4l2Device();
+
   private:
     virtual std::shared_ptr<ExternalCameraDeviceSession> createSession(
             const std::shared_ptr<ICameraDeviceCallback>&, const ExternalCameraConfig& cfg,
             const std::vector<SupportedV4L2Format>& sortedFormats, const CroppingType& croppingType,
             const common::V1_0::helper::CameraMetadata& chars, const std::string& cameraId,
-            unique_fd v4l2Fd);
+            std::unique_ptr<V4l2Device> v4l2Device);
 
     bool isInitFailedLocked();
 
-    // Init supported w/h/format/fps in mSupportedFormats. Caller still owns fd
-    void initSupportedFormatsLocked(int fd);
+    // Init supported w/h/format/fps in mSupportedFormats
+    void initSupportedFormatsLocked(V4l2Device& device);
 
     // Calls into virtual member function. Do not use it in constructor
     status_t initCameraCharacteristics();
@@ -90,12 +95,12 @@ class ExternalCameraDevice : public BnCameraDevice {
     // Init non-device dependent keys
     virtual status_t initDefaultCharsKeys(
             ::android::hardware::camera::common::V1_0::helper::CameraMetadata*);
-    // Init camera control chars keys. Caller still owns fd
+    // Init camera control chars keys
     status_t initCameraControlsCharsKeys(
-            int fd, ::android::hardware::camera::common::V1_0::helper::CameraMetadata*);
-    // Init camera output configuration related keys.  Caller still owns fd
+            V4l2Device& device, ::android::hardware::camera::common::V1_0::helper::CameraMetadata*);
+    // Init camera output configuration related keys
     status_t initOutputCharsKeys(
-            int fd, ::android::hardware::camera::common::V1_0::helper::CameraMetadata*);
+            V4l2Device& device, ::android::hardware::camera::common::V1_0::helper::CameraMetadata*);
 
     // Helper function for initOutputCharskeys
     template <size_t SIZE>
@@ -106,19 +111,22 @@ class ExternalCameraDevice : public BnCameraDevice {
 
     status_t calculateMinFps(::android::hardware::camera::common::V1_0::helper::CameraMetadata*);
 
-    static void getFrameRateList(int fd, double fpsUpperBound, SupportedV4L2Format* format);
+    static void getFrameRateList(V4l2Device& device, double fpsUpperBound,
+                                 SupportedV4L2Format* format);
 
-    static void updateFpsBounds(int fd, CroppingType cropType,
+    static void updateFpsBounds(V4l2Device& device, CroppingType cropType,
                                 const std::vector<ExternalCameraConfig::FpsLimitation>& fpsLimits,
                                 SupportedV4L2Format format,
                                 std::vector<SupportedV4L2Format>& outFmts);
 
     // Get candidate supported formats list of input cropping type.
     static std::vector<SupportedV4L2Format> getCandidateSupportedFormatsLocked(
-            int fd, CroppingType cropType,
+            V4l2Device& device, CroppingType cropType,
             const std::vector<ExternalCameraConfig::FpsLimitation>& fpsLimits,
             const std::vector<ExternalCameraConfig::FpsLimitation>& depthFpsLimits,
             const Size& minStreamSize, bool depthEnabled);
+    // Keep the fastest color format of each size, preferring uncompressed ones on a tie
+    static void pickColorFormats(/*inout*/ std::vector<SupportedV4L2Format>* pFmts);
     // Trim supported format list by the cropping type. Also sort output formats by width/height
     static void trimSupportedFormats(CroppingType cropType,
                                      /*inout*/ std::vector<SupportedV4L2Format>* pFmts);
@@ -34,10 +34,16 @@
 #include <aidl/android/hardware/graphics/common/Dataspace.h>
 #include <aidlcommonsupport/NativeHandle.h>
 #include <convert.h>
+#include <fcntl.h>
+#include <linux/dma-buf.h>
 #include <linux/videodev2.h>
 #include <sync/sync.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <utils/Trace.h>
+#include <algorithm>
 #include <deque>
+#include <future>
 
 #define HAVE_JPEG  // required for libyuv.h to export MJPEG decode APIs
 #include <libyuv.h>
@@ -108,20 +114,23 @@ using ::android::hardware::camera::common::V1_0::helper::ExifUtils;
 // Static instances
 const int ExternalCameraDeviceSession::kMaxProcessedStream;
 const int ExternalCameraDeviceSession::kMaxStallStream;
+const size_t ExternalCameraDeviceSession::OutputThread::kMaxInflightFrames;
+const size_t ExternalCameraDeviceSession::OutputThread::kMaxPipelineWorkers;
 HandleImporter ExternalCameraDeviceSession::sHandleImporter;
 
 ExternalCameraDeviceSession::ExternalCameraDeviceSession(
         const std::shared_ptr<ICameraDeviceCallback>& callback, const ExternalCameraConfig& cfg,
         const std::vector<SupportedV4L2Format>& sortedFormats, const CroppingType& croppingType,
         const common::V1_0::helper::CameraMetadata& chars, const std::string& cameraId,
-        unique_fd v4l2Fd)
+        std::unique_ptr<V4l2Device> v4l2Device)
     : mCallback(callback),
       mCfg(cfg),
       mCameraCharacteristics(chars),
       mSupportedFormats(sortedFormats),
       mCroppingType(croppingType),
       mCameraId(cameraId),
-      mV4l2Fd(std::move(v4l2Fd)),
+      mV4l2Device(std::move(v4l2Device)),
+      mResultMetadataBuilder(chars),
       mMaxThumbResolution(getMaxThumbResolution()),
       mMaxJpegResolution(getMaxJpegResolution()) {}
 
@@ -140,13 +149,13 @@ Size ExternalCameraDeviceSession::getMaxJpegResolution() const {
 }
 
 bool ExternalCameraDeviceSession::initialize() {
-    if (mV4l2Fd.get() < 0) {
-        ALOGE("%s: invalid v4l2 device fd %d!", __FUNCTION__, mV4l2Fd.get());
+    if (mV4l2Device == nullptr) {
+        ALOGE("%s: invalid v4l2 device!", __FUNCTION__);
         return true;
     }
 
     struct v4l2_capability capability;
-    int ret = ioctl(mV4l2Fd.get(), VIDIOC_QUERYCAP, &capability);
+    int ret = mV4l2Device->ioctl(VIDIOC_QUERYCAP, &capability);
     std::string make, model;
     if (ret < 0) {
         ALOGW("%s v4l2 QUERYCAP failed", __FUNCTION__);
@@ -180,6 +189,9 @@ bool ExternalCameraDeviceSession::initialize() {
     }
     mOutputThread->setExifMakeModel(mExifMake, mExifModel);
 
+    mSensorThread = std::make_shared<SensorThread>(this);
+    mSensorThread->run();
+
     status_t status = initDefaultRequests();
     if (status != OK) {
         ALOGE("%s: init default requests failed!", __FUNCTION__);
@@ -238,6 +250,13 @@ void ExternalCameraDeviceSession::closeBufferRequestThread() {
     }
 }
 
+void ExternalCameraDeviceSession::closeSensorThread() {
+    if (mSensorThread != nullptr) {
+        mSensorThread->requestExitAndWait();
+        mSensorThread.reset();
+    }
+}
+
 Status ExternalCameraDeviceSession::initStatus() const {
     Mutex::Autolock _l(mLock);
     Status status = Status::OK;
@@ -572,7 +591,10 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
     }
 
     if (converted && rawSettings != nullptr) {
-        mLatestReqSetting = rawSettings;
+        // Requests keep sharing the previous settings until new ones are sent
+        auto settings = std::make_shared<common::V1_0::helper::CameraMetadata>();
+        *settings = rawSettings;
+        mLatestReqSetting = std::move(settings);
     }
 
     if (!converted) {
@@ -592,7 +614,8 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
         return Status::ILLEGAL_ARGUMENT;
     }
 
-    camera_metadata_entry fpsRange = mLatestReqSetting.find(ANDROID_CONTROL_AE_TARGET_FPS_RANGE);
+    camera_metadata_ro_entry fpsRange =
+            mLatestReqSetting->find(ANDROID_CONTROL_AE_TARGET_FPS_RANGE);
     if (fpsRange.count == 2) {
         double requestFpsMax = fpsRange.data.i32[1];
         double closestFps = 0.0;
@@ -625,6 +648,7 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
         }
 
         if (requestFpsMax != mV4l2StreamingFps) {
+            stopSensorLocked();
             {
                 std::unique_lock<std::mutex> lk(mV4l2BufferLock);
                 while (mNumDequeuedV4l2Buffers != 0) {
@@ -632,16 +656,28 @@ Status ExternalCameraDeviceSession::processOneCaptureRequest(const CaptureReques
                     int waitRet = waitForV4L2BufferReturnLocked(lk);
                     if (waitRet != 0) {
                         ALOGE("%s: wait for pipeline idle failed!", __FUNCTION__);
+                        lk.unlock();
+                        // The stream is still configured at the previous fps
+                        startSensorLocked();
                         return Status::INTERNAL_ERROR;
                     }
                 }
             }
-            configureV4l2StreamLocked(mV4l2StreamingFmt, requestFpsMax);
+            double previousFps = mV4l2StreamingFps;
+            if (configureV4l2StreamLocked(mV4l2StreamingFmt, requestFpsMax) != 0) {
+                ALOGE("%s: V4L2 reconfiguration to %f fps failed!", __FUNCTION__, requestFpsMax);
+                // configureV4l2StreamLocked restarts the sensor thread once streaming is back
+                if (configureV4l2StreamLocked(mV4l2StreamingFmt, previousFps) != 0) {
+                    ALOGE("%s: V4L2 restore to %f fps failed!", __FUNCTION__, previousFps);
+                    notifyError(request.frameNumber, /*stream*/ -1, ErrorCode::ERROR_DEVICE);
+                }
+                return Status::INTERNAL_ERROR;
+            }
         }
     }
 
     nsecs_t shutterTs = 0;
-    std::unique_ptr<V4L2Frame> frameIn = dequeueV4l2FrameLocked(&shutterTs);
+    std::unique_ptr<V4L2Frame> frameIn = takeLatestV4l2Frame(&shutterTs);
     if (frameIn == nullptr) {
         ALOGE("%s: V4L2 deque frame failed!", __FUNCTION__);
         return Status::INTERNAL_ERROR;
@@ -1017,14 +1053,13 @@ status_t ExternalCameraDeviceSession::initDefaultRequests() {
     return OK;
 }
 
-status_t ExternalCameraDeviceSession::fillCaptureResult(common::V1_0::helper::CameraMetadata& md,
-                                                        nsecs_t timestamp) {
+const camera_metadata_t* ExternalCameraDeviceSession::fillCaptureResult(const HalRequest& req) {
     bool afTrigger = false;
     {
         std::lock_guard<std::mutex> lk(mAfTriggerLock);
         afTrigger = mAfTrigger;
-        if (md.exists(ANDROID_CONTROL_AF_TRIGGER)) {
-            camera_metadata_entry entry = md.find(ANDROID_CONTROL_AF_TRIGGER);
+        camera_metadata_ro_entry entry = req.setting->find(ANDROID_CONTROL_AF_TRIGGER);
+        if (entry.count > 0) {
             if (entry.data.u8[0] == ANDROID_CONTROL_AF_TRIGGER_START) {
                 mAfTrigger = afTrigger = true;
             } else if (entry.data.u8[0] == ANDROID_CONTROL_AF_TRIGGER_CANCEL) {
@@ -1042,12 +1077,7 @@ status_t ExternalCameraDeviceSession::fillCaptureResult(common::V1_0::helper::Ca
     } else {
         afState = ANDROID_CONTROL_AF_STATE_INACTIVE;
     }
-    UPDATE(md, ANDROID_CONTROL_AF_STATE, &afState, 1);
-
-    camera_metadata_ro_entry activeArraySize =
-            mCameraCharacteristics.find(ANDROID_SENSOR_INFO_ACTIVE_ARRAY_SIZE);
-
-    return fillCaptureResultCommon(md, timestamp, activeArraySize);
+    return mResultMetadataBuilder.build(req.setting, req.shutterTs, afState);
 }
 
 int ExternalCameraDeviceSession::configureV4l2StreamLocked(const SupportedV4L2Format& v4l2Fmt,
@@ -1069,7 +1099,7 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(const SupportedV4L2Fo
     {
         int numAttempt = 0;
         do {
-            ret = TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_S_FMT, &fmt));
+            ret = TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_S_FMT, &fmt));
             if (numAttempt == MAX_RETRY) {
                 break;
             }
@@ -1096,6 +1126,17 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(const SupportedV4L2Fo
         return -EINVAL;
     }
 
+    // Uncompressed frames are converted assuming tightly packed lines
+    if (isUncompressedColorFourcc(v4l2Fmt.fourcc)) {
+        uint32_t packedBytesPerLine =
+                (v4l2Fmt.fourcc == V4L2_PIX_FMT_YUYV) ? fmt.fmt.pix.width * 2 : fmt.fmt.pix.width;
+        if (fmt.fmt.pix.bytesperline != 0 && fmt.fmt.pix.bytesperline != packedBytesPerLine) {
+            ALOGE("%s: V4L2 bytes per line %u, expect %u", __FUNCTION__,
+                  fmt.fmt.pix.bytesperline, packedBytesPerLine);
+            return -EINVAL;
+        }
+    }
+
     uint32_t bufferSize = fmt.fmt.pix.sizeimage;
     ALOGI("%s: V4L2 buffer size is %d", __FUNCTION__, bufferSize);
     uint32_t expectedMaxBufferSize = kMaxBytesPerPixel * fmt.fmt.pix.width * fmt.fmt.pix.height;
@@ -1135,13 +1176,20 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(const SupportedV4L2Fo
     }
 
     uint32_t v4lBufferCount = (fps >= kDefaultFps) ? mCfg.numVideoBuffers : mCfg.numStillBuffers;
+    if (mCfg.exportDmaBuf) {
+        // A deeper queue keeps the sensor running while earlier frames are being decoded
+        v4lBufferCount = std::max(v4lBufferCount, mCfg.numDmaBufBuffers);
+    }
+
+    // Mappings of a previous configuration would keep the old buffers busy
+    unmapV4l2BuffersLocked();
 
     // VIDIOC_REQBUFS: create buffers
     v4l2_requestbuffers req_buffers{};
     req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req_buffers.memory = V4L2_MEMORY_MMAP;
     req_buffers.count = v4lBufferCount;
-    if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers)) < 0) {
+    if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_REQBUFS, &req_buffers)) < 0) {
         ALOGE("%s: VIDIOC_REQBUFS failed: %s", __FUNCTION__, strerror(errno));
         return -errno;
     }
@@ -1160,12 +1208,17 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(const SupportedV4L2Fo
         v4l2_buffer buffer = {
                 .index = i, .type = V4L2_BUF_TYPE_VIDEO_CAPTURE, .memory = V4L2_MEMORY_MMAP};
 
-        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QUERYBUF, &buffer)) < 0) {
+        if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_QUERYBUF, &buffer)) < 0) {
             ALOGE("%s: QUERYBUF %d failed: %s", __FUNCTION__, i, strerror(errno));
             return -errno;
         }
 
-        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
+        ret = mapV4l2BufferLocked(buffer);
+        if (ret != OK) {
+            return ret;
+        }
+
+        if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_QBUF, &buffer)) < 0) {
             ALOGE("%s: QBUF %d failed: %s", __FUNCTION__, i, strerror(errno));
             return -errno;
         }
@@ -1176,7 +1229,7 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(const SupportedV4L2Fo
         v4l2_buf_type capture_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         int numAttempt = 0;
         do {
-            ret = TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_STREAMON, &capture_type));
+            ret = TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_STREAMON, &capture_type));
             if (numAttempt == MAX_RETRY) {
                 break;
             }
@@ -1197,12 +1250,12 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(const SupportedV4L2Fo
         v4l2_buffer buffer{};
         buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         buffer.memory = V4L2_MEMORY_MMAP;
-        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_DQBUF, &buffer)) < 0) {
+        if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_DQBUF, &buffer)) < 0) {
             ALOGE("%s: DQBUF fails: %s", __FUNCTION__, strerror(errno));
             return -errno;
         }
 
-        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
+        if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_QBUF, &buffer)) < 0) {
             ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__, buffer.index, strerror(errno));
             return -errno;
         }
@@ -1211,10 +1264,11 @@ int ExternalCameraDeviceSession::configureV4l2StreamLocked(const SupportedV4L2Fo
     ALOGI("%s: start V4L2 streaming %dx%d@%ffps", __FUNCTION__, v4l2Fmt.width, v4l2Fmt.height, fps);
     mV4l2StreamingFmt = v4l2Fmt;
     mV4l2Streaming = true;
+    startSensorLocked();
     return OK;
 }
 
-std::unique_ptr<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(nsecs_t* shutterTs) {
+std::unique_ptr<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2Frame(nsecs_t* shutterTs) {
     ATRACE_CALL();
     std::unique_ptr<V4L2Frame> ret = nullptr;
     if (shutterTs == nullptr) {
@@ -1222,21 +1276,11 @@ std::unique_ptr<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(n
         return ret;
     }
 
-    {
-        std::unique_lock<std::mutex> lk(mV4l2BufferLock);
-        if (mNumDequeuedV4l2Buffers == mV4L2BufferCount) {
-            int waitRet = waitForV4L2BufferReturnLocked(lk);
-            if (waitRet != 0) {
-                return ret;
-            }
-        }
-    }
-
     ATRACE_BEGIN("VIDIOC_DQBUF");
     v4l2_buffer buffer{};
     buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     buffer.memory = V4L2_MEMORY_MMAP;
-    if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_DQBUF, &buffer)) < 0) {
+    if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_DQBUF, &buffer)) < 0) {
         ALOGE("%s: DQBUF fails: %s", __FUNCTION__, strerror(errno));
         return ret;
     }
@@ -1252,7 +1296,8 @@ std::unique_ptr<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(n
         // TODO: try to dequeue again
     }
 
-    if (buffer.bytesused > mMaxV4L2BufferSize) {
+    if (buffer.bytesused > mMaxV4L2BufferSize ||
+        buffer.bytesused > mV4l2BufferMappings[buffer.index].length) {
         ALOGE("%s: v4l2 buffer bytes used: %u maximum %u", __FUNCTION__, buffer.bytesused,
               mMaxV4L2BufferSize);
         return ret;
@@ -1272,20 +1317,25 @@ std::unique_ptr<V4L2Frame> ExternalCameraDeviceSession::dequeueV4l2FrameLocked(n
         mNumDequeuedV4l2Buffers++;
     }
 
+    syncV4l2Buffer(buffer.index, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
     return std::make_unique<V4L2Frame>(mV4l2StreamingFmt.width, mV4l2StreamingFmt.height,
-                                       mV4l2StreamingFmt.fourcc, buffer.index, mV4l2Fd.get(),
-                                       buffer.bytesused, buffer.m.offset);
+                                       mV4l2StreamingFmt.fourcc, buffer.index,
+                                       mV4l2BufferMappings[buffer.index].data, buffer.bytesused);
 }
 
 void ExternalCameraDeviceSession::enqueueV4l2Frame(const std::shared_ptr<V4L2Frame>& frame) {
     ATRACE_CALL();
-    frame->unmap();
+    if (!frame->release()) {
+        // Already queued back when the output thread was done reading it
+        return;
+    }
+    syncV4l2Buffer(frame->mBufferIndex, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
     ATRACE_BEGIN("VIDIOC_QBUF");
     v4l2_buffer buffer{};
     buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     buffer.memory = V4L2_MEMORY_MMAP;
     buffer.index = frame->mBufferIndex;
-    if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
+    if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_QBUF, &buffer)) < 0) {
         ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__, frame->mBufferIndex, strerror(errno));
         return;
     }
@@ -1296,6 +1346,110 @@ void ExternalCameraDeviceSession::enqueueV4l2Frame(const std::shared_ptr<V4L2Fra
         mNumDequeuedV4l2Buffers--;
     }
     mV4L2BufferReturned.notify_one();
+    mSensorStateCond.notify_all();
+}
+
+void ExternalCameraDeviceSession::releaseInputFrame(const std::shared_ptr<HalRequest>& req) {
+    enqueueV4l2Frame(std::static_pointer_cast<V4L2Frame>(req->frameIn));
+}
+
+int ExternalCameraDeviceSession::mapV4l2BufferLocked(const v4l2_buffer& buffer) {
+    if (mV4l2BufferMappings.size() <= buffer.index) {
+        mV4l2BufferMappings.resize(buffer.index + 1);
+    }
+    V4l2BufferMapping& mapping = mV4l2BufferMappings[buffer.index];
+
+    void* addr = MAP_FAILED;
+    if (mCfg.exportDmaBuf) {
+        // VIDIOC_EXPBUF: export the buffer as a DMA-BUF
+        v4l2_exportbuffer expbuf{};
+        expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        expbuf.index = buffer.index;
+        expbuf.flags = O_RDONLY | O_CLOEXEC;
+        if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_EXPBUF, &expbuf)) < 0) {
+            ALOGW("%s: EXPBUF %d failed: %s, mapping the V4L2 buffer instead", __FUNCTION__,
+                  buffer.index, strerror(errno));
+        } else {
+            mapping.dmaBuf.reset(expbuf.fd);
+            addr = ::mmap(nullptr, buffer.length, PROT_READ, MAP_SHARED, mapping.dmaBuf.get(), 0);
+            if (addr == MAP_FAILED) {
+                ALOGW("%s: DMA-BUF %d map failed: %s, mapping the V4L2 buffer instead",
+                      __FUNCTION__, buffer.index, strerror(errno));
+                mapping.dmaBuf.reset();
+            }
+        }
+    }
+    if (addr == MAP_FAILED) {
+        addr = mV4l2Device->mmap(buffer.length, buffer.m.offset);
+        if (addr == MAP_FAILED) {
+            ALOGE("%s: V4L2 buffer %d map failed: %s", __FUNCTION__, buffer.index,
+                  strerror(errno));
+            return -errno;
+        }
+    }
+    mapping.data = static_cast<uint8_t*>(addr);
+    mapping.length = buffer.length;
+    return OK;
+}
+
+void ExternalCameraDeviceSession::unmapV4l2BuffersLocked() {
+    for (auto& mapping : mV4l2BufferMappings) {
+        if (mapping.data == nullptr) {
+            continue;
+        }
+        int ret = mapping.dmaBuf.ok() ? ::munmap(mapping.data, mapping.length)
+                                      : mV4l2Device->munmap(mapping.data, mapping.length);
+        if (ret != 0) {
+            ALOGE("%s: V4L2 buffer unmap failed: %s", __FUNCTION__, strerror(errno));
+        }
+    }
+    mV4l2BufferMappings.clear();
+}
+
+void ExternalCameraDeviceSession::syncV4l2Buffer(uint32_t index, uint64_t flags) {
+    const unique_fd& dmaBuf = mV4l2BufferMappings[index].dmaBuf;
+    if (!dmaBuf.ok()) {
+        return;
+    }
+    dma_buf_sync sync = {.flags = flags};
+    if (TEMP_FAILURE_RETRY(::ioctl(dmaBuf.get(), DMA_BUF_IOCTL_SYNC, &sync)) < 0) {
+        ALOGV("%s: DMA_BUF_IOCTL_SYNC on buffer %d failed: %s", __FUNCTION__, index,
+              strerror(errno));
+    }
+}
+
+std::unique_ptr<V4L2Frame> ExternalCameraDeviceSession::takeLatestV4l2Frame(nsecs_t* shutterTs) {
+    ATRACE_CALL();
+    std::unique_lock<std::mutex> lk(mV4l2BufferLock);
+    auto timeout = std::chrono::seconds(kBufferWaitTimeoutSec);
+    if (!mV4l2FrameAvailable.wait_for(lk, timeout,
+                                      [this] { return mLatestV4l2Frame != nullptr; })) {
+        ALOGE("%s: wait for V4L2 frame timeout!", __FUNCTION__);
+        return nullptr;
+    }
+    *shutterTs = mLatestShutterTs;
+    return std::move(mLatestV4l2Frame);
+}
+
+void ExternalCameraDeviceSession::startSensorLocked() {
+    {
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        mSensorActive = true;
+    }
+    mSensorStateCond.notify_all();
+}
+
+void ExternalCameraDeviceSession::stopSensorLocked() {
+    std::unique_ptr<V4L2Frame> latest;
+    {
+        std::unique_lock<std::mutex> lk(mV4l2BufferLock);
+        mSensorActive = false;
+        mSensorStateCond.wait(lk, [this] { return !mSensorDequeuing; });
+        latest = std::move(mLatestV4l2Frame);
+    }
+    if (latest != nullptr) {
+        enqueueV4l2Frame(std::move(latest));
+    }
 }
 
 bool ExternalCameraDeviceSession::isSupported(
@@ -1381,6 +1535,7 @@ void ExternalCameraDeviceSession::closeImpl() {
     if (!closed) {
         closeOutputThread();
         closeBufferRequestThread();
+        closeSensorThread();
 
         Mutex::Autolock _l(mLock);
         // free all buffers
@@ -1391,8 +1546,8 @@ void ExternalCameraDeviceSession::closeImpl() {
             }
         }
         v4l2StreamOffLocked();
-        ALOGV("%s: closing V4L2 camera FD %d", __FUNCTION__, mV4l2Fd.get());
-        mV4l2Fd.reset();
+        ALOGV("%s: closing V4L2 camera FD %d", __FUNCTION__, mV4l2Device->fd());
+        mV4l2Device.reset();
         mClosed = true;
     }
 }
@@ -1413,6 +1568,8 @@ int ExternalCameraDeviceSession::v4l2StreamOffLocked() {
         return OK;
     }
 
+    stopSensorLocked();
+
     {
         std::lock_guard<std::mutex> lk(mV4l2BufferLock);
         if (mNumDequeuedV4l2Buffers != 0) {
@@ -1420,11 +1577,12 @@ int ExternalCameraDeviceSession::v4l2StreamOffLocked() {
             return -1;
         }
     }
+    unmapV4l2BuffersLocked();
     mV4L2BufferCount = 0;
 
     // VIDIOC_STREAMOFF
     v4l2_buf_type capture_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_STREAMOFF, &capture_type)) < 0) {
+    if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_STREAMOFF, &capture_type)) < 0) {
         ALOGE("%s: STREAMOFF failed: %s", __FUNCTION__, strerror(errno));
         return -errno;
     }
@@ -1434,7 +1592,7 @@ int ExternalCameraDeviceSession::v4l2StreamOffLocked() {
     req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req_buffers.memory = V4L2_MEMORY_MMAP;
     req_buffers.count = 0;
-    if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers)) < 0) {
+    if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_REQBUFS, &req_buffers)) < 0) {
         ALOGE("%s: REQBUFS failed: %s", __FUNCTION__, strerror(errno));
         return -errno;
     }
@@ -1447,7 +1605,7 @@ int ExternalCameraDeviceSession::setV4l2FpsLocked(double fps) {
     // VIDIOC_G_PARM/VIDIOC_S_PARM: set fps
     v4l2_streamparm streamparm = {.type = V4L2_BUF_TYPE_VIDEO_CAPTURE};
     // The following line checks that the driver knows about framerate get/set.
-    int ret = TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_G_PARM, &streamparm));
+    int ret = TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_G_PARM, &streamparm));
     if (ret != 0) {
         if (errno == -EINVAL) {
             ALOGW("%s: device does not support VIDIOC_G_PARM", __FUNCTION__);
@@ -1465,7 +1623,7 @@ int ExternalCameraDeviceSession::setV4l2FpsLocked(double fps) {
     streamparm.parm.capture.timeperframe.numerator = kFrameRatePrecision;
     streamparm.parm.capture.timeperframe.denominator = (fps * kFrameRatePrecision);
 
-    if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_S_PARM, &streamparm)) < 0) {
+    if (TEMP_FAILURE_RETRY(mV4l2Device->ioctl(VIDIOC_S_PARM, &streamparm)) < 0) {
         ALOGE("%s: failed to set framerate to %f: %s", __FUNCTION__, fps, strerror(errno));
         return -1;
     }
@@ -1514,7 +1672,7 @@ void ExternalCameraDeviceSession::notifyError(int32_t frameNumber, int32_t strea
 }
 
 void ExternalCameraDeviceSession::invokeProcessCaptureResultCallback(
-        std::vector<CaptureResult>& results, bool tryWriteFmq) {
+        std::vector<CaptureResult>& results, bool tryWriteFmq, const camera_metadata_t* rawResult) {
     if (mProcessCaptureResultLock.tryLock() != OK) {
         const nsecs_t NS_TO_SECOND = 1000000000;
         ALOGV("%s: previous call is not finished! waiting 1s...", __FUNCTION__);
@@ -1523,7 +1681,18 @@ void ExternalCameraDeviceSession::invokeProcessCaptureResultCallback(
             return;
         }
     }
-    if (tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0) {
+    if (rawResult != nullptr) {
+        CaptureResult& result = results[0];
+        size_t size = get_camera_metadata_size(rawResult);
+        if (tryWriteFmq && mResultMetadataQueue->availableToWrite() >= size &&
+            mResultMetadataQueue->write(reinterpret_cast<const int8_t*>(rawResult), size)) {
+            result.fmqResultSize = size;
+        } else {
+            ALOGV("%s: result fmq is full, fall back to binder", __FUNCTION__);
+            convertToAidl(rawResult, &result.result);
+            result.fmqResultSize = 0;
+        }
+    } else if (tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0) {
         for (CaptureResult& result : results) {
             CameraMetadata& md = result.result;
             if (!md.metadata.empty()) {
@@ -1791,20 +1960,22 @@ Status ExternalCameraDeviceSession::processCaptureResult(std::shared_ptr<HalRequ
         }
     }
 
-    // Fill capture result metadata
-    fillCaptureResult(req->setting, req->shutterTs);
-    const camera_metadata_t* rawResult = req->setting.getAndLock();
-    convertToAidl(rawResult, &result.result);
-    req->setting.unlock(rawResult);
-
     // update inflight records
     {
         std::lock_guard<std::mutex> lk(mInflightFramesLock);
         mInflightFrames.erase(req->frameNumber);
     }
 
-    // Callback into framework
-    invokeProcessCaptureResultCallback(results, /* tryWriteFmq */ true);
+    // Fill capture result metadata and callback into framework. The metadata buffer is reused for
+    // the next result, so it is held until sent.
+    {
+        std::lock_guard<std::mutex> lk(mResultMetadataLock);
+        const camera_metadata_t* rawResult = fillCaptureResult(*req);
+        if (rawResult == nullptr) {
+            ALOGE("%s: fill capture result metadata failed!", __FUNCTION__);
+        }
+        invokeProcessCaptureResultCallback(results, /* tryWriteFmq */ true, rawResult);
+    }
     freeReleaseFences(results);
     return Status::OK;
 }
@@ -1858,6 +2029,7 @@ binder_status_t ExternalCameraDeviceSession::dump(int fd, const char** /*args*/,
 
     bool streaming = false;
     size_t v4L2BufferCount = 0;
+    bool v4l2DmaBuf = false;
     SupportedV4L2Format streamingFmt;
     {
         bool sessionLocked = tryLock(mLock);
@@ -1867,6 +2039,7 @@ binder_status_t ExternalCameraDeviceSession::dump(int fd, const char** /*args*/,
         streaming = mV4l2Streaming;
         streamingFmt = mV4l2StreamingFmt;
         v4L2BufferCount = mV4L2BufferCount;
+        v4l2DmaBuf = !mV4l2BufferMappings.empty() && mV4l2BufferMappings[0].dmaBuf.ok();
 
         if (sessionLocked) {
             mLock.unlock();
@@ -1886,8 +2059,9 @@ binder_status_t ExternalCameraDeviceSession::dump(int fd, const char** /*args*/,
         }
     }
 
+    int v4l2Fd = mV4l2Device != nullptr ? mV4l2Device->fd() : -1;
     dprintf(fd, "External camera %s V4L2 FD %d, cropping type %s, %s\n", mCameraId.c_str(),
-            mV4l2Fd.get(), (mCroppingType == VERTICAL) ? "vertical" : "horizontal",
+            v4l2Fd, (mCroppingType == VERTICAL) ? "vertical" : "horizontal",
             streaming ? "streaming" : "not streaming");
 
     if (streaming) {
@@ -1898,12 +2072,16 @@ binder_status_t ExternalCameraDeviceSession::dump(int fd, const char** /*args*/,
                 mV4l2StreamingFps);
 
         size_t numDequeuedV4l2Buffers = 0;
+        uint64_t numDroppedV4l2Frames = 0;
         {
             std::lock_guard<std::mutex> lk(mV4l2BufferLock);
             numDequeuedV4l2Buffers = mNumDequeuedV4l2Buffers;
+            numDroppedV4l2Frames = mNumDroppedV4l2Frames;
         }
-        dprintf(fd, "V4L2 buffer queue size %zu, dequeued %zu\n", v4L2BufferCount,
-                numDequeuedV4l2Buffers);
+        dprintf(fd,
+                "V4L2 buffer queue size %zu%s, dequeued %zu, stale frames dropped %" PRIu64 "\n",
+                v4L2BufferCount, v4l2DmaBuf ? " (DMA-BUF)" : "", numDequeuedV4l2Buffers,
+                numDroppedV4l2Frames);
     }
 
     dprintf(fd, "In-flight frames (not sorted):");
@@ -1921,6 +2099,62 @@ binder_status_t ExternalCameraDeviceSession::dump(int fd, const char** /*args*/,
     return STATUS_OK;
 }
 
+// Start ExternalCameraDeviceSession::SensorThread functions
+ExternalCameraDeviceSession::SensorThread::SensorThread(ExternalCameraDeviceSession* parent)
+    : mParent(parent) {}
+
+bool ExternalCameraDeviceSession::SensorThread::threadLoop() {
+    ExternalCameraDeviceSession* parent = mParent;
+    {
+        // Wait for streaming and a buffer to be queued in the driver. The timeout lets
+        // requestExitAndWait() stop the loop.
+        std::unique_lock<std::mutex> lk(parent->mV4l2BufferLock);
+        auto canDequeue = [parent] {
+            return parent->mSensorActive &&
+                   parent->mNumDequeuedV4l2Buffers < parent->mV4L2BufferCount;
+        };
+        if (!parent->mSensorStateCond.wait_for(lk, std::chrono::milliseconds(kPollTimeoutMs),
+                                               canDequeue)) {
+            return true;
+        }
+        parent->mSensorDequeuing = true;
+    }
+
+    std::unique_ptr<V4L2Frame> stale;
+    if (TEMP_FAILURE_RETRY(parent->mV4l2Device->pollIn(kPollTimeoutMs)) > 0) {
+        nsecs_t shutterTs = 0;
+        std::unique_ptr<V4L2Frame> frame = parent->dequeueV4l2Frame(&shutterTs);
+        if (frame != nullptr) {
+            {
+                std::lock_guard<std::mutex> lk(parent->mV4l2BufferLock);
+                stale = std::move(parent->mLatestV4l2Frame);
+                parent->mLatestV4l2Frame = std::move(frame);
+                parent->mLatestShutterTs = shutterTs;
+                if (stale != nullptr) {
+                    parent->mNumDroppedV4l2Frames++;
+                }
+            }
+            parent->mV4l2FrameAvailable.notify_all();
+        } else {
+            // Avoid spinning on a device in error state
+            usleep(kPollTimeoutMs * 1000);
+        }
+    }
+
+    // No request picked up the previous frame, give it back to the driver
+    if (stale != nullptr) {
+        parent->enqueueV4l2Frame(std::move(stale));
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(parent->mV4l2BufferLock);
+        parent->mSensorDequeuing = false;
+    }
+    parent->mSensorStateCond.notify_all();
+    return true;
+}
+// End ExternalCameraDeviceSession::SensorThread functions
+
 // Start ExternalCameraDeviceSession::BufferRequestThread functions
 ExternalCameraDeviceSession::BufferRequestThread::BufferRequestThread(
         std::weak_ptr<OutputThreadInterface> parent,
@@ -2131,84 +2365,104 @@ ExternalCameraDeviceSession::OutputThread::OutputThread(
       mCameraCharacteristics(chars),
       mBufferRequestThread(bufReqThread) {}
 
-ExternalCameraDeviceSession::OutputThread::~OutputThread() {}
+ExternalCameraDeviceSession::OutputThread::~OutputThread() {
+    stopWorkers();
+}
 
 Status ExternalCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         const Size& v4lSize, const Size& thumbSize, const std::vector<Stream>& streams,
-        uint32_t blobBufferSize) {
-    std::lock_guard<std::mutex> lk(mBufferLock);
-    if (!mScaledYu12Frames.empty()) {
-        ALOGE("%s: intermediate buffer pool has %zu inflight buffers! (expect 0)", __FUNCTION__,
-              mScaledYu12Frames.size());
+        uint32_t blobBufferSize, size_t numFrames) {
+    if (!waitForPipelineIdle()) {
+        ALOGE("%s: output pipeline has inflight requests!", __FUNCTION__);
         return Status::INTERNAL_ERROR;
     }
 
-    // Allocating intermediate YU12 frame
-    if (mYu12Frame == nullptr || mYu12Frame->mWidth != v4lSize.width ||
-        mYu12Frame->mHeight != v4lSize.height) {
-        mYu12Frame.reset();
-        mYu12Frame = std::make_shared<AllocatedFrame>(v4lSize.width, v4lSize.height);
-        int ret = mYu12Frame->allocate(&mYu12FrameLayout);
-        if (ret != 0) {
-            ALOGE("%s: allocating YU12 frame failed!", __FUNCTION__);
-            return Status::INTERNAL_ERROR;
-        }
-    }
-
-    // Allocating intermediate YU12 thumbnail frame
-    if (mYu12ThumbFrame == nullptr || mYu12ThumbFrame->mWidth != thumbSize.width ||
-        mYu12ThumbFrame->mHeight != thumbSize.height) {
-        mYu12ThumbFrame.reset();
-        mYu12ThumbFrame = std::make_shared<AllocatedFrame>(thumbSize.width, thumbSize.height);
-        int ret = mYu12ThumbFrame->allocate(&mYu12ThumbFrameLayout);
-        if (ret != 0) {
-            ALOGE("%s: allocating YU12 thumb frame failed!", __FUNCTION__);
-            return Status::INTERNAL_ERROR;
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    numFrames = std::max<size_t>(numFrames, 1);
+    mFrameContexts.resize(numFrames);
+    for (auto& ctx : mFrameContexts) {
+        if (ctx == nullptr) {
+            ctx = std::make_unique<FrameContext>();
+        }
+
+        // Allocating intermediate YU12 frame
+        if (ctx->mYu12Frame == nullptr || ctx->mYu12Frame->mWidth != v4lSize.width ||
+            ctx->mYu12Frame->mHeight != v4lSize.height) {
+            ctx->mYu12Frame.reset();
+            ctx->mYu12Frame = std::make_shared<AllocatedFrame>(v4lSize.width, v4lSize.height);
+            int ret = ctx->mYu12Frame->allocate(&ctx->mYu12FrameLayout);
+            if (ret != 0) {
+                ALOGE("%s: allocating YU12 frame failed!", __FUNCTION__);
+                return Status::INTERNAL_ERROR;
+            }
         }
-    }
 
-    // Allocating scaled buffers
-    for (const auto& stream : streams) {
-        Size sz = {stream.width, stream.height};
-        if (sz == v4lSize) {
-            continue;  // Don't need an intermediate buffer same size as v4lBuffer
-        }
-        if (mIntermediateBuffers.count(sz) == 0) {
-            // Create new intermediate buffer
-            std::shared_ptr<AllocatedFrame> buf =
-                    std::make_shared<AllocatedFrame>(stream.width, stream.height);
-            int ret = buf->allocate();
+        // Allocating intermediate YU12 thumbnail frame
+        if (ctx->mYu12ThumbFrame == nullptr || ctx->mYu12ThumbFrame->mWidth != thumbSize.width ||
+            ctx->mYu12ThumbFrame->mHeight != thumbSize.height) {
+            ctx->mYu12ThumbFrame.reset();
+            ctx->mYu12ThumbFrame =
+                    std::make_shared<AllocatedFrame>(thumbSize.width, thumbSize.height);
+            int ret = ctx->mYu12ThumbFrame->allocate(&ctx->mYu12ThumbFrameLayout);
             if (ret != 0) {
-                ALOGE("%s: allocating intermediate YU12 frame %dx%d failed!", __FUNCTION__,
-                      stream.width, stream.height);
+                ALOGE("%s: allocating YU12 thumb frame failed!", __FUNCTION__);
                 return Status::INTERNAL_ERROR;
             }
-            mIntermediateBuffers[sz] = buf;
         }
-    }
 
-    // Remove unconfigured buffers
-    auto it = mIntermediateBuffers.begin();
-    while (it != mIntermediateBuffers.end()) {
-        bool configured = false;
-        auto sz = it->first;
+        // Allocating scaled buffers
         for (const auto& stream : streams) {
-            if (stream.width == sz.width && stream.height == sz.height) {
-                configured = true;
-                break;
+            Size sz = {stream.width, stream.height};
+            if (sz == v4lSize) {
+                continue;  // Don't need an intermediate buffer same size as v4lBuffer
+            }
+            if (ctx->mIntermediateBuffers.count(sz) == 0) {
+                // Create new intermediate buffer
+                std::shared_ptr<AllocatedFrame> buf =
+                        std::make_shared<AllocatedFrame>(stream.width, stream.height);
+                int ret = buf->allocate();
+                if (ret != 0) {
+                    ALOGE("%s: allocating intermediate YU12 frame %dx%d failed!", __FUNCTION__,
+                          stream.width, stream.height);
+                    return Status::INTERNAL_ERROR;
+                }
+                ctx->mIntermediateBuffers[sz] = buf;
             }
         }
-        if (configured) {
-            it++;
-        } else {
-            it = mIntermediateBuffers.erase(it);
+
+        // Remove unconfigured buffers
+        auto it = ctx->mIntermediateBuffers.begin();
+        while (it != ctx->mIntermediateBuffers.end()) {
+            bool configured = false;
+            auto sz = it->first;
+            for (const auto& stream : streams) {
+                if (stream.width == sz.width && stream.height == sz.height) {
+                    configured = true;
+                    break;
+                }
+            }
+            if (configured) {
+                it++;
+            } else {
+                it = ctx->mIntermediateBuffers.erase(it);
+            }
         }
     }
 
     // Allocate mute test pattern frame
-    mMuteTestPatternFrame.resize(mYu12Frame->mWidth * mYu12Frame->mHeight * 3);
+    mMuteTestPatternFrame.resize(v4lSize.width * v4lSize.height * 3);
 
     mBlobBufferSize = blobBufferSize;
+
+    std::lock_guard<std::mutex> pipelineLk(mPipelineLock);
+    mFreeFrameContexts.clear();
+    for (auto& ctx : mFrameContexts) {
+        mFreeFrameContexts.push_back(ctx.get());
+    }
+    if (numFrames > 1) {
+        unsigned int numCpus = std::thread::hardware_concurrency();
+        startWorkersLocked(std::clamp<size_t>(numCpus, 1, kMaxPipelineWorkers));
+    }
     return Status::OK;
 }
 
@@ -2239,26 +2493,69 @@ void ExternalCameraDeviceSession::OutputThread::flush() {
             ALOGE("%s: wait for inflight request finish timeout!", __FUNCTION__);
         }
     }
+    lk.unlock();
+    if (!waitForPipelineIdle()) {
+        ALOGE("%s: wait for output pipeline idle timeout!", __FUNCTION__);
+    }
 
     ALOGV("%s: flushing inflight requests", __FUNCTION__);
-    lk.unlock();
     for (const auto& req : reqs) {
         parent->processCaptureRequestError(req);
     }
 }
 
+void ExternalCameraDeviceSession::OutputThread::StageStats::add(nsecs_t durationNs) {
+    mCount++;
+    mTotalNs += durationNs;
+    mMaxNs = std::max(mMaxNs, durationNs);
+}
+
+void ExternalCameraDeviceSession::OutputThread::StageStats::dump(int fd, const char* name) const {
+    if (mCount == 0) {
+        dprintf(fd, "  %s: no samples\n", name);
+        return;
+    }
+    dprintf(fd, "  %s: count %" PRIu64 ", avg %" PRId64 "us, max %" PRId64 "us\n", name, mCount,
+            static_cast<int64_t>(mTotalNs / mCount / 1000), static_cast<int64_t>(mMaxNs / 1000));
+}
+
 void ExternalCameraDeviceSession::OutputThread::dump(int fd) {
-    std::lock_guard<std::mutex> lk(mRequestListLock);
-    if (mProcessingRequest) {
-        dprintf(fd, "OutputThread processing frame %d\n", mProcessingFrameNumber);
-    } else {
-        dprintf(fd, "OutputThread not processing any frames\n");
+    {
+        std::lock_guard<std::mutex> lk(mRequestListLock);
+        if (mProcessingRequest) {
+            dprintf(fd, "OutputThread processing frame %d\n", mProcessingFrameNumber);
+        } else {
+            dprintf(fd, "OutputThread not processing any frames\n");
+        }
+        dprintf(fd, "OutputThread request list contains frame: ");
+        for (const auto& req : mRequestList) {
+            dprintf(fd, "%d, ", req->frameNumber);
+        }
+        dprintf(fd, "\n");
     }
-    dprintf(fd, "OutputThread request list contains frame: ");
-    for (const auto& req : mRequestList) {
-        dprintf(fd, "%d, ", req->frameNumber);
+    {
+        std::lock_guard<std::mutex> lk(mPipelineLock);
+        dprintf(fd, "OutputThread pipeline (%zu workers) contains frame: ", mWorkers.size());
+        for (const auto& inflight : mInflightRequests) {
+            dprintf(fd, "%d, ", inflight->mRequest->frameNumber);
+        }
+        dprintf(fd, "\n");
     }
-    dprintf(fd, "\n");
+    std::lock_guard<std::mutex> lk(mStatsLock);
+    dprintf(fd, "OutputThread stage timing:\n");
+    for (const auto& [fourcc, stats] : mDecodeStats) {
+        std::string name = "decode ";
+        for (int shift = 0; shift < 32; shift += 8) {
+            name += static_cast<char>((fourcc >> shift) & 0xFF);
+        }
+        stats.dump(fd, name.c_str());
+    }
+    mScaleStats.dump(fd, "scale");
+    dprintf(fd, "  scale reused: %" PRIu64 "\n", mScaleCacheHits);
+    mConvertStats.dump(fd, "scale/convert");
+    mJpegStats.dump(fd, "jpeg");
+    mResultLatencyStats.dump(fd, "request to result");
+    mShutterLatencyStats.dump(fd, "shutter to result");
 }
 
 void ExternalCameraDeviceSession::OutputThread::setExifMakeModel(const std::string& make,
@@ -2287,6 +2584,9 @@ ExternalCameraDeviceSession::OutputThread::switchToOffline() {
         }
     }
     lk.unlock();
+    if (!waitForPipelineIdle()) {
+        ALOGE("%s: wait for output pipeline idle timeout!", __FUNCTION__);
+    }
     clearIntermediateBuffers();
     ALOGV("%s: returning %zu request for offline processing", __FUNCTION__, reqs.size());
     return reqs;
@@ -2346,8 +2646,10 @@ void ExternalCameraDeviceSession::OutputThread::signalRequestDone() {
     mRequestDoneCond.notify_one();
 }
 
-int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
-        std::shared_ptr<AllocatedFrame>& in, const Size& outSz, YCbCrLayout* out) {
+int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(FrameContext& ctx,
+                                                                  const Size& outSz,
+                                                                  YCbCrLayout* out) {
+    std::shared_ptr<AllocatedFrame>& in = ctx.mYu12Frame;
     Size inSz = {in->mWidth, in->mHeight};
 
     int ret;
@@ -2384,19 +2686,23 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
         return 0;
     }
 
-    auto it = mScaledYu12Frames.find(outSz);
-    std::shared_ptr<AllocatedFrame> scaledYu12Buf;
-    if (it != mScaledYu12Frames.end()) {
-        scaledYu12Buf = it->second;
-    } else {
-        it = mIntermediateBuffers.find(outSz);
-        if (it == mIntermediateBuffers.end()) {
-            ALOGE("%s: failed to find intermediate buffer size %dx%d", __FUNCTION__, outSz.width,
-                  outSz.height);
-            return -1;
-        }
-        scaledYu12Buf = it->second;
+    // Another stream of this frame may have asked for the same crop and size already
+    ScaleKey key{inputCrop, outSz};
+    auto cached = ctx.mScaledYu12Frames.find(key);
+    if (cached != ctx.mScaledYu12Frames.end()) {
+        *out = cached->second;
+        std::lock_guard<std::mutex> lk(mStatsLock);
+        mScaleCacheHits++;
+        return 0;
     }
+
+    auto it = ctx.mIntermediateBuffers.find(outSz);
+    if (it == ctx.mIntermediateBuffers.end()) {
+        ALOGE("%s: failed to find intermediate buffer size %dx%d", __FUNCTION__, outSz.width,
+              outSz.height);
+        return -1;
+    }
+    std::shared_ptr<AllocatedFrame> scaledYu12Buf = it->second;
     // Scale
     YCbCrLayout outLayout;
     ret = scaledYu12Buf->getLayout(&outLayout);
@@ -2405,6 +2711,7 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
         return ret;
     }
 
+    nsecs_t startTs = systemTime(SYSTEM_TIME_MONOTONIC);
     ret = libyuv::I420Scale(
             static_cast<uint8_t*>(croppedLayout.y), croppedLayout.yStride,
             static_cast<uint8_t*>(croppedLayout.cb), croppedLayout.cStride,
@@ -2420,19 +2727,23 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleLocked(
               inputCrop.width, inputCrop.height, outSz.width, outSz.height, ret);
         return ret;
     }
+    recordStage(&mScaleStats, startTs);
 
     *out = outLayout;
-    mScaledYu12Frames.insert({outSz, scaledYu12Buf});
+    ctx.mScaledYu12Frames.emplace(key, outLayout);
     return 0;
 }
 
-int ExternalCameraDeviceSession::OutputThread::cropAndScaleThumbLocked(
-        std::shared_ptr<AllocatedFrame>& in, const Size& outSz, YCbCrLayout* out) {
+int ExternalCameraDeviceSession::OutputThread::cropAndScaleThumb(FrameContext& ctx,
+                                                                 const Size& outSz,
+                                                                 YCbCrLayout* out) {
+    std::shared_ptr<AllocatedFrame>& in = ctx.mYu12Frame;
+    std::shared_ptr<AllocatedFrame>& thumbFrame = ctx.mYu12ThumbFrame;
     Size inSz{in->mWidth, in->mHeight};
 
-    if ((outSz.width * outSz.height) > (mYu12ThumbFrame->mWidth * mYu12ThumbFrame->mHeight)) {
+    if ((outSz.width * outSz.height) > (thumbFrame->mWidth * thumbFrame->mHeight)) {
         ALOGE("%s: Requested thumbnail size too big (%d,%d) > (%d,%d)", __FUNCTION__, outSz.width,
-              outSz.height, mYu12ThumbFrame->mWidth, mYu12ThumbFrame->mHeight);
+              outSz.height, thumbFrame->mWidth, thumbFrame->mHeight);
         return -1;
     }
 
@@ -2521,10 +2832,23 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleThumbLocked(
     ALOGV("%s: computed input crop +%d,+%d %dx%d", __FUNCTION__, inputCrop.left, inputCrop.top,
           inputCrop.width, inputCrop.height);
 
+    // The thumbnail size may match an output stream with the same crop
+    ScaleKey key{inputCrop, outSz};
+    {
+        std::lock_guard<std::mutex> lk(ctx.mScaleLock);
+        auto cached = ctx.mScaledYu12Frames.find(key);
+        if (cached != ctx.mScaledYu12Frames.end()) {
+            *out = cached->second;
+            std::lock_guard<std::mutex> statsLk(mStatsLock);
+            mScaleCacheHits++;
+            return 0;
+        }
+    }
+
     // Scale
     YCbCrLayout outFullLayout;
 
-    ret = mYu12ThumbFrame->getLayout(&outFullLayout);
+    ret = thumbFrame->getLayout(&outFullLayout);
     if (ret != 0) {
         ALOGE("%s: failed to get output buffer layout", __FUNCTION__);
         return ret;
@@ -2546,11 +2870,14 @@ int ExternalCameraDeviceSession::OutputThread::cropAndScaleThumbLocked(
     }
 
     *out = outFullLayout;
+    std::lock_guard<std::mutex> lk(ctx.mScaleLock);
+    ctx.mScaledYu12Frames.emplace(key, outFullLayout);
     return 0;
 }
 
-int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
-        HalStreamBuffer& halBuf, const common::V1_0::helper::CameraMetadata& setting) {
+int ExternalCameraDeviceSession::OutputThread::createJpeg(
+        FrameContext& ctx, HalStreamBuffer& halBuf,
+        const common::V1_0::helper::CameraMetadata& setting) {
     ATRACE_CALL();
     int ret;
     auto lfail = [&](auto... args) {
@@ -2568,7 +2895,8 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
           static_cast<uint64_t>(halBuf.bufferId), halBuf.width, halBuf.height);
     ALOGV("%s: HAL buffer fmt: %x usage: %" PRIx64 " ptr: %p", __FUNCTION__, halBuf.format,
           static_cast<uint64_t>(halBuf.usage), halBuf.bufPtr);
-    ALOGV("%s: YV12 buffer %d x %d", __FUNCTION__, mYu12Frame->mWidth, mYu12Frame->mHeight);
+    ALOGV("%s: YV12 buffer %d x %d", __FUNCTION__, ctx.mYu12Frame->mWidth,
+          ctx.mYu12Frame->mHeight);
 
     int jpegQuality, thumbQuality;
     Size thumbSize;
@@ -2616,60 +2944,76 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
         return lfail("%s: getJpegBufferSize returned %zd", __FUNCTION__, maxJpegCodeSize);
     }
 
-    /* Hold actual thumbnail and main image code sizes */
-    size_t thumbCodeSize = 0, jpegCodeSize = 0;
-    /* Temporary thumbnail code buffer */
-    std::vector<uint8_t> thumbCode(outputThumbnail ? maxThumbCodeSize : 0);
+    /* The thumbnail and EXIF APP1 segment are only needed once the main image is
+     * encoded, produce them concurrently with the main image. Destroying app1Future waits
+     * for the task, so it never outlives the locals it references. */
+    std::future<std::unique_ptr<ExifUtils>> app1Future = std::async(
+            std::launch::async, [&]() -> std::unique_ptr<ExifUtils> {
+                /* Hold actual thumbnail code size */
+                size_t thumbCodeSize = 0;
+                /* Temporary thumbnail code buffer */
+                std::vector<uint8_t> thumbCode(outputThumbnail ? maxThumbCodeSize : 0);
+
+                if (outputThumbnail) {
+                    YCbCrLayout yu12Thumb;
+                    int thumbRet = cropAndScaleThumb(ctx, thumbSize, &yu12Thumb);
+                    if (thumbRet != 0) {
+                        ALOGE("%s: crop and scale thumbnail failed!", __FUNCTION__);
+                        return nullptr;
+                    }
 
-    YCbCrLayout yu12Thumb;
-    if (outputThumbnail) {
-        ret = cropAndScaleThumbLocked(mYu12Frame, thumbSize, &yu12Thumb);
+                    /* Encode the thumbnail image */
+                    thumbRet = encodeJpegYU12(thumbSize, yu12Thumb, thumbQuality, 0, 0,
+                                              &thumbCode[0], maxThumbCodeSize, thumbCodeSize);
+                    if (thumbRet != 0) {
+                        ALOGE("%s: thumbnail encodeJpegYU12 failed with %d", __FUNCTION__,
+                              thumbRet);
+                        return nullptr;
+                    }
+                }
 
-        if (ret != 0) {
-            return lfail("%s: crop and scale thumbnail failed!", __FUNCTION__);
-        }
-    }
+                /* Combine camera characteristics with request settings to form EXIF
+                 * metadata */
+                common::V1_0::helper::CameraMetadata meta(mCameraCharacteristics);
+                meta.append(setting);
 
-    /* Scale and crop main jpeg */
-    ret = cropAndScaleLocked(mYu12Frame, jpegSize, &yu12Main);
+                /* Generate EXIF object */
+                std::unique_ptr<ExifUtils> utils(ExifUtils::create());
+                /* Make sure it's initialized */
+                utils->initialize();
 
-    if (ret != 0) {
-        return lfail("%s: crop and scale main failed!", __FUNCTION__);
-    }
-
-    /* Encode the thumbnail image */
-    if (outputThumbnail) {
-        ret = encodeJpegYU12(thumbSize, yu12Thumb, thumbQuality, 0, 0, &thumbCode[0],
-                             maxThumbCodeSize, thumbCodeSize);
+                utils->setFromMetadata(meta, jpegSize.width, jpegSize.height);
+                utils->setMake(mExifMake);
+                utils->setModel(mExifModel);
 
-        if (ret != 0) {
-            return lfail("%s: thumbnail encodeJpegYU12 failed with %d", __FUNCTION__, ret);
+                if (!utils->generateApp1(outputThumbnail ? &thumbCode[0] : nullptr,
+                                         thumbCodeSize)) {
+                    ALOGE("%s: generating APP1 failed", __FUNCTION__);
+                    return nullptr;
+                }
+                return utils;
+            });
+    std::unique_ptr<ExifUtils> exifUtils;
+    auto getApp1 = [&](const uint8_t** app1, size_t* app1Size) {
+        exifUtils = app1Future.get();
+        if (exifUtils == nullptr) {
+            return false;
         }
-    }
-
-    /* Combine camera characteristics with request settings to form EXIF
-     * metadata */
-    common::V1_0::helper::CameraMetadata meta(mCameraCharacteristics);
-    meta.append(setting);
-
-    /* Generate EXIF object */
-    std::unique_ptr<ExifUtils> utils(ExifUtils::create());
-    /* Make sure it's initialized */
-    utils->initialize();
-
-    utils->setFromMetadata(meta, jpegSize.width, jpegSize.height);
-    utils->setMake(mExifMake);
-    utils->setModel(mExifModel);
-
-    ret = utils->generateApp1(outputThumbnail ? &thumbCode[0] : nullptr, thumbCodeSize);
+        /* Get internal buffer */
+        *app1 = exifUtils->getApp1Buffer();
+        *app1Size = exifUtils->getApp1Length();
+        return true;
+    };
 
-    if (!ret) {
-        return lfail("%s: generating APP1 failed", __FUNCTION__);
+    /* Scale and crop main jpeg */
+    {
+        std::lock_guard<std::mutex> lk(ctx.mScaleLock);
+        ret = cropAndScaleLocked(ctx, jpegSize, &yu12Main);
     }
 
-    /* Get internal buffer */
-    size_t exifDataSize = utils->getApp1Length();
-    const uint8_t* exifData = utils->getApp1Buffer();
+    if (ret != 0) {
+        return lfail("%s: crop and scale main failed!", __FUNCTION__);
+    }
 
     /* Lock the HAL jpeg code buffer */
     void* bufPtr = sHandleImporter.lock(*(halBuf.bufPtr), static_cast<uint64_t>(halBuf.usage),
@@ -2679,9 +3023,10 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
         return lfail("%s: could not lock %zu bytes", __FUNCTION__, maxJpegCodeSize);
     }
 
-    /* Encode the main jpeg image */
-    ret = encodeJpegYU12(jpegSize, yu12Main, jpegQuality, exifData, exifDataSize, bufPtr,
-                         maxJpegCodeSize, jpegCodeSize);
+    /* Encode the main jpeg image, in strips on several threads for large images */
+    size_t jpegCodeSize = 0;
+    ret = encodeJpegYU12(jpegSize, yu12Main, jpegQuality, getApp1, bufPtr, maxJpegCodeSize,
+                         getJpegStripCount(jpegSize.width, jpegSize.height), jpegCodeSize);
 
     /* TODO: Not sure this belongs here, maybe better to pass jpegCodeSize out
      * and do this when returning buffer to parent */
@@ -2707,13 +3052,354 @@ int ExternalCameraDeviceSession::OutputThread::createJpegLocked(
     return 0;
 }
 
+int ExternalCameraDeviceSession::OutputThread::processOutputBuffer(FrameContext& ctx,
+                                                                   const HalRequest& req,
+                                                                   HalStreamBuffer& halBuf) {
+    // Gralloc lockYCbCr the buffer
+    switch (halBuf.format) {
+        case PixelFormat::BLOB: {
+            nsecs_t startTs = systemTime(SYSTEM_TIME_MONOTONIC);
+            int ret = createJpeg(ctx, halBuf, *req.setting);
+            if (ret != 0) {
+                ALOGE("%s: createJpeg failed with %d", __FUNCTION__, ret);
+                return ret;
+            }
+            recordStage(&mJpegStats, startTs);
+        } break;
+        case PixelFormat::Y16: {
+            uint8_t* inData;
+            size_t inDataSize;
+            if (req.frameIn->getData(&inData, &inDataSize) != 0) {
+                ALOGE("%s: V4L2 buffer map failed", __FUNCTION__);
+                return -1;
+            }
+
+            void* outLayout = sHandleImporter.lock(
+                    *(halBuf.bufPtr), static_cast<uint64_t>(halBuf.usage), inDataSize);
+
+            std::memcpy(outLayout, inData, inDataSize);
+
+            int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
+            if (relFence >= 0) {
+                halBuf.acquireFence = relFence;
+            }
+        } break;
+        case PixelFormat::YCBCR_420_888:
+        case PixelFormat::YV12: {
+            nsecs_t startTs = systemTime(SYSTEM_TIME_MONOTONIC);
+            android::Rect outRect{0, 0, static_cast<int32_t>(halBuf.width),
+                                  static_cast<int32_t>(halBuf.height)};
+            android_ycbcr result = sHandleImporter.lockYCbCr(
+                    *(halBuf.bufPtr), static_cast<uint64_t>(halBuf.usage), outRect);
+            ALOGV("%s: outLayout y %p cb %p cr %p y_str %zu c_str %zu c_step %zu", __FUNCTION__,
+                  result.y, result.cb, result.cr, result.ystride, result.cstride,
+                  result.chroma_step);
+            if (result.ystride > UINT32_MAX || result.cstride > UINT32_MAX ||
+                result.chroma_step > UINT32_MAX) {
+                ALOGE("%s: lockYCbCr failed. Unexpected values!", __FUNCTION__);
+                return -1;
+            }
+            YCbCrLayout outLayout = {.y = result.y,
+                                     .cb = result.cb,
+                                     .cr = result.cr,
+                                     .yStride = static_cast<uint32_t>(result.ystride),
+                                     .cStride = static_cast<uint32_t>(result.cstride),
+                                     .chromaStep = static_cast<uint32_t>(result.chroma_step)};
+
+            // Convert to output buffer size/format
+            uint32_t outputFourcc = getFourCcFromLayout(outLayout);
+            ALOGV("%s: converting to format %c%c%c%c", __FUNCTION__, outputFourcc & 0xFF,
+                  (outputFourcc >> 8) & 0xFF, (outputFourcc >> 16) & 0xFF,
+                  (outputFourcc >> 24) & 0xFF);
+
+            YCbCrLayout cropAndScaled;
+            int ret;
+            {
+                // Streams of the same size share the scaled frame, so only scale once
+                std::lock_guard<std::mutex> lk(ctx.mScaleLock);
+                ATRACE_BEGIN("cropAndScaleLocked");
+                ret = cropAndScaleLocked(ctx, Size{halBuf.width, halBuf.height}, &cropAndScaled);
+                ATRACE_END();
+            }
+            if (ret != 0) {
+                ALOGE("%s: crop and scale failed!", __FUNCTION__);
+                return ret;
+            }
+
+            Size sz{halBuf.width, halBuf.height};
+            ATRACE_BEGIN("formatConvert");
+            ret = formatConvert(cropAndScaled, outLayout, sz, outputFourcc);
+            ATRACE_END();
+            if (ret != 0) {
+                ALOGE("%s: format conversion failed!", __FUNCTION__);
+                return ret;
+            }
+            int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
+            if (relFence >= 0) {
+                halBuf.acquireFence = relFence;
+            }
+            recordStage(&mConvertStats, startTs);
+        } break;
+        default:
+            ALOGE("%s: unknown output format %x", __FUNCTION__, halBuf.format);
+            return -1;
+    }
+    return 0;
+}
+
+int ExternalCameraDeviceSession::OutputThread::decodeFrameLocked(FrameContext& ctx,
+                                                                 uint32_t fourcc,
+                                                                 const uint8_t* inData,
+                                                                 size_t inDataSize) {
+    ATRACE_BEGIN("decodeToYU12");
+    nsecs_t startTs = systemTime(SYSTEM_TIME_MONOTONIC);
+    int res = 0;
+    if (mCameraMuted) {
+        res = libyuv::ConvertToI420(
+                mMuteTestPatternFrame.data(), mMuteTestPatternFrame.size(),
+                static_cast<uint8_t*>(ctx.mYu12FrameLayout.y), ctx.mYu12FrameLayout.yStride,
+                static_cast<uint8_t*>(ctx.mYu12FrameLayout.cb), ctx.mYu12FrameLayout.cStride,
+                static_cast<uint8_t*>(ctx.mYu12FrameLayout.cr), ctx.mYu12FrameLayout.cStride, 0,
+                0, ctx.mYu12Frame->mWidth, ctx.mYu12Frame->mHeight, ctx.mYu12Frame->mWidth,
+                ctx.mYu12Frame->mHeight, libyuv::kRotate0, libyuv::FOURCC_RAW);
+    } else {
+        Size sz{ctx.mYu12Frame->mWidth, ctx.mYu12Frame->mHeight};
+        res = decodeToYU12(fourcc, inData, inDataSize, sz, ctx.mYu12FrameLayout);
+    }
+    ATRACE_END();
+    if (res == 0) {
+        recordDecode(fourcc, startTs);
+    }
+    return res;
+}
+
+bool ExternalCameraDeviceSession::OutputThread::canDecodeToOutput(const HalRequest& req) {
+    if (req.buffers.size() != 1) {
+        return false;
+    }
+    const HalStreamBuffer& halBuf = req.buffers[0];
+    if (halBuf.format != PixelFormat::YCBCR_420_888 && halBuf.format != PixelFormat::YV12) {
+        return false;
+    }
+    return halBuf.width == req.frameIn->mWidth && halBuf.height == req.frameIn->mHeight;
+}
+
+int ExternalCameraDeviceSession::OutputThread::decodeToOutputBuffer(HalStreamBuffer& halBuf,
+                                                                    uint32_t fourcc,
+                                                                    const uint8_t* inData,
+                                                                    size_t inDataSize) {
+    nsecs_t startTs = systemTime(SYSTEM_TIME_MONOTONIC);
+    android::Rect outRect{0, 0, static_cast<int32_t>(halBuf.width),
+                          static_cast<int32_t>(halBuf.height)};
+    android_ycbcr result = sHandleImporter.lockYCbCr(
+            *(halBuf.bufPtr), static_cast<uint64_t>(halBuf.usage), outRect);
+    int ret = 0;
+    if (result.ystride > UINT32_MAX || result.cstride > UINT32_MAX ||
+        result.chroma_step > UINT32_MAX) {
+        ALOGE("%s: lockYCbCr failed. Unexpected values!", __FUNCTION__);
+        ret = -EINVAL;
+    } else {
+        YCbCrLayout outLayout = {.y = result.y,
+                                 .cb = result.cb,
+                                 .cr = result.cr,
+                                 .yStride = static_cast<uint32_t>(result.ystride),
+                                 .cStride = static_cast<uint32_t>(result.cstride),
+                                 .chromaStep = static_cast<uint32_t>(result.chroma_step)};
+        ATRACE_BEGIN("decodeToOutput");
+        ret = decodeToLayout(fourcc, inData, inDataSize, Size{halBuf.width, halBuf.height},
+                             outLayout);
+        ATRACE_END();
+    }
+
+    int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
+    if (ret == -ENOTSUP) {
+        // The buffer will be locked again by the regular path
+        if (relFence >= 0) {
+            sync_wait(relFence, -1);
+            ::close(relFence);
+        }
+        return ret;
+    }
+    if (relFence >= 0) {
+        halBuf.acquireFence = relFence;
+    }
+    if (ret == 0) {
+        recordDecode(fourcc, startTs);
+    }
+    return ret;
+}
+
 void ExternalCameraDeviceSession::OutputThread::clearIntermediateBuffers() {
     std::lock_guard<std::mutex> lk(mBufferLock);
-    mYu12Frame.reset();
-    mYu12ThumbFrame.reset();
-    mIntermediateBuffers.clear();
+    mFrameContexts.clear();
     mMuteTestPatternFrame.clear();
     mBlobBufferSize = 0;
+    std::lock_guard<std::mutex> pipelineLk(mPipelineLock);
+    mFreeFrameContexts.clear();
+}
+
+ExternalCameraDeviceSession::OutputThread::FrameContext*
+ExternalCameraDeviceSession::OutputThread::acquireFrameContext() {
+    std::unique_lock<std::mutex> lk(mPipelineLock);
+    auto timeout = std::chrono::seconds(kFlushWaitTimeoutSec);
+    if (!mPipelineCond.wait_for(lk, timeout, [this] { return !mFreeFrameContexts.empty(); })) {
+        return nullptr;
+    }
+    FrameContext* ctx = mFreeFrameContexts.back();
+    mFreeFrameContexts.pop_back();
+    return ctx;
+}
+
+void ExternalCameraDeviceSession::OutputThread::submitToPipeline(
+        const std::shared_ptr<InflightRequest>& inflight) {
+    std::vector<size_t> jobs;
+    if (inflight->mResult == InflightRequest::Result::OK && !inflight->mDecodedToOutput) {
+        for (size_t i = 0; i < inflight->mRequest->buffers.size(); i++) {
+            if (!inflight->mRequest->buffers[i].fenceTimeout) {
+                jobs.push_back(i);
+            }
+        }
+    }
+
+    std::unique_lock<std::mutex> lk(mPipelineLock);
+    mInflightRequests.push_back(inflight);
+    inflight->mPendingJobs = jobs.size();
+    bool runInline = mWorkers.empty();
+    if (!runInline) {
+        for (size_t i : jobs) {
+            mPipelineJobs.push_back(PipelineJob{inflight, i});
+        }
+    }
+    lk.unlock();
+
+    if (jobs.empty()) {
+        deliverCompletedRequests();
+    } else if (runInline) {
+        // No worker thread, process the output buffers on this thread.
+        HalRequest& req = *inflight->mRequest;
+        for (size_t i : jobs) {
+            completeJob(inflight, processOutputBuffer(*inflight->mContext, req, req.buffers[i]));
+        }
+    } else {
+        mJobCond.notify_all();
+    }
+}
+
+void ExternalCameraDeviceSession::OutputThread::completeJob(
+        const std::shared_ptr<InflightRequest>& inflight, int ret) {
+    {
+        std::lock_guard<std::mutex> lk(mPipelineLock);
+        if (ret != 0) {
+            inflight->mResult = InflightRequest::Result::DEVICE_ERROR;
+        }
+        inflight->mPendingJobs--;
+    }
+    deliverCompletedRequests();
+}
+
+void ExternalCameraDeviceSession::OutputThread::deliverCompletedRequests() {
+    std::lock_guard<std::mutex> deliveryLk(mDeliveryLock);
+    auto parent = mParent.lock();
+    while (true) {
+        std::shared_ptr<InflightRequest> inflight;
+        {
+            std::lock_guard<std::mutex> lk(mPipelineLock);
+            if (mInflightRequests.empty() || mInflightRequests.front()->mPendingJobs > 0) {
+                break;
+            }
+            inflight = mInflightRequests.front();
+        }
+
+        std::shared_ptr<HalRequest>& req = inflight->mRequest;
+        bool failed = false;
+        if (parent == nullptr) {
+            ALOGE("%s: session has been disconnected!", __FUNCTION__);
+        } else if (inflight->mResult == InflightRequest::Result::OK) {
+            if (parent->processCaptureResult(req) != Status::OK) {
+                ALOGE("%s: failed to process capture result!", __FUNCTION__);
+                failed = true;
+            }
+        } else if (inflight->mResult == InflightRequest::Result::REQUEST_ERROR) {
+            if (parent->processCaptureRequestError(req) != Status::OK) {
+                ALOGE("%s: failed to process capture request error!", __FUNCTION__);
+                failed = true;
+            }
+        } else {
+            failed = true;
+        }
+        if (failed && parent != nullptr) {
+            parent->notifyError(req->frameNumber, /*stream*/ -1, ErrorCode::ERROR_DEVICE);
+        }
+        recordStage(&mResultLatencyStats, inflight->mStartTs);
+        if (!failed && inflight->mResult == InflightRequest::Result::OK) {
+            recordStage(&mShutterLatencyStats, req->shutterTs);
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(mPipelineLock);
+            mInflightRequests.pop_front();
+            inflight->mContext->mScaledYu12Frames.clear();
+            mFreeFrameContexts.push_back(inflight->mContext);
+            mPipelineFailed |= failed;
+        }
+        mPipelineCond.notify_all();
+    }
+}
+
+bool ExternalCameraDeviceSession::OutputThread::waitForPipelineIdle() {
+    std::unique_lock<std::mutex> lk(mPipelineLock);
+    auto timeout = std::chrono::seconds(kFlushWaitTimeoutSec);
+    return mPipelineCond.wait_for(lk, timeout, [this] { return mInflightRequests.empty(); });
+}
+
+void ExternalCameraDeviceSession::OutputThread::startWorkersLocked(size_t numWorkers) {
+    while (mWorkers.size() < numWorkers) {
+        mWorkers.emplace_back(&OutputThread::workerLoop, this);
+    }
+}
+
+void ExternalCameraDeviceSession::OutputThread::stopWorkers() {
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lk(mPipelineLock);
+        mWorkersExit = true;
+        workers = std::move(mWorkers);
+        mWorkers.clear();
+    }
+    mJobCond.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ExternalCameraDeviceSession::OutputThread::workerLoop() {
+    while (true) {
+        PipelineJob job;
+        {
+            std::unique_lock<std::mutex> lk(mPipelineLock);
+            mJobCond.wait(lk, [this] { return mWorkersExit || !mPipelineJobs.empty(); });
+            if (mPipelineJobs.empty()) {
+                return;
+            }
+            job = std::move(mPipelineJobs.front());
+            mPipelineJobs.pop_front();
+        }
+        HalRequest& req = *job.mInflight->mRequest;
+        int ret = processOutputBuffer(*job.mInflight->mContext, req, req.buffers[job.mBufferIndex]);
+        completeJob(job.mInflight, ret);
+    }
+}
+
+void ExternalCameraDeviceSession::OutputThread::recordStage(StageStats* stats, nsecs_t startTs) {
+    nsecs_t duration = systemTime(SYSTEM_TIME_MONOTONIC) - startTs;
+    std::lock_guard<std::mutex> lk(mStatsLock);
+    stats->add(duration);
+}
+
+void ExternalCameraDeviceSession::OutputThread::recordDecode(uint32_t fourcc, nsecs_t startTs) {
+    nsecs_t duration = systemTime(SYSTEM_TIME_MONOTONIC) - startTs;
+    std::lock_guard<std::mutex> lk(mStatsLock);
+    mDecodeStats[fourcc].add(duration);
 }
 
 bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
@@ -2724,9 +3410,14 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         return false;
     }
 
-    // TODO: maybe we need to setup a sensor thread to dq/enq v4l frames
-    //       regularly to prevent v4l buffer queue filled with stale buffers
-    //       when app doesn't program a preview request
+    {
+        std::lock_guard<std::mutex> lk(mPipelineLock);
+        if (mPipelineFailed) {
+            ALOGE("%s: output pipeline failed, stopping", __FUNCTION__);
+            return false;
+        }
+    }
+
     waitForNextRequest(&req);
     if (req == nullptr) {
         // No new request, wait again
@@ -2740,7 +3431,9 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         return false;
     };
 
-    if (req->frameIn->mFourcc != V4L2_PIX_FMT_MJPEG && req->frameIn->mFourcc != V4L2_PIX_FMT_Z16) {
+    uint32_t fourcc = req->frameIn->mFourcc;
+    bool isColor = fourcc == V4L2_PIX_FMT_MJPEG || isUncompressedColorFourcc(fourcc);
+    if (!isColor && fourcc != V4L2_PIX_FMT_Z16) {
         return onDeviceError("%s: do not support V4L2 format %c%c%c%c", __FUNCTION__,
                              req->frameIn->mFourcc & 0xFF, (req->frameIn->mFourcc >> 8) & 0xFF,
                              (req->frameIn->mFourcc >> 16) & 0xFF,
@@ -2753,6 +3446,17 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         return onDeviceError("%s: failed to send buffer request!", __FUNCTION__);
     }
 
+    // Bound the number of frames in the pipeline
+    std::shared_ptr<InflightRequest> inflight = std::make_shared<InflightRequest>();
+    inflight->mRequest = req;
+    inflight->mStartTs = systemTime(SYSTEM_TIME_MONOTONIC);
+    inflight->mContext = acquireFrameContext();
+    if (inflight->mContext == nullptr) {
+        waitForBufferRequestDone(&req->buffers);
+        return onDeviceError("%s: wait for output pipeline timeout!", __FUNCTION__);
+    }
+    FrameContext& ctx = *inflight->mContext;
+
     std::unique_lock<std::mutex> lk(mBufferLock);
     // Convert input V4L2 frame to YU12 of the same size
     // TODO: see if we can save some computation by converting to YV12 here
@@ -2764,13 +3468,13 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
     }
 
     // Process camera mute state
-    auto testPatternMode = req->setting.find(ANDROID_SENSOR_TEST_PATTERN_MODE);
+    auto testPatternMode = req->setting->find(ANDROID_SENSOR_TEST_PATTERN_MODE);
     if (testPatternMode.count == 1) {
         if (mCameraMuted != (testPatternMode.data.u8[0] != ANDROID_SENSOR_TEST_PATTERN_MODE_OFF)) {
             mCameraMuted = !mCameraMuted;
             // Get solid color for test pattern, if any was set
             if (testPatternMode.data.u8[0] == ANDROID_SENSOR_TEST_PATTERN_MODE_SOLID_COLOR) {
-                auto entry = req->setting.find(ANDROID_SENSOR_TEST_PATTERN_DATA);
+                auto entry = req->setting->find(ANDROID_SENSOR_TEST_PATTERN_DATA);
                 if (entry.count == 4) {
                     // Update the mute frame if the pattern color has changed
                     if (memcmp(entry.data.i32, mTestPatternData, sizeof(mTestPatternData)) != 0) {
@@ -2787,28 +3491,11 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
         }
     }
 
-    // TODO: in some special case maybe we can decode jpg directly to gralloc output?
-    if (req->frameIn->mFourcc == V4L2_PIX_FMT_MJPEG) {
-        ATRACE_BEGIN("MJPGtoI420");
-        res = 0;
-        if (mCameraMuted) {
-            res = libyuv::ConvertToI420(
-                    mMuteTestPatternFrame.data(), mMuteTestPatternFrame.size(),
-                    static_cast<uint8_t*>(mYu12FrameLayout.y), mYu12FrameLayout.yStride,
-                    static_cast<uint8_t*>(mYu12FrameLayout.cb), mYu12FrameLayout.cStride,
-                    static_cast<uint8_t*>(mYu12FrameLayout.cr), mYu12FrameLayout.cStride, 0, 0,
-                    mYu12Frame->mWidth, mYu12Frame->mHeight, mYu12Frame->mWidth,
-                    mYu12Frame->mHeight, libyuv::kRotate0, libyuv::FOURCC_RAW);
-        } else {
-            res = libyuv::MJPGToI420(
-                    inData, inDataSize, static_cast<uint8_t*>(mYu12FrameLayout.y),
-                    mYu12FrameLayout.yStride, static_cast<uint8_t*>(mYu12FrameLayout.cb),
-                    mYu12FrameLayout.cStride, static_cast<uint8_t*>(mYu12FrameLayout.cr),
-                    mYu12FrameLayout.cStride, mYu12Frame->mWidth, mYu12Frame->mHeight,
-                    mYu12Frame->mWidth, mYu12Frame->mHeight);
-        }
-        ATRACE_END();
-
+    // A request with a single YUV output of the V4L2 frame size is decoded straight into the
+    // output buffer once it is available, skipping the intermediate frame and the copy out of it.
+    bool decodeToOutput = isColor && !mCameraMuted && canDecodeToOutput(*req);
+    if (isColor && !decodeToOutput) {
+        res = decodeFrameLocked(ctx, fourcc, inData, inDataSize);
         if (res != 0) {
             // For some webcam, the first few V4L2 frames might be malformed...
             ALOGE("%s: Convert V4L2 frame to YU12 failed! res %d", __FUNCTION__, res);
@@ -2818,14 +3505,16 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
             ATRACE_END();
 
             lk.unlock();
-            Status st = parent->processCaptureRequestError(req);
-            if (st != Status::OK) {
-                return onDeviceError("%s: failed to process capture request error!", __FUNCTION__);
-            }
+            // Return the error in request order
+            inflight->mResult = InflightRequest::Result::REQUEST_ERROR;
+            submitToPipeline(inflight);
             signalRequestDone();
             return true;
         }
+        // Outputs are made from the intermediate YU12 frame
+        parent->releaseInputFrame(req);
     }
+    lk.unlock();
 
     ATRACE_BEGIN("Wait for BufferRequest done");
     res = waitForBufferRequestDone(&req->buffers);
@@ -2834,11 +3523,8 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
     if (res != 0) {
         // HAL buffer management buffer request can fail
         ALOGE("%s: wait for BufferRequest done failed! res %d", __FUNCTION__, res);
-        lk.unlock();
-        Status st = parent->processCaptureRequestError(req);
-        if (st != Status::OK) {
-            return onDeviceError("%s: failed to process capture request error!", __FUNCTION__);
-        }
+        inflight->mResult = InflightRequest::Result::REQUEST_ERROR;
+        submitToPipeline(inflight);
         signalRequestDone();
         return true;
     }
@@ -2858,94 +3544,33 @@ bool ExternalCameraDeviceSession::OutputThread::threadLoop() {
                 halBuf.acquireFence = -1;
             }
         }
+    }
 
-        if (halBuf.fenceTimeout) {
-            continue;
+    if (decodeToOutput && !req->buffers[0].fenceTimeout) {
+        res = decodeToOutputBuffer(req->buffers[0], fourcc, inData, inDataSize);
+        if (res == -ENOTSUP) {
+            // The output layout needs a conversion pass, go through the intermediate frame
+            lk.lock();
+            res = decodeFrameLocked(ctx, fourcc, inData, inDataSize);
+            lk.unlock();
+        } else if (res == 0) {
+            inflight->mDecodedToOutput = true;
         }
-
-        // Gralloc lockYCbCr the buffer
-        switch (halBuf.format) {
-            case PixelFormat::BLOB: {
-                int ret = createJpegLocked(halBuf, req->setting);
-
-                if (ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: createJpegLocked failed with %d", __FUNCTION__, ret);
-                }
-            } break;
-            case PixelFormat::Y16: {
-                void* outLayout = sHandleImporter.lock(
-                        *(halBuf.bufPtr), static_cast<uint64_t>(halBuf.usage), inDataSize);
-
-                std::memcpy(outLayout, inData, inDataSize);
-
-                int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
-                if (relFence >= 0) {
-                    halBuf.acquireFence = relFence;
-                }
-            } break;
-            case PixelFormat::YCBCR_420_888:
-            case PixelFormat::YV12: {
-                android::Rect outRect{0, 0, static_cast<int32_t>(halBuf.width),
-                                      static_cast<int32_t>(halBuf.height)};
-                android_ycbcr result = sHandleImporter.lockYCbCr(
-                        *(halBuf.bufPtr), static_cast<uint64_t>(halBuf.usage), outRect);
-                ALOGV("%s: outLayout y %p cb %p cr %p y_str %zu c_str %zu c_step %zu", __FUNCTION__,
-                      result.y, result.cb, result.cr, result.ystride, result.cstride,
-                      result.chroma_step);
-                if (result.ystride > UINT32_MAX || result.cstride > UINT32_MAX ||
-                    result.chroma_step > UINT32_MAX) {
-                    return onDeviceError("%s: lockYCbCr failed. Unexpected values!", __FUNCTION__);
-                }
-                YCbCrLayout outLayout = {.y = result.y,
-                                         .cb = result.cb,
-                                         .cr = result.cr,
-                                         .yStride = static_cast<uint32_t>(result.ystride),
-                                         .cStride = static_cast<uint32_t>(result.cstride),
-                                         .chromaStep = static_cast<uint32_t>(result.chroma_step)};
-
-                // Convert to output buffer size/format
-                uint32_t outputFourcc = getFourCcFromLayout(outLayout);
-                ALOGV("%s: converting to format %c%c%c%c", __FUNCTION__, outputFourcc & 0xFF,
-                      (outputFourcc >> 8) & 0xFF, (outputFourcc >> 16) & 0xFF,
-                      (outputFourcc >> 24) & 0xFF);
-
-                YCbCrLayout cropAndScaled;
-                ATRACE_BEGIN("cropAndScaleLocked");
-                int ret = cropAndScaleLocked(mYu12Frame, Size{halBuf.width, halBuf.height},
-                                             &cropAndScaled);
-                ATRACE_END();
-                if (ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: crop and scale failed!", __FUNCTION__);
-                }
-
-                Size sz{halBuf.width, halBuf.height};
-                ATRACE_BEGIN("formatConvert");
-                ret = formatConvert(cropAndScaled, outLayout, sz, outputFourcc);
-                ATRACE_END();
-                if (ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: format conversion failed!", __FUNCTION__);
-                }
-                int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
-                if (relFence >= 0) {
-                    halBuf.acquireFence = relFence;
-                }
-            } break;
-            default:
-                lk.unlock();
-                return onDeviceError("%s: unknown output format %x", __FUNCTION__, halBuf.format);
+        if (res == 0) {
+            parent->releaseInputFrame(req);
+        }
+        if (res != 0) {
+            ALOGE("%s: Convert V4L2 frame to output buffer failed! res %d", __FUNCTION__, res);
+            inflight->mResult = InflightRequest::Result::REQUEST_ERROR;
+            submitToPipeline(inflight);
+            signalRequestDone();
+            return true;
         }
-    }  // for each buffer
-    mScaledYu12Frames.clear();
-
-    // Don't hold the lock while calling back to parent
-    lk.unlock();
-    Status st = parent->processCaptureResult(req);
-    if (st != Status::OK) {
-        return onDeviceError("%s: failed to process capture result!", __FUNCTION__);
     }
+
+    // Output buffers are processed by the workers, results are delivered by whoever
+    // completes the oldest request in the pipeline.
+    submitToPipeline(inflight);
     signalRequestDone();
     return true;
 }
@@ -28,9 +28,12 @@
 #include <android/hardware/graphics/mapper/3.0/IMapper.h>
 #include <android/hardware/graphics/mapper/4.0/IMapper.h>
 #include <fmq/AidlMessageQueue.h>
+#include <linux/videodev2.h>
 #include <utils/Thread.h>
 #include <deque>
 #include <list>
+#include <map>
+#include <thread>
 
 namespace android {
 namespace hardware {
@@ -68,7 +71,8 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
                                 const std::vector<SupportedV4L2Format>& sortedFormats,
                                 const CroppingType& croppingType,
                                 const common::V1_0::helper::CameraMetadata& chars,
-                                const std::string& cameraId, unique_fd v4l2Fd);
+                                const std::string& cameraId,
+                                std::unique_ptr<V4l2Device> v4l2Device);
     ~ExternalCameraDeviceSession() override;
 
     // Caller must use this method to check if CameraDeviceSession ctor failed
@@ -105,6 +109,8 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
 
     void notifyError(int32_t frameNumber, int32_t streamId, ErrorCode ec) override;
 
+    void releaseInputFrame(const std::shared_ptr<HalRequest>& req) override;
+
     Status processCaptureRequestError(const std::shared_ptr<HalRequest>& ptr,
                                       std::vector<NotifyMsg>* msgs,
                                       std::vector<CaptureResult>* results) override;
@@ -161,6 +167,21 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
         std::condition_variable mRequestDoneCond;  // signaled when a request is done
     };
 
+    // Keeps the V4L2 queue flowing while streaming. Only the newest frame is kept for the next
+    // capture request, older frames are returned to the driver right away.
+    class SensorThread : public SimpleThread {
+      public:
+        explicit SensorThread(ExternalCameraDeviceSession* parent);
+
+        bool threadLoop() override;
+
+      private:
+        static const int kPollTimeoutMs = 100;
+
+        // The session joins this thread in close(), before the V4L2 fd is released
+        ExternalCameraDeviceSession* const mParent;
+    };
+
     class OutputThread : public SimpleThread {
       public:
         OutputThread(std::weak_ptr<OutputThreadInterface> parent, CroppingType,
@@ -168,9 +189,12 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
                      std::shared_ptr<BufferRequestThread> bufReqThread);
         ~OutputThread();
 
+        // numFrames is the number of frames processed concurrently. When it is more than 1,
+        // output buffers are processed by a pool of worker threads.
         Status allocateIntermediateBuffers(const Size& v4lSize, const Size& thumbSize,
                                            const std::vector<Stream>& streams,
-                                           uint32_t blobBufferSize);
+                                           uint32_t blobBufferSize,
+                                           size_t numFrames = kMaxInflightFrames);
         Status submitRequest(const std::shared_ptr<HalRequest>&);
         void flush();
         void dump(int fd);
@@ -181,11 +205,64 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
         // The remaining request list is returned for offline processing
         std::list<std::shared_ptr<HalRequest>> switchToOffline();
 
+        static const size_t kMaxInflightFrames = 3;
+        static const size_t kMaxPipelineWorkers = 4;
+
       protected:
         static const int kFlushWaitTimeoutSec = 3;  // 3 sec
         static const int kReqWaitTimeoutMs = 33;    // 33ms
         static const int kReqWaitTimesMax = 90;     // 33ms * 90 ~= 3 sec
 
+        // Intermediate buffers of one frame in the output pipeline
+        // V4L2 frameIn
+        // (MJPG decode)-> mYu12Frame
+        // (Scale)-> mScaledYu12Frames
+        // (Format convert) -> output gralloc frames
+        struct FrameContext {
+            std::shared_ptr<AllocatedFrame> mYu12Frame;
+            std::shared_ptr<AllocatedFrame> mYu12ThumbFrame;
+            std::unordered_map<Size, std::shared_ptr<AllocatedFrame>, SizeHasher>
+                    mIntermediateBuffers;
+            // Crops of mYu12Frame already scaled for this frame, in mIntermediateBuffers or
+            // mYu12ThumbFrame. Output streams and the JPEG thumbnail asking for the same crop
+            // and size reuse them instead of scaling again. Cleared when the frame is done.
+            std::unordered_map<ScaleKey, YCbCrLayout, ScaleKeyHasher> mScaledYu12Frames;
+            YCbCrLayout mYu12FrameLayout;
+            YCbCrLayout mYu12ThumbFrameLayout;
+            // Output buffers of a frame are processed concurrently. Protects mScaledYu12Frames
+            // and the scaling into mIntermediateBuffers.
+            std::mutex mScaleLock;
+        };
+
+        // A request in the output pipeline. Requests leave the pipeline in the order they
+        // entered it.
+        struct InflightRequest {
+            enum class Result { OK, REQUEST_ERROR, DEVICE_ERROR };
+
+            std::shared_ptr<HalRequest> mRequest;
+            FrameContext* mContext = nullptr;
+            size_t mPendingJobs = 0;  // protected by mPipelineLock
+            Result mResult = Result::OK;
+            nsecs_t mStartTs = 0;
+            // The only output buffer was decoded into directly by threadLoop
+            bool mDecodedToOutput = false;
+        };
+
+        // Processing of one output buffer of a request
+        struct PipelineJob {
+            std::shared_ptr<InflightRequest> mInflight;
+            size_t mBufferIndex;
+        };
+
+        struct StageStats {
+            uint64_t mCount = 0;
+            nsecs_t mTotalNs = 0;
+            nsecs_t mMaxNs = 0;
+
+            void add(nsecs_t durationNs);
+            void dump(int fd, const char* name) const;
+        };
+
         // Methods to request output buffer in parallel
         int requestBufferStart(const std::vector<HalStreamBuffer>&);
         int waitForBufferRequestDone(
@@ -194,17 +271,49 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
         void waitForNextRequest(std::shared_ptr<HalRequest>* out);
         void signalRequestDone();
 
-        int cropAndScaleLocked(std::shared_ptr<AllocatedFrame>& in, const Size& outSize,
-                               YCbCrLayout* out);
+        // Must be called with ctx.mScaleLock held
+        int cropAndScaleLocked(FrameContext& ctx, const Size& outSize, YCbCrLayout* out);
+
+        // Takes ctx.mScaleLock to share the scaled thumbnail through ctx.mScaledYu12Frames
+        int cropAndScaleThumb(FrameContext& ctx, const Size& outSize, YCbCrLayout* out);
 
-        int cropAndScaleThumbLocked(std::shared_ptr<AllocatedFrame>& in, const Size& outSize,
-                                    YCbCrLayout* out);
+        int createJpeg(FrameContext& ctx, HalStreamBuffer& halBuf,
+                       const common::V1_0::helper::CameraMetadata& settings);
 
-        int createJpegLocked(HalStreamBuffer& halBuf,
-                             const common::V1_0::helper::CameraMetadata& settings);
+        // Writes the output buffer from the decoded frame in ctx. Returns non-zero on
+        // device error.
+        int processOutputBuffer(FrameContext& ctx, const HalRequest& req,
+                                HalStreamBuffer& halBuf);
+
+        // Decodes the V4L2 frame into the intermediate YU12 frame of ctx, or the mute test
+        // pattern if the camera is muted. Must be called with mBufferLock held.
+        int decodeFrameLocked(FrameContext& ctx, uint32_t fourcc, const uint8_t* inData,
+                              size_t inDataSize);
+
+        // True if the request has a single YUV output buffer of the V4L2 frame size, which
+        // can be decoded into without the intermediate YU12 frame.
+        static bool canDecodeToOutput(const HalRequest& req);
+
+        // Returns -ENOTSUP if the locked output layout can't be decoded into directly
+        int decodeToOutputBuffer(HalStreamBuffer& halBuf, uint32_t fourcc, const uint8_t* inData,
+                                 size_t inDataSize);
 
         void clearIntermediateBuffers();
 
+        // Output pipeline: threadLoop decodes the V4L2 frame, then worker threads process the
+        // output buffers. Results are delivered in request order.
+        FrameContext* acquireFrameContext();
+        void submitToPipeline(const std::shared_ptr<InflightRequest>& inflight);
+        void completeJob(const std::shared_ptr<InflightRequest>& inflight, int ret);
+        void deliverCompletedRequests();
+        bool waitForPipelineIdle();
+        void startWorkersLocked(size_t numWorkers);
+        void stopWorkers();
+        void workerLoop();
+        void recordStage(StageStats* stats, nsecs_t startTs);
+        // Decode timings are kept per V4L2 format to compare the MJPEG and uncompressed paths
+        void recordDecode(uint32_t fourcc, nsecs_t startTs);
+
         const std::weak_ptr<OutputThreadInterface> mParent;
         const CroppingType mCroppingType;
         const common::V1_0::helper::CameraMetadata mCameraCharacteristics;
@@ -217,17 +326,9 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
         bool mProcessingRequest = false;
         uint32_t mProcessingFrameNumber = 0;
 
-        // V4L2 frameIn
-        // (MJPG decode)-> mYu12Frame
-        // (Scale)-> mScaledYu12Frames
-        // (Format convert) -> output gralloc frames
-        mutable std::mutex mBufferLock;  // Protect access to intermediate buffers
-        std::shared_ptr<AllocatedFrame> mYu12Frame;
-        std::shared_ptr<AllocatedFrame> mYu12ThumbFrame;
-        std::unordered_map<Size, std::shared_ptr<AllocatedFrame>, SizeHasher> mIntermediateBuffers;
-        std::unordered_map<Size, std::shared_ptr<AllocatedFrame>, SizeHasher> mScaledYu12Frames;
-        YCbCrLayout mYu12FrameLayout;
-        YCbCrLayout mYu12ThumbFrameLayout;
+        // Protect access to intermediate buffers allocation and the decode stage
+        mutable std::mutex mBufferLock;
+        std::vector<std::unique_ptr<FrameContext>> mFrameContexts;
         std::vector<uint8_t> mMuteTestPatternFrame;
         uint32_t mTestPatternData[4] = {0, 0, 0, 0};
         bool mCameraMuted = false;
@@ -237,6 +338,27 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
         std::string mExifModel;
 
         const std::shared_ptr<BufferRequestThread> mBufferRequestThread;
+
+        mutable std::mutex mPipelineLock;  // Protect the pipeline states below
+        std::condition_variable mJobCond;       // signaled when a job is queued
+        std::condition_variable mPipelineCond;  // signaled when a request leaves the pipeline
+        std::deque<std::shared_ptr<InflightRequest>> mInflightRequests;  // in request order
+        std::deque<PipelineJob> mPipelineJobs;
+        std::vector<FrameContext*> mFreeFrameContexts;
+        std::vector<std::thread> mWorkers;
+        bool mWorkersExit = false;
+        bool mPipelineFailed = false;
+
+        std::mutex mDeliveryLock;  // Serialize result delivery to keep the request order
+
+        mutable std::mutex mStatsLock;  // Protect the stage statistics below
+        std::map<uint32_t, StageStats> mDecodeStats;  // keyed by V4L2 fourcc
+        StageStats mScaleStats;
+        uint64_t mScaleCacheHits = 0;
+        StageStats mConvertStats;
+        StageStats mJpegStats;
+        StageStats mResultLatencyStats;
+        StageStats mShutterLatencyStats;
     };
 
   private:
@@ -245,22 +367,40 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
     void initOutputThread();
     void closeOutputThread();
     void closeBufferRequestThread();
+    void closeSensorThread();
 
     void closeImpl();
     Status initStatus() const;
     status_t initDefaultRequests();
 
-    status_t fillCaptureResult(common::V1_0::helper::CameraMetadata& md, nsecs_t timestamp);
+    // Returns the result metadata of req, see ResultMetadataBuilder::build
+    const camera_metadata_t* fillCaptureResult(const HalRequest& req);
     int configureV4l2StreamLocked(const SupportedV4L2Format& fmt, double fps = 0.0);
     int v4l2StreamOffLocked();
 
     int setV4l2FpsLocked(double fps);
 
-    std::unique_ptr<V4L2Frame> dequeueV4l2FrameLocked(
-            /*out*/ nsecs_t* shutterTs);  // Called with mLock held
+    // Called by the sensor thread only
+    std::unique_ptr<V4L2Frame> dequeueV4l2Frame(/*out*/ nsecs_t* shutterTs);
+
+    // Waits for a frame newer than the last one handed out. Called with mLock held
+    std::unique_ptr<V4L2Frame> takeLatestV4l2Frame(/*out*/ nsecs_t* shutterTs);
 
+    // Queue the buffer back to V4L2. Does nothing if the frame was already released
     void enqueueV4l2Frame(const std::shared_ptr<V4L2Frame>&);
 
+    // V4L2 buffers are mapped once when streaming starts, through an exported DMA-BUF if
+    // configured, and unmapped when streaming stops. Called with mLock held
+    int mapV4l2BufferLocked(const v4l2_buffer& buffer);
+    void unmapV4l2BuffersLocked();
+    // DMA_BUF_IOCTL_SYNC around CPU reads of an exported buffer
+    void syncV4l2Buffer(uint32_t index, uint64_t flags);
+
+    // Let the sensor thread dequeue frames, or stop it and return the frame it holds.
+    // Called with mLock held
+    void startSensorLocked();
+    void stopSensorLocked();
+
     // Check if input Stream is one of supported stream setting on this device
     static bool isSupported(const Stream& stream,
                             const std::vector<SupportedV4L2Format>& supportedFormats,
@@ -276,7 +416,10 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
     Status processOneCaptureRequest(const CaptureRequest& request);
     void notifyShutter(int32_t frameNumber, nsecs_t shutterTs);
 
-    void invokeProcessCaptureResultCallback(std::vector<CaptureResult>& results, bool tryWriteFmq);
+    // If rawResult is not null, it is the metadata of results[0]. It is written to the result FMQ
+    // as is, and only converted into results[0].result when it doesn't fit.
+    void invokeProcessCaptureResultCallback(std::vector<CaptureResult>& results, bool tryWriteFmq,
+                                            const camera_metadata_t* rawResult = nullptr);
     Size getMaxJpegResolution() const;
 
     Size getMaxThumbResolution() const;
@@ -316,7 +459,7 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
 
     // Not protected by mLock, this is almost a const.
     // Setup in constructor, reset in close() after OutputThread is joined
-    unique_fd mV4l2Fd;
+    std::unique_ptr<V4l2Device> mV4l2Device;
 
     // device is closed either
     //    - closed by user
@@ -326,7 +469,7 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
     bool mInitialized = false;
     bool mInitFail = false;
     bool mFirstRequest = false;
-    common::V1_0::helper::CameraMetadata mLatestReqSetting;
+    std::shared_ptr<const common::V1_0::helper::CameraMetadata> mLatestReqSetting;
 
     bool mV4l2Streaming = false;
     SupportedV4L2Format mV4l2StreamingFmt;
@@ -339,6 +482,24 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
     size_t mNumDequeuedV4l2Buffers = 0;
     uint32_t mMaxV4L2BufferSize = 0;
 
+    // CPU mappings of the V4L2 buffers by buffer index, valid while streaming
+    struct V4l2BufferMapping {
+        uint8_t* data = nullptr;
+        size_t length = 0;
+        unique_fd dmaBuf;  // set when the buffer is exported as a DMA-BUF
+    };
+    std::vector<V4l2BufferMapping> mV4l2BufferMappings;
+
+    // Sensor thread states, also protected by mV4l2BufferLock
+    std::shared_ptr<SensorThread> mSensorThread;
+    std::condition_variable mSensorStateCond;    // signaled when the states below change
+    std::condition_variable mV4l2FrameAvailable;  // signaled when a new frame is dequeued
+    bool mSensorActive = false;
+    bool mSensorDequeuing = false;
+    std::unique_ptr<V4L2Frame> mLatestV4l2Frame;
+    nsecs_t mLatestShutterTs = 0;
+    uint64_t mNumDroppedV4l2Frames = 0;
+
     // Not protected by mLock (but might be used when mLock is locked)
     std::shared_ptr<OutputThread> mOutputThread;
 
@@ -356,6 +517,9 @@ class ExternalCameraDeviceSession : public BnCameraDeviceSession, public OutputT
     std::mutex mAfTriggerLock;  // protect mAfTrigger
     bool mAfTrigger = false;
 
+    std::mutex mResultMetadataLock;  // protect mResultMetadataBuilder
+    ResultMetadataBuilder mResultMetadataBuilder;
+
     uint32_t mBlobBufferSize = 0;
 
     static HandleImporter sHandleImporter;
@@ -66,6 +66,7 @@ ExternalCameraOfflineSession::ExternalCameraOfflineSession(
       mExifModel(exifModel),
       mBlobBufferSize(blobBufferSize),
       mAfTrigger(afTrigger),
+      mResultMetadataBuilder(chars),
       mOfflineStreams(offlineStreams),
       mOfflineReqs(offlineReqs),
       mCirculatingBuffers(circulatingBuffers) {}
@@ -126,34 +127,26 @@ Status ExternalCameraOfflineSession::processCaptureResult(std::shared_ptr<HalReq
         }
     }
 
-    // Fill capture result metadata
-    fillCaptureResult(req->setting, req->shutterTs);
-    const camera_metadata_t* rawResult = req->setting.getAndLock();
-    convertToAidl(rawResult, &result.result);
-    req->setting.unlock(rawResult);
-
-    // Callback into framework
-    invokeProcessCaptureResultCallback(results, /* tryWriteFmq */ true);
+    // Fill capture result metadata and callback into framework
+    {
+        std::lock_guard<std::mutex> lk(mResultMetadataLock);
+        const camera_metadata_t* rawResult = fillCaptureResult(*req);
+        if (rawResult == nullptr) {
+            ALOGE("%s: fill capture result metadata failed!", __FUNCTION__);
+        }
+        invokeProcessCaptureResultCallback(results, /* tryWriteFmq */ true, rawResult);
+    }
     freeReleaseFences(results);
     return Status::OK;
 }
 
-#define UPDATE(md, tag, data, size)               \
-    do {                                          \
-        if ((md).update((tag), (data), (size))) { \
-            ALOGE("Update " #tag " failed!");     \
-            return BAD_VALUE;                     \
-        }                                         \
-    } while (0)
-
-status_t ExternalCameraOfflineSession::fillCaptureResult(common::V1_0::helper::CameraMetadata md,
-                                                         nsecs_t timestamp) {
+const camera_metadata_t* ExternalCameraOfflineSession::fillCaptureResult(const HalRequest& req) {
     bool afTrigger = false;
     {
         std::lock_guard<std::mutex> lk(mAfTriggerLock);
         afTrigger = mAfTrigger;
-        if (md.exists(ANDROID_CONTROL_AF_TRIGGER)) {
-            camera_metadata_entry entry = md.find(ANDROID_CONTROL_AF_TRIGGER);
+        camera_metadata_ro_entry entry = req.setting->find(ANDROID_CONTROL_AF_TRIGGER);
+        if (entry.count > 0) {
             if (entry.data.u8[0] == ANDROID_CONTROL_AF_TRIGGER_START) {
                 mAfTrigger = afTrigger = true;
             } else if (entry.data.u8[0] == ANDROID_CONTROL_AF_TRIGGER_CANCEL) {
@@ -171,14 +164,11 @@ status_t ExternalCameraOfflineSession::fillCaptureResult(common::V1_0::helper::C
     } else {
         afState = ANDROID_CONTROL_AF_STATE_INACTIVE;
     }
-    UPDATE(md, ANDROID_CONTROL_AF_STATE, &afState, 1);
-
-    camera_metadata_ro_entry activeArraySize = mChars.find(ANDROID_SENSOR_INFO_ACTIVE_ARRAY_SIZE);
-
-    return fillCaptureResultCommon(md, timestamp, activeArraySize);
+    return mResultMetadataBuilder.build(req.setting, req.shutterTs, afState);
 }
+
 void ExternalCameraOfflineSession::invokeProcessCaptureResultCallback(
-        std::vector<CaptureResult>& results, bool tryWriteFmq) {
+        std::vector<CaptureResult>& results, bool tryWriteFmq, const camera_metadata_t* rawResult) {
     if (mProcessCaptureResultLock.tryLock() != OK) {
         const nsecs_t NS_TO_SECOND = 1E9;
         ALOGV("%s: previous call is not finished! waiting 1s...", __FUNCTION__);
@@ -187,7 +177,18 @@ void ExternalCameraOfflineSession::invokeProcessCaptureResultCallback(
             return;
         }
     }
-    if (tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0) {
+    if (rawResult != nullptr) {
+        CaptureResult& result = results[0];
+        size_t size = get_camera_metadata_size(rawResult);
+        if (tryWriteFmq && mResultMetadataQueue->availableToWrite() >= size &&
+            mResultMetadataQueue->write(reinterpret_cast<const int8_t*>(rawResult), size)) {
+            result.fmqResultSize = size;
+        } else {
+            ALOGV("%s: result fmq is full, fall back to binder", __FUNCTION__);
+            convertToAidl(rawResult, &result.result);
+            result.fmqResultSize = 0;
+        }
+    } else if (tryWriteFmq && mResultMetadataQueue->availableToWrite() > 0) {
         for (CaptureResult& result : results) {
             if (!result.result.metadata.empty()) {
                 if (mResultMetadataQueue->write(
@@ -315,8 +316,9 @@ void ExternalCameraOfflineSession::initOutputThread() {
 
     Size inputSize = {mOfflineReqs[0]->frameIn->mWidth, mOfflineReqs[0]->frameIn->mHeight};
     Size maxThumbSize = getMaxThumbnailResolution(mChars);
+    // Offline requests are processed serially, one frame context is enough
     mOutputThread->allocateIntermediateBuffers(inputSize, maxThumbSize, mOfflineStreams,
-                                               mBlobBufferSize);
+                                               mBlobBufferSize, /*numFrames*/ 1);
 
     mOutputThread->run();
 }
@@ -389,7 +391,9 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
         return false;
     };
 
-    if (req->frameIn->mFourcc != V4L2_PIX_FMT_MJPEG && req->frameIn->mFourcc != V4L2_PIX_FMT_Z16) {
+    uint32_t fourcc = req->frameIn->mFourcc;
+    bool isColor = fourcc == V4L2_PIX_FMT_MJPEG || isUncompressedColorFourcc(fourcc);
+    if (!isColor && fourcc != V4L2_PIX_FMT_Z16) {
         return onDeviceError("%s: do not support V4L2 format %c%c%c%c", __FUNCTION__,
                              req->frameIn->mFourcc & 0xFF, (req->frameIn->mFourcc >> 8) & 0xFF,
                              (req->frameIn->mFourcc >> 16) & 0xFF,
@@ -403,6 +407,7 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
     }
 
     std::unique_lock<std::mutex> lk(mBufferLock);
+    FrameContext& ctx = *mFrameContexts[0];
     // Convert input V4L2 frame to YU12 of the same size
     // TODO: see if we can save some computation by converting to YV12 here
     uint8_t* inData;
@@ -413,14 +418,10 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
     }
 
     // TODO: in some special case maybe we can decode jpg directly to gralloc output?
-    if (req->frameIn->mFourcc == V4L2_PIX_FMT_MJPEG) {
-        ATRACE_BEGIN("MJPGtoI420");
-        int convRes = libyuv::MJPGToI420(
-                inData, inDataSize, static_cast<uint8_t*>(mYu12FrameLayout.y),
-                mYu12FrameLayout.yStride, static_cast<uint8_t*>(mYu12FrameLayout.cb),
-                mYu12FrameLayout.cStride, static_cast<uint8_t*>(mYu12FrameLayout.cr),
-                mYu12FrameLayout.cStride, mYu12Frame->mWidth, mYu12Frame->mHeight,
-                mYu12Frame->mWidth, mYu12Frame->mHeight);
+    if (isColor) {
+        ATRACE_BEGIN("decodeToYU12");
+        Size sz{ctx.mYu12Frame->mWidth, ctx.mYu12Frame->mHeight};
+        int convRes = decodeToYU12(fourcc, inData, inDataSize, sz, ctx.mYu12FrameLayout);
         ATRACE_END();
 
         if (convRes != 0) {
@@ -469,11 +470,11 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
         // Gralloc lockYCbCr the buffer
         switch (halBuf.format) {
             case PixelFormat::BLOB: {
-                int ret = createJpegLocked(halBuf, req->setting);
+                int ret = createJpeg(ctx, halBuf, *req->setting);
 
                 if (ret != 0) {
                     lk.unlock();
-                    return onDeviceError("%s: createJpegLocked failed with %d", __FUNCTION__, ret);
+                    return onDeviceError("%s: createJpeg failed with %d", __FUNCTION__, ret);
                 }
             } break;
             case PixelFormat::Y16: {
@@ -515,8 +516,12 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
 
                 YCbCrLayout cropAndScaled;
                 ATRACE_BEGIN("cropAndScaleLocked");
-                int ret = cropAndScaleLocked(mYu12Frame, Size{halBuf.width, halBuf.height},
+                int ret;
+                {
+                    std::lock_guard<std::mutex> scaleLk(ctx.mScaleLock);
+                    ret = cropAndScaleLocked(ctx, Size{halBuf.width, halBuf.height},
                                              &cropAndScaled);
+                }
                 ATRACE_END();
                 if (ret != 0) {
                     lk.unlock();
@@ -541,7 +546,7 @@ bool ExternalCameraOfflineSession::OutputThread::threadLoop() {
                 return onDeviceError("%s: unknown output format %x", __FUNCTION__, halBuf.format);
         }
     }  // for each buffer
-    mScaledYu12Frames.clear();
+    ctx.mScaledYu12Frames.clear();
 
     // Don't hold the lock while calling back to parent
     lk.unlock();
@@ -92,8 +92,9 @@ class ExternalCameraOfflineSession final : public BnCameraOfflineSession,
         std::deque<std::shared_ptr<HalRequest>> mOfflineReqs;
     };  // OutputThread
 
-    status_t fillCaptureResult(common::V1_0::helper::CameraMetadata md, nsecs_t timestamp);
-    void invokeProcessCaptureResultCallback(std::vector<CaptureResult>& results, bool tryWriteFmq);
+    const camera_metadata_t* fillCaptureResult(const HalRequest& req);
+    void invokeProcessCaptureResultCallback(std::vector<CaptureResult>& results, bool tryWriteFmq,
+                                            const camera_metadata_t* rawResult = nullptr);
     void initOutputThread();
     void cleanupBuffersLocked(int32_t id);
 
@@ -113,6 +114,9 @@ class ExternalCameraOfflineSession final : public BnCameraOfflineSession,
     std::mutex mAfTriggerLock;  // protect mAfTrigger
     bool mAfTrigger;
 
+    std::mutex mResultMetadataLock;  // protect mResultMetadataBuilder
+    ResultMetadataBuilder mResultMetadataBuilder;
+
     const std::vector<Stream> mOfflineStreams;
     std::deque<std::shared_ptr<HalRequest>> mOfflineReqs;
 
@@ -23,6 +23,9 @@
 #include <jpeglib.h>
 #include <linux/videodev2.h>
 #include <log/log.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <algorithm>
 #include <cinttypes>
 #include <cmath>
@@ -42,6 +45,7 @@ const int kDefaultCameraIdOffset = 100;
 const int kDefaultJpegBufSize = 5 << 20;  // 5MB
 const int kDefaultNumVideoBuffer = 4;
 const int kDefaultNumStillBuffer = 2;
+const int kDefaultNumDmaBufBuffer = 8;
 const int kDefaultOrientation = 0;  // suitable for natural landscape displays like tablet/TV
                                     // For phone devices 270 is better
 }  // anonymous namespace
@@ -124,6 +128,15 @@ ExternalCameraConfig ExternalCameraConfig::loadFromCfg(const char* cfgPath) {
                 numStillBuf->UnsignedAttribute("count", /*Default*/ kDefaultNumStillBuffer);
     }
 
+    XMLElement* dmaBuf = deviceCfg->FirstChildElement("ExportDmaBuf");
+    if (dmaBuf == nullptr) {
+        ALOGI("%s: v4l2 buffers are not exported as DMA-BUFs", __FUNCTION__);
+    } else {
+        ret.exportDmaBuf = dmaBuf->BoolAttribute("enabled", false);
+        ret.numDmaBufBuffers =
+                dmaBuf->UnsignedAttribute("count", /*Default*/ kDefaultNumDmaBufBuffer);
+    }
+
     XMLElement* fpsList = deviceCfg->FirstChildElement("FpsList");
     if (fpsList == nullptr) {
         ALOGI("%s: no fps list specified", __FUNCTION__);
@@ -169,9 +182,10 @@ ExternalCameraConfig ExternalCameraConfig::loadFromCfg(const char* cfgPath) {
     }
 
     ALOGI("%s: external camera cfg loaded: maxJpgBufSize %d,"
-          " num video buffers %d, num still buffers %d, orientation %d",
+          " num video buffers %d, num still buffers %d, export DMA-BUF %d (%d buffers),"
+          " orientation %d",
           __FUNCTION__, ret.maxJpegBufSize, ret.numVideoBuffers, ret.numStillBuffers,
-          ret.orientation);
+          ret.exportDmaBuf, ret.numDmaBufBuffers, ret.orientation);
     for (const auto& limit : ret.fpsLimits) {
         ALOGI("%s: fpsLimitList: %dx%d@%f", __FUNCTION__, limit.size.width, limit.size.height,
               limit.fpsUpperBound);
@@ -219,6 +233,8 @@ ExternalCameraConfig::ExternalCameraConfig()
       maxJpegBufSize(kDefaultJpegBufSize),
       numVideoBuffers(kDefaultNumVideoBuffer),
       numStillBuffers(kDefaultNumStillBuffer),
+      exportDmaBuf(false),
+      numDmaBufBuffers(kDefaultNumDmaBufBuffer),
       depthEnabled(false),
       orientation(kDefaultOrientation) {
     fpsLimits.push_back({/* size */ {/* width */ 640, /* height */ 480}, /* fpsUpperBound */ 30.0});
@@ -242,14 +258,31 @@ Frame::Frame(uint32_t width, uint32_t height, uint32_t fourcc)
     : mWidth(width), mHeight(height), mFourcc(fourcc) {}
 Frame::~Frame() {}
 
-V4L2Frame::V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, int bufIdx, int fd, uint32_t dataSize,
-                     uint64_t offset)
-    : Frame(w, h, fourcc), mBufferIndex(bufIdx), mFd(fd), mDataSize(dataSize), mOffset(offset) {}
+KernelV4l2Device::KernelV4l2Device(::android::base::unique_fd fd) : mFd(std::move(fd)) {}
+
+int KernelV4l2Device::ioctl(unsigned long request, void* arg) {
+    return ::ioctl(mFd.get(), request, arg);
+}
+
+int KernelV4l2Device::pollIn(int timeoutMs) {
+    pollfd pfd{.fd = mFd.get(), .events = POLLIN};
+    return ::poll(&pfd, 1, timeoutMs);
+}
+
+void* KernelV4l2Device::mmap(size_t length, uint64_t offset) {
+    return ::mmap(nullptr, length, PROT_READ, MAP_SHARED, mFd.get(), offset);
+}
 
-V4L2Frame::~V4L2Frame() {
-    unmap();
+int KernelV4l2Device::munmap(void* addr, size_t length) {
+    return ::munmap(addr, length);
 }
 
+V4L2Frame::V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, int bufIdx, uint8_t* data,
+                     uint32_t dataSize)
+    : Frame(w, h, fourcc), mBufferIndex(bufIdx), mData(data), mDataSize(dataSize) {}
+
+V4L2Frame::~V4L2Frame() {}
+
 int V4L2Frame::getData(uint8_t** outData, size_t* dataSize) {
     return map(outData, dataSize);
 }
@@ -262,32 +295,23 @@ int V4L2Frame::map(uint8_t** data, size_t* dataSize) {
     }
 
     std::lock_guard<std::mutex> lk(mLock);
-    if (!mMapped) {
-        void* addr = mmap(nullptr, mDataSize, PROT_READ, MAP_SHARED, mFd, mOffset);
-        if (addr == MAP_FAILED) {
-            ALOGE("%s: V4L2 buffer map failed: %s", __FUNCTION__, strerror(errno));
-            return -EINVAL;
-        }
-        mData = static_cast<uint8_t*>(addr);
-        mMapped = true;
+    if (mReleased) {
+        ALOGE("%s: V4L2 buffer %d was already released", __FUNCTION__, mBufferIndex);
+        return -EINVAL;
     }
     *data = mData;
     *dataSize = mDataSize;
-    ALOGV("%s: V4L map FD %d, data %p size %zu", __FUNCTION__, mFd, mData, mDataSize);
     return 0;
 }
 
-int V4L2Frame::unmap() {
+bool V4L2Frame::release() {
     std::lock_guard<std::mutex> lk(mLock);
-    if (mMapped) {
-        ALOGV("%s: V4L unmap data %p size %zu", __FUNCTION__, mData, mDataSize);
-        if (munmap(mData, mDataSize) != 0) {
-            ALOGE("%s: V4L2 buffer unmap failed: %s", __FUNCTION__, strerror(errno));
-            return -EINVAL;
-        }
-        mMapped = false;
+    if (mReleased) {
+        return false;
     }
-    return 0;
+    mReleased = true;
+    mData = nullptr;
+    return true;
 }
 
 AllocatedFrame::AllocatedFrame(uint32_t w, uint32_t h) : Frame(w, h, V4L2_PIX_FMT_YUV420) {}
@@ -541,7 +565,7 @@ int formatConvert(const YCbCrLayout& in, const YCbCrLayout& out, Size sz, uint32
             break;
         case V4L2_PIX_FMT_YVU420:  // YV12
         case V4L2_PIX_FMT_YUV420:  // YU12
-            // TODO: maybe we can speed up here by somehow save this copy?
+            // Requests with a single output of the V4L2 size skip this copy, see decodeToLayout
             ret = libyuv::I420Copy(static_cast<uint8_t*>(in.y), static_cast<int32_t>(in.yStride),
                                    static_cast<uint8_t*>(in.cb), static_cast<int32_t>(in.cStride),
                                    static_cast<uint8_t*>(in.cr), static_cast<int32_t>(in.cStride),
@@ -567,168 +591,104 @@ int formatConvert(const YCbCrLayout& in, const YCbCrLayout& out, Size sz, uint32
     return 0;
 }
 
-int encodeJpegYU12(const Size& inSz, const YCbCrLayout& inLayout, int jpegQuality,
-                   const void* app1Buffer, size_t app1Size, void* out, size_t maxOutSize,
-                   size_t& actualCodeSize) {
-    /* libjpeg is a C library so we use C-style "inheritance" by
-     * putting libjpeg's jpeg_destination_mgr first in our custom
-     * struct. This allows us to cast jpeg_destination_mgr* to
-     * CustomJpegDestMgr* when we get it passed to us in a callback */
-    struct CustomJpegDestMgr {
-        struct jpeg_destination_mgr mgr;
-        JOCTET* mBuffer;
-        size_t mBufferSize;
-        size_t mEncodedSize;
-        bool mSuccess;
-    } dmgr;
-
-    jpeg_compress_struct cinfo = {};
-    jpeg_error_mgr jerr;
-
-    /* Initialize error handling with standard callbacks, but
-     * then override output_message (to print to ALOG) and
-     * error_exit to set a flag and print a message instead
-     * of killing the whole process */
-    cinfo.err = jpeg_std_error(&jerr);
-
-    cinfo.err->output_message = [](j_common_ptr cinfo) {
-        char buffer[JMSG_LENGTH_MAX];
-
-        /* Create the message */
-        (*cinfo->err->format_message)(cinfo, buffer);
-        ALOGE("libjpeg error: %s", buffer);
-    };
-    cinfo.err->error_exit = [](j_common_ptr cinfo) {
-        (*cinfo->err->output_message)(cinfo);
-        if (cinfo->client_data) {
-            auto& dmgr = *reinterpret_cast<CustomJpegDestMgr*>(cinfo->client_data);
-            dmgr.mSuccess = false;
-        }
-    };
-
-    /* Now that we initialized some callbacks, let's create our compressor */
-    jpeg_create_compress(&cinfo);
-
-    /* Initialize our destination manager */
-    dmgr.mBuffer = static_cast<JOCTET*>(out);
-    dmgr.mBufferSize = maxOutSize;
-    dmgr.mEncodedSize = 0;
-    dmgr.mSuccess = true;
-    cinfo.client_data = static_cast<void*>(&dmgr);
-
-    /* These lambdas become C-style function pointers and as per C++11 spec
-     * may not capture anything */
-    dmgr.mgr.init_destination = [](j_compress_ptr cinfo) {
-        auto& dmgr = reinterpret_cast<CustomJpegDestMgr&>(*cinfo->dest);
-        dmgr.mgr.next_output_byte = dmgr.mBuffer;
-        dmgr.mgr.free_in_buffer = dmgr.mBufferSize;
-        ALOGV("%s:%d jpeg start: %p [%zu]", __FUNCTION__, __LINE__, dmgr.mBuffer, dmgr.mBufferSize);
-    };
-
-    dmgr.mgr.empty_output_buffer = [](j_compress_ptr cinfo __unused) {
-        ALOGV("%s:%d Out of buffer", __FUNCTION__, __LINE__);
-        return 0;
-    };
-
-    dmgr.mgr.term_destination = [](j_compress_ptr cinfo) {
-        auto& dmgr = reinterpret_cast<CustomJpegDestMgr&>(*cinfo->dest);
-        dmgr.mEncodedSize = dmgr.mBufferSize - dmgr.mgr.free_in_buffer;
-        ALOGV("%s:%d Done with jpeg: %zu", __FUNCTION__, __LINE__, dmgr.mEncodedSize);
-    };
-    cinfo.dest = reinterpret_cast<struct jpeg_destination_mgr*>(&dmgr);
-
-    /* We are going to be using JPEG in raw data mode, so we are passing
-     * straight subsampled planar YCbCr and it will not touch our pixel
-     * data or do any scaling or anything */
-    cinfo.image_width = inSz.width;
-    cinfo.image_height = inSz.height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_YCbCr;
-
-    /* Initialize defaults and then override what we want */
-    jpeg_set_defaults(&cinfo);
-
-    jpeg_set_quality(&cinfo, jpegQuality, 1);
-    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
-    cinfo.raw_data_in = 1;
-    cinfo.dct_method = JDCT_IFAST;
-
-    /* Configure sampling factors. The sampling factor is JPEG subsampling 420
-     * because the source format is YUV420. Note that libjpeg sampling factors
-     * are... a little weird. Sampling of Y=2,U=1,V=1 means there is 1 U and
-     * 1 V value for each 2 Y values */
-    cinfo.comp_info[0].h_samp_factor = 2;
-    cinfo.comp_info[0].v_samp_factor = 2;
-    cinfo.comp_info[1].h_samp_factor = 1;
-    cinfo.comp_info[1].v_samp_factor = 1;
-    cinfo.comp_info[2].h_samp_factor = 1;
-    cinfo.comp_info[2].v_samp_factor = 1;
-
-    /* Start the compressor */
-    jpeg_start_compress(&cinfo, TRUE);
-
-    /* Let's not hardcode YUV420 in 6 places... 5 was enough */
-    int maxVSampFactor = cinfo.max_v_samp_factor;
-    int cVSubSampling = cinfo.comp_info[0].v_samp_factor / cinfo.comp_info[1].v_samp_factor;
-
-    /* Compute our macroblock height, so we can pad our input to be vertically
-     * macroblock aligned. No need to for horizontal alignment since AllocatedFrame already
-     * pads horizontally */
-
-    size_t mcuV = DCTSIZE * maxVSampFactor;
-    size_t paddedHeight = mcuV * ((inSz.height + mcuV - 1) / mcuV);
-
-    /* libjpeg uses arrays of row pointers, which makes it really easy to pad
-     * data vertically (unfortunately doesn't help horizontally) */
-    std::vector<JSAMPROW> yLines(paddedHeight);
-    std::vector<JSAMPROW> cbLines(paddedHeight / cVSubSampling);
-    std::vector<JSAMPROW> crLines(paddedHeight / cVSubSampling);
-
-    uint8_t* py = static_cast<uint8_t*>(inLayout.y);
-    uint8_t* pcb = static_cast<uint8_t*>(inLayout.cb);
-    uint8_t* pcr = static_cast<uint8_t*>(inLayout.cr);
-
-    for (int32_t i = 0; i < paddedHeight; i++) {
-        /* Once we are in the padding territory we still point to the last line
-         * effectively replicating it several times ~ CLAMP_TO_EDGE */
-        int li = std::min(i, inSz.height - 1);
-        yLines[i] = static_cast<JSAMPROW>(py + li * inLayout.yStride);
-        if (i < paddedHeight / cVSubSampling) {
-            li = std::min(i, (inSz.height - 1) / cVSubSampling);
-            cbLines[i] = static_cast<JSAMPROW>(pcb + li * inLayout.cStride);
-            crLines[i] = static_cast<JSAMPROW>(pcr + li * inLayout.cStride);
-        }
-    }
+bool isUncompressedColorFourcc(uint32_t fourcc) {
+    return fourcc == V4L2_PIX_FMT_YUYV || fourcc == V4L2_PIX_FMT_NV12;
+}
 
-    /* If APP1 data was passed in, use it */
-    if (app1Buffer && app1Size) {
-        jpeg_write_marker(&cinfo, JPEG_APP0 + 1, static_cast<const JOCTET*>(app1Buffer), app1Size);
+int decodeToYU12(uint32_t fourcc, const uint8_t* in, size_t inSize, Size sz,
+                 const YCbCrLayout& out) {
+    int32_t width = static_cast<int32_t>(sz.width);
+    int32_t height = static_cast<int32_t>(sz.height);
+    uint8_t* outY = static_cast<uint8_t*>(out.y);
+    uint8_t* outCb = static_cast<uint8_t*>(out.cb);
+    uint8_t* outCr = static_cast<uint8_t*>(out.cr);
+    int32_t yStride = static_cast<int32_t>(out.yStride);
+    int32_t cStride = static_cast<int32_t>(out.cStride);
+    size_t numPixels = static_cast<size_t>(width) * height;
+
+    switch (fourcc) {
+        case V4L2_PIX_FMT_MJPEG:
+            return libyuv::MJPGToI420(in, inSize, outY, yStride, outCb, cStride, outCr, cStride,
+                                      width, height, width, height);
+        case V4L2_PIX_FMT_YUYV:
+            if (inSize < numPixels * 2) {
+                ALOGE("%s: YUYV frame size %zu too small for %dx%d", __FUNCTION__, inSize, width,
+                      height);
+                return -EINVAL;
+            }
+            return libyuv::YUY2ToI420(in, width * 2, outY, yStride, outCb, cStride, outCr,
+                                      cStride, width, height);
+        case V4L2_PIX_FMT_NV12:
+            if (inSize < numPixels * 3 / 2) {
+                ALOGE("%s: NV12 frame size %zu too small for %dx%d", __FUNCTION__, inSize, width,
+                      height);
+                return -EINVAL;
+            }
+            return libyuv::NV12ToI420(in, width, in + numPixels, width, outY, yStride, outCb,
+                                      cStride, outCr, cStride, width, height);
+        default:
+            ALOGE("%s: unsupported V4L2 format %c%c%c%c", __FUNCTION__, fourcc & 0xFF,
+                  (fourcc >> 8) & 0xFF, (fourcc >> 16) & 0xFF, (fourcc >> 24) & 0xFF);
+            return -EINVAL;
     }
+}
 
-    /* While we still have padded height left to go, keep giving it one
-     * macroblock at a time. */
-    while (cinfo.next_scanline < cinfo.image_height) {
-        const uint32_t batchSize = DCTSIZE * maxVSampFactor;
-        const uint32_t nl = cinfo.next_scanline;
-        JSAMPARRAY planes[3]{&yLines[nl], &cbLines[nl / cVSubSampling],
-                             &crLines[nl / cVSubSampling]};
-
-        uint32_t done = jpeg_write_raw_data(&cinfo, planes, batchSize);
-
-        if (done != batchSize) {
-            ALOGE("%s: compressed %u lines, expected %u (total %u/%u)", __FUNCTION__, done,
-                  batchSize, cinfo.next_scanline, cinfo.image_height);
-            return -1;
-        }
+int decodeToLayout(uint32_t fourcc, const uint8_t* in, size_t inSize, Size sz,
+                   const YCbCrLayout& out) {
+    int32_t width = static_cast<int32_t>(sz.width);
+    int32_t height = static_cast<int32_t>(sz.height);
+    switch (getFourCcFromLayout(out)) {
+        case V4L2_PIX_FMT_YUV420:  // YU12
+        case V4L2_PIX_FMT_YVU420:  // YV12
+            // The layout carries the plane pointers, so YV12 is written like YU12
+            return decodeToYU12(fourcc, in, inSize, sz, out);
+        case V4L2_PIX_FMT_NV12:
+            if (fourcc != V4L2_PIX_FMT_MJPEG) {
+                return -ENOTSUP;
+            }
+            return libyuv::MJPGToNV12(in, inSize, static_cast<uint8_t*>(out.y),
+                                      static_cast<int32_t>(out.yStride),
+                                      static_cast<uint8_t*>(out.cb),
+                                      static_cast<int32_t>(out.cStride), width, height, width,
+                                      height);
+        case V4L2_PIX_FMT_NV21:
+            if (fourcc != V4L2_PIX_FMT_MJPEG) {
+                return -ENOTSUP;
+            }
+            return libyuv::MJPGToNV21(in, inSize, static_cast<uint8_t*>(out.y),
+                                      static_cast<int32_t>(out.yStride),
+                                      static_cast<uint8_t*>(out.cr),
+                                      static_cast<int32_t>(out.cStride), width, height, width,
+                                      height);
+        default:
+            return -ENOTSUP;
     }
+}
 
-    /* This will flush everything */
-    jpeg_finish_compress(&cinfo);
-
-    /* Grab the actual code size and set it */
-    actualCodeSize = dmgr.mEncodedSize;
+int encodeJpegYU12(const Size& inSz, const YCbCrLayout& inLayout, int jpegQuality,
+                   const void* app1Buffer, size_t app1Size, void* out, size_t maxOutSize,
+                   size_t& actualCodeSize) {
+    return encodeJpegYU12(inSz, inLayout, jpegQuality,
+                          [app1Buffer, app1Size](const uint8_t** app1, size_t* size) {
+                              *app1 = static_cast<const uint8_t*>(app1Buffer);
+                              *size = app1Buffer != nullptr ? app1Size : 0;
+                              return true;
+                          },
+                          out, maxOutSize, /*numStrips*/ 1, actualCodeSize);
+}
 
-    return 0;
+int encodeJpegYU12(const Size& inSz, const YCbCrLayout& inLayout, int jpegQuality,
+                   const JpegApp1Getter& getApp1, void* out, size_t maxOutSize, size_t numStrips,
+                   size_t& actualCodeSize) {
+    YU12Image image = {.width = static_cast<int32_t>(inSz.width),
+                       .height = static_cast<int32_t>(inSz.height),
+                       .y = static_cast<const uint8_t*>(inLayout.y),
+                       .cb = static_cast<const uint8_t*>(inLayout.cb),
+                       .cr = static_cast<const uint8_t*>(inLayout.cr),
+                       .yStride = inLayout.yStride,
+                       .cStride = inLayout.cStride};
+    return encodeJpegYU12Strips(image, jpegQuality, getApp1, out, maxOutSize, numStrips,
+                                &actualCodeSize);
 }
 
 Size getMaxThumbnailResolution(const common::V1_0::helper::CameraMetadata& chars) {
@@ -760,7 +720,6 @@ void freeReleaseFences(std::vector<CaptureResult>& results) {
     }
 }
 
-#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 #define UPDATE(md, tag, data, size)               \
     do {                                          \
         if ((md).update((tag), (data), (size))) { \
@@ -769,13 +728,56 @@ void freeReleaseFences(std::vector<CaptureResult>& results) {
         }                                         \
     } while (0)
 
-status_t fillCaptureResultCommon(CameraMetadata& md, nsecs_t timestamp,
-                                 camera_metadata_ro_entry& activeArraySize) {
-    if (activeArraySize.count < 4) {
+ResultMetadataBuilder::ResultMetadataBuilder(const CameraMetadata& chars) {
+    camera_metadata_ro_entry activeArraySize = chars.find(ANDROID_SENSOR_INFO_ACTIVE_ARRAY_SIZE);
+    if (activeArraySize.count >= 4) {
+        mActiveArraySize.assign(activeArraySize.data.i32, activeArraySize.data.i32 + 4);
+    }
+}
+
+ResultMetadataBuilder::~ResultMetadataBuilder() {
+    if (mTemplate != nullptr) {
+        free_camera_metadata(mTemplate);
+    }
+}
+
+const camera_metadata_t* ResultMetadataBuilder::build(
+        const std::shared_ptr<const CameraMetadata>& settings, nsecs_t timestamp,
+        uint8_t afState) {
+    if (settings == nullptr) {
+        ALOGE("%s: request has no settings!", __FUNCTION__);
+        return nullptr;
+    }
+    if (settings != mSettings) {
+        mSettings.reset();
+        if (buildTemplate(*settings) != OK) {
+            return nullptr;
+        }
+        mSettings = settings;
+    }
+
+    // Same size as the template entries, so these are written in place
+    if (update_camera_metadata_entry(mTemplate, mAfStateIndex, &afState, 1, nullptr) != OK ||
+        update_camera_metadata_entry(mTemplate, mTimestampIndex, &timestamp, 1, nullptr) != OK) {
+        ALOGE("%s: patching result metadata failed!", __FUNCTION__);
+        return nullptr;
+    }
+    return mTemplate;
+}
+
+status_t ResultMetadataBuilder::buildTemplate(const CameraMetadata& settings) {
+    if (mActiveArraySize.size() < 4) {
         ALOGE("%s: cannot find active array size!", __FUNCTION__);
         return -EINVAL;
     }
+
+    CameraMetadata md(settings);
     // android.control
+    // For USB camera, the USB camera handles everything and we don't have control over AF. The AF
+    // state is faked from the requests, and patched for each frame.
+    const uint8_t afState = ANDROID_CONTROL_AF_STATE_INACTIVE;
+    UPDATE(md, ANDROID_CONTROL_AF_STATE, &afState, 1);
+
     // For USB camera, we don't know the AE state. Set the state to converged to
     // indicate the frame should be good to use. Then apps don't have to wait the
     // AE state.
@@ -800,15 +802,12 @@ status_t fillCaptureResultCommon(CameraMetadata& md, nsecs_t timestamp,
     UPDATE(md, ANDROID_REQUEST_PIPELINE_DEPTH, &requestPipelineMaxDepth, 1);
 
     // android.scaler
-    const int32_t crop_region[] = {
-            activeArraySize.data.i32[0],
-            activeArraySize.data.i32[1],
-            activeArraySize.data.i32[2],
-            activeArraySize.data.i32[3],
-    };
-    UPDATE(md, ANDROID_SCALER_CROP_REGION, crop_region, ARRAY_SIZE(crop_region));
+    // The whole active array is always output, whatever crop the request asks for
+    UPDATE(md, ANDROID_SCALER_CROP_REGION, mActiveArraySize.data(), mActiveArraySize.size());
 
     // android.sensor
+    // Patched for each frame
+    const int64_t timestamp = 0;
     UPDATE(md, ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
 
     // android.statistics
@@ -818,10 +817,34 @@ status_t fillCaptureResultCommon(CameraMetadata& md, nsecs_t timestamp,
     const uint8_t sceneFlicker = ANDROID_STATISTICS_SCENE_FLICKER_NONE;
     UPDATE(md, ANDROID_STATISTICS_SCENE_FLICKER, &sceneFlicker, 1);
 
+    // Copy into a buffer without spare capacity, so the whole buffer can be sent as is
+    const camera_metadata_t* raw = md.getAndLock();
+    camera_metadata_t* compact = clone_camera_metadata(raw);
+    md.unlock(raw);
+    if (compact == nullptr) {
+        ALOGE("%s: cloning result metadata failed!", __FUNCTION__);
+        return NO_MEMORY;
+    }
+
+    camera_metadata_entry afStateEntry;
+    camera_metadata_entry timestampEntry;
+    if (find_camera_metadata_entry(compact, ANDROID_CONTROL_AF_STATE, &afStateEntry) != OK ||
+        find_camera_metadata_entry(compact, ANDROID_SENSOR_TIMESTAMP, &timestampEntry) != OK) {
+        ALOGE("%s: cannot find per-frame result entries!", __FUNCTION__);
+        free_camera_metadata(compact);
+        return BAD_VALUE;
+    }
+
+    if (mTemplate != nullptr) {
+        free_camera_metadata(mTemplate);
+    }
+    mTemplate = compact;
+    mAfStateIndex = afStateEntry.index;
+    mTimestampIndex = timestampEntry.index;
+    mNumTemplateBuilds++;
     return OK;
 }
 
-#undef ARRAY_SIZE
 #undef UPDATE
 
 AllocatedV4L2Frame::AllocatedV4L2Frame(std::shared_ptr<V4L2Frame> frameIn)
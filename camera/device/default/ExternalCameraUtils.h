@@ -19,6 +19,7 @@
 
 #include <CameraMetadata.h>
 #include <HandleImporter.h>
+#include <JpegEncoder.h>
 #include <aidl/android/hardware/camera/common/Status.h>
 #include <aidl/android/hardware/camera/device/CaptureResult.h>
 #include <aidl/android/hardware/camera/device/ErrorCode.h>
@@ -28,6 +29,7 @@
 #include <android/hardware/graphics/mapper/2.0/IMapper.h>
 #include <android/hardware/graphics/mapper/3.0/IMapper.h>
 #include <android/hardware/graphics/mapper/4.0/IMapper.h>
+#include <android-base/unique_fd.h>
 #include <tinyxml2.h>
 #include <map>
 #include <unordered_map>
@@ -69,6 +71,29 @@ struct SizeHasher {
     }
 };
 
+// A crop of an input frame scaled to an output size
+struct ScaleKey {
+    IMapper::Rect crop;
+    Size size;
+
+    bool operator==(const ScaleKey& other) const {
+        return crop.left == other.crop.left && crop.top == other.crop.top &&
+               crop.width == other.crop.width && crop.height == other.crop.height &&
+               size == other.size;
+    }
+};
+
+struct ScaleKeyHasher {
+    size_t operator()(const ScaleKey& key) const {
+        size_t result = SizeHasher()(key.size);
+        result = 31 * result + key.crop.left;
+        result = 31 * result + key.crop.top;
+        result = 31 * result + key.crop.width;
+        result = 31 * result + key.crop.height;
+        return result;
+    }
+};
+
 struct ExternalCameraConfig {
     static const char* kDefaultCfgPath;
     static ExternalCameraConfig loadFromCfg(const char* cfgPath = kDefaultCfgPath);
@@ -91,6 +116,12 @@ struct ExternalCameraConfig {
     // Size of v4l2 buffer queue when streaming > kMaxVideoSize
     uint32_t numStillBuffers;
 
+    // Export v4l2 buffers as DMA-BUFs (VIDIOC_EXPBUF) and read frames through them
+    bool exportDmaBuf;
+
+    // Minimum size of v4l2 buffer queue when exporting DMA-BUFs
+    uint32_t numDmaBufBuffers;
+
     // Indication that the device connected supports depth output
     bool depthEnabled;
 
@@ -147,27 +178,60 @@ struct Frame : public std::enable_shared_from_this<Frame> {
     virtual int getData(uint8_t** outData, size_t* dataSize) = 0;
 };
 
+// The V4L2 calls made on an opened video device. The kernel driver is the only production
+// implementation, tests and benchmarks substitute a fake device.
+class V4l2Device {
+  public:
+    virtual ~V4l2Device() = default;
+
+    // Same contract as ioctl(2): returns -1 and sets errno on failure
+    virtual int ioctl(unsigned long request, void* arg) = 0;
+    // Wait up to timeoutMs for a buffer to become ready to dequeue. Same return values as poll(2)
+    virtual int pollIn(int timeoutMs) = 0;
+    // Map a buffer at the offset returned by VIDIOC_QUERYBUF. Returns MAP_FAILED on failure
+    virtual void* mmap(size_t length, uint64_t offset) = 0;
+    virtual int munmap(void* addr, size_t length) = 0;
+    // For logging only, -1 when not backed by a file descriptor
+    virtual int fd() const = 0;
+};
+
+// A V4L2 device node opened from /dev/videoX
+class KernelV4l2Device : public V4l2Device {
+  public:
+    explicit KernelV4l2Device(::android::base::unique_fd fd);
+
+    int ioctl(unsigned long request, void* arg) override;
+    int pollIn(int timeoutMs) override;
+    void* mmap(size_t length, uint64_t offset) override;
+    int munmap(void* addr, size_t length) override;
+    int fd() const override { return mFd.get(); }
+
+  private:
+    ::android::base::unique_fd mFd;
+};
+
 // A class provide access to a dequeued V4L2 frame buffer (mostly in MJPG format)
 // Also contains necessary information to enqueue the buffer back to V4L2 buffer queue
 class V4L2Frame : public Frame {
   public:
-    V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, int bufIdx, int fd, uint32_t dataSize,
-              uint64_t offset);
+    // data points into the mapping of the V4L2 buffer, which the session keeps while streaming
+    V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, int bufIdx, uint8_t* data,
+              uint32_t dataSize);
     virtual ~V4L2Frame();
 
     virtual int getData(uint8_t** outData, size_t* dataSize) override;
 
     const int mBufferIndex;  // for later enqueue
     int map(uint8_t** data, size_t* dataSize);
-    int unmap();
+    // Called when the buffer goes back to the V4L2 queue, map fails from then on. Returns false
+    // if the frame was already released.
+    bool release();
 
   private:
     std::mutex mLock;
-    const int mFd;  // used for mmap but doesn't claim ownership
+    uint8_t* mData;  // doesn't claim ownership
     const size_t mDataSize;
-    const uint64_t mOffset;  // used for mmap
-    uint8_t* mData = nullptr;
-    bool mMapped = false;
+    bool mReleased = false;
 };
 
 // A RAII class representing a CPU allocated YUV frame used as intermediate buffers
@@ -213,7 +277,8 @@ struct HalStreamBuffer {
 
 struct HalRequest {
     int32_t frameNumber;
-    common::V1_0::helper::CameraMetadata setting;
+    // Shared by consecutive requests that reuse the same settings
+    std::shared_ptr<const common::V1_0::helper::CameraMetadata> setting;
     std::shared_ptr<Frame> frameIn;
     nsecs_t shutterTs;
     std::vector<HalStreamBuffer> buffers;
@@ -247,16 +312,63 @@ int getCropRect(CroppingType ct, const Size& inSize, const Size& outSize, IMappe
 
 int formatConvert(const YCbCrLayout& in, const YCbCrLayout& out, Size sz, uint32_t format);
 
+// Returns true for the uncompressed V4L2 color formats supported by decodeToYU12
+bool isUncompressedColorFourcc(uint32_t fourcc);
+
+// Converts a V4L2 MJPEG, YUYV or NV12 frame of size sz to the YU12 layout out.
+// Uncompressed frames are expected to be tightly packed.
+int decodeToYU12(uint32_t fourcc, const uint8_t* in, size_t inSize, Size sz,
+                 const YCbCrLayout& out);
+
+// Like decodeToYU12, but also writes semi-planar layouts from MJPEG frames. Used to decode
+// straight into an output buffer of the V4L2 frame size. Returns -ENOTSUP without writing
+// anything if the output layout can't be written in one pass.
+int decodeToLayout(uint32_t fourcc, const uint8_t* in, size_t inSize, Size sz,
+                   const YCbCrLayout& out);
+
 int encodeJpegYU12(const Size& inSz, const YCbCrLayout& inLayout, int jpegQuality,
                    const void* app1Buffer, size_t app1Size, void* out, size_t maxOutSize,
                    size_t& actualCodeSize);
 
+// Same as above, but splits the image into numStrips strips encoded in parallel and asks for the
+// APP1 payload only once the strips are encoded. See encodeJpegYU12Strips.
+int encodeJpegYU12(const Size& inSz, const YCbCrLayout& inLayout, int jpegQuality,
+                   const JpegApp1Getter& getApp1, void* out, size_t maxOutSize, size_t numStrips,
+                   size_t& actualCodeSize);
+
 Size getMaxThumbnailResolution(const common::V1_0::helper::CameraMetadata&);
 
 void freeReleaseFences(std::vector<CaptureResult>&);
 
-status_t fillCaptureResultCommon(common::V1_0::helper::CameraMetadata& md, nsecs_t timestamp,
-                                 camera_metadata_ro_entry& activeArraySize);
+// Builds capture result metadata: the request settings plus the result fields the HAL reports.
+// The result is laid out once per distinct settings object into a compact template, and only the
+// per-frame fields (AF state and sensor timestamp) are patched in place for the requests reusing
+// those settings, so steady state results are built without allocating. Not thread safe.
+class ResultMetadataBuilder {
+  public:
+    explicit ResultMetadataBuilder(const common::V1_0::helper::CameraMetadata& chars);
+    ~ResultMetadataBuilder();
+
+    // Returns the result metadata of a request, or nullptr on error. The buffer is owned by the
+    // builder and stays valid until the next call.
+    const camera_metadata_t* build(
+            const std::shared_ptr<const common::V1_0::helper::CameraMetadata>& settings,
+            nsecs_t timestamp, uint8_t afState);
+
+    // Number of templates laid out so far; each one is an allocation
+    size_t numTemplateBuilds() const { return mNumTemplateBuilds; }
+
+  private:
+    status_t buildTemplate(const common::V1_0::helper::CameraMetadata& settings);
+
+    std::vector<int32_t> mActiveArraySize;
+    // Settings the template was built from, held so the object can't be recycled under us
+    std::shared_ptr<const common::V1_0::helper::CameraMetadata> mSettings;
+    camera_metadata_t* mTemplate = nullptr;
+    size_t mAfStateIndex = 0;
+    size_t mTimestampIndex = 0;
+    size_t mNumTemplateBuilds = 0;
+};
 
 // Interface for OutputThread calling back to parent
 struct OutputThreadInterface {
@@ -284,6 +396,10 @@ struct OutputThreadInterface {
             std::shared_ptr<HalRequest>&) = 0;
 
     virtual ssize_t getJpegBufferSize(int32_t width, int32_t height) const = 0;
+
+    // The input frame of the request won't be read again, so its V4L2 buffer can be queued
+    // back before the outputs are done
+    virtual void releaseInputFrame(const std::shared_ptr<HalRequest>&) {}
 };
 
 // A CPU copy of a mapped V4L2Frame. Will map the input V4L2 frame.
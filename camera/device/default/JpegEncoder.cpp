@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ExtCamJpeg"
+// #define LOG_NDEBUG 0
+
+#include "JpegEncoder.h"
+
+#include <stdio.h>  // before jpeglib.h, which uses FILE
+#include <jpeglib.h>
+#include <log/log.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace device {
+namespace implementation {
+
+namespace {
+const size_t kMaxJpegThreads = 4;
+const int64_t kMinPixelsPerStrip = 1 << 20;  // not worth a thread below ~1MP
+const size_t kStripHeaderMargin = 64 * 1024;  // headers of a strip, and uneven compression
+
+// Lines of one MCU row for YUV420, and MCU rows per strip granularity so the restart marker
+// numbers (RST0..RST7) of every strip line up with the stitched image.
+const int32_t kMcuHeight = 16;
+const size_t kRestartMarkerCycle = 8;
+
+const uint8_t kMarkerApp0 = 0xE0;
+const uint8_t kMarkerApp1 = 0xE1;
+const uint8_t kMarkerSos = 0xDA;
+const uint8_t kMarkerEoi = 0xD9;
+const uint8_t kMarkerRst7 = 0xD7;
+
+// Encode the image in one pass. With restartEveryRow, a restart marker is written after each
+// MCU row.
+int encodeOnePass(const YU12Image& in, int jpegQuality, const uint8_t* app1Buffer,
+                  size_t app1Size, bool restartEveryRow, void* out, size_t maxOutSize,
+                  size_t* actualCodeSize) {
+    /* libjpeg is a C library so we use C-style "inheritance" by
+     * putting libjpeg's jpeg_destination_mgr first in our custom
+     * struct. This allows us to cast jpeg_destination_mgr* to
+     * CustomJpegDestMgr* when we get it passed to us in a callback */
+    struct CustomJpegDestMgr {
+        struct jpeg_destination_mgr mgr;
+        JOCTET* mBuffer;
+        size_t mBufferSize;
+        size_t mEncodedSize;
+        bool mSuccess;
+    } dmgr;
+
+    jpeg_compress_struct cinfo = {};
+    jpeg_error_mgr jerr;
+
+    /* Initialize error handling with standard callbacks, but
+     * then override output_message (to print to ALOG) and
+     * error_exit to set a flag and print a message instead
+     * of killing the whole process */
+    cinfo.err = jpeg_std_error(&jerr);
+
+    cinfo.err->output_message = [](j_common_ptr cinfo) {
+        char buffer[JMSG_LENGTH_MAX];
+
+        /* Create the message */
+        (*cinfo->err->format_message)(cinfo, buffer);
+        ALOGE("libjpeg error: %s", buffer);
+    };
+    cinfo.err->error_exit = [](j_common_ptr cinfo) {
+        (*cinfo->err->output_message)(cinfo);
+        if (cinfo->client_data) {
+            auto& dmgr = *reinterpret_cast<CustomJpegDestMgr*>(cinfo->client_data);
+            dmgr.mSuccess = false;
+        }
+    };
+
+    /* Now that we initialized some callbacks, let's create our compressor */
+    jpeg_create_compress(&cinfo);
+
+    /* Free the compressor on every exit */
+    struct CompressorGuard {
+        jpeg_compress_struct* cinfo;
+        ~CompressorGuard() { jpeg_destroy_compress(cinfo); }
+    } compressorGuard{&cinfo};
+
+    /* Initialize our destination manager */
+    dmgr.mBuffer = static_cast<JOCTET*>(out);
+    dmgr.mBufferSize = maxOutSize;
+    dmgr.mEncodedSize = 0;
+    dmgr.mSuccess = true;
+    cinfo.client_data = static_cast<void*>(&dmgr);
+
+    /* These lambdas become C-style function pointers and as per C++11 spec
+     * may not capture anything */
+    dmgr.mgr.init_destination = [](j_compress_ptr cinfo) {
+        auto& dmgr = reinterpret_cast<CustomJpegDestMgr&>(*cinfo->dest);
+        dmgr.mgr.next_output_byte = dmgr.mBuffer;
+        dmgr.mgr.free_in_buffer = dmgr.mBufferSize;
+        ALOGV("%s:%d jpeg start: %p [%zu]", __FUNCTION__, __LINE__, dmgr.mBuffer, dmgr.mBufferSize);
+    };
+
+    dmgr.mgr.empty_output_buffer = [](j_compress_ptr /*cinfo*/) {
+        ALOGV("%s:%d Out of buffer", __FUNCTION__, __LINE__);
+        return 0;
+    };
+
+    dmgr.mgr.term_destination = [](j_compress_ptr cinfo) {
+        auto& dmgr = reinterpret_cast<CustomJpegDestMgr&>(*cinfo->dest);
+        dmgr.mEncodedSize = dmgr.mBufferSize - dmgr.mgr.free_in_buffer;
+        ALOGV("%s:%d Done with jpeg: %zu", __FUNCTION__, __LINE__, dmgr.mEncodedSize);
+    };
+    cinfo.dest = reinterpret_cast<struct jpeg_destination_mgr*>(&dmgr);
+
+    /* We are going to be using JPEG in raw data mode, so we are passing
+     * straight subsampled planar YCbCr and it will not touch our pixel
+     * data or do any scaling or anything */
+    cinfo.image_width = in.width;
+    cinfo.image_height = in.height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+
+    /* Initialize defaults and then override what we want */
+    jpeg_set_defaults(&cinfo);
+
+    jpeg_set_quality(&cinfo, jpegQuality, 1);
+    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+    cinfo.raw_data_in = 1;
+    cinfo.dct_method = JDCT_IFAST;
+    if (restartEveryRow) {
+        cinfo.restart_in_rows = 1;
+    }
+
+    /* Configure sampling factors. The sampling factor is JPEG subsampling 420
+     * because the source format is YUV420. Note that libjpeg sampling factors
+     * are... a little weird. Sampling of Y=2,U=1,V=1 means there is 1 U and
+     * 1 V value for each 2 Y values */
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 2;
+    cinfo.comp_info[1].h_samp_factor = 1;
+    cinfo.comp_info[1].v_samp_factor = 1;
+    cinfo.comp_info[2].h_samp_factor = 1;
+    cinfo.comp_info[2].v_samp_factor = 1;
+
+    /* Start the compressor */
+    jpeg_start_compress(&cinfo, TRUE);
+
+    /* Let's not hardcode YUV420 in 6 places... 5 was enough */
+    int maxVSampFactor = cinfo.max_v_samp_factor;
+    int cVSubSampling = cinfo.comp_info[0].v_samp_factor / cinfo.comp_info[1].v_samp_factor;
+
+    /* Compute our macroblock height, so we can pad our input to be vertically
+     * macroblock aligned. No need to for horizontal alignment since AllocatedFrame already
+     * pads horizontally */
+
+    size_t mcuV = DCTSIZE * maxVSampFactor;
+    size_t paddedHeight = mcuV * ((in.height + mcuV - 1) / mcuV);
+
+    /* libjpeg uses arrays of row pointers, which makes it really easy to pad
+     * data vertically (unfortunately doesn't help horizontally) */
+    std::vector<JSAMPROW> yLines(paddedHeight);
+    std::vector<JSAMPROW> cbLines(paddedHeight / cVSubSampling);
+    std::vector<JSAMPROW> crLines(paddedHeight / cVSubSampling);
+
+    /* libjpeg does not write through the row pointers */
+    uint8_t* py = const_cast<uint8_t*>(in.y);
+    uint8_t* pcb = const_cast<uint8_t*>(in.cb);
+    uint8_t* pcr = const_cast<uint8_t*>(in.cr);
+
+    for (int32_t i = 0; i < paddedHeight; i++) {
+        /* Once we are in the padding territory we still point to the last line
+         * effectively replicating it several times ~ CLAMP_TO_EDGE */
+        int li = std::min(i, in.height - 1);
+        yLines[i] = static_cast<JSAMPROW>(py + li * in.yStride);
+        if (i < paddedHeight / cVSubSampling) {
+            li = std::min(i, (in.height - 1) / cVSubSampling);
+            cbLines[i] = static_cast<JSAMPROW>(pcb + li * in.cStride);
+            crLines[i] = static_cast<JSAMPROW>(pcr + li * in.cStride);
+        }
+    }
+
+    /* If APP1 data was passed in, use it */
+    if (app1Buffer && app1Size) {
+        jpeg_write_marker(&cinfo, JPEG_APP0 + 1, static_cast<const JOCTET*>(app1Buffer), app1Size);
+    }
+
+    /* While we still have padded height left to go, keep giving it one
+     * macroblock at a time. */
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const uint32_t batchSize = DCTSIZE * maxVSampFactor;
+        const uint32_t nl = cinfo.next_scanline;
+        JSAMPARRAY planes[3]{&yLines[nl], &cbLines[nl / cVSubSampling],
+                             &crLines[nl / cVSubSampling]};
+
+        uint32_t done = jpeg_write_raw_data(&cinfo, planes, batchSize);
+
+        if (done != batchSize) {
+            ALOGE("%s: compressed %u lines, expected %u (total %u/%u)", __FUNCTION__, done,
+                  batchSize, cinfo.next_scanline, cinfo.image_height);
+            return -1;
+        }
+    }
+
+    /* This will flush everything */
+    jpeg_finish_compress(&cinfo);
+
+    /* Grab the actual code size and set it */
+    *actualCodeSize = dmgr.mEncodedSize;
+
+    return 0;
+}
+
+// Offsets into the headers of a JPEG written by encodeOnePass
+struct JpegLayout {
+    size_t app0End = 2;   // end of the JFIF APP0 segment, or of SOI if there is none
+    size_t sofHeight = 0;  // image height field of the SOF segment
+    size_t scanStart = 0;  // entropy coded data, right after the SOS segment
+};
+
+bool parseJpegLayout(const uint8_t* code, size_t size, JpegLayout* layout) {
+    size_t pos = 2;  // skip SOI
+    while (pos + 4 <= size) {
+        if (code[pos] != 0xFF) {
+            ALOGE("%s: no marker at offset %zu", __FUNCTION__, pos);
+            return false;
+        }
+        uint8_t marker = code[pos + 1];
+        size_t length = (code[pos + 2] << 8) | code[pos + 3];
+        if (marker == kMarkerApp0 && pos == 2) {
+            layout->app0End = pos + 2 + length;
+        } else if (marker >= 0xC0 && marker <= 0xC2) {
+            layout->sofHeight = pos + 5;
+        } else if (marker == kMarkerSos) {
+            layout->scanStart = pos + 2 + length;
+            return layout->sofHeight != 0 && layout->scanStart + 2 <= size &&
+                   code[size - 2] == 0xFF && code[size - 1] == kMarkerEoi;
+        }
+        pos += 2 + length;
+    }
+    ALOGE("%s: no scan found in %zu bytes", __FUNCTION__, size);
+    return false;
+}
+}  // anonymous namespace
+
+size_t getJpegStripCount(int32_t width, int32_t height) {
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t bySize = static_cast<size_t>(int64_t(width) * height / kMinPixelsPerStrip);
+    return std::max<size_t>(1, std::min({kMaxJpegThreads, cores, bySize}));
+}
+
+int encodeJpegYU12Strips(const YU12Image& in, int jpegQuality, const JpegApp1Getter& getApp1,
+                         void* out, size_t maxOutSize, size_t numStrips,
+                         size_t* actualCodeSize) {
+    size_t mcuRows = (in.height + kMcuHeight - 1) / kMcuHeight;
+    size_t rowsPerStrip = (mcuRows + numStrips - 1) / std::max<size_t>(numStrips, 1);
+    rowsPerStrip = (rowsPerStrip + kRestartMarkerCycle - 1) / kRestartMarkerCycle *
+                   kRestartMarkerCycle;
+    numStrips = (mcuRows + rowsPerStrip - 1) / rowsPerStrip;
+
+    const uint8_t* app1 = nullptr;
+    size_t app1Size = 0;
+    if (numStrips <= 1) {
+        if (!getApp1(&app1, &app1Size)) {
+            return -1;
+        }
+        return encodeOnePass(in, jpegQuality, app1, app1Size, /*restartEveryRow*/ false, out,
+                             maxOutSize, actualCodeSize);
+    }
+
+    // Each strip gets its share of the output size. The buffers are not zero-filled, so only the
+    // pages a strip writes to are touched.
+    const size_t stripCodeSize = maxOutSize / numStrips + kStripHeaderMargin;
+    std::vector<std::unique_ptr<uint8_t[]>> codes(numStrips);
+    std::vector<size_t> codeSizes(numStrips, 0);
+    std::vector<int> results(numStrips, 0);
+    auto encodeStrip = [&](size_t i) {
+        int32_t top = static_cast<int32_t>(i * rowsPerStrip) * kMcuHeight;
+        YU12Image strip = in;
+        strip.height = std::min<int32_t>(rowsPerStrip * kMcuHeight, in.height - top);
+        strip.y += top * in.yStride;
+        strip.cb += top / 2 * in.cStride;
+        strip.cr += top / 2 * in.cStride;
+        codes[i] = std::unique_ptr<uint8_t[]>(new uint8_t[stripCodeSize]);
+        results[i] = encodeOnePass(strip, jpegQuality, nullptr, 0, /*restartEveryRow*/ true,
+                                   codes[i].get(), stripCodeSize, &codeSizes[i]);
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numStrips; i++) {
+        threads.emplace_back(encodeStrip, i);
+    }
+    encodeStrip(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<JpegLayout> layouts(numStrips);
+    for (size_t i = 0; i < numStrips; i++) {
+        if (results[i] != 0 || !parseJpegLayout(codes[i].get(), codeSizes[i], &layouts[i])) {
+            // e.g. the strip holds more detail than its share of the output size
+            ALOGW("%s: encoding strip %zu/%zu failed, encoding in one pass", __FUNCTION__, i,
+                  numStrips);
+            codes.clear();
+            if (!getApp1(&app1, &app1Size)) {
+                return -1;
+            }
+            return encodeOnePass(in, jpegQuality, app1, app1Size, /*restartEveryRow*/ false, out,
+                                 maxOutSize, actualCodeSize);
+        }
+    }
+
+    if (!getApp1(&app1, &app1Size)) {
+        return -1;
+    }
+    if (app1Size + 2 > 0xFFFF) {
+        ALOGE("%s: APP1 size %zu too large", __FUNCTION__, app1Size);
+        return -1;
+    }
+
+    // Headers and tables of the first strip are shared by all strips, only the height differs
+    uint8_t* first = codes[0].get();
+    const JpegLayout& firstLayout = layouts[0];
+    first[firstLayout.sofHeight] = (in.height >> 8) & 0xFF;
+    first[firstLayout.sofHeight + 1] = in.height & 0xFF;
+
+    uint8_t* dst = static_cast<uint8_t*>(out);
+    size_t written = 0;
+    bool overflow = false;
+    auto write = [&](const uint8_t* data, size_t size) {
+        if (overflow || written + size > maxOutSize) {
+            overflow = true;
+            return;
+        }
+        memcpy(dst + written, data, size);
+        written += size;
+    };
+
+    write(first, firstLayout.app0End);
+    if (app1Size > 0) {
+        const uint8_t app1Header[] = {0xFF, kMarkerApp1, static_cast<uint8_t>((app1Size + 2) >> 8),
+                                      static_cast<uint8_t>((app1Size + 2) & 0xFF)};
+        write(app1Header, sizeof(app1Header));
+        write(app1, app1Size);
+    }
+    write(first + firstLayout.app0End, firstLayout.scanStart - firstLayout.app0End);
+    for (size_t i = 0; i < numStrips; i++) {
+        if (i > 0) {
+            // Strips hold a multiple of 8 MCU rows, the marker after the last row is RST7
+            const uint8_t rst[] = {0xFF, kMarkerRst7};
+            write(rst, sizeof(rst));
+        }
+        // Entropy coded data without the EOI marker
+        write(codes[i].get() + layouts[i].scanStart, codeSizes[i] - 2 - layouts[i].scanStart);
+    }
+    const uint8_t eoi[] = {0xFF, kMarkerEoi};
+    write(eoi, sizeof(eoi));
+
+    if (overflow) {
+        ALOGE("%s: output buffer of %zu bytes too small", __FUNCTION__, maxOutSize);
+        return -1;
+    }
+    *actualCodeSize = written;
+    return 0;
+}
+
+}  // namespace implementation
+}  // namespace device
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
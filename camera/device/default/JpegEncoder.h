@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_INTERFACES_CAMERA_DEVICE_DEFAULT_JPEGENCODER_H_
+#define HARDWARE_INTERFACES_CAMERA_DEVICE_DEFAULT_JPEGENCODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace device {
+namespace implementation {
+
+// A YU12 (I420) image, only depends on libjpeg so it can be benchmarked on host
+struct YU12Image {
+    int32_t width;
+    int32_t height;
+    const uint8_t* y;
+    const uint8_t* cb;
+    const uint8_t* cr;
+    uint32_t yStride;
+    uint32_t cStride;
+};
+
+// Returns the APP1 payload to write after the JFIF header, or false on error. The payload
+// may be empty.
+using JpegApp1Getter = std::function<bool(const uint8_t** app1, size_t* app1Size)>;
+
+// Encodes a baseline JPEG into out. With numStrips > 1, the image is split into horizontal
+// strips of whole restart intervals which are encoded on numStrips threads and stitched into a
+// single JPEG. getApp1 is called once the strips are encoded, so the caller can produce the
+// APP1 payload (e.g. EXIF with a thumbnail) concurrently.
+int encodeJpegYU12Strips(const YU12Image& in, int jpegQuality, const JpegApp1Getter& getApp1,
+                         void* out, size_t maxOutSize, size_t numStrips,
+                         /*out*/ size_t* actualCodeSize);
+
+// Number of strips encodeJpegYU12Strips should use for an image, based on its size and the
+// number of cores
+size_t getJpegStripCount(int32_t width, int32_t height);
+
+}  // namespace implementation
+}  // namespace device
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
+
+#endif  // HARDWARE_INTERFACES_CAMERA_DEVICE_DEFAULT_JPEGENCODER_H_
@@ -0,0 +1,608 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ExtCamSessionBench"
+
+#include "FakeV4l2Device.h"
+
+#include <ExternalCameraDevice.h>
+#include <aidl/android/hardware/camera/device/BnCameraDeviceCallback.h>
+#include <aidl/android/hardware/camera/metadata/RequestAvailableColorSpaceProfilesMap.h>
+#include <aidl/android/hardware/camera/metadata/RequestAvailableDynamicRangeProfilesMap.h>
+#include <aidl/android/hardware/camera/metadata/ScalerAvailableStreamUseCases.h>
+#include <aidl/android/hardware/camera/metadata/SensorPixelMode.h>
+#include <aidlcommonsupport/NativeHandle.h>
+#include <benchmark/benchmark.h>
+#include <sys/resource.h>
+#include <ui/GraphicBufferAllocator.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Frames per second, request to buffer return latency and CPU time per frame of the external
+ * camera HAL, running a full session on a fake 720p30 V4L2 device for a preview stream, preview
+ * plus video, and preview plus still capture, with and without DMA-BUF export. Also reports the
+ * heap allocations per frame, for the whole session and for building the result metadata alone:
+ * adb shell /data/benchmarktest64/camera.device-external-session_benchmark/camera.device-external-session_benchmark
+ *
+ * Trailing arguments are MJPEG files replayed as the camera output instead of synthetic frames.
+ */
+namespace android::hardware::camera::device::implementation {
+
+using ::aidl::android::hardware::camera::device::BnCameraDeviceCallback;
+using ::aidl::android::hardware::camera::device::BufferRequestStatus;
+using ::aidl::android::hardware::camera::device::BufferStatus;
+using ::aidl::android::hardware::camera::device::CaptureResult;
+using ::aidl::android::hardware::camera::device::ErrorCode;
+using ::aidl::android::hardware::camera::device::ICameraDeviceSession;
+using ::aidl::android::hardware::camera::device::NotifyMsg;
+using ::aidl::android::hardware::camera::device::StreamBuffer;
+using ::aidl::android::hardware::camera::device::StreamBufferRequestError;
+using ::aidl::android::hardware::camera::device::StreamBufferRet;
+using ::aidl::android::hardware::camera::device::StreamBuffersVal;
+using ::aidl::android::hardware::camera::device::StreamConfigurationMode;
+using ::aidl::android::hardware::camera::device::StreamRotation;
+using ::aidl::android::hardware::camera::device::StreamType;
+using ::aidl::android::hardware::camera::metadata::RequestAvailableColorSpaceProfilesMap;
+using ::aidl::android::hardware::camera::metadata::RequestAvailableDynamicRangeProfilesMap;
+using ::aidl::android::hardware::camera::metadata::ScalerAvailableStreamUseCases;
+using ::aidl::android::hardware::camera::metadata::SensorPixelMode;
+using ::aidl::android::hardware::common::NativeHandle;
+using ::aidl::android::hardware::graphics::common::BufferUsage;
+using ::aidl::android::hardware::graphics::common::Dataspace;
+using ::aidl::android::hardware::graphics::common::PixelFormat;
+
+namespace {
+const int32_t kWidth = 1280;
+const int32_t kHeight = 720;
+const double kFps = 30.0;
+const size_t kNumSyntheticFrames = 8;
+const uint32_t kMaxInflightRequests = 4;  // REQUEST_PIPELINE_MAX_DEPTH
+
+// MJPEG frames given on the command line
+std::vector<std::string> sMjpegFrameFiles;
+
+// Allocations through operator new in the whole process. The metadata buffers malloc'ed by
+// libcamera_metadata are not seen here; ResultMetadataBuilder counts those it lays out.
+std::atomic<uint64_t> sNumAllocations{0};
+
+// An external camera that streams from a FakeV4l2Device instead of a /dev/video node
+class FakeCameraDevice : public ExternalCameraDevice {
+  public:
+    FakeCameraDevice(const ExternalCameraConfig& cfg,
+                     std::shared_ptr<const FakeV4l2Device::Config> v4l2Config)
+        : ExternalCameraDevice("/dev/video99", cfg), mV4l2Config(std::move(v4l2Config)) {}
+
+  protected:
+    std::unique_ptr<V4l2Device> openV4l2Device() override {
+        return std::make_unique<FakeV4l2Device>(mV4l2Config);
+    }
+
+  private:
+    const std::shared_ptr<const FakeV4l2Device::Config> mV4l2Config;
+};
+
+// Plays the camera framework: hands out gralloc buffers when the HAL asks for them and takes
+// them back with the capture results. A frame is done once all its output buffers are back.
+class SessionCallback : public BnCameraDeviceCallback {
+  public:
+    ~SessionCallback() override { freeBuffers(); }
+
+    void setStreams(const std::vector<Stream>& streams, const std::vector<HalStream>& halStreams) {
+        std::lock_guard<std::mutex> lk(mLock);
+        freeBuffersLocked();
+        mPools.clear();
+        for (size_t i = 0; i < streams.size(); i++) {
+            BufferPool& pool = mPools[streams[i].id];
+            pool.stream = streams[i];
+            pool.halStream = halStreams[i];
+        }
+    }
+
+    void setResultQueue(std::unique_ptr<AidlMessageQueue<int8_t, SynchronizedReadWrite>> queue) {
+        std::lock_guard<std::mutex> lk(mLock);
+        mResultQueue = std::move(queue);
+    }
+
+    void startFrame(int32_t frameNumber, size_t numBuffers) {
+        std::lock_guard<std::mutex> lk(mLock);
+        mInflight[frameNumber] = {systemTime(SYSTEM_TIME_MONOTONIC), numBuffers};
+    }
+
+    // Returns false if the device reported a fatal error
+    bool waitForInflightBelow(size_t count) {
+        std::unique_lock<std::mutex> lk(mLock);
+        mCond.wait(lk, [&] { return mInflight.size() < count || mDeviceError; });
+        return !mDeviceError;
+    }
+
+    // Drops the latency samples and error count recorded so far
+    void resetStats() {
+        std::lock_guard<std::mutex> lk(mLock);
+        mLatenciesNs.clear();
+        mBufferErrors = 0;
+    }
+
+    std::vector<nsecs_t> latenciesNs() {
+        std::lock_guard<std::mutex> lk(mLock);
+        return mLatenciesNs;
+    }
+
+    size_t bufferErrors() {
+        std::lock_guard<std::mutex> lk(mLock);
+        return mBufferErrors;
+    }
+
+    ScopedAStatus notify(const std::vector<NotifyMsg>& msgs) override {
+        std::lock_guard<std::mutex> lk(mLock);
+        for (const auto& msg : msgs) {
+            if (msg.getTag() == NotifyMsg::Tag::error &&
+                msg.get<NotifyMsg::Tag::error>().errorCode == ErrorCode::ERROR_DEVICE) {
+                mDeviceError = true;
+                mCond.notify_all();
+            }
+        }
+        return ScopedAStatus::ok();
+    }
+
+    ScopedAStatus processCaptureResult(const std::vector<CaptureResult>& results) override {
+        std::lock_guard<std::mutex> lk(mLock);
+        for (const auto& result : results) {
+            if (result.fmqResultSize > 0 && mResultQueue != nullptr) {
+                mResultMetadata.resize(result.fmqResultSize);
+                mResultQueue->read(mResultMetadata.data(), result.fmqResultSize);
+            }
+            for (const auto& buffer : result.outputBuffers) {
+                if (buffer.status != BufferStatus::OK) {
+                    mBufferErrors++;
+                }
+                returnBufferLocked(buffer);
+            }
+            auto it = mInflight.find(result.frameNumber);
+            if (it == mInflight.end()) {
+                continue;
+            }
+            it->second.buffersLeft -= std::min(it->second.buffersLeft, result.outputBuffers.size());
+            if (it->second.buffersLeft == 0) {
+                mLatenciesNs.push_back(systemTime(SYSTEM_TIME_MONOTONIC) - it->second.submitTs);
+                mInflight.erase(it);
+                mCond.notify_all();
+            }
+        }
+        return ScopedAStatus::ok();
+    }
+
+    ScopedAStatus requestStreamBuffers(const std::vector<BufferRequest>& bufReqs,
+                                       std::vector<StreamBufferRet>* bufRets,
+                                       BufferRequestStatus* _aidl_return) override {
+        std::lock_guard<std::mutex> lk(mLock);
+        bool allOk = true;
+        bool anyOk = false;
+        bufRets->resize(bufReqs.size());
+        for (size_t i = 0; i < bufReqs.size(); i++) {
+            StreamBufferRet& ret = (*bufRets)[i];
+            ret.streamId = bufReqs[i].streamId;
+            auto it = mPools.find(bufReqs[i].streamId);
+            if (it == mPools.end()) {
+                ret.val.set<StreamBuffersVal::Tag::error>(StreamBufferRequestError::UNKNOWN_ERROR);
+                allOk = false;
+                continue;
+            }
+            std::vector<StreamBuffer> buffers;
+            for (int32_t n = 0; n < bufReqs[i].numBuffersRequested; n++) {
+                StreamBuffer buffer;
+                if (!getBufferLocked(it->second, &buffer)) {
+                    break;
+                }
+                buffers.push_back(std::move(buffer));
+            }
+            if (static_cast<int32_t>(buffers.size()) < bufReqs[i].numBuffersRequested) {
+                for (const auto& buffer : buffers) {
+                    returnBufferLocked(buffer);
+                }
+                ret.val.set<StreamBuffersVal::Tag::error>(
+                        StreamBufferRequestError::MAX_BUFFER_EXCEEDED);
+                allOk = false;
+                continue;
+            }
+            ret.val.set<StreamBuffersVal::Tag::buffers>(std::move(buffers));
+            anyOk = true;
+        }
+        *_aidl_return = allOk  ? BufferRequestStatus::OK
+                        : anyOk ? BufferRequestStatus::FAILED_PARTIAL
+                                : BufferRequestStatus::FAILED_UNKNOWN;
+        return ScopedAStatus::ok();
+    }
+
+    ScopedAStatus returnStreamBuffers(const std::vector<StreamBuffer>& buffers) override {
+        std::lock_guard<std::mutex> lk(mLock);
+        for (const auto& buffer : buffers) {
+            returnBufferLocked(buffer);
+        }
+        return ScopedAStatus::ok();
+    }
+
+  private:
+    struct BufferPool {
+        Stream stream;
+        HalStream halStream;
+        std::unordered_map<int64_t, buffer_handle_t> handles;  // by buffer id
+        std::vector<int64_t> freeIds;
+    };
+
+    struct InflightFrame {
+        nsecs_t submitTs;
+        size_t buffersLeft;
+    };
+
+    // Gralloc buffers are allocated on first use and their handle sent once, after which the
+    // HAL has them cached by buffer id
+    bool getBufferLocked(BufferPool& pool, StreamBuffer* buffer) {
+        *buffer = {pool.stream.id, 0,
+                   NativeHandle(), BufferStatus::OK,
+                   NativeHandle(), NativeHandle()};
+        if (!pool.freeIds.empty()) {
+            buffer->bufferId = pool.freeIds.back();
+            pool.freeIds.pop_back();
+            return true;
+        }
+        if (pool.handles.size() >= static_cast<size_t>(pool.halStream.maxBuffers)) {
+            return false;
+        }
+
+        uint32_t width = pool.stream.width;
+        uint32_t height = pool.stream.height;
+        if (pool.stream.format == PixelFormat::BLOB) {
+            width = pool.stream.bufferSize;
+            height = 1;
+        }
+        uint64_t usage = static_cast<uint64_t>(pool.halStream.producerUsage) |
+                         static_cast<uint64_t>(pool.halStream.consumerUsage);
+        buffer_handle_t handle = nullptr;
+        uint32_t stride = 0;
+        if (GraphicBufferAllocator::get().allocateRawHandle(
+                    width, height, static_cast<int32_t>(pool.halStream.overrideFormat),
+                    /*layerCount*/ 1, usage, &handle, &stride, LOG_TAG) != OK) {
+            ALOGE("%s: allocating a %dx%d buffer failed", __FUNCTION__, width, height);
+            return false;
+        }
+        buffer->bufferId = mNextBufferId++;
+        buffer->buffer = ::android::dupToAidl(handle);
+        pool.handles[buffer->bufferId] = handle;
+        return true;
+    }
+
+    void returnBufferLocked(const StreamBuffer& buffer) {
+        auto it = mPools.find(buffer.streamId);
+        if (buffer.bufferId == 0 || it == mPools.end() ||
+            it->second.handles.count(buffer.bufferId) == 0) {
+            return;
+        }
+        it->second.freeIds.push_back(buffer.bufferId);
+    }
+
+    void freeBuffers() {
+        std::lock_guard<std::mutex> lk(mLock);
+        freeBuffersLocked();
+    }
+
+    void freeBuffersLocked() {
+        for (auto& [streamId, pool] : mPools) {
+            for (auto& [bufferId, handle] : pool.handles) {
+                GraphicBufferAllocator::get().free(handle);
+            }
+            pool.handles.clear();
+            pool.freeIds.clear();
+        }
+    }
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::unordered_map<int32_t, BufferPool> mPools;  // by stream id
+    int64_t mNextBufferId = 1;
+    std::unique_ptr<AidlMessageQueue<int8_t, SynchronizedReadWrite>> mResultQueue;
+    std::vector<int8_t> mResultMetadata;
+    std::unordered_map<int32_t, InflightFrame> mInflight;  // by frame number
+    std::vector<nsecs_t> mLatenciesNs;
+    size_t mBufferErrors = 0;
+    bool mDeviceError = false;
+};
+
+Stream makeStream(int32_t id, PixelFormat format, Dataspace dataSpace, int32_t bufferSize) {
+    return {id,
+            StreamType::OUTPUT,
+            kWidth,
+            kHeight,
+            format,
+            static_cast<BufferUsage>(0),
+            dataSpace,
+            StreamRotation::ROTATION_0,
+            /*physicalCameraId*/ "",
+            bufferSize,
+            /*groupId*/ -1,
+            {SensorPixelMode::ANDROID_SENSOR_PIXEL_MODE_DEFAULT},
+            RequestAvailableDynamicRangeProfilesMap::
+                    ANDROID_REQUEST_AVAILABLE_DYNAMIC_RANGE_PROFILES_MAP_STANDARD,
+            ScalerAvailableStreamUseCases::ANDROID_SCALER_AVAILABLE_STREAM_USE_CASES_DEFAULT,
+            static_cast<int>(
+                    RequestAvailableColorSpaceProfilesMap::
+                            ANDROID_REQUEST_AVAILABLE_COLOR_SPACE_PROFILES_MAP_UNSPECIFIED)};
+}
+
+nsecs_t cpuTimeNs() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return seconds_to_nanoseconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           microseconds_to_nanoseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+}  // anonymous namespace
+
+class ExternalCameraSessionBench : public benchmark::Fixture {
+  public:
+    void SetUp(benchmark::State& state) override {
+        auto v4l2Config = std::make_shared<FakeV4l2Device::Config>();
+        v4l2Config->fourcc = static_cast<uint32_t>(state.range(0));
+        v4l2Config->width = kWidth;
+        v4l2Config->height = kHeight;
+        v4l2Config->fps = kFps;
+        bool framesOk = (v4l2Config->fourcc == V4L2_PIX_FMT_MJPEG && !sMjpegFrameFiles.empty())
+                                ? FakeV4l2Device::loadFrames(sMjpegFrameFiles, v4l2Config.get())
+                                : FakeV4l2Device::makeFrames(kNumSyntheticFrames, v4l2Config.get());
+        if (!framesOk) {
+            state.SkipWithError("cannot prepare the fake camera frames");
+            return;
+        }
+        bool exportDmaBuf = state.range(1) != 0;
+        state.SetLabel(std::string(v4l2Config->fourcc == V4L2_PIX_FMT_MJPEG ? "MJPEG" : "YUYV") +
+                       (exportDmaBuf ? " DMA-BUF" : ""));
+
+        mCfg = std::make_unique<ExternalCameraConfig>(ExternalCameraConfig::loadFromCfg(""));
+        // Do not let the default limits throttle the fake sensor
+        mCfg->fpsLimits = {{{7680, 4320}, kFps}};
+        mCfg->exportDmaBuf = exportDmaBuf;
+
+        mDevice = ndk::SharedRefBase::make<FakeCameraDevice>(*mCfg, v4l2Config);
+        if (mDevice->isInitFailed()) {
+            state.SkipWithError("fake camera device init failed");
+            return;
+        }
+        mDevice->getCameraCharacteristics(&mChars);
+        const camera_metadata_t* staticMeta =
+                reinterpret_cast<const camera_metadata_t*>(mChars.metadata.data());
+        camera_metadata_ro_entry entry;
+        if (find_camera_metadata_ro_entry(staticMeta, ANDROID_JPEG_MAX_SIZE, &entry) == 0 &&
+            entry.count == 1) {
+            mJpegBufferSize = entry.data.i32[0];
+        }
+
+        mCallback = ndk::SharedRefBase::make<SessionCallback>();
+        if (!mDevice->open(mCallback, &mSession).isOk() || mSession == nullptr ||
+            !mSession->constructDefaultRequestSettings(RequestTemplate::PREVIEW, &mSettings)
+                     .isOk()) {
+            state.SkipWithError("cannot open a camera session");
+            return;
+        }
+        MQDescriptor<int8_t, SynchronizedReadWrite> descriptor;
+        if (mSession->getCaptureResultMetadataQueue(&descriptor).isOk()) {
+            mCallback->setResultQueue(
+                    std::make_unique<AidlMessageQueue<int8_t, SynchronizedReadWrite>>(descriptor));
+        }
+    }
+
+    void TearDown(benchmark::State&) override {
+        if (mSession != nullptr) {
+            mSession->close();
+        }
+        mSession.reset();
+        mCallback.reset();
+        mDevice.reset();
+        mCfg.reset();
+    }
+
+  protected:
+    Stream yuvStream(int32_t id) {
+        return makeStream(id, PixelFormat::YCBCR_420_888, Dataspace::UNKNOWN, 0);
+    }
+
+    Stream blobStream(int32_t id) {
+        return makeStream(id, PixelFormat::BLOB, Dataspace::JFIF, mJpegBufferSize);
+    }
+
+    // Configure the streams, then keep up to kMaxInflightRequests requests in flight, one
+    // submitted per iteration, until the benchmark has enough samples
+    void run(benchmark::State& state, const std::vector<Stream>& streams) {
+        if (mSession == nullptr) {
+            return;
+        }
+        StreamConfiguration config = {streams, StreamConfigurationMode::NORMAL_MODE,
+                                      CameraMetadata()};
+        std::vector<HalStream> halStreams;
+        if (!mSession->configureStreams(config, &halStreams).isOk() ||
+            halStreams.size() != streams.size()) {
+            state.SkipWithError("configureStreams failed");
+            return;
+        }
+        mCallback->setStreams(streams, halStreams);
+        uint32_t maxInflight = kMaxInflightRequests;
+        for (const auto& halStream : halStreams) {
+            maxInflight = std::min(maxInflight, static_cast<uint32_t>(halStream.maxBuffers));
+        }
+
+        // Warm up: the first frames pay for buffer allocation and the V4L2 stream start
+        int32_t frameNumber = 0;
+        for (; frameNumber < static_cast<int32_t>(maxInflight) * 2; frameNumber++) {
+            if (!submit(frameNumber, streams, maxInflight)) {
+                state.SkipWithError("warm up capture failed");
+                return;
+            }
+        }
+        mCallback->waitForInflightBelow(1);
+        mCallback->resetStats();
+
+        uint64_t allocStart = sNumAllocations.load(std::memory_order_relaxed);
+        nsecs_t cpuStartNs = cpuTimeNs();
+        for (auto _ : state) {
+            if (!submit(frameNumber++, streams, maxInflight)) {
+                state.SkipWithError("capture failed");
+                break;
+            }
+        }
+        mCallback->waitForInflightBelow(1);
+        nsecs_t cpuNs = cpuTimeNs() - cpuStartNs;
+        uint64_t allocs = sNumAllocations.load(std::memory_order_relaxed) - allocStart;
+
+        std::vector<nsecs_t> latencies = mCallback->latenciesNs();
+        if (latencies.empty()) {
+            return;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        auto percentileMs = [&](size_t p) {
+            return latencies[(latencies.size() - 1) * p / 100] / 1e6;
+        };
+        state.counters["fps"] = benchmark::Counter(latencies.size(), benchmark::Counter::kIsRate);
+        state.counters["p50_ms"] = percentileMs(50);
+        state.counters["p90_ms"] = percentileMs(90);
+        state.counters["p99_ms"] = percentileMs(99);
+        state.counters["cpu_ms_per_frame"] = cpuNs / 1e6 / latencies.size();
+        state.counters["buffer_errors"] = mCallback->bufferErrors();
+        state.counters["allocs_per_frame"] = static_cast<double>(allocs) / latencies.size();
+    }
+
+    // Build the result metadata of consecutive frames sharing the preview settings, the way
+    // processCaptureResult does, and count the allocations it takes
+    void buildResults(benchmark::State& state) {
+        if (mSession == nullptr) {
+            return;
+        }
+        common::V1_0::helper::CameraMetadata chars;
+        chars = reinterpret_cast<const camera_metadata_t*>(mChars.metadata.data());
+        auto settings = std::make_shared<common::V1_0::helper::CameraMetadata>();
+        *settings = reinterpret_cast<const camera_metadata_t*>(mSettings.metadata.data());
+        std::shared_ptr<const common::V1_0::helper::CameraMetadata> requestSettings = settings;
+        ResultMetadataBuilder builder(chars);
+
+        const nsecs_t frameIntervalNs = static_cast<nsecs_t>(1e9 / kFps);
+        nsecs_t timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+        uint64_t allocStart = sNumAllocations.load(std::memory_order_relaxed);
+        for (auto _ : state) {
+            timestamp += frameIntervalNs;
+            const camera_metadata_t* result =
+                    builder.build(requestSettings, timestamp, ANDROID_CONTROL_AF_STATE_INACTIVE);
+            if (result == nullptr) {
+                state.SkipWithError("building the result metadata failed");
+                break;
+            }
+            benchmark::DoNotOptimize(result);
+        }
+        uint64_t allocs = sNumAllocations.load(std::memory_order_relaxed) - allocStart +
+                          builder.numTemplateBuilds();
+        state.counters["allocs_per_frame"] = static_cast<double>(allocs) / state.iterations();
+        state.counters["template_builds"] = builder.numTemplateBuilds();
+    }
+
+    bool submit(int32_t frameNumber, const std::vector<Stream>& streams, uint32_t maxInflight) {
+        if (!mCallback->waitForInflightBelow(maxInflight)) {
+            return false;
+        }
+        std::vector<CaptureRequest> requests(1);
+        CaptureRequest& request = requests[0];
+        request.frameNumber = frameNumber;
+        request.fmqSettingsSize = 0;
+        if (frameNumber == 0) {
+            request.settings = mSettings;
+        }
+        request.inputBuffer = {-1, 0, NativeHandle(), BufferStatus::ERROR, NativeHandle(),
+                               NativeHandle()};
+        for (const auto& stream : streams) {
+            // The HAL requests the buffers itself from the callback
+            request.outputBuffers.push_back({stream.id, /*bufferId*/ 0, NativeHandle(),
+                                             BufferStatus::OK, NativeHandle(), NativeHandle()});
+        }
+
+        mCallback->startFrame(frameNumber, streams.size());
+        int32_t numProcessed = 0;
+        return mSession->processCaptureRequest(requests, {}, &numProcessed).isOk() &&
+               numProcessed == 1;
+    }
+
+    std::unique_ptr<ExternalCameraConfig> mCfg;
+    std::shared_ptr<FakeCameraDevice> mDevice;
+    std::shared_ptr<SessionCallback> mCallback;
+    std::shared_ptr<ICameraDeviceSession> mSession;
+    CameraMetadata mChars;
+    CameraMetadata mSettings;
+    int32_t mJpegBufferSize = 0;
+};
+
+BENCHMARK_DEFINE_F(ExternalCameraSessionBench, Preview)(benchmark::State& state) {
+    run(state, {yuvStream(0)});
+}
+
+BENCHMARK_DEFINE_F(ExternalCameraSessionBench, PreviewVideo)(benchmark::State& state) {
+    run(state, {yuvStream(0), yuvStream(1)});
+}
+
+BENCHMARK_DEFINE_F(ExternalCameraSessionBench, PreviewStill)(benchmark::State& state) {
+    run(state, {yuvStream(0), blobStream(1)});
+}
+
+#define EXTERNAL_CAMERA_SESSION_BENCHMARK(name)                              \
+    BENCHMARK_REGISTER_F(ExternalCameraSessionBench, name)                   \
+            ->ArgNames({"fourcc", "dmabuf"})                                 \
+            ->ArgsProduct({{V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUYV}, {0, 1}}) \
+            ->Iterations(300)                                                \
+            ->Unit(benchmark::kMillisecond)                                  \
+            ->UseRealTime()
+
+EXTERNAL_CAMERA_SESSION_BENCHMARK(Preview);
+EXTERNAL_CAMERA_SESSION_BENCHMARK(PreviewVideo);
+EXTERNAL_CAMERA_SESSION_BENCHMARK(PreviewStill);
+
+BENCHMARK_DEFINE_F(ExternalCameraSessionBench, ResultMetadata)(benchmark::State& state) {
+    buildResults(state);
+}
+BENCHMARK_REGISTER_F(ExternalCameraSessionBench, ResultMetadata)
+        ->ArgNames({"fourcc", "dmabuf"})
+        ->Args({V4L2_PIX_FMT_MJPEG, 0});
+
+}  // namespace android::hardware::camera::device::implementation
+
+void* operator new(size_t size) {
+    android::hardware::camera::device::implementation::sNumAllocations.fetch_add(
+            1, std::memory_order_relaxed);
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        abort();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    // Whatever google-benchmark did not consume is a frame file
+    for (int i = 1; i < argc; i++) {
+        android::hardware::camera::device::implementation::sMjpegFrameFiles.push_back(argv[i]);
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FakeV4l2Device"
+
+#include "FakeV4l2Device.h"
+
+#include <JpegEncoder.h>
+#include <android-base/file.h>
+#include <fcntl.h>
+#include <log/log.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace device {
+namespace implementation {
+
+namespace {
+const uint32_t kBytesPerPixel = 2;  // YUYV, and the largest MJPEG frame we accept
+const uint32_t kPageSize = 4096;
+const int kMjpegQuality = 90;
+
+nsecs_t toNs(std::chrono::milliseconds ms) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(ms).count();
+}
+}  // anonymous namespace
+
+bool FakeV4l2Device::loadFrames(const std::vector<std::string>& paths, Config* config) {
+    config->frames.clear();
+    const size_t maxSize = size_t(config->width) * config->height * kBytesPerPixel;
+    for (const auto& path : paths) {
+        std::string content;
+        if (!base::ReadFileToString(path, &content)) {
+            ALOGE("%s: cannot read frame %s", __FUNCTION__, path.c_str());
+            return false;
+        }
+        if (content.empty() || content.size() > maxSize) {
+            ALOGE("%s: frame %s has %zu bytes, expect 1 to %zu", __FUNCTION__, path.c_str(),
+                  content.size(), maxSize);
+            return false;
+        }
+        config->frames.emplace_back(content.begin(), content.end());
+    }
+    return !config->frames.empty();
+}
+
+bool FakeV4l2Device::makeFrames(size_t numFrames, Config* config) {
+    const uint32_t width = config->width;
+    const uint32_t height = config->height;
+    config->frames.clear();
+
+    std::vector<uint8_t> yu12(width * height * 3 / 2);
+    uint8_t* y = yu12.data();
+    uint8_t* cb = y + width * height;
+    uint8_t* cr = cb + width * height / 4;
+    for (size_t n = 0; n < numFrames; n++) {
+        // A diagonal gradient moving by a few pixels every frame
+        for (uint32_t row = 0; row < height; row++) {
+            for (uint32_t col = 0; col < width; col++) {
+                y[row * width + col] = uint8_t(row + col + n * 4);
+            }
+        }
+        for (uint32_t row = 0; row < height / 2; row++) {
+            for (uint32_t col = 0; col < width / 2; col++) {
+                cb[row * width / 2 + col] = uint8_t(0x80 + row - n);
+                cr[row * width / 2 + col] = uint8_t(0x80 + col + n);
+            }
+        }
+
+        std::vector<uint8_t> frame;
+        if (config->fourcc == V4L2_PIX_FMT_YUYV) {
+            frame.resize(width * height * 2);
+            for (uint32_t row = 0; row < height; row++) {
+                for (uint32_t col = 0; col < width; col += 2) {
+                    uint8_t* out = &frame[(row * width + col) * 2];
+                    uint32_t c = (row / 2) * (width / 2) + col / 2;
+                    out[0] = y[row * width + col];
+                    out[1] = cb[c];
+                    out[2] = y[row * width + col + 1];
+                    out[3] = cr[c];
+                }
+            }
+        } else if (config->fourcc == V4L2_PIX_FMT_MJPEG) {
+            YU12Image image = {.width = static_cast<int32_t>(width),
+                               .height = static_cast<int32_t>(height),
+                               .y = y,
+                               .cb = cb,
+                               .cr = cr,
+                               .yStride = width,
+                               .cStride = width / 2};
+            auto noApp1 = [](const uint8_t** app1, size_t* app1Size) {
+                *app1 = nullptr;
+                *app1Size = 0;
+                return true;
+            };
+            frame.resize(width * height * kBytesPerPixel);
+            size_t codeSize = 0;
+            if (encodeJpegYU12Strips(image, kMjpegQuality, noApp1, frame.data(), frame.size(),
+                                     /*numStrips*/ 1, &codeSize) != 0) {
+                ALOGE("%s: encoding frame %zu failed", __FUNCTION__, n);
+                return false;
+            }
+            frame.resize(codeSize);
+        } else {
+            ALOGE("%s: unsupported fourcc 0x%x", __FUNCTION__, config->fourcc);
+            return false;
+        }
+        config->frames.push_back(std::move(frame));
+    }
+    return !config->frames.empty();
+}
+
+FakeV4l2Device::FakeV4l2Device(std::shared_ptr<const Config> config)
+    : mConfig(std::move(config)),
+      mBufferSize(mConfig->width * mConfig->height * kBytesPerPixel),
+      mFrameIntervalNs(static_cast<nsecs_t>(1e9 / mConfig->fps)) {}
+
+FakeV4l2Device::~FakeV4l2Device() {
+    streamOff();
+    std::lock_guard<std::mutex> lk(mLock);
+    freeBuffersLocked();
+}
+
+int FakeV4l2Device::fail(int error) {
+    errno = error;
+    return -1;
+}
+
+int FakeV4l2Device::ioctl(unsigned long request, void* arg) {
+    switch (request) {
+        case VIDIOC_QUERYCAP: {
+            auto* cap = static_cast<v4l2_capability*>(arg);
+            *cap = {};
+            strlcpy(reinterpret_cast<char*>(cap->driver), "fake", sizeof(cap->driver));
+            strlcpy(reinterpret_cast<char*>(cap->card), "Fake V4L2 camera", sizeof(cap->card));
+            cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+            cap->device_caps = cap->capabilities;
+            return 0;
+        }
+        case VIDIOC_ENUM_FMT:
+            return enumFormat(static_cast<v4l2_fmtdesc*>(arg));
+        case VIDIOC_ENUM_FRAMESIZES:
+            return enumFrameSizes(static_cast<v4l2_frmsizeenum*>(arg));
+        case VIDIOC_ENUM_FRAMEINTERVALS:
+            return enumFrameIntervals(static_cast<v4l2_frmivalenum*>(arg));
+        case VIDIOC_S_FMT:
+            return setFormat(static_cast<v4l2_format*>(arg));
+        case VIDIOC_G_PARM:
+            return getParam(static_cast<v4l2_streamparm*>(arg));
+        case VIDIOC_S_PARM:
+            return setParam(static_cast<v4l2_streamparm*>(arg));
+        case VIDIOC_REQBUFS:
+            return requestBuffers(static_cast<v4l2_requestbuffers*>(arg));
+        case VIDIOC_QUERYBUF:
+            return queryBuffer(static_cast<v4l2_buffer*>(arg));
+        case VIDIOC_EXPBUF:
+            return exportBuffer(static_cast<v4l2_exportbuffer*>(arg));
+        case VIDIOC_QBUF:
+            return queueBuffer(static_cast<v4l2_buffer*>(arg));
+        case VIDIOC_DQBUF:
+            return dequeueBuffer(static_cast<v4l2_buffer*>(arg));
+        case VIDIOC_STREAMON:
+            return streamOn();
+        case VIDIOC_STREAMOFF:
+            return streamOff();
+        default:
+            // Controls and the like are not emulated
+            return fail(ENOTTY);
+    }
+}
+
+int FakeV4l2Device::pollIn(int timeoutMs) {
+    std::unique_lock<std::mutex> lk(mLock);
+    nsecs_t deadline =
+            systemTime(SYSTEM_TIME_MONOTONIC) + toNs(std::chrono::milliseconds(timeoutMs));
+    return waitForFrameLocked(lk, deadline) ? 1 : 0;
+}
+
+void* FakeV4l2Device::mmap(size_t length, uint64_t offset) {
+    std::lock_guard<std::mutex> lk(mLock);
+    const uint64_t stride = (mBufferSize + kPageSize - 1) / kPageSize * kPageSize;
+    uint64_t index = offset / stride;
+    if (offset % stride != 0 || index >= mBuffers.size() || length > mBufferSize) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+    return ::mmap(nullptr, length, PROT_READ, MAP_SHARED, mBuffers[index].memfd.get(), 0);
+}
+
+int FakeV4l2Device::munmap(void* addr, size_t length) {
+    return ::munmap(addr, length);
+}
+
+nsecs_t FakeV4l2Device::frameDueLocked(uint64_t sequence) const {
+    return mStreamOnTs + static_cast<nsecs_t>(sequence + 1) * mFrameIntervalNs;
+}
+
+bool FakeV4l2Device::waitForFrameLocked(std::unique_lock<std::mutex>& lk, nsecs_t deadline) {
+    while (mStreaming) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t wakeUp = deadline;
+        if (!mQueuedBuffers.empty()) {
+            nsecs_t due = frameDueLocked(mNextSequence);
+            if (now >= due) {
+                return true;
+            }
+            wakeUp = std::min(wakeUp, due);
+        }
+        if (now >= deadline) {
+            return false;
+        }
+        mCond.wait_for(lk, std::chrono::nanoseconds(wakeUp - now));
+    }
+    return false;
+}
+
+int FakeV4l2Device::enumFormat(v4l2_fmtdesc* desc) const {
+    if (desc->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || desc->index > 0) {
+        return fail(EINVAL);
+    }
+    desc->flags = mConfig->fourcc == V4L2_PIX_FMT_MJPEG ? V4L2_FMT_FLAG_COMPRESSED : 0;
+    desc->pixelformat = mConfig->fourcc;
+    return 0;
+}
+
+int FakeV4l2Device::enumFrameSizes(v4l2_frmsizeenum* frameSize) const {
+    if (frameSize->pixel_format != mConfig->fourcc || frameSize->index > 0) {
+        return fail(EINVAL);
+    }
+    frameSize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+    frameSize->discrete = {.width = mConfig->width, .height = mConfig->height};
+    return 0;
+}
+
+int FakeV4l2Device::enumFrameIntervals(v4l2_frmivalenum* frameInterval) const {
+    if (frameInterval->pixel_format != mConfig->fourcc || frameInterval->index > 0 ||
+        frameInterval->width != mConfig->width || frameInterval->height != mConfig->height) {
+        return fail(EINVAL);
+    }
+    const uint32_t kPrecision = 10000;
+    frameInterval->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+    frameInterval->discrete = {.numerator = kPrecision,
+                               .denominator = static_cast<uint32_t>(mConfig->fps * kPrecision)};
+    return 0;
+}
+
+int FakeV4l2Device::setFormat(v4l2_format* format) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (format->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || mStreaming || !mBuffers.empty()) {
+        return fail(EBUSY);
+    }
+    // Like a real driver, adjust the request to what the device supports
+    v4l2_pix_format& pix = format->fmt.pix;
+    pix.width = mConfig->width;
+    pix.height = mConfig->height;
+    pix.pixelformat = mConfig->fourcc;
+    pix.field = V4L2_FIELD_NONE;
+    pix.bytesperline = mConfig->fourcc == V4L2_PIX_FMT_YUYV ? mConfig->width * 2 : 0;
+    pix.sizeimage = mBufferSize;
+    return 0;
+}
+
+int FakeV4l2Device::getParam(v4l2_streamparm* param) {
+    if (param->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        return fail(EINVAL);
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    param->parm.capture = {};
+    param->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+    param->parm.capture.timeperframe = {.numerator = static_cast<uint32_t>(mFrameIntervalNs / 1000),
+                                        .denominator = 1000000};
+    return 0;
+}
+
+int FakeV4l2Device::setParam(v4l2_streamparm* param) {
+    v4l2_fract& tpf = param->parm.capture.timeperframe;
+    if (param->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || tpf.numerator == 0 || tpf.denominator == 0) {
+        return fail(EINVAL);
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    // The sensor can only slow down from its native rate
+    nsecs_t requestedNs = static_cast<nsecs_t>(1e9 * tpf.numerator / tpf.denominator);
+    mFrameIntervalNs = std::max(requestedNs, static_cast<nsecs_t>(1e9 / mConfig->fps));
+    tpf = {.numerator = static_cast<uint32_t>(mFrameIntervalNs / 1000), .denominator = 1000000};
+    return 0;
+}
+
+int FakeV4l2Device::requestBuffers(v4l2_requestbuffers* request) {
+    if (request->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || request->memory != V4L2_MEMORY_MMAP) {
+        return fail(EINVAL);
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mStreaming) {
+        return fail(EBUSY);
+    }
+    mQueuedBuffers.clear();
+    freeBuffersLocked();
+    for (uint32_t i = 0; i < request->count; i++) {
+        Buffer buffer;
+        buffer.memfd.reset(memfd_create("fake-v4l2-buffer", MFD_CLOEXEC));
+        if (!buffer.memfd.ok() || ftruncate(buffer.memfd.get(), mBufferSize) != 0) {
+            freeBuffersLocked();
+            return fail(ENOMEM);
+        }
+        void* addr = ::mmap(nullptr, mBufferSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            buffer.memfd.get(), 0);
+        if (addr == MAP_FAILED) {
+            freeBuffersLocked();
+            return fail(ENOMEM);
+        }
+        buffer.data = static_cast<uint8_t*>(addr);
+        mBuffers.push_back(std::move(buffer));
+    }
+    return 0;
+}
+
+void FakeV4l2Device::freeBuffersLocked() {
+    for (auto& buffer : mBuffers) {
+        ::munmap(buffer.data, mBufferSize);
+    }
+    mBuffers.clear();
+}
+
+int FakeV4l2Device::queryBuffer(v4l2_buffer* buffer) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (buffer->index >= mBuffers.size()) {
+        return fail(EINVAL);
+    }
+    const uint32_t stride = (mBufferSize + kPageSize - 1) / kPageSize * kPageSize;
+    buffer->length = mBufferSize;
+    buffer->m.offset = buffer->index * stride;
+    return 0;
+}
+
+int FakeV4l2Device::exportBuffer(v4l2_exportbuffer* expbuf) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (expbuf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || expbuf->index >= mBuffers.size()) {
+        return fail(EINVAL);
+    }
+    // A memfd stands in for the DMA-BUF: it maps the same pages, DMA_BUF_IOCTL_SYNC fails on it
+    int fd = fcntl(mBuffers[expbuf->index].memfd.get(), F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    expbuf->fd = fd;
+    return 0;
+}
+
+int FakeV4l2Device::queueBuffer(v4l2_buffer* buffer) {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (buffer->index >= mBuffers.size() ||
+            std::find(mQueuedBuffers.begin(), mQueuedBuffers.end(), buffer->index) !=
+                    mQueuedBuffers.end()) {
+            return fail(EINVAL);
+        }
+        mQueuedBuffers.push_back(buffer->index);
+    }
+    mCond.notify_all();
+    return 0;
+}
+
+int FakeV4l2Device::dequeueBuffer(v4l2_buffer* buffer) {
+    std::unique_lock<std::mutex> lk(mLock);
+    // The HAL opens the device in blocking mode
+    if (!waitForFrameLocked(lk, std::numeric_limits<nsecs_t>::max())) {
+        return fail(EINVAL);
+    }
+
+    // Frames that came while no buffer was queued are lost, like on a real sensor
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    uint64_t latest = static_cast<uint64_t>((now - mStreamOnTs) / mFrameIntervalNs);
+    uint64_t sequence = std::max(mNextSequence, latest > 0 ? latest - 1 : 0);
+    mNextSequence = sequence + 1;
+
+    uint32_t index = mQueuedBuffers.front();
+    mQueuedBuffers.pop_front();
+    const std::vector<uint8_t>& frame = mConfig->frames[sequence % mConfig->frames.size()];
+    memcpy(mBuffers[index].data, frame.data(), frame.size());
+
+    nsecs_t timestamp = frameDueLocked(sequence);
+    buffer->index = index;
+    buffer->bytesused = frame.size();
+    buffer->flags = V4L2_BUF_FLAG_DONE | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    buffer->field = V4L2_FIELD_NONE;
+    buffer->timestamp.tv_sec = timestamp / 1000000000LL;
+    buffer->timestamp.tv_usec = (timestamp % 1000000000LL) / 1000;
+    buffer->sequence = static_cast<uint32_t>(sequence);
+    buffer->length = mBufferSize;
+    return 0;
+}
+
+int FakeV4l2Device::streamOn() {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (mBuffers.empty()) {
+            return fail(EINVAL);
+        }
+        mStreaming = true;
+        mStreamOnTs = systemTime(SYSTEM_TIME_MONOTONIC);
+        mNextSequence = 0;
+    }
+    mCond.notify_all();
+    return 0;
+}
+
+int FakeV4l2Device::streamOff() {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mStreaming = false;
+        // Buffers go back to the application dequeued
+        mQueuedBuffers.clear();
+    }
+    mCond.notify_all();
+    return 0;
+}
+
+}  // namespace implementation
+}  // namespace device
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
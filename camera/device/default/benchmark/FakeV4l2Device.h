@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_INTERFACES_CAMERA_DEVICE_DEFAULT_BENCHMARK_FAKEV4L2DEVICE_H_
+#define HARDWARE_INTERFACES_CAMERA_DEVICE_DEFAULT_BENCHMARK_FAKEV4L2DEVICE_H_
+
+#include <ExternalCameraUtils.h>
+#include <android-base/unique_fd.h>
+#include <linux/videodev2.h>
+#include <utils/Timers.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace device {
+namespace implementation {
+
+// A V4L2 capture device standing in for a UVC camera. It offers a single format, size and frame
+// rate and replays a list of frames in a loop, paced like a sensor: a frame is ready every frame
+// interval after VIDIOC_STREAMON, and frames are dropped when no buffer is queued in time.
+// Supports mmap buffers, exported as memfds by VIDIOC_EXPBUF, and the ioctls the external camera
+// HAL uses.
+class FakeV4l2Device : public V4l2Device {
+  public:
+    struct Config {
+        uint32_t fourcc;  // V4L2_PIX_FMT_MJPEG or V4L2_PIX_FMT_YUYV
+        uint32_t width;
+        uint32_t height;
+        double fps;
+        // Payload of each frame, replayed in order
+        std::vector<std::vector<uint8_t>> frames;
+    };
+
+    // Each file holds one frame in the configured format. Returns false if a file can't be read.
+    static bool loadFrames(const std::vector<std::string>& paths, Config* config);
+    // Synthesize numFrames frames of a moving gradient in the configured format and size
+    static bool makeFrames(size_t numFrames, Config* config);
+
+    explicit FakeV4l2Device(std::shared_ptr<const Config> config);
+    ~FakeV4l2Device() override;
+
+    int ioctl(unsigned long request, void* arg) override;
+    int pollIn(int timeoutMs) override;
+    void* mmap(size_t length, uint64_t offset) override;
+    int munmap(void* addr, size_t length) override;
+    int fd() const override { return -1; }
+
+  private:
+    // Sets errno and returns -1, like the kernel would
+    static int fail(int error);
+
+    nsecs_t frameDueLocked(uint64_t sequence) const;
+    // Wait until a queued buffer can be filled with the next frame, or until deadline
+    bool waitForFrameLocked(std::unique_lock<std::mutex>& lk, nsecs_t deadline);
+
+    int enumFormat(v4l2_fmtdesc* desc) const;
+    int enumFrameSizes(v4l2_frmsizeenum* frameSize) const;
+    int enumFrameIntervals(v4l2_frmivalenum* frameInterval) const;
+    int setFormat(v4l2_format* format);
+    int getParam(v4l2_streamparm* param);
+    int setParam(v4l2_streamparm* param);
+    int requestBuffers(v4l2_requestbuffers* request);
+    int queryBuffer(v4l2_buffer* buffer);
+    int exportBuffer(v4l2_exportbuffer* expbuf);
+    int queueBuffer(v4l2_buffer* buffer);
+    int dequeueBuffer(v4l2_buffer* buffer);
+    int streamOn();
+    int streamOff();
+    void freeBuffersLocked();
+
+    const std::shared_ptr<const Config> mConfig;
+    const uint32_t mBufferSize;
+
+    std::mutex mLock;  // Protects the states below
+    std::condition_variable mCond;
+    nsecs_t mFrameIntervalNs;
+    struct Buffer {
+        ::android::base::unique_fd memfd;
+        uint8_t* data = nullptr;  // writable mapping of memfd
+    };
+    std::vector<Buffer> mBuffers;
+    std::deque<uint32_t> mQueuedBuffers;  // in QBUF order
+    bool mStreaming = false;
+    nsecs_t mStreamOnTs = 0;
+    uint64_t mNextSequence = 0;
+};
+
+}  // namespace implementation
+}  // namespace device
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
+
+#endif  // HARDWARE_INTERFACES_CAMERA_DEVICE_DEFAULT_BENCHMARK_FAKEV4L2DEVICE_H_
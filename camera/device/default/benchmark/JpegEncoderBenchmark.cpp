@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JpegEncoder.h"
+
+#include <benchmark/benchmark.h>
+#include <vector>
+
+/**
+ * Time to encode a still capture sized YU12 image on one thread versus in 2 and 4 restart
+ * interval strips. The encoder only links libjpeg and liblog, so this also builds and runs on host:
+ * adb shell /data/benchmarktest64/camera.device-external-jpeg_benchmark/camera.device-external-jpeg_benchmark
+ */
+namespace android::hardware::camera::device::implementation {
+
+class JpegEncoderBench : public benchmark::Fixture {
+  public:
+    void SetUp(benchmark::State& state) override {
+        const int32_t width = state.range(0);
+        const int32_t height = state.range(1);
+        // Round up to whole MCUs, like AllocatedFrame does
+        const uint32_t yStride = (width + 15) & ~15;
+        const uint32_t cStride = yStride / 2;
+        const size_t ySize = size_t(yStride) * height;
+        const size_t cSize = size_t(cStride) * ((height + 1) / 2);
+        mPixels.resize(ySize + 2 * cSize);
+        // A gradient with some texture, so the encoder does not only see flat blocks
+        for (int32_t row = 0; row < height; row++) {
+            for (uint32_t col = 0; col < yStride; col++) {
+                mPixels[row * yStride + col] = uint8_t(row + col + ((row * col) & 0x1F));
+            }
+        }
+        for (size_t i = ySize; i < mPixels.size(); i++) {
+            mPixels[i] = uint8_t(0x80 + (i & 0xF));
+        }
+        mImage = {.width = width,
+                  .height = height,
+                  .y = mPixels.data(),
+                  .cb = mPixels.data() + ySize,
+                  .cr = mPixels.data() + ySize + cSize,
+                  .yStride = yStride,
+                  .cStride = cStride};
+        mOut.resize(ySize * 2);
+    }
+
+    void TearDown(benchmark::State&) override {
+        mPixels.clear();
+        mOut.clear();
+    }
+
+  protected:
+    static bool noApp1(const uint8_t** app1, size_t* app1Size) {
+        *app1 = nullptr;
+        *app1Size = 0;
+        return true;
+    }
+
+    std::vector<uint8_t> mPixels;
+    std::vector<uint8_t> mOut;
+    YU12Image mImage;
+};
+
+BENCHMARK_DEFINE_F(JpegEncoderBench, Encode)(benchmark::State& state) {
+    const size_t numStrips = state.range(2);
+    for (auto _ : state) {
+        size_t codeSize = 0;
+        if (encodeJpegYU12Strips(mImage, /*jpegQuality*/ 95, noApp1, mOut.data(), mOut.size(),
+                                 numStrips, &codeSize) != 0) {
+            state.SkipWithError("encodeJpegYU12Strips failed");
+            break;
+        }
+        benchmark::DoNotOptimize(codeSize);
+    }
+    state.SetItemsProcessed(state.iterations() * mImage.width * mImage.height);
+}
+BENCHMARK_REGISTER_F(JpegEncoderBench, Encode)
+        ->ArgNames({"width", "height", "strips"})
+        ->ArgsProduct({{1920}, {1080}, {1, 2, 4}})
+        ->ArgsProduct({{4000}, {3000}, {1, 2, 4}})
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+}  // namespace android::hardware::camera::device::implementation
+
+BENCHMARK_MAIN();
@@ -21,6 +21,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <utils/Log.h>
+#include <limits>
 #include <thread>
 
 #include "Accessor.h"
@@ -32,6 +33,10 @@ namespace aidl::android::hardware::media::bufferpool2::implementation {
 namespace {
     static constexpr nsecs_t kEvictGranularityNs = 1000000000; // 1 sec
     static constexpr nsecs_t kEvictDurationNs = 5000000000; // 5 secs
+    // Clients are woken up to handle invalidations as soon as they are
+    // posted, so ACKs are checked shortly after and then with back-off.
+    static constexpr nsecs_t kInvalidateAckDelayNs = 1000000; // 1 msec
+    static constexpr nsecs_t kInvalidateAckMaxDelayNs = 10000000; // 10 msecs
 }
 
 #ifdef __ANDROID_VNDK__
@@ -173,9 +178,12 @@ bool Accessor::isValid() {
 }
 
 BufferPoolStatus Accessor::flush() {
+    // Evicted allocations are freed after the lock is released.
+    std::vector<std::shared_ptr<BufferPoolAllocation>> evicted;
     std::lock_guard<std::mutex> lock(mBufferPool.mMutex);
     mBufferPool.processStatusMessages();
     mBufferPool.flush(ref<Accessor>());
+    mBufferPool.takeEvictedAllocations(&evicted);
     return ResultStatus::OK;
 }
 
@@ -183,10 +191,21 @@ BufferPoolStatus Accessor::allocate(
         ConnectionId connectionId,
         const std::vector<uint8_t> &params,
         BufferId *bufferId, const native_handle_t** handle) {
+    std::vector<std::shared_ptr<BufferPoolAllocation>> evicted;
     std::unique_lock<std::mutex> lock(mBufferPool.mMutex);
-    mBufferPool.processStatusMessages();
     BufferPoolStatus status = ResultStatus::OK;
-    if (!mBufferPool.getFreeBuffer(mAllocator, params, bufferId, handle)) {
+    // Status messages are processed only when no free buffer is compatible.
+    // Buffers released since the last drain are then still owned and not
+    // recycled yet, but they are never the reason for a new allocation: a new
+    // buffer is only allocated after the drain found no compatible one. The
+    // only cost of the lag is that an older free buffer is recycled before a
+    // more recently released one.
+    bool recycled = mBufferPool.getFreeBuffer(mAllocator, params, bufferId, handle);
+    if (!recycled) {
+        mBufferPool.processStatusMessages();
+        recycled = mBufferPool.getFreeBuffer(mAllocator, params, bufferId, handle);
+    }
+    if (!recycled) {
         lock.unlock();
         std::shared_ptr<BufferPoolAllocation> alloc;
         size_t allocSize;
@@ -203,6 +222,7 @@ BufferPoolStatus Accessor::allocate(
         mBufferPool.handleOwnBuffer(connectionId, *bufferId);
     }
     mBufferPool.cleanUp();
+    mBufferPool.takeEvictedAllocations(&evicted);
     scheduleEvictIfNeeded();
     return status;
 }
@@ -210,6 +230,7 @@ BufferPoolStatus Accessor::allocate(
 BufferPoolStatus Accessor::fetch(
         ConnectionId connectionId, TransactionId transactionId,
         BufferId bufferId, const native_handle_t** handle) {
+    std::vector<std::shared_ptr<BufferPoolAllocation>> evicted;
     std::lock_guard<std::mutex> lock(mBufferPool.mMutex);
     mBufferPool.processStatusMessages();
     auto found = mBufferPool.mTransactions.find(transactionId);
@@ -224,11 +245,13 @@ BufferPoolStatus Accessor::fetch(
             if (bufferIt != mBufferPool.mBuffers.end()) {
                 mBufferPool.mStats.onBufferFetched();
                 *handle = bufferIt->second->handle();
+                mBufferPool.takeEvictedAllocations(&evicted);
                 return ResultStatus::OK;
             }
         }
     }
     mBufferPool.cleanUp();
+    mBufferPool.takeEvictedAllocations(&evicted);
     scheduleEvictIfNeeded();
     return ResultStatus::CRITICAL_ERROR;
 }
@@ -241,6 +264,7 @@ BufferPoolStatus Accessor::connect(
         InvalidationDescriptor* invDescPtr) {
     std::shared_ptr<Connection> newConnection = ::ndk::SharedRefBase::make<Connection>();
     BufferPoolStatus status = ResultStatus::CRITICAL_ERROR;
+    std::vector<std::shared_ptr<BufferPoolAllocation>> evicted;
     {
         std::lock_guard<std::mutex> lock(mBufferPool.mMutex);
         if (newConnection) {
@@ -265,6 +289,7 @@ BufferPoolStatus Accessor::connect(
         }
         mBufferPool.processStatusMessages();
         mBufferPool.cleanUp();
+        mBufferPool.takeEvictedAllocations(&evicted);
         scheduleEvictIfNeeded();
     }
     if (!local && status == ResultStatus::OK) {
@@ -275,6 +300,7 @@ BufferPoolStatus Accessor::connect(
 }
 
 BufferPoolStatus Accessor::close(ConnectionId connectionId) {
+    std::vector<std::shared_ptr<BufferPoolAllocation>> evicted;
     {
         std::lock_guard<std::mutex> lock(mBufferPool.mMutex);
         ALOGV("connection close %lld: %u", (long long)connectionId, mBufferPool.mInvalidation.mId);
@@ -285,6 +311,7 @@ BufferPoolStatus Accessor::close(ConnectionId connectionId) {
         // Since close# will be called after all works are finished, it is OK to
         // evict unused buffers.
         mBufferPool.cleanUp(true);
+        mBufferPool.takeEvictedAllocations(&evicted);
         scheduleEvictIfNeeded();
     }
     sConnectionDeathRecipient->remove(connectionId);
@@ -293,20 +320,30 @@ BufferPoolStatus Accessor::close(ConnectionId connectionId) {
 
 void Accessor::cleanUp(bool clearCache) {
     // transaction timeout, buffer caching TTL handling
+    std::vector<std::shared_ptr<BufferPoolAllocation>> evicted;
     std::lock_guard<std::mutex> lock(mBufferPool.mMutex);
     mBufferPool.processStatusMessages();
     mBufferPool.cleanUp(clearCache);
+    mBufferPool.takeEvictedAllocations(&evicted);
 }
 
-void Accessor::handleInvalidateAck() {
-    std::map<ConnectionId, const std::shared_ptr<IObserver>> observers;
-    uint32_t invalidationId;
-    {
-        std::lock_guard<std::mutex> lock(mBufferPool.mMutex);
-        mBufferPool.processStatusMessages();
-        mBufferPool.mInvalidation.onHandleAck(&observers, &invalidationId);
+bool Accessor::tryEvict() {
+    std::vector<std::shared_ptr<BufferPoolAllocation>> evicted;
+    // Eviction gives way to the allocation path; a busy pool is not idle.
+    std::unique_lock<std::mutex> lock(mBufferPool.mMutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return false;
     }
-    // Do not hold lock for send invalidations
+    mBufferPool.processStatusMessages();
+    mBufferPool.cleanUp(true);
+    mBufferPool.takeEvictedAllocations(&evicted);
+    return true;
+}
+
+namespace {
+void notifyInvalidation(
+        const std::map<ConnectionId, const std::shared_ptr<IObserver>> &observers,
+        uint32_t invalidationId) {
     size_t deadClients = 0;
     for (auto it = observers.begin(); it != observers.end(); ++it) {
         const std::shared_ptr<IObserver> observer = it->second;
@@ -321,85 +358,121 @@ void Accessor::handleInvalidateAck() {
         ALOGD("During invalidation found %zu dead clients", deadClients);
     }
 }
+}  // namespace
+
+void Accessor::handleInvalidateAck() {
+    std::map<ConnectionId, const std::shared_ptr<IObserver>> observers;
+    uint32_t invalidationId;
+    std::vector<std::shared_ptr<BufferPoolAllocation>> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mBufferPool.mMutex);
+        mBufferPool.processStatusMessages();
+        mBufferPool.mInvalidation.onHandleAck(&observers, &invalidationId);
+        mBufferPool.takeEvictedAllocations(&evicted);
+    }
+    // Do not hold lock for send invalidations
+    notifyInvalidation(observers, invalidationId);
+}
+
+bool Accessor::tryHandleInvalidateAck() {
+    std::map<ConnectionId, const std::shared_ptr<IObserver>> observers;
+    uint32_t invalidationId;
+    std::vector<std::shared_ptr<BufferPoolAllocation>> evicted;
+    {
+        std::unique_lock<std::mutex> lock(mBufferPool.mMutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return false;
+        }
+        mBufferPool.processStatusMessages();
+        mBufferPool.mInvalidation.onHandleAck(&observers, &invalidationId);
+        mBufferPool.takeEvictedAllocations(&evicted);
+    }
+    // Do not hold lock for send invalidations
+    notifyInvalidation(observers, invalidationId);
+    return true;
+}
 
 void Accessor::invalidatorThread(
-            std::map<uint32_t, const std::weak_ptr<Accessor>> &accessors,
+            std::map<uint32_t, AccessorInvalidator::Entry> &accessors,
             std::mutex &mutex,
-            std::condition_variable &cv,
-            bool &ready) {
-    constexpr uint32_t NUM_SPIN_TO_INCREASE_SLEEP = 1024;
-    constexpr uint32_t NUM_SPIN_TO_LOG = 1024*8;
-    constexpr useconds_t MAX_SLEEP_US = 10000;
-    uint32_t numSpin = 0;
-    useconds_t sleepUs = 1;
-
-    while(true) {
-        std::map<uint32_t, const std::weak_ptr<Accessor>> copied;
+            std::condition_variable &cv) {
+    std::list<std::pair<uint32_t, const std::weak_ptr<Accessor>>> due;
+    while (true) {
         {
             std::unique_lock<std::mutex> lock(mutex);
-            while (!ready) {
-                numSpin = 0;
-                sleepUs = 1;
-                cv.wait(lock);
+            while (due.empty()) {
+                while (accessors.size() == 0) {
+                    cv.wait(lock);
+                }
+                nsecs_t now = systemTime();
+                nsecs_t nextTs = std::numeric_limits<nsecs_t>::max();
+                for (auto it = accessors.begin(); it != accessors.end(); ++it) {
+                    if (now >= it->second.mNextTs) {
+                        due.emplace_back(it->first, it->second.mAccessor);
+                    } else {
+                        nextTs = std::min(nextTs, it->second.mNextTs);
+                    }
+                }
+                if (due.empty()) {
+                    cv.wait_for(lock, std::chrono::nanoseconds(nextTs - now));
+                }
             }
-            copied.insert(accessors.begin(), accessors.end());
         }
-        std::list<ConnectionId> erased;
-        for (auto it = copied.begin(); it != copied.end(); ++it) {
+        for (auto it = due.begin(); it != due.end(); ++it) {
             const std::shared_ptr<Accessor> acc = it->second.lock();
-            if (!acc) {
-                erased.push_back(it->first);
-            } else {
-                acc->handleInvalidateAck();
+            if (acc) {
+                // If the buffer pool is busy, ACKs are retried after back-off.
+                acc->tryHandleInvalidateAck();
             }
         }
         {
-            std::unique_lock<std::mutex> lock(mutex);
-            for (auto it = erased.begin(); it != erased.end(); ++it) {
-                accessors.erase(*it);
-            }
-            if (accessors.size() == 0) {
-                ready = false;
-            } else {
-                // N.B. Since there is not a efficient way to wait over FMQ,
-                // polling over the FMQ is the current way to prevent draining
-                // CPU.
-                lock.unlock();
-                ++numSpin;
-                if (numSpin % NUM_SPIN_TO_INCREASE_SLEEP == 0 &&
-                    sleepUs < MAX_SLEEP_US) {
-                    sleepUs *= 10;
+            std::lock_guard<std::mutex> lock(mutex);
+            nsecs_t now = systemTime();
+            for (auto it = due.begin(); it != due.end(); ++it) {
+                auto found = accessors.find(it->first);
+                if (found == accessors.end()) {
+                    // All invalidations are synced.
+                    continue;
                 }
-                if (numSpin % NUM_SPIN_TO_LOG == 0) {
-                    ALOGW("invalidator thread spinning");
+                if (found->second.mAccessor.expired()) {
+                    accessors.erase(found);
+                    continue;
                 }
-                ::usleep(sleepUs);
+                found->second.mDelayNs =
+                        std::min(found->second.mDelayNs * 2, kInvalidateAckMaxDelayNs);
+                found->second.mNextTs = now + found->second.mDelayNs;
             }
         }
+        due.clear();
     }
 }
 
-Accessor::AccessorInvalidator::AccessorInvalidator() : mReady(false) {
+Accessor::AccessorInvalidator::AccessorInvalidator() {
     std::thread invalidator(
             invalidatorThread,
             std::ref(mAccessors),
             std::ref(mMutex),
-            std::ref(mCv),
-            std::ref(mReady));
+            std::ref(mCv));
     invalidator.detach();
 }
 
 void Accessor::AccessorInvalidator::addAccessor(
         uint32_t accessorId, const std::weak_ptr<Accessor> &accessor) {
     bool notify = false;
+    nsecs_t ts = systemTime() + kInvalidateAckDelayNs;
     std::unique_lock<std::mutex> lock(mMutex);
-    if (mAccessors.find(accessorId) == mAccessors.end()) {
-        if (!mReady) {
-            mReady = true;
+    auto it = mAccessors.find(accessorId);
+    if (it == mAccessors.end()) {
+        mAccessors.emplace(accessorId, Entry{accessor, ts, kInvalidateAckDelayNs});
+        notify = true;
+        ALOGV("buffer invalidation added bp:%u", accessorId);
+    } else {
+        // A new invalidation restarts the back-off.
+        if (ts < it->second.mNextTs) {
+            it->second.mNextTs = ts;
             notify = true;
         }
-        mAccessors.emplace(accessorId, accessor);
-        ALOGV("buffer invalidation added bp:%u %d", accessorId, notify);
+        it->second.mDelayNs = kInvalidateAckDelayNs;
     }
     lock.unlock();
     if (notify) {
@@ -411,9 +484,6 @@ void Accessor::AccessorInvalidator::delAccessor(uint32_t accessorId) {
     std::lock_guard<std::mutex> lock(mMutex);
     mAccessors.erase(accessorId);
     ALOGV("buffer invalidation deleted bp:%u", accessorId);
-    if (mAccessors.size() == 0) {
-        mReady = false;
-    }
 }
 
 std::unique_ptr<Accessor::AccessorInvalidator> Accessor::sInvalidator;
@@ -429,23 +499,33 @@ void Accessor::evictorThread(
         std::mutex &mutex,
         std::condition_variable &cv) {
     std::list<const std::weak_ptr<Accessor>> evictList;
+    std::list<const std::weak_ptr<Accessor>> busyList;
     while (true) {
         int expired = 0;
         int evicted = 0;
         {
-            nsecs_t now = systemTime();
             std::unique_lock<std::mutex> lock(mutex);
-            while (accessors.size() == 0) {
-                cv.wait(lock);
-            }
-            auto it = accessors.begin();
-            while (it != accessors.end()) {
-                if (now > (it->second + kEvictDurationNs)) {
-                    ++expired;
-                    evictList.push_back(it->first);
-                    it = accessors.erase(it);
-                } else {
-                    ++it;
+            while (expired == 0) {
+                while (accessors.size() == 0) {
+                    cv.wait(lock);
+                }
+                nsecs_t now = systemTime();
+                nsecs_t nextTs = std::numeric_limits<nsecs_t>::max();
+                auto it = accessors.begin();
+                while (it != accessors.end()) {
+                    if (now >= (it->second + kEvictDurationNs)) {
+                        ++expired;
+                        evictList.push_back(it->first);
+                        it = accessors.erase(it);
+                    } else {
+                        nextTs = std::min(nextTs, it->second + kEvictDurationNs);
+                        ++it;
+                    }
+                }
+                if (expired == 0) {
+                    // Accessor activities only postpone the deadlines, so
+                    // there is no need to be notified of them.
+                    cv.wait_for(lock, std::chrono::nanoseconds(nextTs - now));
                 }
             }
         }
@@ -453,15 +533,24 @@ void Accessor::evictorThread(
         for (auto it = evictList.begin(); it != evictList.end(); ++it) {
             const std::shared_ptr<Accessor> accessor = it->lock();
             if (accessor) {
-                accessor->cleanUp(true);
-                ++evicted;
+                if (accessor->tryEvict()) {
+                    ++evicted;
+                } else {
+                    busyList.push_back(*it);
+                }
             }
         }
-        if (expired > 0) {
-            ALOGD("evictor expired: %d, evicted: %d", expired, evicted);
+        if (!busyList.empty()) {
+            nsecs_t now = systemTime();
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto it = busyList.begin(); it != busyList.end(); ++it) {
+                accessors.emplace(*it, now);
+            }
         }
+        ALOGD("evictor expired: %d, evicted: %d, busy: %zu",
+              expired, evicted, busyList.size());
         evictList.clear();
-        ::usleep(kEvictGranularityNs / 1000);
+        busyList.clear();
     }
 }
 
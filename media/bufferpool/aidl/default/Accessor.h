@@ -195,11 +195,20 @@ private:
     nsecs_t mScheduleEvictTs;
     BufferPool mBufferPool;
 
+    /**
+     * Handles buffer invalidation ACKs of accessors with pending
+     * invalidations. Each accessor is checked on its own schedule, which
+     * backs off while its clients have not acknowledged yet.
+     */
     struct  AccessorInvalidator {
-        std::map<uint32_t, const std::weak_ptr<Accessor>> mAccessors;
+        struct Entry {
+            const std::weak_ptr<Accessor> mAccessor;
+            nsecs_t mNextTs;
+            nsecs_t mDelayNs;
+        };
+        std::map<uint32_t, Entry> mAccessors;
         std::mutex mMutex;
         std::condition_variable mCv;
-        bool mReady;
 
         AccessorInvalidator();
         void addAccessor(uint32_t accessorId, const std::weak_ptr<Accessor> &accessor);
@@ -209,11 +218,14 @@ private:
     static std::unique_ptr<AccessorInvalidator> sInvalidator;
 
     static void invalidatorThread(
-        std::map<uint32_t, const std::weak_ptr<Accessor>> &accessors,
+        std::map<uint32_t, AccessorInvalidator::Entry> &accessors,
         std::mutex &mutex,
-        std::condition_variable &cv,
-        bool &ready);
+        std::condition_variable &cv);
 
+    /**
+     * Frees the cached buffers of accessors which have been idle for a while.
+     * The thread sleeps until the earliest eviction deadline of the accessors.
+     */
     struct AccessorEvictor {
         std::map<const std::weak_ptr<Accessor>, nsecs_t, std::owner_less<>> mAccessors;
         std::mutex mMutex;
@@ -230,6 +242,20 @@ private:
         std::mutex &mutex,
         std::condition_variable &cv);
 
+    /**
+     * Handles buffer invalidation ACKs unless the buffer pool is busy.
+     *
+     * @return {@code false} if the buffer pool was busy, {@code true} otherwise.
+     */
+    bool tryHandleInvalidateAck();
+
+    /**
+     * Frees all buffers waiting to be recycled unless the buffer pool is busy.
+     *
+     * @return {@code false} if the buffer pool was busy, {@code true} otherwise.
+     */
+    bool tryEvict();
+
     void scheduleEvictIfNeeded();
 
     friend struct BufferPool;
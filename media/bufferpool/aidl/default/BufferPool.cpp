@@ -38,6 +38,9 @@ namespace {
     static constexpr size_t kMinBufferCountForEviction = 25;
     static constexpr size_t kMaxUnusedBufferCount = 64;
     static constexpr size_t kUnusedBufferCountTarget = kMaxUnusedBufferCount - 16;
+
+    static constexpr size_t kMaxFreeTransactionCount = 64;
+    static constexpr size_t kMaxEmptyBuckets = 8;
 }
 
 BufferPool::BufferPool()
@@ -198,11 +201,11 @@ bool BufferPool::handleReleaseBuffer(
                 iter->second->mTransactionCount == 0) {
             if (!iter->second->mInvalidated) {
                 mStats.onBufferUnused(iter->second->mAllocSize);
-                mFreeBuffers.insert(bufferId);
+                mFreeBuffers.insert(bufferId, iter->second->mConfig);
             } else {
                 mStats.onBufferUnused(iter->second->mAllocSize);
                 mStats.onBufferEvicted(iter->second->mAllocSize);
-                mBuffers.erase(iter);
+                evictBuffer(iter);
                 mInvalidation.onBufferInvalidated(bufferId, mInvalidationChannel);
             }
         }
@@ -240,9 +243,7 @@ bool BufferPool::handleTransferTo(const BufferStatusMessage &message) {
         return false;
     }
     mStats.onBufferSent();
-    mTransactions.insert(std::make_pair(
-            message.transactionId,
-            std::make_unique<TransactionStatus>(message, mTimestampMs)));
+    addTransaction(message);
     insert(&mPendingTransactions, message.targetConnectionId,
            FromAidl(message.transactionId));
     bufferIter->second->mTransactionCount++;
@@ -254,9 +255,7 @@ bool BufferPool::handleTransferFrom(const BufferStatusMessage &message) {
     if (found == mTransactions.end()) {
         // TODO: is it feasible to check ownership here?
         mStats.onBufferSent();
-        mTransactions.insert(std::make_pair(
-                message.transactionId,
-                std::make_unique<TransactionStatus>(message, mTimestampMs)));
+        addTransaction(message);
         insert(&mPendingTransactions, message.connectionId,
                FromAidl(message.transactionId));
         auto bufferIter = mBuffers.find(message.bufferId);
@@ -287,15 +286,15 @@ bool BufferPool::handleTransferResult(const BufferStatusMessage &message) {
                 && bufferIter->second->mTransactionCount == 0) {
                 if (!bufferIter->second->mInvalidated) {
                     mStats.onBufferUnused(bufferIter->second->mAllocSize);
-                    mFreeBuffers.insert(message.bufferId);
+                    mFreeBuffers.insert(message.bufferId, bufferIter->second->mConfig);
                 } else {
                     mStats.onBufferUnused(bufferIter->second->mAllocSize);
                     mStats.onBufferEvicted(bufferIter->second->mAllocSize);
-                    mBuffers.erase(bufferIter);
+                    evictBuffer(bufferIter);
                     mInvalidation.onBufferInvalidated(message.bufferId, mInvalidationChannel);
                 }
             }
-            mTransactions.erase(found);
+            eraseTransaction(found);
         }
         ALOGV("transfer finished %llu %u - %d", (unsigned long long)message.transactionId,
               message.bufferId, deleted);
@@ -306,6 +305,25 @@ bool BufferPool::handleTransferResult(const BufferStatusMessage &message) {
     return false;
 }
 
+void BufferPool::addTransaction(const BufferStatusMessage &message) {
+    std::unique_ptr<TransactionStatus> status;
+    if (mFreeTransactions.empty()) {
+        status = std::make_unique<TransactionStatus>(message, mTimestampMs);
+    } else {
+        status = std::move(mFreeTransactions.back());
+        mFreeTransactions.pop_back();
+        status->init(message, mTimestampMs);
+    }
+    mTransactions.emplace(message.transactionId, std::move(status));
+}
+
+void BufferPool::eraseTransaction(Transactions::iterator it) {
+    if (mFreeTransactions.size() < kMaxFreeTransactionCount) {
+        mFreeTransactions.push_back(std::move(it->second));
+    }
+    mTransactions.erase(it);
+}
+
 void BufferPool::processStatusMessages() {
     std::vector<BufferStatusMessage> messages;
     mObserver.getBufferStatusChanges(messages);
@@ -366,11 +384,11 @@ bool BufferPool::handleClose(ConnectionId connectionId) {
                     // TODO: handle freebuffer insert fail
                     if (!bufferIter->second->mInvalidated) {
                         mStats.onBufferUnused(bufferIter->second->mAllocSize);
-                        mFreeBuffers.insert(bufferId);
+                        mFreeBuffers.insert(bufferId, bufferIter->second->mConfig);
                     } else {
                         mStats.onBufferUnused(bufferIter->second->mAllocSize);
                         mStats.onBufferEvicted(bufferIter->second->mAllocSize);
-                        mBuffers.erase(bufferIter);
+                        evictBuffer(bufferIter);
                         mInvalidation.onBufferInvalidated(bufferId, mInvalidationChannel);
                     }
                 }
@@ -396,36 +414,103 @@ bool BufferPool::handleClose(ConnectionId connectionId) {
                     // TODO: handle freebuffer insert fail
                     if (!bufferIter->second->mInvalidated) {
                         mStats.onBufferUnused(bufferIter->second->mAllocSize);
-                        mFreeBuffers.insert(bufferId);
+                        mFreeBuffers.insert(bufferId, bufferIter->second->mConfig);
                     } else {
                         mStats.onBufferUnused(bufferIter->second->mAllocSize);
                         mStats.onBufferEvicted(bufferIter->second->mAllocSize);
-                        mBuffers.erase(bufferIter);
+                        evictBuffer(bufferIter);
                         mInvalidation.onBufferInvalidated(bufferId, mInvalidationChannel);
                     }
                 }
-                mTransactions.erase(iter);
+                eraseTransaction(iter);
             }
         }
+        mPendingTransactions.erase(pending);
     }
     mConnectionIds.erase(connectionId);
     return true;
 }
 
+void BufferPool::FreeBuffers::insert(BufferId id, const std::vector<uint8_t> &params) {
+    if (mEntries.find(id) != mEntries.end()) {
+        return;
+    }
+    auto [bucketIt, inserted] = mBuckets.try_emplace(params);
+    Bucket &bucket = bucketIt->second;
+    if (!inserted && bucket.empty()) {
+        --mNumEmptyBuckets;
+    }
+    pushBack(&bucket, id);
+    pushBack(&mLru, id);
+    Entry entry{std::prev(mLru.end()), std::prev(bucket.end()), &*bucketIt};
+    if (mSpareEntries.empty()) {
+        mEntries.emplace(id, entry);
+        return;
+    }
+    Entries::node_type node = std::move(mSpareEntries.back());
+    mSpareEntries.pop_back();
+    node.key() = id;
+    node.mapped() = entry;
+    mEntries.insert(std::move(node));
+}
+
+void BufferPool::FreeBuffers::erase(BufferId id) {
+    auto it = mEntries.find(id);
+    if (it == mEntries.end()) {
+        return;
+    }
+    const Entry &entry = it->second;
+    mSpareListNodes.splice(mSpareListNodes.end(), mLru, entry.mLruIt);
+    Bucket &bucket = entry.mBucket->second;
+    mSpareListNodes.splice(mSpareListNodes.end(), bucket, entry.mBucketIt);
+    mSpareEntries.push_back(mEntries.extract(it));
+    if (bucket.empty() && ++mNumEmptyBuckets > kMaxEmptyBuckets) {
+        for (auto bucketIt = mBuckets.begin(); bucketIt != mBuckets.end();) {
+            if (bucketIt->second.empty()) {
+                bucketIt = mBuckets.erase(bucketIt);
+            } else {
+                ++bucketIt;
+            }
+        }
+        mNumEmptyBuckets = 0;
+    }
+}
+
+void BufferPool::FreeBuffers::pushBack(std::list<BufferId> *list, BufferId id) {
+    if (mSpareListNodes.empty()) {
+        list->push_back(id);
+        return;
+    }
+    list->splice(list->end(), mSpareListNodes, mSpareListNodes.begin());
+    list->back() = id;
+}
+
+bool BufferPool::FreeBuffers::findCompatible(
+        const std::shared_ptr<BufferPoolAllocator> &allocator,
+        const std::vector<uint8_t> &params, BufferId *pId) const {
+    auto exact = mBuckets.find(params);
+    if (exact != mBuckets.end() && !exact->second.empty() &&
+            allocator->compatible(params, exact->first)) {
+        *pId = exact->second.back();
+        return true;
+    }
+    for (auto it = mBuckets.begin(); it != mBuckets.end(); ++it) {
+        if (it != exact && !it->second.empty() &&
+                allocator->compatible(params, it->first)) {
+            *pId = it->second.back();
+            return true;
+        }
+    }
+    return false;
+}
+
 bool BufferPool::getFreeBuffer(
         const std::shared_ptr<BufferPoolAllocator> &allocator,
         const std::vector<uint8_t> &params, BufferId *pId,
         const native_handle_t** handle) {
-    auto bufferIt = mFreeBuffers.begin();
-    for (;bufferIt != mFreeBuffers.end(); ++bufferIt) {
-        BufferId bufferId = *bufferIt;
-        if (allocator->compatible(params, mBuffers[bufferId]->mConfig)) {
-            break;
-        }
-    }
-    if (bufferIt != mFreeBuffers.end()) {
-        BufferId id = *bufferIt;
-        mFreeBuffers.erase(bufferIt);
+    BufferId id;
+    if (mFreeBuffers.findCompatible(allocator, params, &id)) {
+        mFreeBuffers.erase(id);
         mStats.onBufferRecycled(mBuffers[id]->mAllocSize);
         *handle = mBuffers[id]->handle();
         *pId = id;
@@ -477,43 +562,60 @@ void BufferPool::cleanUp(bool clearCache) {
                   mStats.mTotalRecycles, mStats.mTotalAllocations,
                   mStats.mTotalFetches, mStats.mTotalTransfers);
         }
-        for (auto freeIt = mFreeBuffers.begin(); freeIt != mFreeBuffers.end();) {
+        // Evicts the least recently freed buffers first.
+        while (!mFreeBuffers.empty()) {
             if (!clearCache && mStats.buffersNotInUse() <= kUnusedBufferCountTarget &&
                     (mStats.mSizeCached < kMinAllocBytesForEviction ||
                      mBuffers.size() < kMinBufferCountForEviction)) {
                 break;
             }
-            auto it = mBuffers.find(*freeIt);
+            BufferId bufferId = mFreeBuffers.oldest();
+            auto it = mBuffers.find(bufferId);
             if (it != mBuffers.end() &&
                     it->second->mOwnerCount == 0 && it->second->mTransactionCount == 0) {
                 mStats.onBufferEvicted(it->second->mAllocSize);
-                mBuffers.erase(it);
-                freeIt = mFreeBuffers.erase(freeIt);
+                evictBuffer(it);
             } else {
-                ++freeIt;
                 ALOGW("bufferpool2 inconsistent!");
             }
+            mFreeBuffers.erase(bufferId);
         }
     }
 }
 
+void BufferPool::evictBuffer(Buffers::iterator it) {
+    mEvictedAllocations.push_back(it->second->mAllocation);
+    // The buffer has no owner left, only its emptied owner set.
+    mUsingConnections.erase(it->first);
+    mBuffers.erase(it);
+}
+
+void BufferPool::takeEvictedAllocations(
+        std::vector<std::shared_ptr<BufferPoolAllocation>> *evicted) {
+    if (!mEvictedAllocations.empty()) {
+        evicted->swap(mEvictedAllocations);
+    }
+}
+
 void BufferPool::invalidate(
         bool needsAck, BufferId from, BufferId to,
         const std::shared_ptr<Accessor> &impl) {
-    for (auto freeIt = mFreeBuffers.begin(); freeIt != mFreeBuffers.end();) {
-        if (isBufferInRange(from, to, *freeIt)) {
-            auto it = mBuffers.find(*freeIt);
+    std::vector<BufferId> evicted;
+    for (BufferId bufferId : mFreeBuffers.mLru) {
+        if (isBufferInRange(from, to, bufferId)) {
+            auto it = mBuffers.find(bufferId);
             if (it != mBuffers.end() &&
                 it->second->mOwnerCount == 0 && it->second->mTransactionCount == 0) {
                 mStats.onBufferEvicted(it->second->mAllocSize);
-                mBuffers.erase(it);
-                freeIt = mFreeBuffers.erase(freeIt);
-                continue;
+                evictBuffer(it);
+                evicted.push_back(bufferId);
             } else {
                 ALOGW("bufferpool2 inconsistent!");
             }
         }
-        ++freeIt;
+    }
+    for (BufferId bufferId : evicted) {
+        mFreeBuffers.erase(bufferId);
     }
 
     size_t left = 0;
@@ -16,14 +16,19 @@
 
 #pragma once
 
+#include <list>
 #include <map>
 #include <set>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <utils/Timers.h>
 
 #include "BufferStatus.h"
+#include "DataHelper.h"
 
 namespace aidl::android::hardware::media::bufferpool2::implementation {
 
@@ -52,20 +57,91 @@ private:
     BufferStatusObserver mObserver;
     BufferInvalidationChannel mInvalidationChannel;
 
-    std::map<ConnectionId, std::set<BufferId>> mUsingBuffers;
-    std::map<BufferId, std::set<ConnectionId>> mUsingConnections;
+    std::unordered_map<ConnectionId, FlatSet<BufferId>> mUsingBuffers;
+    std::unordered_map<BufferId, FlatSet<ConnectionId>> mUsingConnections;
 
-    std::map<ConnectionId, std::set<TransactionId>> mPendingTransactions;
+    std::unordered_map<ConnectionId, FlatSet<TransactionId>> mPendingTransactions;
     // Transactions completed before TRANSFER_TO message arrival.
     // Fetch does not occur for the transactions.
     // Only transaction id is kept for the transactions in short duration.
-    std::set<TransactionId> mCompletedTransactions;
+    std::unordered_set<TransactionId> mCompletedTransactions;
     // Currently active(pending) transations' status & information.
-    std::map<TransactionId, std::unique_ptr<TransactionStatus>>
-            mTransactions;
+    using Transactions =
+            std::unordered_map<TransactionId, std::unique_ptr<TransactionStatus>>;
+    Transactions mTransactions;
+    // Finished transactions' status objects, kept for reuse by new
+    // transactions to avoid an allocation per buffer transfer.
+    std::vector<std::unique_ptr<TransactionStatus>> mFreeTransactions;
+
+    using Buffers = std::unordered_map<BufferId, std::unique_ptr<InternalBuffer>>;
+    Buffers mBuffers;
+    // Allocations of the buffers removed from mBuffers. Freeing an allocation
+    // can be slow, so they are released by the accessor after unlocking
+    // mMutex.
+    std::vector<std::shared_ptr<BufferPoolAllocation>> mEvictedAllocations;
+
+    /// Buffers which are available to be recycled.
+    ///
+    /// Free buffers are bucketed by their allocation parameters, so that a
+    /// compatible buffer is usually found with a single hash lookup. They are
+    /// also kept in the order they became free, for LRU eviction.
+    struct FreeBuffers {
+        struct ParamsHash {
+            size_t operator()(const std::vector<uint8_t> &params) const {
+                return std::hash<std::string_view>()(std::string_view(
+                        reinterpret_cast<const char *>(params.data()), params.size()));
+            }
+        };
+        /// Buffers of the same allocation parameters, most recently freed last.
+        using Bucket = std::list<BufferId>;
+        using Buckets = std::unordered_map<std::vector<uint8_t>, Bucket, ParamsHash>;
+
+        struct Entry {
+            std::list<BufferId>::iterator mLruIt;
+            Bucket::iterator mBucketIt;
+            // Nodes of an unordered_map are stable across rehashes.
+            Buckets::value_type *mBucket;
+        };
+
+        using Entries = std::unordered_map<BufferId, Entry>;
+
+        /// Free buffers, least recently freed first.
+        std::list<BufferId> mLru;
+        /// Emptied buckets are kept until there are more than
+        /// kMaxEmptyBuckets of them, since their params are likely reused.
+        Buckets mBuckets;
+        size_t mNumEmptyBuckets = 0;
+        Entries mEntries;
+
+        /// List and map nodes of erased buffers, which insert() reuses so that
+        /// freeing and recycling buffers does not allocate.
+        std::list<BufferId> mSpareListNodes;
+        std::vector<Entries::node_type> mSpareEntries;
+
+        bool empty() const {
+            return mEntries.empty();
+        }
+
+        /// The least recently freed buffer.
+        BufferId oldest() const {
+            return mLru.front();
+        }
+
+        void insert(BufferId id, const std::vector<uint8_t> &params);
+
+        void erase(BufferId id);
+
+        /// Appends id to list with a spare node if there is one.
+        void pushBack(std::list<BufferId> *list, BufferId id);
+
+        /// Finds the most recently freed buffer compatible with params.
+        /// The bucket of the same params is tried first, then
+        /// compatible() is called once per bucket.
+        bool findCompatible(
+                const std::shared_ptr<BufferPoolAllocator> &allocator,
+                const std::vector<uint8_t> &params, BufferId *pId) const;
+    } mFreeBuffers;
 
-    std::map<BufferId, std::unique_ptr<InternalBuffer>> mBuffers;
-    std::set<BufferId> mFreeBuffers;
     std::set<ConnectionId> mConnectionIds;
 
     struct Invalidation {
@@ -197,6 +273,12 @@ private:
         return mValid;
     }
 
+    /// Starts a transaction from a TRANSFER_TO or TRANSFER_FROM message.
+    void addTransaction(const BufferStatusMessage &message);
+
+    /// Ends a transaction, and keeps its status object for reuse.
+    void eraseTransaction(Transactions::iterator it);
+
     void invalidate(bool needsAck, BufferId from, BufferId to,
                     const std::shared_ptr<Accessor> &impl);
 
@@ -324,6 +406,23 @@ public:
      */
     void cleanUp(bool clearCache = false);
 
+    /**
+     * Removes a buffer from the buffer pool. The allocation of the buffer is
+     * kept until the accessor takes evicted allocations.
+     *
+     * @param it    the iterator of the buffer in mBuffers.
+     */
+    void evictBuffer(Buffers::iterator it);
+
+    /**
+     * Takes the allocations of evicted buffers in order to free them without
+     * holding the lock.
+     *
+     * @param evicted   the allocations of evicted buffers.
+     */
+    void takeEvictedAllocations(
+            std::vector<std::shared_ptr<BufferPoolAllocation>> *evicted);
+
     /**
      * Processes pending buffer status messages and invalidate all current
      * free buffers. Active buffers are invalidated after being inactive.
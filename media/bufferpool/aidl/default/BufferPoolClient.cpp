@@ -17,6 +17,10 @@
 #define LOG_TAG "AidlBufferPoolCli"
 //#define LOG_NDEBUG 0
 
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
 #include <thread>
 #include <aidlcommonsupport/NativeHandle.h>
 #include <utils/Log.h>
@@ -36,6 +40,7 @@ static constexpr int kPostMaxRetry = 3;
 static constexpr int kCacheTtlMs = 1000;
 static constexpr size_t kMaxCachedBufferCount = 64;
 static constexpr size_t kCachedBufferCountTarget = kMaxCachedBufferCount - 16;
+static constexpr int kInvalidationListenerStopRetryMs = 10;
 
 class BufferPoolClient::Impl
         : public std::enable_shared_from_this<BufferPoolClient::Impl> {
@@ -64,8 +69,17 @@ public:
 
     bool isActive(int64_t *lastTransactionMs, bool clearCache);
 
+    ~Impl();
+
     void receiveInvalidation(uint32_t msgID);
 
+    /**
+     * Registers the client to the invalidation listener thread of its buffer
+     * pool, which handles buffer invalidations as soon as they are posted by
+     * the buffer pool, instead of on the next client operation.
+     */
+    void startInvalidationListener();
+
     BufferPoolStatus flush();
 
     BufferPoolStatus allocate(const std::vector<uint8_t> &params,
@@ -111,6 +125,7 @@ private:
 
     struct BlockPoolDataDtor;
     struct ClientBuffer;
+    class InvalidationListenerThread;
 
     bool mLocal;
     bool mValid;
@@ -120,7 +135,9 @@ private:
     uint32_t mSeqId;
     ConnectionId mConnectionId;
     int64_t mLastEvictCacheMs;
-    std::unique_ptr<BufferInvalidationListener> mInvalidationListener;
+    // Shared with the invalidation listener thread.
+    std::shared_ptr<BufferInvalidationListener> mInvalidationListener;
+    std::shared_ptr<InvalidationListenerThread> mInvalidationListenerThread;
 
     // CachedBuffers
     struct BufferCache {
@@ -167,6 +184,145 @@ private:
     std::mutex mRemoteSyncLock;
 };
 
+/**
+ * The buffer invalidation FMQ of a buffer pool is read by every client of the
+ * buffer pool, and its event flag is woken once per posted invalidation. The
+ * clients of a buffer pool in a process share a single thread which waits on
+ * the event flag without a timeout and hands the invalidations to every
+ * client, so that no client misses a wake-up consumed by another one.
+ */
+class BufferPoolClient::Impl::InvalidationListenerThread {
+public:
+    /**
+     * Returns the listener thread of the buffer pool, starting it if the
+     * buffer pool has none in this process yet.
+     *
+     * @param accessor  the buffer pool.
+     * @param listener  the invalidation FMQ of a client of the buffer pool.
+     */
+    static std::shared_ptr<InvalidationListenerThread> get(
+            const std::shared_ptr<IAccessor> &accessor,
+            const std::shared_ptr<BufferInvalidationListener> &listener) {
+        ::ndk::SpAIBinder binder = accessor->asBinder();
+        std::lock_guard<std::mutex> lock(sThreadsLock);
+        auto it = sThreads.find(binder.get());
+        if (it != sThreads.end()) {
+            std::shared_ptr<InvalidationListenerThread> thread = it->second.lock();
+            if (thread) {
+                return thread;
+            }
+        }
+        auto thread = std::make_shared<InvalidationListenerThread>(binder, listener);
+        sThreads[binder.get()] = thread;
+        return thread;
+    }
+
+    InvalidationListenerThread(
+            const ::ndk::SpAIBinder &binder,
+            const std::shared_ptr<BufferInvalidationListener> &listener)
+            : mBinder(binder), mState(std::make_shared<State>(listener)) {
+        mThread = std::thread(run, mState);
+    }
+
+    ~InvalidationListenerThread() {
+        {
+            std::lock_guard<std::mutex> lock(sThreadsLock);
+            auto it = sThreads.find(mBinder.get());
+            if (it != sThreads.end() && it->second.expired()) {
+                sThreads.erase(it);
+            }
+        }
+        std::unique_lock<std::mutex> lock(mState->mLock);
+        mState->mStop = true;
+        if (mThread.get_id() == std::this_thread::get_id()) {
+            // The last client was released by the thread itself, which
+            // exits after handing out the current invalidations.
+            lock.unlock();
+            mThread.detach();
+            return;
+        }
+        // The event flag is shared with the listeners of other processes,
+        // which can consume the interrupt bit.
+        while (!mState->mExited) {
+            mState->mListener->interruptWait();
+            mState->mExitedCv.wait_for(
+                    lock, std::chrono::milliseconds(kInvalidationListenerStopRetryMs));
+        }
+        lock.unlock();
+        mThread.join();
+    }
+
+    void addClient(ConnectionId connectionId, const std::weak_ptr<Impl> &client) {
+        std::lock_guard<std::mutex> lock(mState->mLock);
+        mState->mClients[connectionId] = client;
+    }
+
+    void removeClient(ConnectionId connectionId) {
+        std::lock_guard<std::mutex> lock(mState->mLock);
+        mState->mClients.erase(connectionId);
+    }
+
+private:
+    // Shared with the thread, which can outlive this object when detached.
+    struct State {
+        explicit State(const std::shared_ptr<BufferInvalidationListener> &listener)
+                : mListener(listener), mStop(false), mExited(false) {}
+
+        // Only the event flag of the listener is used.
+        const std::shared_ptr<BufferInvalidationListener> mListener;
+        std::mutex mLock;
+        std::map<ConnectionId, std::weak_ptr<Impl>> mClients;
+        bool mStop;
+        bool mExited;
+        std::condition_variable mExitedCv;
+    };
+
+    static void run(std::shared_ptr<State> state) {
+        std::vector<std::weak_ptr<Impl>> clients;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(state->mLock);
+                if (state->mStop) {
+                    break;
+                }
+            }
+            state->mListener->waitForInvalidations();
+            {
+                std::lock_guard<std::mutex> lock(state->mLock);
+                if (state->mStop) {
+                    break;
+                }
+                for (auto it = state->mClients.begin(); it != state->mClients.end(); ++it) {
+                    clients.push_back(it->second);
+                }
+            }
+            for (auto it = clients.begin(); it != clients.end(); ++it) {
+                std::shared_ptr<Impl> client = it->lock();
+                if (client) {
+                    client->receiveInvalidation(0);
+                }
+            }
+            clients.clear();
+        }
+        std::lock_guard<std::mutex> lock(state->mLock);
+        state->mExited = true;
+        state->mExitedCv.notify_all();
+    }
+
+    // Keeps the key of sThreads from being reused while this is alive.
+    const ::ndk::SpAIBinder mBinder;
+    const std::shared_ptr<State> mState;
+    std::thread mThread;
+
+    static std::mutex sThreadsLock;
+    static std::map<const AIBinder*, std::weak_ptr<InvalidationListenerThread>> sThreads;
+};
+
+std::mutex BufferPoolClient::Impl::InvalidationListenerThread::sThreadsLock;
+std::map<const AIBinder*,
+         std::weak_ptr<BufferPoolClient::Impl::InvalidationListenerThread>>
+        BufferPoolClient::Impl::InvalidationListenerThread::sThreads;
+
 struct BufferPoolClient::Impl::BlockPoolDataDtor {
     BlockPoolDataDtor(const std::shared_ptr<BufferPoolClient::Impl> &impl)
             : mImpl(impl) {}
@@ -283,7 +439,7 @@ BufferPoolClient::Impl::Impl(const std::shared_ptr<Accessor> &accessor,
         mReleasing.mStatusChannel =
                 std::make_unique<BufferStatusChannel>(statusDesc);
         mInvalidationListener =
-                std::make_unique<BufferInvalidationListener>(invDesc);
+                std::make_shared<BufferInvalidationListener>(invDesc);
         mValid = mReleasing.mStatusChannel &&
                 mReleasing.mStatusChannel->isValid() &&
                 mInvalidationListener &&
@@ -299,7 +455,7 @@ BufferPoolClient::Impl::Impl(const std::shared_ptr<IAccessor> &accessor,
     bool valid = false;
     if (accessor && accessor->connect(observer, &conInfo).isOk()) {
         auto channel = std::make_unique<BufferStatusChannel>(conInfo.toFmqDesc);
-        auto observer = std::make_unique<BufferInvalidationListener>(conInfo.fromFmqDesc);
+        auto observer = std::make_shared<BufferInvalidationListener>(conInfo.fromFmqDesc);
 
         if (channel && channel->isValid()
             && observer && observer->isValid()) {
@@ -336,6 +492,22 @@ void BufferPoolClient::Impl::receiveInvalidation(uint32_t messageId) {
     // TODO: evict cache required?
 }
 
+BufferPoolClient::Impl::~Impl() {
+    if (mInvalidationListenerThread) {
+        mInvalidationListenerThread->removeClient(mConnectionId);
+    }
+}
+
+void BufferPoolClient::Impl::startInvalidationListener() {
+    if (!mInvalidationListener->canWait()) {
+        // Invalidations are handled when the IObserver is notified.
+        return;
+    }
+    mInvalidationListenerThread =
+            InvalidationListenerThread::get(mAccessor, mInvalidationListener);
+    mInvalidationListenerThread->addClient(mConnectionId, shared_from_this());
+}
+
 BufferPoolStatus BufferPoolClient::Impl::flush() {
     if (!mLocal || !mLocalConnection || !mValid) {
         return ResultStatus::CRITICAL_ERROR;
@@ -773,11 +945,17 @@ BufferPoolStatus BufferPoolClient::Impl::fetchBufferHandle(
 BufferPoolClient::BufferPoolClient(const std::shared_ptr<Accessor> &accessor,
                                    const std::shared_ptr<IObserver> &observer) {
     mImpl = std::make_shared<Impl>(accessor, observer);
+    if (mImpl && mImpl->isValid()) {
+        mImpl->startInvalidationListener();
+    }
 }
 
 BufferPoolClient::BufferPoolClient(const std::shared_ptr<IAccessor> &accessor,
                                    const std::shared_ptr<IObserver> &observer) {
     mImpl = std::make_shared<Impl>(accessor, observer);
+    if (mImpl && mImpl->isValid()) {
+        mImpl->startInvalidationListener();
+    }
 }
 
 BufferPoolClient::~BufferPoolClient() {
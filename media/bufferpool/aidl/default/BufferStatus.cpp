@@ -25,6 +25,7 @@
 namespace aidl::android::hardware::media::bufferpool2::implementation {
 
 using aidl::android::hardware::media::bufferpool2::BufferStatus;
+using ::android::hardware::EventFlag;
 
 bool isMessageLater(uint32_t curMsgId, uint32_t prevMsgId) {
     return curMsgId != prevMsgId && curMsgId - prevMsgId < prevMsgId - curMsgId;
@@ -40,6 +41,10 @@ bool isBufferInRange(BufferId from, BufferId to, BufferId bufferId) {
 
 static constexpr int kNumElementsInQueue = 1024*16;
 static constexpr int kMinElementsToSyncInQueue = 128;
+// EventFlag bit which is set when buffer invalidation messages are posted.
+static constexpr uint32_t kInvalidationPosted = 1 << 0;
+// EventFlag bit which is set in order to stop waiting for buffer invalidations.
+static constexpr uint32_t kInvalidationWaitInterrupted = 1 << 1;
 
 BufferPoolStatus BufferStatusObserver::open(
         ConnectionId id, StatusDescriptor* fmqDescPtr) {
@@ -202,7 +207,7 @@ bool BufferStatusChannel::postBufferStatusMessage(
 }
 
 BufferInvalidationListener::BufferInvalidationListener(
-        const InvalidationDescriptor &fmqDesc) {
+        const InvalidationDescriptor &fmqDesc) : mEventFlag(nullptr) {
     std::unique_ptr<BufferInvalidationQueue> queue =
             std::make_unique<BufferInvalidationQueue>(fmqDesc);
     if (!queue || queue->isValid() == false) {
@@ -218,6 +223,17 @@ BufferInvalidationListener::BufferInvalidationListener(
     if (avail > 0) {
         mBufferInvalidationQueue->read(temp.data(), avail);
     }
+    if (EventFlag::createEventFlag(
+            mBufferInvalidationQueue->getEventFlagWord(), &mEventFlag) != ::android::OK) {
+        // Falls back to being notified via IObserver only.
+        mEventFlag = nullptr;
+    }
+}
+
+BufferInvalidationListener::~BufferInvalidationListener() {
+    if (mEventFlag) {
+        EventFlag::deleteEventFlag(&mEventFlag);
+    }
 }
 
 void BufferInvalidationListener::getInvalidations(
@@ -242,6 +258,25 @@ void BufferInvalidationListener::getInvalidations(
     }
 }
 
+bool BufferInvalidationListener::canWait() {
+    return mValid && mEventFlag;
+}
+
+void BufferInvalidationListener::waitForInvalidations() {
+    if (!canWait()) {
+        return;
+    }
+    uint32_t efState = 0;
+    // A timeout of 0 waits until one of the bits is set.
+    mEventFlag->wait(kInvalidationPosted | kInvalidationWaitInterrupted, &efState, 0);
+}
+
+void BufferInvalidationListener::interruptWait() {
+    if (canWait()) {
+        mEventFlag->wake(kInvalidationWaitInterrupted);
+    }
+}
+
 bool BufferInvalidationListener::isValid() {
     return mValid;
 }
@@ -249,9 +284,21 @@ bool BufferInvalidationListener::isValid() {
 BufferInvalidationChannel::BufferInvalidationChannel()
     : mValid(true),
       mBufferInvalidationQueue(
-              std::make_unique<BufferInvalidationQueue>(kNumElementsInQueue, true)) {
+              std::make_unique<BufferInvalidationQueue>(kNumElementsInQueue, true)),
+      mEventFlag(nullptr) {
     if (!mBufferInvalidationQueue || mBufferInvalidationQueue->isValid() == false) {
         mValid = false;
+        return;
+    }
+    if (EventFlag::createEventFlag(
+            mBufferInvalidationQueue->getEventFlagWord(), &mEventFlag) != ::android::OK) {
+        mEventFlag = nullptr;
+    }
+}
+
+BufferInvalidationChannel::~BufferInvalidationChannel() {
+    if (mEventFlag) {
+        EventFlag::deleteEventFlag(&mEventFlag);
     }
 }
 
@@ -275,6 +322,11 @@ void BufferInvalidationChannel::postInvalidation(
     message.toBufferId = toId;
     // TODO: handle failure (it does not happen normally.)
     mBufferInvalidationQueue->write(&message);
+    if (mEventFlag) {
+        // N.B. The wake-up is a no-op while the bit is already set, so a
+        // burst of invalidations costs at most one futex wake.
+        mEventFlag->wake(kInvalidationPosted);
+    }
 }
 
 }  // namespace ::aidl::android::hardware::media::bufferpool2::implementation
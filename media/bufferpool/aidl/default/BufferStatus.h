@@ -17,6 +17,7 @@
 #pragma once
 
 #include <bufferpool2/BufferPoolTypes.h>
+#include <fmq/EventFlag.h>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -152,6 +153,7 @@ class BufferInvalidationListener {
 private:
     bool mValid;
     std::unique_ptr<BufferInvalidationQueue> mBufferInvalidationQueue;
+    ::android::hardware::EventFlag *mEventFlag;
 
 public:
     /**
@@ -161,12 +163,29 @@ public:
      */
     BufferInvalidationListener(const InvalidationDescriptor &fmqDesc);
 
+    ~BufferInvalidationListener();
+
     /** Retrieves all pending buffer invalidation messages from the buffer pool.
      *
      * @param messages  retrieved pending messages.
      */
     void getInvalidations(std::vector<BufferInvalidationMessage> &messages);
 
+    /**
+     * Returns whether waitForInvalidations() is supported, i.e. whether the
+     * event flag of the FMQ is available.
+     */
+    bool canWait();
+
+    /**
+     * Waits without a timeout until the buffer pool posts buffer invalidation
+     * messages, or until interruptWait() is called.
+     */
+    void waitForInvalidations();
+
+    /** Wakes up the thread which is blocked in waitForInvalidations(). */
+    void interruptWait();
+
     /** Returns whether the FMQ is connected successfully. */
     bool isValid();
 };
@@ -180,6 +199,7 @@ class BufferInvalidationChannel {
 private:
     bool mValid;
     std::unique_ptr<BufferInvalidationQueue> mBufferInvalidationQueue;
+    ::android::hardware::EventFlag *mEventFlag;
 
 public:
     /**
@@ -187,6 +207,8 @@ public:
      */
     BufferInvalidationChannel();
 
+    ~BufferInvalidationChannel();
+
     /** Returns whether the FMQ is connected successfully. */
     bool isValid();
 
@@ -198,7 +220,8 @@ public:
      */
     void getDesc(InvalidationDescriptor* _Nonnull fmqDescPtr);
 
-    /** Posts a buffer invalidation for invalidated buffers.
+    /** Posts a buffer invalidation for invalidated buffers, and wakes up the
+     * clients waiting for buffer invalidations.
      *
      * @param msgId     Invalidation message id which is used when clients send
      *                  acks back via BufferStatusMessage
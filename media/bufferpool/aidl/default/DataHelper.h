@@ -19,49 +19,81 @@
 #include <aidl/android/hardware/media/bufferpool2/BufferStatusMessage.h>
 #include <bufferpool2/BufferPoolTypes.h>
 
-#include <map>
-#include <set>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
 
 namespace aidl::android::hardware::media::bufferpool2::implementation {
 
-// Helper template methods for handling map of set.
-template<class T, class U>
-bool insert(std::map<T, std::set<U>> *mapOfSet, T key, U value) {
-    auto iter = mapOfSet->find(key);
-    if (iter == mapOfSet->end()) {
-        std::set<U> valueSet{value};
-        mapOfSet->insert(std::make_pair(key, valueSet));
+// A set of a few values kept sorted in a vector. Lookups are cache friendly
+// and updates don't allocate once the vector has grown.
+template<class T>
+class FlatSet {
+public:
+    using const_iterator = typename std::vector<T>::const_iterator;
+
+    bool insert(T value) {
+        auto it = std::lower_bound(mValues.begin(), mValues.end(), value);
+        if (it != mValues.end() && *it == value) {
+            return false;
+        }
+        mValues.insert(it, value);
         return true;
-    } else if (iter->second.find(value)  == iter->second.end()) {
-        iter->second.insert(value);
+    }
+
+    bool erase(T value) {
+        auto it = std::lower_bound(mValues.begin(), mValues.end(), value);
+        if (it == mValues.end() || *it != value) {
+            return false;
+        }
+        mValues.erase(it);
         return true;
     }
-    return false;
-}
+
+    bool contains(T value) const {
+        return std::binary_search(mValues.begin(), mValues.end(), value);
+    }
+
+    size_t size() const {
+        return mValues.size();
+    }
+
+    const_iterator begin() const {
+        return mValues.begin();
+    }
+
+    const_iterator end() const {
+        return mValues.end();
+    }
+
+private:
+    std::vector<T> mValues;
+};
 
 // Helper template methods for handling map of set.
 template<class T, class U>
-bool erase(std::map<T, std::set<U>> *mapOfSet, T key, U value) {
-    bool ret = false;
+bool insert(std::unordered_map<T, FlatSet<U>> *mapOfSet, T key, U value) {
+    return (*mapOfSet)[key].insert(value);
+}
+
+// Helper template methods for handling map of set. An emptied set is kept
+// in the map so that the key can be reused without allocation, and is removed
+// by the owner of the map once the key goes away.
+template<class T, class U>
+bool erase(std::unordered_map<T, FlatSet<U>> *mapOfSet, T key, U value) {
     auto iter = mapOfSet->find(key);
     if (iter != mapOfSet->end()) {
-        if (iter->second.erase(value) > 0) {
-            ret = true;
-        }
-        if (iter->second.size() == 0) {
-            mapOfSet->erase(iter);
-        }
+        return iter->second.erase(value);
     }
-    return ret;
+    return false;
 }
 
 // Helper template methods for handling map of set.
 template<class T, class U>
-bool contains(std::map<T, std::set<U>> *mapOfSet, T key, U value) {
+bool contains(std::unordered_map<T, FlatSet<U>> *mapOfSet, T key, U value) {
     auto iter = mapOfSet->find(key);
     if (iter != mapOfSet->end()) {
-        auto setIter = iter->second.find(value);
-        return setIter != iter->second.end();
+        return iter->second.contains(value);
     }
     return false;
 }
@@ -105,6 +137,11 @@ struct TransactionStatus {
     bool mSenderValidated;
 
     TransactionStatus(const BufferStatusMessage &message, int64_t timestampMs) {
+        init(message, timestampMs);
+    }
+
+    // Re-initializes a recycled transaction status.
+    void init(const BufferStatusMessage &message, int64_t timestampMs) {
         mId = message.transactionId;
         mBufferId = message.bufferId;
         mStatus = message.status;
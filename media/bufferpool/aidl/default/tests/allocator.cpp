@@ -239,7 +239,11 @@ bool TestBufferPoolAllocator::UnmapMemoryForMutex(void *mem) {
 
 void getTestAllocatorParams(std::vector<uint8_t> *params) {
   constexpr static int kAllocationSize = 1024 * 10;
-  Params ashmemParams(kAllocationSize);
+  getTestAllocatorParams(params, kAllocationSize);
+}
+
+void getTestAllocatorParams(std::vector<uint8_t> *params, uint32_t size) {
+  Params ashmemParams(size);
 
   params->assign(ashmemParams.array, ashmemParams.array + sizeof(ashmemParams));
 }
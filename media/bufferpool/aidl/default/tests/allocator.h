@@ -64,4 +64,7 @@ class TestBufferPoolAllocator : public BufferPoolAllocator {
 // retrieve buffer allocator parameters
 void getTestAllocatorParams(std::vector<uint8_t> *params);
 
+// retrieve buffer allocator parameters for the specified allocation size
+void getTestAllocatorParams(std::vector<uint8_t> *params, uint32_t size);
+
 void getIpcMutexParams(std::vector<uint8_t> *params);
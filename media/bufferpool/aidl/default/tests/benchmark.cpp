@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "buffferpool_benchmark"
+
+#include <benchmark/benchmark.h>
+
+#include <bufferpool2/ClientManager.h>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "allocator.h"
+
+using aidl::android::hardware::media::bufferpool2::implementation::BufferPoolStatus;
+using aidl::android::hardware::media::bufferpool2::implementation::ClientManager;
+using aidl::android::hardware::media::bufferpool2::implementation::ConnectionId;
+using aidl::android::hardware::media::bufferpool2::implementation::TransactionId;
+using aidl::android::hardware::media::bufferpool2::BufferPoolData;
+
+namespace {
+
+// Allocation sizes are multiples of a page.
+constexpr static uint32_t kAllocationUnit = 4096;
+
+// Allocates and releases one buffer per iteration, cycling through the
+// specified number of distinct allocation sizes. The pool is warmed up with a
+// free buffer of every size, so all allocations are recycled.
+void BM_AllocateRecycle(benchmark::State &state) {
+  const size_t numSizes = state.range(0);
+  std::shared_ptr<ClientManager> manager = ClientManager::getInstance();
+  std::shared_ptr<BufferPoolAllocator> allocator =
+      std::make_shared<TestBufferPoolAllocator>();
+  ConnectionId connectionId;
+  if (manager->create(allocator, &connectionId) != ResultStatus::OK) {
+    state.SkipWithError("failed to create a buffer pool");
+    return;
+  }
+
+  std::vector<std::vector<uint8_t>> params(numSizes);
+  for (size_t i = 0; i < numSizes; ++i) {
+    getTestAllocatorParams(&params[i], kAllocationUnit * (i + 1));
+  }
+
+  auto allocate = [&](const std::vector<uint8_t> &vecParams,
+                      std::shared_ptr<BufferPoolData> *buffer) {
+    native_handle_t *allocHandle = nullptr;
+    BufferPoolStatus status =
+        manager->allocate(connectionId, vecParams, &allocHandle, buffer);
+    if (allocHandle) {
+      native_handle_close(allocHandle);
+      native_handle_delete(allocHandle);
+    }
+    return status == ResultStatus::OK;
+  };
+
+  {
+    std::vector<std::shared_ptr<BufferPoolData>> buffers(numSizes);
+    for (size_t i = 0; i < numSizes; ++i) {
+      if (!allocate(params[i], &buffers[i])) {
+        state.SkipWithError("failed to allocate a buffer");
+        manager->close(connectionId);
+        return;
+      }
+    }
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    std::shared_ptr<BufferPoolData> buffer;
+    if (!allocate(params[i++ % numSizes], &buffer)) {
+      state.SkipWithError("failed to allocate a buffer");
+      break;
+    }
+  }
+  manager->close(connectionId);
+}
+
+// The pool keeps up to 48 unused buffers after a clean up.
+BENCHMARK(BM_AllocateRecycle)->Arg(1)->Arg(8)->Arg(32)->Arg(48);
+
+// Transfers one buffer per iteration from a client to a receiver of the same
+// pool, keeping the specified number of received buffers in flight. Every
+// transfer posts TRANSFER_TO, TRANSFER_FROM, TRANSFER_OK and NOT_USED status
+// messages to the pool. Each benchmark thread is a separate client with its
+// own pool.
+void BM_Transfer(benchmark::State &state) {
+  const size_t numInFlight = state.range(0);
+  std::shared_ptr<ClientManager> manager = ClientManager::getInstance();
+  std::shared_ptr<BufferPoolAllocator> allocator =
+      std::make_shared<TestBufferPoolAllocator>();
+  ConnectionId connectionId;
+  ConnectionId receiverId;
+  bool isNew = true;
+  if (manager->create(allocator, &connectionId) != ResultStatus::OK) {
+    state.SkipWithError("failed to create a buffer pool");
+    return;
+  }
+  if (manager->registerSender(manager, connectionId, &receiverId, &isNew) !=
+      ResultStatus::OK) {
+    state.SkipWithError("failed to register a sender");
+    manager->close(connectionId);
+    return;
+  }
+
+  std::vector<uint8_t> vecParams;
+  getTestAllocatorParams(&vecParams);
+  std::deque<std::shared_ptr<BufferPoolData>> inFlight;
+  for (auto _ : state) {
+    std::shared_ptr<BufferPoolData> sbuffer, rbuffer;
+    native_handle_t *allocHandle = nullptr;
+    native_handle_t *recvHandle = nullptr;
+    TransactionId transactionId;
+    int64_t postMs;
+    bool ok =
+        manager->allocate(connectionId, vecParams, &allocHandle, &sbuffer) ==
+            ResultStatus::OK &&
+        manager->postSend(receiverId, sbuffer, &transactionId, &postMs) ==
+            ResultStatus::OK &&
+        manager->receive(receiverId, transactionId, sbuffer->mId, postMs,
+                         &recvHandle, &rbuffer) == ResultStatus::OK;
+    if (allocHandle) {
+      native_handle_close(allocHandle);
+      native_handle_delete(allocHandle);
+    }
+    if (recvHandle) {
+      native_handle_close(recvHandle);
+      native_handle_delete(recvHandle);
+    }
+    if (!ok) {
+      state.SkipWithError("failed to transfer a buffer");
+      break;
+    }
+    inFlight.push_back(std::move(rbuffer));
+    if (inFlight.size() > numInFlight) {
+      inFlight.pop_front();
+    }
+  }
+  inFlight.clear();
+  manager->close(connectionId);
+  state.counters["transfers"] =
+      benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+
+BENCHMARK(BM_Transfer)->Arg(1)->Arg(16)->Arg(32)->ThreadRange(1, 4)->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -136,6 +136,45 @@ TEST_F(BufferpoolSingleTest, RecycleBuffer) {
   EXPECT_TRUE(kNumRecycleTest > 1);
 }
 
+// Buffer recycle test with a pending release.
+// Check whether a released buffer whose status message is not processed yet
+// is recycled instead of a new buffer being allocated, while another free
+// buffer is recycled first.
+TEST_F(BufferpoolSingleTest, RecycleBufferWithPendingRelease) {
+  std::vector<uint8_t> vecParams;
+  getTestAllocatorParams(&vecParams);
+
+  auto allocate = [&](std::shared_ptr<BufferPoolData> *buffer) {
+    native_handle_t *allocHandle = nullptr;
+    BufferPoolStatus status = mManager->allocate(mConnectionId, vecParams, &allocHandle, buffer);
+    if (allocHandle) {
+      native_handle_close(allocHandle);
+      native_handle_delete(allocHandle);
+    }
+    return status == ResultStatus::OK;
+  };
+
+  std::shared_ptr<BufferPoolData> buffer[2];
+  ASSERT_TRUE(allocate(&buffer[0]));
+  ASSERT_TRUE(allocate(&buffer[1]));
+  const BufferId bid[2] = {buffer[0]->mId, buffer[1]->mId};
+  ASSERT_TRUE(bid[0] != bid[1]);
+  buffer[0].reset();
+  buffer[1].reset();
+
+  // Recycles one of the released buffers, the other one stays free.
+  ASSERT_TRUE(allocate(&buffer[0]));
+  // Released while the other buffer is free, so its release is still pending
+  // when the free buffer is recycled, and it is recycled next.
+  buffer[0].reset();
+  ASSERT_TRUE(allocate(&buffer[0]));
+  ASSERT_TRUE(allocate(&buffer[1]));
+  EXPECT_TRUE(buffer[0]->mId != buffer[1]->mId);
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(buffer[i]->mId == bid[0] || buffer[i]->mId == bid[1]);
+  }
+}
+
 // Buffer transfer test.
 // Check whether buffer is transferred to another client successfully.
 TEST_F(BufferpoolSingleTest, TransferBuffer) {
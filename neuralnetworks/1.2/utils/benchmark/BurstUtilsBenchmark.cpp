@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <android/hardware/neuralnetworks/1.2/types.h>
+#include <benchmark/benchmark.h>
+#include <nnapi/hal/1.2/BurstUtils.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+/**
+ * Per inference overhead of the burst FMQ packets of small models, from the request sent by the
+ * controller to the result received back from the server, and the latency of a round trip through
+ * a server thread with and without polling:
+ * adb shell /data/benchmarktest64/neuralnetworks_utils_hal_1_2_benchmark/neuralnetworks_utils_hal_1_2_benchmark
+ */
+namespace android::hardware::neuralnetworks::V1_2::utils {
+namespace {
+
+// Allocations through operator new in the whole process, hidl_vec included
+std::atomic<uint64_t> sNumAllocations{0};
+
+constexpr auto kTiming = V1_2::Timing{.timeOnDevice = 1, .timeInDriver = 2};
+
+// A model with numOperands 4-D inputs and outputs, each in its own pool
+struct Inference {
+    explicit Inference(uint32_t numOperands) {
+        request.inputs.resize(numOperands);
+        request.outputs.resize(numOperands);
+        for (uint32_t i = 0; i < numOperands; ++i) {
+            request.inputs[i] = {.hasNoValue = false,
+                                 .location = {.poolIndex = i, .offset = 0, .length = 4 * 224},
+                                 .dimensions = {1, 224, 224, 3}};
+            request.outputs[i] = {.hasNoValue = false,
+                                  .location = {.poolIndex = numOperands + i, .length = 4 * 1001},
+                                  .dimensions = {1, 1001, 1, 1}};
+            slots.push_back(i);
+            slots.push_back(numOperands + i);
+            outputShapes.push_back({.dimensions = {1, 1001, 1, 1}, .isSufficient = true});
+        }
+    }
+
+    V1_0::Request request;
+    std::vector<int32_t> slots;
+    std::vector<V1_2::OutputShape> outputShapes;
+};
+
+void setCounters(benchmark::State& state, uint64_t numAllocations) {
+    state.counters["allocs_per_inference"] =
+            static_cast<double>(numAllocations) / static_cast<double>(state.iterations());
+    state.counters["inferences"] = benchmark::Counter(static_cast<double>(state.iterations()),
+                                                      benchmark::Counter::kIsRate);
+}
+
+// Round trip through intermediate packets, as both ends of the channels exchanged them before the
+// packets were serialized in place
+void BM_PacketRoundTrip(benchmark::State& state) {
+    const Inference inference(state.range(0));
+
+    const uint64_t allocStart = sNumAllocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        const auto requestPacket =
+                serialize(inference.request, V1_2::MeasureTiming::NO, inference.slots);
+        auto request = deserialize(requestPacket);
+        const auto resultPacket =
+                serialize(V1_0::ErrorStatus::NONE, inference.outputShapes, kTiming);
+        auto result = deserialize(resultPacket);
+        if (!request.has_value() || !result.has_value()) {
+            state.SkipWithError("deserialize failed");
+            break;
+        }
+        benchmark::DoNotOptimize(request);
+        benchmark::DoNotOptimize(result);
+    }
+    setCounters(state, sNumAllocations.load(std::memory_order_relaxed) - allocStart);
+}
+
+// Round trip through the request and result channels, serialized and deserialized in the FMQs
+void BM_ChannelRoundTrip(benchmark::State& state) {
+    const Inference inference(state.range(0));
+    auto [requestSender, requestDescriptor] =
+            RequestChannelSender::create(kExecutionBurstChannelLength).value();
+    const auto requestReceiver =
+            RequestChannelReceiver::create(*requestDescriptor, std::chrono::microseconds(0))
+                    .value();
+    auto [resultReceiver, resultDescriptor] =
+            ResultChannelReceiver::create(kExecutionBurstChannelLength,
+                                          std::chrono::microseconds(0))
+                    .value();
+    const auto resultSender = ResultChannelSender::create(*resultDescriptor).value();
+
+    const uint64_t allocStart = sNumAllocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        const auto sent =
+                requestSender->send(inference.request, V1_2::MeasureTiming::NO, inference.slots);
+        auto request = requestReceiver->getBlocking();
+        const auto returned =
+                resultSender->send(V1_0::ErrorStatus::NONE, inference.outputShapes, kTiming);
+        auto result = resultReceiver->getBlocking();
+        if (!sent.has_value() || !request.has_value() || !returned.has_value() ||
+            !result.has_value()) {
+            state.SkipWithError("round trip failed");
+            break;
+        }
+        benchmark::DoNotOptimize(request);
+        benchmark::DoNotOptimize(result);
+    }
+    setCounters(state, sNumAllocations.load(std::memory_order_relaxed) - allocStart);
+}
+
+// Round trip through a server thread that keeps a CPU busy for state.range(0) microseconds per
+// execution. Both ends poll for at most state.range(1) microseconds before blocking.
+void BM_ServerRoundTrip(benchmark::State& state) {
+    const Inference inference(1);
+    const auto executionTime = std::chrono::microseconds(state.range(0));
+    const auto maxWindow = std::chrono::microseconds(state.range(1));
+    auto [requestSender, requestDescriptor] =
+            RequestChannelSender::create(kExecutionBurstChannelLength).value();
+    const auto requestReceiver =
+            RequestChannelReceiver::create(*requestDescriptor, maxWindow).value();
+    auto [resultReceiver, resultDescriptor] =
+            ResultChannelReceiver::create(kExecutionBurstChannelLength, maxWindow).value();
+    const auto resultSender = ResultChannelSender::create(*resultDescriptor).value();
+
+    std::thread server([&requestReceiver, &resultSender, &inference, executionTime] {
+        while (requestReceiver->getBlocking().has_value()) {
+            const auto end = std::chrono::steady_clock::now() + executionTime;
+            while (std::chrono::steady_clock::now() < end) {
+            }
+            resultSender->send(V1_0::ErrorStatus::NONE, inference.outputShapes, kTiming);
+        }
+    });
+
+    for (auto _ : state) {
+        const auto sent =
+                requestSender->send(inference.request, V1_2::MeasureTiming::NO, inference.slots);
+        if (!sent.has_value() || !resultReceiver->getBlocking().has_value()) {
+            state.SkipWithError("round trip failed");
+            break;
+        }
+    }
+    requestReceiver->invalidate();
+    server.join();
+
+    const auto controllerStats = resultReceiver->getPollingStats();
+    const auto serverStats = requestReceiver->getPollingStats();
+    const auto iterations = static_cast<double>(state.iterations());
+    state.counters["polling_us_per_inference"] =
+            std::chrono::duration<double, std::micro>(controllerStats.pollingTime +
+                                                      serverStats.pollingTime)
+                    .count() /
+            iterations;
+    state.counters["futex_wakes_per_inference"] =
+            static_cast<double>(controllerStats.numFutexWakes + serverStats.numFutexWakes) /
+            iterations;
+    state.counters["controller_window_us"] =
+            std::chrono::duration<double, std::micro>(controllerStats.window).count();
+    state.counters["server_window_us"] =
+            std::chrono::duration<double, std::micro>(serverStats.window).count();
+}
+
+BENCHMARK(BM_PacketRoundTrip)->ArgName("operands")->Arg(1)->Arg(4)->Arg(16);
+BENCHMARK(BM_ChannelRoundTrip)->ArgName("operands")->Arg(1)->Arg(4)->Arg(16);
+BENCHMARK(BM_ServerRoundTrip)
+        ->ArgNames({"execution_us", "max_window_us"})
+        ->ArgsProduct({{0, 20, 500}, {0, 50}})
+        ->UseRealTime();
+
+}  // namespace
+}  // namespace android::hardware::neuralnetworks::V1_2::utils
+
+void* operator new(size_t size) {
+    android::hardware::neuralnetworks::V1_2::utils::sNumAllocations.fetch_add(
+            1, std::memory_order_relaxed);
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        abort();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+BENCHMARK_MAIN();
@@ -148,9 +148,10 @@ class Burst final : public nn::IBurst, public std::enable_shared_from_this<Burst
      * Creates a burst controller on a prepared model.
      *
      * @param preparedModel Model prepared for execution to execute on.
-     * @param pollingTimeWindow How much time (in microseconds) the Burst is allowed to poll the FMQ
-     *     before waiting on the blocking futex. Polling may result in lower latencies at the
-     *     potential cost of more power usage.
+     * @param pollingTimeWindow The most time (in microseconds) the Burst is allowed to poll the
+     *     FMQ before waiting on the blocking futex. Within it, the Burst polls as long as results
+     *     are expected to take to arrive. Polling may result in lower latencies at the potential
+     *     cost of more power usage.
      * @return Burst Execution burst controller object.
      */
     static nn::GeneralResult<std::shared_ptr<const Burst>> create(
@@ -167,6 +168,9 @@ class Burst final : public nn::IBurst, public std::enable_shared_from_this<Burst
     // See IBurst::cacheMemory for information on this method.
     OptionalCacheHold cacheMemory(const nn::SharedMemory& memory) const override;
 
+    // How the controller has waited for results so far, for tuning its polling window.
+    PollingStats getPollingStats() const;
+
     // See IBurst::execute for information on this method.
     nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>> execute(
             const nn::Request& request, nn::MeasureTiming measure,
@@ -181,11 +185,11 @@ class Burst final : public nn::IBurst, public std::enable_shared_from_this<Burst
             const std::vector<nn::TokenValuePair>& hints,
             const std::vector<nn::ExtensionNameAndPrefix>& extensionNameToPrefix) const override;
 
-    // If fallback is not nullptr, this method will invoke the fallback function to try another
-    // execution path if the packet could not be sent. Otherwise, failing to send the packet will
-    // result in an error.
+    // The request is serialized straight into the request FMQ. If fallback is not nullptr, this
+    // method will invoke the fallback function to try another execution path if the packet could
+    // not be sent. Otherwise, failing to send the packet will result in an error.
     nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>> executeInternal(
-            const std::vector<FmqRequestDatum>& requestPacket,
+            const V1_0::Request& request, MeasureTiming measure, const std::vector<int32_t>& slots,
             const hal::utils::RequestRelocation& relocation, FallbackFunction fallback) const;
 
   private:
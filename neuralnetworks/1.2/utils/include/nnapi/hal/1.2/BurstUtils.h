@@ -19,14 +19,17 @@
 
 #include <android/hardware/neuralnetworks/1.0/types.h>
 #include <android/hardware/neuralnetworks/1.2/types.h>
+#include <fmq/EventFlag.h>
 #include <fmq/MessageQueue.h>
 #include <hidl/MQDescriptor.h>
 #include <nnapi/Result.h>
 #include <nnapi/Types.h>
 #include <nnapi/hal/1.0/ProtectCallback.h>
 
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <memory>
 #include <tuple>
 #include <utility>
@@ -40,23 +43,98 @@ namespace android::hardware::neuralnetworks::V1_2::utils {
 constexpr const size_t kExecutionBurstChannelLength = 1024;
 
 /**
- * Get how long the burst controller should poll while waiting for results to be returned.
+ * Get the longest the burst controller may poll while waiting for results to be returned.
  *
  * This time can be affected by the property "debug.nn.burst-controller-polling-window".
  *
- * @return Polling time in microseconds.
+ * @return Maximum polling time in microseconds.
  */
 std::chrono::microseconds getBurstControllerPollingTimeWindow();
 
 /**
- * Get how long the burst server should poll while waiting for a request to be received.
+ * Get the longest the burst server may poll while waiting for a request to be received.
  *
  * This time can be affected by the property "debug.nn.burst-server-polling-window".
  *
- * @return Polling time in microseconds.
+ * @return Maximum polling time in microseconds.
  */
 std::chrono::microseconds getBurstServerPollingTimeWindow();
 
+/**
+ * How a channel receiver has waited for its packets so far, for tuning the polling windows.
+ */
+struct PollingStats {
+    // Packets received
+    uint64_t numPackets = 0;
+    // Packets received without blocking on the futex, either already available or caught polling
+    uint64_t numPolledPackets = 0;
+    // Times the receiver was woken up after blocking on the futex
+    uint64_t numFutexWakes = 0;
+    // Total time spent polling
+    std::chrono::nanoseconds pollingTime{0};
+    // How long the receiver will poll for the next packet
+    std::chrono::nanoseconds window{0};
+};
+
+/**
+ * Decides how long a channel receiver polls the FMQ before blocking on the futex.
+ *
+ * Polling notices a packet sooner than a futex wake-up does, but keeps a CPU busy for as long as
+ * it lasts. The policy remembers how long the most recent packets took to arrive once the receiver
+ * started waiting: the time between requests on the server, the execution time on the controller.
+ * It polls just long enough to catch most of them, as long as that fits within the maximum window,
+ * and does not poll at all when packets take longer than that to arrive.
+ *
+ * Only the thread receiving on the channel may call getWindow and recordPacket. getStats may be
+ * called from any thread.
+ */
+class PollingPolicy final {
+  public:
+    /**
+     * @param maxWindow Longest the receiver may poll for a packet. Zero disables polling.
+     */
+    explicit PollingPolicy(std::chrono::microseconds maxWindow);
+
+    /**
+     * How long to poll for the next packet.
+     */
+    std::chrono::nanoseconds getWindow() const;
+
+    /**
+     * Learn from how a packet was received.
+     *
+     * @param wait Time from the start of the wait until the packet was available.
+     * @param pollingTime Time spent polling for the packet.
+     * @param numFutexWakes Times the receiver was woken up after blocking on the futex.
+     */
+    void recordPacket(std::chrono::nanoseconds wait, std::chrono::nanoseconds pollingTime,
+                      uint64_t numFutexWakes);
+
+    PollingStats getStats() const;
+
+  private:
+    static constexpr size_t kNumWaits = 16;
+
+    const std::chrono::nanoseconds kMaxWindow;
+    // The most recent waits, in a ring
+    std::array<std::chrono::nanoseconds, kNumWaits> mWaits{};
+    size_t mNumWaits = 0;
+    size_t mNextWait = 0;
+    std::atomic<int64_t> mWindowNs;
+    std::atomic<uint64_t> mNumPackets{0};
+    std::atomic<uint64_t> mNumPolledPackets{0};
+    std::atomic<uint64_t> mNumFutexWakes{0};
+    std::atomic<int64_t> mPollingTimeNs{0};
+};
+
+/**
+ * Deleter of an EventFlag created by EventFlag::createEventFlag.
+ */
+struct EventFlagDeleter {
+    void operator()(EventFlag* eventFlag) const;
+};
+using UniqueEventFlag = std::unique_ptr<EventFlag, EventFlagDeleter>;
+
 /**
  * Function to serialize a request.
  *
@@ -126,6 +204,8 @@ class RequestChannelSender final : public neuralnetworks::utils::IProtectedCallb
     /**
      * Send the request to the channel.
      *
+     * The request is serialized directly into the FMQ, without an intermediate packet.
+     *
      * @param request Request object without the pool information.
      * @param measure Whether to collect timing information for the execution.
      * @param slots Slot identifiers corresponding to memory resources for the request.
@@ -147,6 +227,7 @@ class RequestChannelSender final : public neuralnetworks::utils::IProtectedCallb
 
   private:
     MessageQueue<FmqRequestDatum, kSynchronizedReadWrite> mFmqRequestChannel;
+    UniqueEventFlag mEventFlag;
     std::atomic<bool> mValid{true};
 };
 
@@ -165,9 +246,10 @@ class RequestChannelReceiver final {
      * Create the receiving end of a request channel.
      *
      * @param requestChannel Descriptor for the request channel.
-     * @param pollingTimeWindow How much time (in microseconds) the RequestChannelReceiver is
-     *     allowed to poll the FMQ before waiting on the blocking futex. Polling may result in lower
-     *     latencies at the potential cost of more power usage.
+     * @param pollingTimeWindow The most time (in microseconds) the RequestChannelReceiver is
+     *     allowed to poll the FMQ before waiting on the blocking futex. Within it, the receiver
+     *     polls as long as its PollingPolicy expects the next request to take to arrive. Polling
+     *     may result in lower latencies at the potential cost of more power usage.
      * @return RequestChannelReceiver on successful creation, nullptr otherwise.
      */
     static nn::GeneralResult<std::unique_ptr<RequestChannelReceiver>> create(
@@ -181,6 +263,8 @@ class RequestChannelReceiver final {
      * 1) The packet has been retrieved, or
      * 2) The receiver has been invalidated
      *
+     * The packet is deserialized where it lies in the FMQ, then released.
+     *
      * @return Request object if successfully received, an appropriate message if error or if the
      *     receiver object was invalidated.
      */
@@ -192,16 +276,23 @@ class RequestChannelReceiver final {
      */
     void invalidate();
 
+    /**
+     * How the receiver has waited for requests so far.
+     */
+    PollingStats getPollingStats() const;
+
     RequestChannelReceiver(PrivateConstructorTag tag,
                            const MQDescriptorSync<FmqRequestDatum>& requestChannel,
                            std::chrono::microseconds pollingTimeWindow);
 
   private:
-    nn::Result<std::vector<FmqRequestDatum>> getPacketBlocking();
+    // Waits until a packet is available and returns its size, without reading it
+    nn::Result<size_t> waitForPacket();
 
     MessageQueue<FmqRequestDatum, kSynchronizedReadWrite> mFmqRequestChannel;
+    UniqueEventFlag mEventFlag;
     std::atomic<bool> mTeardown{false};
-    const std::chrono::microseconds kPollingTimeWindow;
+    PollingPolicy mPollingPolicy;
 };
 
 /**
@@ -224,21 +315,25 @@ class ResultChannelSender final {
     /**
      * Send the result to the channel.
      *
+     * The result is serialized directly into the FMQ, without an intermediate packet.
+     *
      * @param errorStatus Status of the execution.
      * @param outputShapes Dynamic shapes of the output tensors.
      * @param timing Timing information of the execution.
+     * @return An empty `Result` on successful send, otherwise an error message.
      */
-    void send(V1_0::ErrorStatus errorStatus, const std::vector<OutputShape>& outputShapes,
-              Timing timing);
+    nn::Result<void> send(V1_0::ErrorStatus errorStatus,
+                          const std::vector<OutputShape>& outputShapes, Timing timing);
 
     // prefer calling ResultChannelSender::send
-    void sendPacket(const std::vector<FmqResultDatum>& packet);
+    nn::Result<void> sendPacket(const std::vector<FmqResultDatum>& packet);
 
     ResultChannelSender(PrivateConstructorTag tag,
                         const MQDescriptorSync<FmqResultDatum>& resultChannel);
 
   private:
     MessageQueue<FmqResultDatum, kSynchronizedReadWrite> mFmqResultChannel;
+    UniqueEventFlag mEventFlag;
 };
 
 /**
@@ -256,9 +351,10 @@ class ResultChannelReceiver final : public neuralnetworks::utils::IProtectedCall
      * Create the receiving end of a result channel.
      *
      * @param channelLength Number of elements in the FMQ.
-     * @param pollingTimeWindow How much time (in microseconds) the ResultChannelReceiver is allowed
-     *     to poll the FMQ before waiting on the blocking futex. Polling may result in lower
-     *     latencies at the potential cost of more power usage.
+     * @param pollingTimeWindow The most time (in microseconds) the ResultChannelReceiver is
+     *     allowed to poll the FMQ before waiting on the blocking futex. Within it, the receiver
+     *     polls as long as its PollingPolicy expects the next result to take to arrive. Polling
+     *     may result in lower latencies at the potential cost of more power usage.
      * @return A pair of ResultChannelReceiver and the FMQ descriptor on successful creation, or
      *     GeneralError otherwise.
      */
@@ -273,6 +369,8 @@ class ResultChannelReceiver final : public neuralnetworks::utils::IProtectedCall
      * 1) The packet has been retrieved, or
      * 2) The receiver has been invalidated
      *
+     * The packet is deserialized where it lies in the FMQ, then released.
+     *
      * @return Result object if successfully received, otherwise an appropriate message if error or
      *     if the receiver object was invalidated.
      */
@@ -284,6 +382,11 @@ class ResultChannelReceiver final : public neuralnetworks::utils::IProtectedCall
      */
     void notifyAsDeadObject() override;
 
+    /**
+     * How the receiver has waited for results so far.
+     */
+    PollingStats getPollingStats() const;
+
     // prefer calling ResultChannelReceiver::getBlocking
     nn::Result<std::vector<FmqResultDatum>> getPacketBlocking();
 
@@ -291,9 +394,13 @@ class ResultChannelReceiver final : public neuralnetworks::utils::IProtectedCall
                           std::chrono::microseconds pollingTimeWindow);
 
   private:
+    // Waits until a packet is available and returns its size, without reading it
+    nn::Result<size_t> waitForPacket();
+
     MessageQueue<FmqResultDatum, kSynchronizedReadWrite> mFmqResultChannel;
+    UniqueEventFlag mEventFlag;
     std::atomic<bool> mValid{true};
-    const std::chrono::microseconds kPollingTimeWindow;
+    PollingPolicy mPollingPolicy;
 };
 
 }  // namespace android::hardware::neuralnetworks::V1_2::utils
@@ -21,15 +21,20 @@
 #include <android/hardware/neuralnetworks/1.0/types.h>
 #include <android/hardware/neuralnetworks/1.1/types.h>
 #include <android/hardware/neuralnetworks/1.2/types.h>
+#include <fmq/EventFlag.h>
 #include <fmq/MessageQueue.h>
 #include <hidl/MQDescriptor.h>
 #include <nnapi/Result.h>
 #include <nnapi/Types.h>
 #include <nnapi/hal/1.0/ProtectCallback.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <limits>
 #include <memory>
+#include <string>
 #include <thread>
 #include <tuple>
 #include <utility>
@@ -41,8 +46,19 @@ namespace {
 constexpr V1_2::Timing kNoTiming = {std::numeric_limits<uint64_t>::max(),
                                     std::numeric_limits<uint64_t>::max()};
 
+// Bits of the event flag word that MessageQueue::writeBlocking and MessageQueue::readBlocking use
+// by default, so that either end of a channel may use them while the other end uses begin/commit.
+constexpr uint32_t kFmqNotEmpty = 1 << 0;
+constexpr uint32_t kFmqNotFull = 1 << 1;
+
+// Fraction of the recent packets the polling window of a PollingPolicy should catch
+constexpr size_t kPollingCoverageNumerator = 7;
+constexpr size_t kPollingCoverageDenominator = 8;
+
 std::chrono::microseconds getPollingTimeWindow(const std::string& property) {
-    constexpr int32_t kDefaultPollingTimeWindow = 0;
+    // About what blocking on the futex and being woken up costs. PollingPolicy only polls this long
+    // when packets are expected to arrive within it.
+    constexpr int32_t kDefaultPollingTimeWindow = 50;
 #ifdef NN_DEBUGGABLE
     constexpr int32_t kMinPollingTimeWindow = 0;
     const int32_t selectedPollingTimeWindow =
@@ -54,20 +70,51 @@ std::chrono::microseconds getPollingTimeWindow(const std::string& property) {
 #endif  // NN_DEBUGGABLE
 }
 
-}  // namespace
-
-std::chrono::microseconds getBurstControllerPollingTimeWindow() {
-    return getPollingTimeWindow("debug.nn.burst-controller-polling-window");
-}
-
-std::chrono::microseconds getBurstServerPollingTimeWindow() {
-    return getPollingTimeWindow("debug.nn.burst-server-polling-window");
+nn::GeneralResult<UniqueEventFlag> createEventFlag(std::atomic<uint32_t>* eventFlagWord) {
+    EventFlag* eventFlag = nullptr;
+    if (eventFlagWord == nullptr ||
+        EventFlag::createEventFlag(eventFlagWord, &eventFlag) != NO_ERROR) {
+        return NN_ERROR() << "Unable to create EventFlag";
+    }
+    return UniqueEventFlag(eventFlag);
 }
 
-// serialize a request into a packet
-std::vector<FmqRequestDatum> serialize(const V1_0::Request& request, V1_2::MeasureTiming measure,
-                                       const std::vector<int32_t>& slots) {
-    // count how many elements need to be sent for a request
+/**
+ * A packet that is still in the FMQ, possibly wrapping around the end of the ring buffer.
+ *
+ * Each element is copied out of the shared memory before it is returned, so a misbehaving sender
+ * cannot change an element between its validation and its use.
+ */
+template <typename Datum>
+class PacketView {
+  public:
+    template <typename MemTransaction>
+    PacketView(const MemTransaction& transaction, size_t size)
+        : mFirst(transaction.getFirstRegion().getAddress()),
+          mFirstLength(std::min(size, transaction.getFirstRegion().getLength())),
+          mSecond(transaction.getSecondRegion().getAddress()),
+          mSize(size) {}
+
+    size_t size() const { return mSize; }
+
+    Datum at(size_t index) const {
+        CHECK_LT(index, mSize);
+        const Datum* slot =
+                index < mFirstLength ? mFirst + index : mSecond + (index - mFirstLength);
+        Datum datum;
+        std::memcpy(&datum, slot, sizeof(Datum));
+        return datum;
+    }
+
+  private:
+    const Datum* mFirst;
+    size_t mFirstLength;
+    const Datum* mSecond;
+    size_t mSize;
+};
+
+// count how many elements need to be sent for a request
+size_t getPacketSize(const V1_0::Request& request, const std::vector<int32_t>& slots) {
     size_t count = 2 + request.inputs.size() + request.outputs.size() + slots.size();
     for (const auto& input : request.inputs) {
         count += input.dimensions.size();
@@ -76,245 +123,243 @@ std::vector<FmqRequestDatum> serialize(const V1_0::Request& request, V1_2::Measu
         count += output.dimensions.size();
     }
     CHECK_LE(count, std::numeric_limits<uint32_t>::max());
+    return count;
+}
 
-    // create buffer to temporarily store elements
-    std::vector<FmqRequestDatum> data;
-    data.reserve(count);
+// count how many elements need to be sent for a result
+size_t getPacketSize(const std::vector<V1_2::OutputShape>& outputShapes) {
+    size_t count = 2 + outputShapes.size();
+    for (const auto& outputShape : outputShapes) {
+        count += outputShape.dimensions.size();
+    }
+    return count;
+}
+
+// serialize a request of `count` elements, passing each element in turn to `put`
+template <typename Put>
+void serialize(const V1_0::Request& request, V1_2::MeasureTiming measure,
+               const std::vector<int32_t>& slots, size_t count, const Put& put) {
+    FmqRequestDatum datum;
 
     // package packetInfo
-    data.emplace_back();
-    data.back().packetInformation(
+    datum.packetInformation(
             {.packetSize = static_cast<uint32_t>(count),
              .numberOfInputOperands = static_cast<uint32_t>(request.inputs.size()),
              .numberOfOutputOperands = static_cast<uint32_t>(request.outputs.size()),
              .numberOfPools = static_cast<uint32_t>(slots.size())});
+    put(datum);
 
     // package input data
     for (const auto& input : request.inputs) {
         // package operand information
-        data.emplace_back();
-        data.back().inputOperandInformation(
+        datum.inputOperandInformation(
                 {.hasNoValue = input.hasNoValue,
                  .location = input.location,
                  .numberOfDimensions = static_cast<uint32_t>(input.dimensions.size())});
+        put(datum);
 
         // package operand dimensions
         for (uint32_t dimension : input.dimensions) {
-            data.emplace_back();
-            data.back().inputOperandDimensionValue(dimension);
+            datum.inputOperandDimensionValue(dimension);
+            put(datum);
         }
     }
 
     // package output data
     for (const auto& output : request.outputs) {
         // package operand information
-        data.emplace_back();
-        data.back().outputOperandInformation(
+        datum.outputOperandInformation(
                 {.hasNoValue = output.hasNoValue,
                  .location = output.location,
                  .numberOfDimensions = static_cast<uint32_t>(output.dimensions.size())});
+        put(datum);
 
         // package operand dimensions
         for (uint32_t dimension : output.dimensions) {
-            data.emplace_back();
-            data.back().outputOperandDimensionValue(dimension);
+            datum.outputOperandDimensionValue(dimension);
+            put(datum);
         }
     }
 
     // package pool identifier
     for (int32_t slot : slots) {
-        data.emplace_back();
-        data.back().poolIdentifier(slot);
+        datum.poolIdentifier(slot);
+        put(datum);
     }
 
     // package measureTiming
-    data.emplace_back();
-    data.back().measureTiming(measure);
-
-    CHECK_EQ(data.size(), count);
-
-    // return packet
-    return data;
+    datum.measureTiming(measure);
+    put(datum);
 }
 
-// serialize result
-std::vector<FmqResultDatum> serialize(V1_0::ErrorStatus errorStatus,
-                                      const std::vector<V1_2::OutputShape>& outputShapes,
-                                      V1_2::Timing timing) {
-    // count how many elements need to be sent for a request
-    size_t count = 2 + outputShapes.size();
-    for (const auto& outputShape : outputShapes) {
-        count += outputShape.dimensions.size();
-    }
-
-    // create buffer to temporarily store elements
-    std::vector<FmqResultDatum> data;
-    data.reserve(count);
+// serialize a result of `count` elements, passing each element in turn to `put`
+template <typename Put>
+void serialize(V1_0::ErrorStatus errorStatus, const std::vector<V1_2::OutputShape>& outputShapes,
+               V1_2::Timing timing, size_t count, const Put& put) {
+    FmqResultDatum datum;
 
     // package packetInfo
-    data.emplace_back();
-    data.back().packetInformation({.packetSize = static_cast<uint32_t>(count),
-                                   .errorStatus = errorStatus,
-                                   .numberOfOperands = static_cast<uint32_t>(outputShapes.size())});
+    datum.packetInformation({.packetSize = static_cast<uint32_t>(count),
+                             .errorStatus = errorStatus,
+                             .numberOfOperands = static_cast<uint32_t>(outputShapes.size())});
+    put(datum);
 
     // package output shape data
     for (const auto& operand : outputShapes) {
         // package operand information
-        data.emplace_back();
-        data.back().operandInformation(
+        datum.operandInformation(
                 {.isSufficient = operand.isSufficient,
                  .numberOfDimensions = static_cast<uint32_t>(operand.dimensions.size())});
+        put(datum);
 
         // package operand dimensions
         for (uint32_t dimension : operand.dimensions) {
-            data.emplace_back();
-            data.back().operandDimensionValue(dimension);
+            datum.operandDimensionValue(dimension);
+            put(datum);
         }
     }
 
     // package executionTiming
-    data.emplace_back();
-    data.back().executionTiming(timing);
-
-    CHECK_EQ(data.size(), count);
-
-    // return result
-    return data;
+    datum.executionTiming(timing);
+    put(datum);
 }
 
 // deserialize request
-nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>> deserialize(
-        const std::vector<FmqRequestDatum>& data) {
+template <typename Packet>
+nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>> deserializeRequest(
+        const Packet& data) {
     using discriminator = FmqRequestDatum::hidl_discriminator;
 
     size_t index = 0;
 
     // validate packet information
-    if (index >= data.size() ||
-        data.at(index).getDiscriminator() != discriminator::packetInformation) {
+    if (index >= data.size()) {
+        return NN_ERROR() << "FMQ Request packet ill-formed";
+    }
+    const FmqRequestDatum& packetDatum = data.at(index);
+    if (packetDatum.getDiscriminator() != discriminator::packetInformation) {
         return NN_ERROR() << "FMQ Request packet ill-formed";
     }
 
     // unpackage packet information
-    const FmqRequestDatum::PacketInformation& packetInfo = data.at(index).packetInformation();
+    const FmqRequestDatum::PacketInformation& packetInfo = packetDatum.packetInformation();
     index++;
     const uint32_t packetSize = packetInfo.packetSize;
     const uint32_t numberOfInputOperands = packetInfo.numberOfInputOperands;
     const uint32_t numberOfOutputOperands = packetInfo.numberOfOutputOperands;
     const uint32_t numberOfPools = packetInfo.numberOfPools;
 
-    // verify packet size
-    if (data.size() != packetSize) {
+    // verify packet size, knowing that each operand and pool takes at least one element
+    const uint64_t minimumPacketSize = uint64_t{2} + numberOfInputOperands +
+                                       numberOfOutputOperands + numberOfPools;
+    if (data.size() != packetSize || minimumPacketSize > packetSize) {
         return NN_ERROR() << "FMQ Request packet ill-formed";
     }
 
     // unpackage input operands
-    std::vector<V1_0::RequestArgument> inputs;
-    inputs.reserve(numberOfInputOperands);
-    for (size_t operand = 0; operand < numberOfInputOperands; ++operand) {
+    hidl_vec<V1_0::RequestArgument> inputs(numberOfInputOperands);
+    for (auto& input : inputs) {
         // validate input operand information
-        if (index >= data.size() ||
-            data.at(index).getDiscriminator() != discriminator::inputOperandInformation) {
+        if (index >= data.size()) {
+            return NN_ERROR() << "FMQ Request packet ill-formed";
+        }
+        const FmqRequestDatum& operandDatum = data.at(index);
+        if (operandDatum.getDiscriminator() != discriminator::inputOperandInformation) {
             return NN_ERROR() << "FMQ Request packet ill-formed";
         }
 
         // unpackage operand information
         const FmqRequestDatum::OperandInformation& operandInfo =
-                data.at(index).inputOperandInformation();
+                operandDatum.inputOperandInformation();
         index++;
-        const bool hasNoValue = operandInfo.hasNoValue;
-        const V1_0::DataLocation location = operandInfo.location;
+        input.hasNoValue = operandInfo.hasNoValue;
+        input.location = operandInfo.location;
         const uint32_t numberOfDimensions = operandInfo.numberOfDimensions;
+        if (numberOfDimensions > data.size() - index) {
+            return NN_ERROR() << "FMQ Request packet ill-formed";
+        }
 
         // unpackage operand dimensions
-        std::vector<uint32_t> dimensions;
-        dimensions.reserve(numberOfDimensions);
-        for (size_t i = 0; i < numberOfDimensions; ++i) {
+        input.dimensions.resize(numberOfDimensions);
+        for (uint32_t& dimension : input.dimensions) {
             // validate dimension
-            if (index >= data.size() ||
-                data.at(index).getDiscriminator() != discriminator::inputOperandDimensionValue) {
+            const FmqRequestDatum& dimensionDatum = data.at(index);
+            if (dimensionDatum.getDiscriminator() != discriminator::inputOperandDimensionValue) {
                 return NN_ERROR() << "FMQ Request packet ill-formed";
             }
 
             // unpackage dimension
-            const uint32_t dimension = data.at(index).inputOperandDimensionValue();
+            dimension = dimensionDatum.inputOperandDimensionValue();
             index++;
-
-            // store result
-            dimensions.push_back(dimension);
         }
-
-        // store result
-        inputs.push_back(
-                {.hasNoValue = hasNoValue, .location = location, .dimensions = dimensions});
     }
 
     // unpackage output operands
-    std::vector<V1_0::RequestArgument> outputs;
-    outputs.reserve(numberOfOutputOperands);
-    for (size_t operand = 0; operand < numberOfOutputOperands; ++operand) {
+    hidl_vec<V1_0::RequestArgument> outputs(numberOfOutputOperands);
+    for (auto& output : outputs) {
         // validate output operand information
-        if (index >= data.size() ||
-            data.at(index).getDiscriminator() != discriminator::outputOperandInformation) {
+        if (index >= data.size()) {
+            return NN_ERROR() << "FMQ Request packet ill-formed";
+        }
+        const FmqRequestDatum& operandDatum = data.at(index);
+        if (operandDatum.getDiscriminator() != discriminator::outputOperandInformation) {
             return NN_ERROR() << "FMQ Request packet ill-formed";
         }
 
         // unpackage operand information
         const FmqRequestDatum::OperandInformation& operandInfo =
-                data.at(index).outputOperandInformation();
+                operandDatum.outputOperandInformation();
         index++;
-        const bool hasNoValue = operandInfo.hasNoValue;
-        const V1_0::DataLocation location = operandInfo.location;
+        output.hasNoValue = operandInfo.hasNoValue;
+        output.location = operandInfo.location;
         const uint32_t numberOfDimensions = operandInfo.numberOfDimensions;
+        if (numberOfDimensions > data.size() - index) {
+            return NN_ERROR() << "FMQ Request packet ill-formed";
+        }
 
         // unpackage operand dimensions
-        std::vector<uint32_t> dimensions;
-        dimensions.reserve(numberOfDimensions);
-        for (size_t i = 0; i < numberOfDimensions; ++i) {
+        output.dimensions.resize(numberOfDimensions);
+        for (uint32_t& dimension : output.dimensions) {
             // validate dimension
-            if (index >= data.size() ||
-                data.at(index).getDiscriminator() != discriminator::outputOperandDimensionValue) {
+            const FmqRequestDatum& dimensionDatum = data.at(index);
+            if (dimensionDatum.getDiscriminator() != discriminator::outputOperandDimensionValue) {
                 return NN_ERROR() << "FMQ Request packet ill-formed";
             }
 
             // unpackage dimension
-            const uint32_t dimension = data.at(index).outputOperandDimensionValue();
+            dimension = dimensionDatum.outputOperandDimensionValue();
             index++;
-
-            // store result
-            dimensions.push_back(dimension);
         }
-
-        // store result
-        outputs.push_back(
-                {.hasNoValue = hasNoValue, .location = location, .dimensions = dimensions});
     }
 
     // unpackage pools
-    std::vector<int32_t> slots;
-    slots.reserve(numberOfPools);
-    for (size_t pool = 0; pool < numberOfPools; ++pool) {
+    std::vector<int32_t> slots(numberOfPools);
+    for (int32_t& slot : slots) {
         // validate input operand information
-        if (index >= data.size() ||
-            data.at(index).getDiscriminator() != discriminator::poolIdentifier) {
+        if (index >= data.size()) {
+            return NN_ERROR() << "FMQ Request packet ill-formed";
+        }
+        const FmqRequestDatum& poolDatum = data.at(index);
+        if (poolDatum.getDiscriminator() != discriminator::poolIdentifier) {
             return NN_ERROR() << "FMQ Request packet ill-formed";
         }
 
         // unpackage operand information
-        const int32_t poolId = data.at(index).poolIdentifier();
+        slot = poolDatum.poolIdentifier();
         index++;
-
-        // store result
-        slots.push_back(poolId);
     }
 
     // validate measureTiming
-    if (index >= data.size() || data.at(index).getDiscriminator() != discriminator::measureTiming) {
+    if (index >= data.size()) {
+        return NN_ERROR() << "FMQ Request packet ill-formed";
+    }
+    const FmqRequestDatum& measureDatum = data.at(index);
+    if (measureDatum.getDiscriminator() != discriminator::measureTiming) {
         return NN_ERROR() << "FMQ Request packet ill-formed";
     }
 
     // unpackage measureTiming
-    const V1_2::MeasureTiming measure = data.at(index).measureTiming();
+    const V1_2::MeasureTiming measure = measureDatum.measureTiming();
     index++;
 
     // validate packet information
@@ -323,80 +368,87 @@ nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>>
     }
 
     // return request
-    V1_0::Request request = {.inputs = inputs, .outputs = outputs, .pools = {}};
+    V1_0::Request request = {
+            .inputs = std::move(inputs), .outputs = std::move(outputs), .pools = {}};
     return std::make_tuple(std::move(request), std::move(slots), measure);
 }
 
 // deserialize a packet into the result
-nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::Timing>> deserialize(
-        const std::vector<FmqResultDatum>& data) {
+template <typename Packet>
+nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::Timing>>
+deserializeResult(const Packet& data) {
     using discriminator = FmqResultDatum::hidl_discriminator;
     size_t index = 0;
 
     // validate packet information
-    if (index >= data.size() ||
-        data.at(index).getDiscriminator() != discriminator::packetInformation) {
+    if (index >= data.size()) {
+        return NN_ERROR() << "FMQ Result packet ill-formed";
+    }
+    const FmqResultDatum& packetDatum = data.at(index);
+    if (packetDatum.getDiscriminator() != discriminator::packetInformation) {
         return NN_ERROR() << "FMQ Result packet ill-formed";
     }
 
     // unpackage packet information
-    const FmqResultDatum::PacketInformation& packetInfo = data.at(index).packetInformation();
+    const FmqResultDatum::PacketInformation& packetInfo = packetDatum.packetInformation();
     index++;
     const uint32_t packetSize = packetInfo.packetSize;
     const V1_0::ErrorStatus errorStatus = packetInfo.errorStatus;
     const uint32_t numberOfOperands = packetInfo.numberOfOperands;
 
-    // verify packet size
-    if (data.size() != packetSize) {
+    // verify packet size, knowing that each operand takes at least one element
+    const uint64_t minimumPacketSize = uint64_t{2} + numberOfOperands;
+    if (data.size() != packetSize || minimumPacketSize > packetSize) {
         return NN_ERROR() << "FMQ Result packet ill-formed";
     }
 
     // unpackage operands
-    std::vector<V1_2::OutputShape> outputShapes;
-    outputShapes.reserve(numberOfOperands);
-    for (size_t operand = 0; operand < numberOfOperands; ++operand) {
+    std::vector<V1_2::OutputShape> outputShapes(numberOfOperands);
+    for (auto& outputShape : outputShapes) {
         // validate operand information
-        if (index >= data.size() ||
-            data.at(index).getDiscriminator() != discriminator::operandInformation) {
+        if (index >= data.size()) {
+            return NN_ERROR() << "FMQ Result packet ill-formed";
+        }
+        const FmqResultDatum& operandDatum = data.at(index);
+        if (operandDatum.getDiscriminator() != discriminator::operandInformation) {
             return NN_ERROR() << "FMQ Result packet ill-formed";
         }
 
         // unpackage operand information
-        const FmqResultDatum::OperandInformation& operandInfo = data.at(index).operandInformation();
+        const FmqResultDatum::OperandInformation& operandInfo = operandDatum.operandInformation();
         index++;
-        const bool isSufficient = operandInfo.isSufficient;
+        outputShape.isSufficient = operandInfo.isSufficient;
         const uint32_t numberOfDimensions = operandInfo.numberOfDimensions;
+        if (numberOfDimensions > data.size() - index) {
+            return NN_ERROR() << "FMQ Result packet ill-formed";
+        }
 
         // unpackage operand dimensions
-        std::vector<uint32_t> dimensions;
-        dimensions.reserve(numberOfDimensions);
-        for (size_t i = 0; i < numberOfDimensions; ++i) {
+        outputShape.dimensions.resize(numberOfDimensions);
+        for (uint32_t& dimension : outputShape.dimensions) {
             // validate dimension
-            if (index >= data.size() ||
-                data.at(index).getDiscriminator() != discriminator::operandDimensionValue) {
+            const FmqResultDatum& dimensionDatum = data.at(index);
+            if (dimensionDatum.getDiscriminator() != discriminator::operandDimensionValue) {
                 return NN_ERROR() << "FMQ Result packet ill-formed";
             }
 
             // unpackage dimension
-            const uint32_t dimension = data.at(index).operandDimensionValue();
+            dimension = dimensionDatum.operandDimensionValue();
             index++;
-
-            // store result
-            dimensions.push_back(dimension);
         }
-
-        // store result
-        outputShapes.push_back({.dimensions = dimensions, .isSufficient = isSufficient});
     }
 
     // validate execution timing
-    if (index >= data.size() ||
-        data.at(index).getDiscriminator() != discriminator::executionTiming) {
+    if (index >= data.size()) {
+        return NN_ERROR() << "FMQ Result packet ill-formed";
+    }
+    const FmqResultDatum& timingDatum = data.at(index);
+    if (timingDatum.getDiscriminator() != discriminator::executionTiming) {
         return NN_ERROR() << "FMQ Result packet ill-formed";
     }
 
     // unpackage execution timing
-    const V1_2::Timing timing = data.at(index).executionTiming();
+    const V1_2::Timing timing = timingDatum.executionTiming();
     index++;
 
     // validate packet information
@@ -408,6 +460,113 @@ nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::T
     return std::make_tuple(errorStatus, std::move(outputShapes), timing);
 }
 
+}  // namespace
+
+void EventFlagDeleter::operator()(EventFlag* eventFlag) const {
+    EventFlag::deleteEventFlag(&eventFlag);
+}
+
+std::chrono::microseconds getBurstControllerPollingTimeWindow() {
+    return getPollingTimeWindow("debug.nn.burst-controller-polling-window");
+}
+
+std::chrono::microseconds getBurstServerPollingTimeWindow() {
+    return getPollingTimeWindow("debug.nn.burst-server-polling-window");
+}
+
+// PollingPolicy methods
+
+PollingPolicy::PollingPolicy(std::chrono::microseconds maxWindow)
+    : kMaxWindow(maxWindow), mWindowNs(kMaxWindow.count()) {}
+
+std::chrono::nanoseconds PollingPolicy::getWindow() const {
+    return std::chrono::nanoseconds(mWindowNs.load(std::memory_order_relaxed));
+}
+
+void PollingPolicy::recordPacket(std::chrono::nanoseconds wait,
+                                 std::chrono::nanoseconds pollingTime, uint64_t numFutexWakes) {
+    mNumPackets.fetch_add(1, std::memory_order_relaxed);
+    if (numFutexWakes == 0) {
+        mNumPolledPackets.fetch_add(1, std::memory_order_relaxed);
+    }
+    mNumFutexWakes.fetch_add(numFutexWakes, std::memory_order_relaxed);
+    mPollingTimeNs.fetch_add(pollingTime.count(), std::memory_order_relaxed);
+
+    if (kMaxWindow == std::chrono::nanoseconds::zero()) {
+        return;
+    }
+
+    mWaits[mNextWait] = wait;
+    mNextWait = (mNextWait + 1) % kNumWaits;
+    mNumWaits = std::min(mNumWaits + 1, kNumWaits);
+
+    // Poll long enough to catch most of the recent packets, with a quarter more as margin. If that
+    // is longer than allowed, most packets take too long for polling to pay off.
+    const size_t numCovered =
+            (mNumWaits * kPollingCoverageNumerator + kPollingCoverageDenominator - 1) /
+            kPollingCoverageDenominator;
+    auto waits = mWaits;
+    const auto covered = waits.begin() + (numCovered - 1);
+    std::nth_element(waits.begin(), covered, waits.begin() + mNumWaits);
+    const auto window = *covered + *covered / 4;
+    mWindowNs.store(window <= kMaxWindow ? window.count() : 0, std::memory_order_relaxed);
+}
+
+PollingStats PollingPolicy::getStats() const {
+    return {.numPackets = mNumPackets.load(std::memory_order_relaxed),
+            .numPolledPackets = mNumPolledPackets.load(std::memory_order_relaxed),
+            .numFutexWakes = mNumFutexWakes.load(std::memory_order_relaxed),
+            .pollingTime = std::chrono::nanoseconds(mPollingTimeNs.load(std::memory_order_relaxed)),
+            .window = getWindow()};
+}
+
+// serialize a request into a packet
+std::vector<FmqRequestDatum> serialize(const V1_0::Request& request, V1_2::MeasureTiming measure,
+                                       const std::vector<int32_t>& slots) {
+    const size_t count = getPacketSize(request, slots);
+
+    // create buffer to temporarily store elements
+    std::vector<FmqRequestDatum> data;
+    data.reserve(count);
+    serialize(request, measure, slots, count,
+              [&data](const FmqRequestDatum& datum) { data.push_back(datum); });
+
+    CHECK_EQ(data.size(), count);
+
+    // return packet
+    return data;
+}
+
+// serialize result
+std::vector<FmqResultDatum> serialize(V1_0::ErrorStatus errorStatus,
+                                      const std::vector<V1_2::OutputShape>& outputShapes,
+                                      V1_2::Timing timing) {
+    const size_t count = getPacketSize(outputShapes);
+
+    // create buffer to temporarily store elements
+    std::vector<FmqResultDatum> data;
+    data.reserve(count);
+    serialize(errorStatus, outputShapes, timing, count,
+              [&data](const FmqResultDatum& datum) { data.push_back(datum); });
+
+    CHECK_EQ(data.size(), count);
+
+    // return result
+    return data;
+}
+
+// deserialize request
+nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>> deserialize(
+        const std::vector<FmqRequestDatum>& data) {
+    return deserializeRequest(data);
+}
+
+// deserialize a packet into the result
+nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::Timing>> deserialize(
+        const std::vector<FmqResultDatum>& data) {
+    return deserializeResult(data);
+}
+
 // RequestChannelSender methods
 
 nn::GeneralResult<
@@ -418,6 +577,8 @@ RequestChannelSender::create(size_t channelLength) {
     if (!requestChannelSender->mFmqRequestChannel.isValid()) {
         return NN_ERROR() << "Unable to create RequestChannelSender";
     }
+    requestChannelSender->mEventFlag =
+            NN_TRY(createEventFlag(requestChannelSender->mFmqRequestChannel.getEventFlagWord()));
 
     const MQDescriptorSync<FmqRequestDatum>* descriptor =
             requestChannelSender->mFmqRequestChannel.getDesc();
@@ -430,8 +591,34 @@ RequestChannelSender::RequestChannelSender(PrivateConstructorTag /*tag*/, size_t
 nn::Result<void> RequestChannelSender::send(const V1_0::Request& request,
                                             V1_2::MeasureTiming measure,
                                             const std::vector<int32_t>& slots) {
-    const std::vector<FmqRequestDatum> serialized = serialize(request, measure, slots);
-    return sendPacket(serialized);
+    if (!mValid) {
+        return NN_ERROR() << "FMQ object is invalid";
+    }
+
+    const size_t count = getPacketSize(request, slots);
+    MessageQueue<FmqRequestDatum, kSynchronizedReadWrite>::MemTransaction transaction;
+    if (count > mFmqRequestChannel.availableToWrite() ||
+        !mFmqRequestChannel.beginWrite(count, &transaction)) {
+        return NN_ERROR()
+               << "RequestChannelSender::send -- packet size exceeds size available in FMQ";
+    }
+
+    // serialize the request straight into the FMQ
+    size_t index = 0;
+    serialize(request, measure, slots, count,
+              [&transaction, &index](const FmqRequestDatum& datum) {
+                  transaction.copyTo(&datum, index++);
+              });
+    CHECK_EQ(index, count);
+
+    // Publish the whole packet at once, then signal the futex to unblock the consumer if it is
+    // waiting on it.
+    if (!mFmqRequestChannel.commitWrite(count)) {
+        return NN_ERROR() << "RequestChannelSender::send -- FMQ's commitWrite returned an error";
+    }
+    mEventFlag->wake(kFmqNotEmpty);
+
+    return {};
 }
 
 nn::Result<void> RequestChannelSender::sendPacket(const std::vector<FmqRequestDatum>& packet) {
@@ -439,18 +626,22 @@ nn::Result<void> RequestChannelSender::sendPacket(const std::vector<FmqRequestDa
         return NN_ERROR() << "FMQ object is invalid";
     }
 
-    if (packet.size() > mFmqRequestChannel.availableToWrite()) {
+    MessageQueue<FmqRequestDatum, kSynchronizedReadWrite>::MemTransaction transaction;
+    if (packet.size() > mFmqRequestChannel.availableToWrite() ||
+        !mFmqRequestChannel.beginWrite(packet.size(), &transaction)) {
         return NN_ERROR()
                << "RequestChannelSender::sendPacket -- packet size exceeds size available in FMQ";
     }
 
-    // Always send the packet with "blocking" because this signals the futex and unblocks the
-    // consumer if it is waiting on the futex.
-    const bool success = mFmqRequestChannel.writeBlocking(packet.data(), packet.size());
+    // Publish the whole packet at once, then signal the futex to unblock the consumer if it is
+    // waiting on it.
+    const bool success = transaction.copyTo(packet.data(), 0, packet.size()) &&
+                         mFmqRequestChannel.commitWrite(packet.size());
     if (!success) {
         return NN_ERROR()
-               << "RequestChannelSender::sendPacket -- FMQ's writeBlocking returned an error";
+               << "RequestChannelSender::sendPacket -- FMQ's commitWrite returned an error";
     }
+    mEventFlag->wake(kFmqNotEmpty);
 
     return {};
 }
@@ -474,6 +665,8 @@ nn::GeneralResult<std::unique_ptr<RequestChannelReceiver>> RequestChannelReceive
         return NN_ERROR()
                << "RequestChannelReceiver::create was passed an MQDescriptor without an EventFlag";
     }
+    requestChannelReceiver->mEventFlag =
+            NN_TRY(createEventFlag(requestChannelReceiver->mFmqRequestChannel.getEventFlagWord()));
 
     return requestChannelReceiver;
 }
@@ -481,12 +674,25 @@ nn::GeneralResult<std::unique_ptr<RequestChannelReceiver>> RequestChannelReceive
 RequestChannelReceiver::RequestChannelReceiver(
         PrivateConstructorTag /*tag*/, const MQDescriptorSync<FmqRequestDatum>& requestChannel,
         std::chrono::microseconds pollingTimeWindow)
-    : mFmqRequestChannel(requestChannel), kPollingTimeWindow(pollingTimeWindow) {}
+    : mFmqRequestChannel(requestChannel), mPollingPolicy(pollingTimeWindow) {}
 
 nn::Result<std::tuple<V1_0::Request, std::vector<int32_t>, V1_2::MeasureTiming>>
 RequestChannelReceiver::getBlocking() {
-    const auto packet = NN_TRY(getPacketBlocking());
-    return deserialize(packet);
+    const size_t count = NN_TRY(waitForPacket());
+
+    MessageQueue<FmqRequestDatum, kSynchronizedReadWrite>::MemTransaction transaction;
+    if (!mFmqRequestChannel.beginRead(count, &transaction)) {
+        return NN_ERROR() << "Error receiving packet";
+    }
+
+    // deserialize the packet where it lies, then release it to the sender
+    auto result = deserializeRequest(PacketView<FmqRequestDatum>(transaction, count));
+    if (!mFmqRequestChannel.commitRead(count)) {
+        return NN_ERROR() << "Error receiving packet";
+    }
+    mEventFlag->wake(kFmqNotFull);
+
+    return result;
 }
 
 void RequestChannelReceiver::invalidate() {
@@ -500,67 +706,64 @@ void RequestChannelReceiver::invalidate() {
     mFmqRequestChannel.writeBlocking(data.data(), data.size());
 }
 
-nn::Result<std::vector<FmqRequestDatum>> RequestChannelReceiver::getPacketBlocking() {
+PollingStats RequestChannelReceiver::getPollingStats() const {
+    return mPollingPolicy.getStats();
+}
+
+nn::Result<size_t> RequestChannelReceiver::waitForPacket() {
     if (mTeardown) {
         return NN_ERROR() << "FMQ object is being torn down";
     }
 
-    // First spend time polling if results are available in FMQ instead of waiting on the futex.
+    // First spend time polling if requests are available in FMQ instead of waiting on the futex.
     // Polling is more responsive (yielding lower latencies), but can take up more power, so only
-    // poll for a limited period of time.
+    // poll for as long as the polling policy expects the packet to take to arrive.
 
     auto& getCurrentTime = std::chrono::high_resolution_clock::now;
-    const auto timeToStopPolling = getCurrentTime() + kPollingTimeWindow;
+    const auto startTime = getCurrentTime();
+    const auto timeToStopPolling = startTime + mPollingPolicy.getWindow();
 
-    while (getCurrentTime() < timeToStopPolling) {
+    auto currentTime = startTime;
+    size_t available = mFmqRequestChannel.availableToRead();
+    while (available == 0 && currentTime < timeToStopPolling) {
         // if class is being torn down, immediately return
         if (mTeardown.load(std::memory_order_relaxed)) {
             return NN_ERROR() << "FMQ object is being torn down";
         }
 
-        // Check if data is available. If it is, immediately retrieve it and return.
-        const size_t available = mFmqRequestChannel.availableToRead();
-        if (available > 0) {
-            std::vector<FmqRequestDatum> packet(available);
-            const bool success = mFmqRequestChannel.readBlocking(packet.data(), available);
-            if (!success) {
-                return NN_ERROR() << "Error receiving packet";
-            }
-            return packet;
-        }
-
         std::this_thread::yield();
-    }
-
-    // If we get to this point, we either stopped polling because it was taking too long or polling
-    // was not allowed. Instead, perform a blocking call which uses a futex to save power.
 
-    // wait for request packet and read first element of request packet
-    FmqRequestDatum datum;
-    bool success = mFmqRequestChannel.readBlocking(&datum, 1);
-
-    // retrieve remaining elements
-    // NOTE: all of the data is already available at this point, so there's no need to do a blocking
-    // wait to wait for more data. This is known because in FMQ, all writes are published (made
-    // available) atomically. Currently, the producer always publishes the entire packet in one
-    // function call, so if the first element of the packet is available, the remaining elements are
-    // also available.
-    const size_t count = mFmqRequestChannel.availableToRead();
-    std::vector<FmqRequestDatum> packet(count + 1);
-    std::memcpy(&packet.front(), &datum, sizeof(datum));
-    success &= mFmqRequestChannel.read(packet.data() + 1, count);
+        // Check if data is available. If it is, immediately retrieve it.
+        currentTime = getCurrentTime();
+        available = mFmqRequestChannel.availableToRead();
+    }
+    const auto pollingTime = currentTime - startTime;
+
+    // If we get to this point without a packet, we either stopped polling because it was taking
+    // too long or polling was not allowed. Instead, perform a blocking call which uses a futex to
+    // save power.
+
+    // wait for request packet
+    // NOTE: in FMQ, all writes are published (made available) atomically. Currently, the producer
+    // always publishes the entire packet in one function call, so if any element of the packet is
+    // available, the whole packet is available.
+    uint64_t numFutexWakes = 0;
+    while (available == 0) {
+        uint32_t state = 0;
+        if (mEventFlag->wait(kFmqNotEmpty, &state) != NO_ERROR) {
+            return NN_ERROR() << "Error receiving packet";
+        }
+        numFutexWakes++;
+        available = mFmqRequestChannel.availableToRead();
+    }
 
     // terminate loop
     if (mTeardown) {
         return NN_ERROR() << "FMQ object is being torn down";
     }
 
-    // ensure packet was successfully received
-    if (!success) {
-        return NN_ERROR() << "Error receiving packet";
-    }
-
-    return packet;
+    mPollingPolicy.recordPacket(getCurrentTime() - startTime, pollingTime, numFutexWakes);
+    return available;
 }
 
 // ResultChannelSender methods
@@ -577,6 +780,8 @@ nn::GeneralResult<std::unique_ptr<ResultChannelSender>> ResultChannelSender::cre
         return NN_ERROR()
                << "ResultChannelSender::create was passed an MQDescriptor without an EventFlag";
     }
+    resultChannelSender->mEventFlag =
+            NN_TRY(createEventFlag(resultChannelSender->mFmqResultChannel.getEventFlagWord()));
 
     return resultChannelSender;
 }
@@ -585,28 +790,73 @@ ResultChannelSender::ResultChannelSender(PrivateConstructorTag /*tag*/,
                                          const MQDescriptorSync<FmqResultDatum>& resultChannel)
     : mFmqResultChannel(resultChannel) {}
 
-void ResultChannelSender::send(V1_0::ErrorStatus errorStatus,
-                               const std::vector<V1_2::OutputShape>& outputShapes,
-                               V1_2::Timing timing) {
-    const std::vector<FmqResultDatum> serialized = serialize(errorStatus, outputShapes, timing);
-    sendPacket(serialized);
+nn::Result<void> ResultChannelSender::send(V1_0::ErrorStatus errorStatus,
+                                           const std::vector<V1_2::OutputShape>& outputShapes,
+                                           V1_2::Timing timing) {
+    const size_t count = getPacketSize(outputShapes);
+    if (count > mFmqResultChannel.availableToWrite()) {
+        const std::vector<FmqResultDatum> errorPacket =
+                serialize(V1_0::ErrorStatus::GENERAL_FAILURE, {}, kNoTiming);
+
+        // Always send the packet with "blocking" because this signals the futex and unblocks the
+        // consumer if it is waiting on the futex.
+        mFmqResultChannel.writeBlocking(errorPacket.data(), errorPacket.size());
+        return NN_ERROR()
+               << "ResultChannelSender::send -- packet size exceeds size available in FMQ";
+    }
+
+    MessageQueue<FmqResultDatum, kSynchronizedReadWrite>::MemTransaction transaction;
+    if (!mFmqResultChannel.beginWrite(count, &transaction)) {
+        return NN_ERROR() << "ResultChannelSender::send -- FMQ's beginWrite returned an error";
+    }
+
+    // serialize the result straight into the FMQ
+    size_t index = 0;
+    serialize(errorStatus, outputShapes, timing, count,
+              [&transaction, &index](const FmqResultDatum& datum) {
+                  transaction.copyTo(&datum, index++);
+              });
+    CHECK_EQ(index, count);
+
+    // Publish the whole packet at once, then signal the futex to unblock the consumer if it is
+    // waiting on it.
+    if (!mFmqResultChannel.commitWrite(count)) {
+        return NN_ERROR() << "ResultChannelSender::send -- FMQ's commitWrite returned an error";
+    }
+    mEventFlag->wake(kFmqNotEmpty);
+
+    return {};
 }
 
-void ResultChannelSender::sendPacket(const std::vector<FmqResultDatum>& packet) {
+nn::Result<void> ResultChannelSender::sendPacket(const std::vector<FmqResultDatum>& packet) {
     if (packet.size() > mFmqResultChannel.availableToWrite()) {
-        LOG(ERROR)
-                << "ResultChannelSender::sendPacket -- packet size exceeds size available in FMQ";
         const std::vector<FmqResultDatum> errorPacket =
                 serialize(V1_0::ErrorStatus::GENERAL_FAILURE, {}, kNoTiming);
 
         // Always send the packet with "blocking" because this signals the futex and unblocks the
         // consumer if it is waiting on the futex.
         mFmqResultChannel.writeBlocking(errorPacket.data(), errorPacket.size());
-    } else {
-        // Always send the packet with "blocking" because this signals the futex and unblocks the
-        // consumer if it is waiting on the futex.
-        mFmqResultChannel.writeBlocking(packet.data(), packet.size());
+        return NN_ERROR()
+               << "ResultChannelSender::sendPacket -- packet size exceeds size available in FMQ";
+    }
+
+    MessageQueue<FmqResultDatum, kSynchronizedReadWrite>::MemTransaction transaction;
+    if (!mFmqResultChannel.beginWrite(packet.size(), &transaction)) {
+        return NN_ERROR()
+               << "ResultChannelSender::sendPacket -- FMQ's beginWrite returned an error";
     }
+
+    // Publish the whole packet at once, then signal the futex to unblock the consumer if it is
+    // waiting on it.
+    const bool success = transaction.copyTo(packet.data(), 0, packet.size()) &&
+                         mFmqResultChannel.commitWrite(packet.size());
+    if (!success) {
+        return NN_ERROR()
+               << "ResultChannelSender::sendPacket -- FMQ's commitWrite returned an error";
+    }
+    mEventFlag->wake(kFmqNotEmpty);
+
+    return {};
 }
 
 // ResultChannelReceiver methods
@@ -619,6 +869,8 @@ ResultChannelReceiver::create(size_t channelLength, std::chrono::microseconds po
     if (!resultChannelReceiver->mFmqResultChannel.isValid()) {
         return NN_ERROR() << "Unable to create ResultChannelReceiver";
     }
+    resultChannelReceiver->mEventFlag =
+            NN_TRY(createEventFlag(resultChannelReceiver->mFmqResultChannel.getEventFlagWord()));
 
     const MQDescriptorSync<FmqResultDatum>* descriptor =
             resultChannelReceiver->mFmqResultChannel.getDesc();
@@ -628,12 +880,25 @@ ResultChannelReceiver::create(size_t channelLength, std::chrono::microseconds po
 ResultChannelReceiver::ResultChannelReceiver(PrivateConstructorTag /*tag*/, size_t channelLength,
                                              std::chrono::microseconds pollingTimeWindow)
     : mFmqResultChannel(channelLength, /*configureEventFlagWord=*/true),
-      kPollingTimeWindow(pollingTimeWindow) {}
+      mPollingPolicy(pollingTimeWindow) {}
 
 nn::Result<std::tuple<V1_0::ErrorStatus, std::vector<V1_2::OutputShape>, V1_2::Timing>>
 ResultChannelReceiver::getBlocking() {
-    const auto packet = NN_TRY(getPacketBlocking());
-    return deserialize(packet);
+    const size_t count = NN_TRY(waitForPacket());
+
+    MessageQueue<FmqResultDatum, kSynchronizedReadWrite>::MemTransaction transaction;
+    if (!mFmqResultChannel.beginRead(count, &transaction)) {
+        return NN_ERROR() << "Error receiving packet";
+    }
+
+    // deserialize the packet where it lies, then release it to the sender
+    auto result = deserializeResult(PacketView<FmqResultDatum>(transaction, count));
+    if (!mFmqResultChannel.commitRead(count)) {
+        return NN_ERROR() << "Error receiving packet";
+    }
+    mEventFlag->wake(kFmqNotFull);
+
+    return result;
 }
 
 void ResultChannelReceiver::notifyAsDeadObject() {
@@ -647,66 +912,75 @@ void ResultChannelReceiver::notifyAsDeadObject() {
     mFmqResultChannel.writeBlocking(data.data(), data.size());
 }
 
+PollingStats ResultChannelReceiver::getPollingStats() const {
+    return mPollingPolicy.getStats();
+}
+
 nn::Result<std::vector<FmqResultDatum>> ResultChannelReceiver::getPacketBlocking() {
+    const size_t count = NN_TRY(waitForPacket());
+
+    std::vector<FmqResultDatum> packet(count);
+    if (!mFmqResultChannel.read(packet.data(), count)) {
+        return NN_ERROR() << "Error receiving packet";
+    }
+    mEventFlag->wake(kFmqNotFull);
+
+    return packet;
+}
+
+nn::Result<size_t> ResultChannelReceiver::waitForPacket() {
     if (!mValid) {
         return NN_ERROR() << "FMQ object is invalid";
     }
 
     // First spend time polling if results are available in FMQ instead of waiting on the futex.
     // Polling is more responsive (yielding lower latencies), but can take up more power, so only
-    // poll for a limited period of time.
+    // poll for as long as the polling policy expects the packet to take to arrive.
 
     auto& getCurrentTime = std::chrono::high_resolution_clock::now;
-    const auto timeToStopPolling = getCurrentTime() + kPollingTimeWindow;
+    const auto startTime = getCurrentTime();
+    const auto timeToStopPolling = startTime + mPollingPolicy.getWindow();
 
-    while (getCurrentTime() < timeToStopPolling) {
+    auto currentTime = startTime;
+    size_t available = mFmqResultChannel.availableToRead();
+    while (available == 0 && currentTime < timeToStopPolling) {
         // if class is being torn down, immediately return
         if (!mValid.load(std::memory_order_relaxed)) {
             return NN_ERROR() << "FMQ object is invalid";
         }
 
-        // Check if data is available. If it is, immediately retrieve it and return.
-        const size_t available = mFmqResultChannel.availableToRead();
-        if (available > 0) {
-            std::vector<FmqResultDatum> packet(available);
-            const bool success = mFmqResultChannel.readBlocking(packet.data(), available);
-            if (!success) {
-                return NN_ERROR() << "Error receiving packet";
-            }
-            return packet;
-        }
-
         std::this_thread::yield();
-    }
-
-    // If we get to this point, we either stopped polling because it was taking too long or polling
-    // was not allowed. Instead, perform a blocking call which uses a futex to save power.
 
-    // wait for result packet and read first element of result packet
-    FmqResultDatum datum;
-    bool success = mFmqResultChannel.readBlocking(&datum, 1);
-
-    // retrieve remaining elements
-    // NOTE: all of the data is already available at this point, so there's no need to do a blocking
-    // wait to wait for more data. This is known because in FMQ, all writes are published (made
-    // available) atomically. Currently, the producer always publishes the entire packet in one
-    // function call, so if the first element of the packet is available, the remaining elements are
-    // also available.
-    const size_t count = mFmqResultChannel.availableToRead();
-    std::vector<FmqResultDatum> packet(count + 1);
-    std::memcpy(&packet.front(), &datum, sizeof(datum));
-    success &= mFmqResultChannel.read(packet.data() + 1, count);
+        // Check if data is available. If it is, immediately retrieve it.
+        currentTime = getCurrentTime();
+        available = mFmqResultChannel.availableToRead();
+    }
+    const auto pollingTime = currentTime - startTime;
+
+    // If we get to this point without a packet, we either stopped polling because it was taking
+    // too long or polling was not allowed. Instead, perform a blocking call which uses a futex to
+    // save power.
+
+    // wait for result packet
+    // NOTE: in FMQ, all writes are published (made available) atomically. Currently, the producer
+    // always publishes the entire packet in one function call, so if any element of the packet is
+    // available, the whole packet is available.
+    uint64_t numFutexWakes = 0;
+    while (available == 0) {
+        uint32_t state = 0;
+        if (mEventFlag->wait(kFmqNotEmpty, &state) != NO_ERROR) {
+            return NN_ERROR() << "Error receiving packet";
+        }
+        numFutexWakes++;
+        available = mFmqResultChannel.availableToRead();
+    }
 
     if (!mValid) {
         return NN_ERROR() << "FMQ object is invalid";
     }
 
-    // ensure packet was successfully received
-    if (!success) {
-        return NN_ERROR() << "Error receiving packet";
-    }
-
-    return packet;
+    mPollingPolicy.recordPacket(getCurrentTime() - startTime, pollingTime, numFutexWakes);
+    return available;
 }
 
 }  // namespace android::hardware::neuralnetworks::V1_2::utils
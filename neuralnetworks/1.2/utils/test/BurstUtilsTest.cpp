@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android/hardware/neuralnetworks/1.0/types.h>
+#include <android/hardware/neuralnetworks/1.2/types.h>
+#include <gtest/gtest.h>
+#include <nnapi/hal/1.2/BurstUtils.h>
+
+#include <chrono>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace android::hardware::neuralnetworks::V1_2::utils {
+namespace {
+
+using namespace std::chrono_literals;
+
+// Small enough that a few packets wrap around the end of the ring buffer
+constexpr size_t kChannelLength = 32;
+constexpr auto kTiming = V1_2::Timing{.timeOnDevice = 1, .timeInDriver = 2};
+
+V1_0::Request makeRequest(uint32_t numOperands) {
+    V1_0::Request request;
+    request.inputs.resize(numOperands);
+    request.outputs.resize(numOperands);
+    for (uint32_t i = 0; i < numOperands; ++i) {
+        request.inputs[i] = {.hasNoValue = false,
+                             .location = {.poolIndex = i, .offset = 4 * i, .length = 4},
+                             .dimensions = {1, 2, i}};
+        request.outputs[i] = {.hasNoValue = i % 2 == 0, .location = {}, .dimensions = {i}};
+    }
+    return request;
+}
+
+TEST(BurstUtilsTest, requestChannelRoundTrip) {
+    // setup test
+    auto [sender, descriptor] = RequestChannelSender::create(kChannelLength).value();
+    const auto receiver = RequestChannelReceiver::create(*descriptor, 0us).value();
+
+    for (uint32_t numOperands = 0; numOperands < 8; ++numOperands) {
+        const auto request = makeRequest(numOperands % 4);
+        const std::vector<int32_t> slots(numOperands % 3, numOperands);
+
+        // run test
+        ASSERT_TRUE(sender->send(request, V1_2::MeasureTiming::YES, slots).has_value());
+        const auto result = receiver->getBlocking();
+
+        // verify result
+        ASSERT_TRUE(result.has_value()) << result.error();
+        const auto& [receivedRequest, receivedSlots, measure] = result.value();
+        EXPECT_EQ(request.inputs, receivedRequest.inputs);
+        EXPECT_EQ(request.outputs, receivedRequest.outputs);
+        EXPECT_EQ(slots, receivedSlots);
+        EXPECT_EQ(V1_2::MeasureTiming::YES, measure);
+    }
+}
+
+TEST(BurstUtilsTest, requestChannelRejectsPacketLargerThanChannel) {
+    // setup test
+    auto [sender, descriptor] = RequestChannelSender::create(kChannelLength).value();
+
+    // run test
+    const auto result = sender->send(makeRequest(kChannelLength), V1_2::MeasureTiming::NO, {});
+
+    // verify result
+    EXPECT_FALSE(result.has_value());
+}
+
+TEST(BurstUtilsTest, resultChannelRoundTripWhileBlocked) {
+    // setup test
+    auto [receiver, descriptor] = ResultChannelReceiver::create(kChannelLength, 0us).value();
+    const auto sender = ResultChannelSender::create(*descriptor).value();
+    const std::vector<V1_2::OutputShape> outputShapes = {
+            {.dimensions = {1, 2}, .isSufficient = true},
+            {.dimensions = {}, .isSufficient = false},
+    };
+
+    for (size_t i = 0; i < 8; ++i) {
+        // run test
+        std::thread thread([&sender, &outputShapes] {
+            std::this_thread::sleep_for(1ms);
+            EXPECT_TRUE(sender->send(V1_0::ErrorStatus::NONE, outputShapes, kTiming).has_value());
+        });
+        const auto result = receiver->getBlocking();
+        thread.join();
+
+        // verify result
+        ASSERT_TRUE(result.has_value()) << result.error();
+        const auto& [status, receivedOutputShapes, timing] = result.value();
+        EXPECT_EQ(V1_0::ErrorStatus::NONE, status);
+        EXPECT_EQ(outputShapes, receivedOutputShapes);
+        EXPECT_EQ(kTiming, timing);
+    }
+}
+
+TEST(BurstUtilsTest, resultChannelSendsFailureForPacketLargerThanChannel) {
+    // setup test
+    auto [receiver, descriptor] = ResultChannelReceiver::create(kChannelLength, 0us).value();
+    const auto sender = ResultChannelSender::create(*descriptor).value();
+    const std::vector<V1_2::OutputShape> outputShapes(kChannelLength, {.dimensions = {1}});
+
+    // run test
+    const auto sent = sender->send(V1_0::ErrorStatus::NONE, outputShapes, kTiming);
+    const auto result = receiver->getBlocking();
+
+    // verify result
+    EXPECT_FALSE(sent.has_value());
+    ASSERT_TRUE(result.has_value()) << result.error();
+    EXPECT_EQ(V1_0::ErrorStatus::GENERAL_FAILURE, std::get<0>(result.value()));
+}
+
+TEST(BurstUtilsTest, deserializeRejectsTruncatedPacket) {
+    // setup test
+    const auto packet = serialize(makeRequest(2), V1_2::MeasureTiming::NO, {0});
+
+    for (size_t size = 0; size < packet.size(); ++size) {
+        // run test
+        const auto truncated = std::vector<FmqRequestDatum>(packet.begin(), packet.begin() + size);
+        const auto result = deserialize(truncated);
+
+        // verify result
+        EXPECT_FALSE(result.has_value());
+    }
+}
+
+TEST(BurstUtilsTest, deserializeRejectsOversizedCounts) {
+    // setup test
+    auto packet = serialize(makeRequest(2), V1_2::MeasureTiming::NO, {0});
+    auto operandInfo = packet[1].inputOperandInformation();
+    operandInfo.numberOfDimensions = kExecutionBurstChannelLength;
+    packet[1].inputOperandInformation(operandInfo);
+
+    // run test
+    const auto result = deserialize(packet);
+
+    // verify result
+    EXPECT_FALSE(result.has_value());
+}
+
+TEST(BurstUtilsTest, invalidateUnblocksRequestReceiver) {
+    // setup test
+    auto [sender, descriptor] = RequestChannelSender::create(kChannelLength).value();
+    const auto receiver = RequestChannelReceiver::create(*descriptor, 0us).value();
+    std::thread thread([&receiver] {
+        std::this_thread::sleep_for(1ms);
+        receiver->invalidate();
+    });
+
+    // run test
+    const auto result = receiver->getBlocking();
+    thread.join();
+
+    // verify result
+    EXPECT_FALSE(result.has_value());
+}
+
+TEST(BurstUtilsTest, pollingPolicyPollsForShortWaits) {
+    // setup test
+    PollingPolicy policy(100us);
+    ASSERT_EQ(100us, policy.getWindow());
+
+    // run test
+    for (size_t i = 0; i < 16; ++i) {
+        policy.recordPacket(20us, 20us, /*numFutexWakes=*/0);
+    }
+
+    // verify result
+    EXPECT_EQ(25us, policy.getWindow());
+}
+
+TEST(BurstUtilsTest, pollingPolicyStopsPollingForLongWaits) {
+    // setup test
+    PollingPolicy policy(100us);
+
+    // run test
+    for (size_t i = 0; i < 16; ++i) {
+        policy.recordPacket(1ms, 100us, /*numFutexWakes=*/1);
+    }
+
+    // verify result
+    EXPECT_EQ(0us, policy.getWindow());
+}
+
+TEST(BurstUtilsTest, pollingPolicyIgnoresRareLongWaits) {
+    // setup test
+    PollingPolicy policy(100us);
+
+    // run test
+    for (size_t i = 0; i < 16; ++i) {
+        policy.recordPacket(i == 0 ? 1ms : 40us, 40us, /*numFutexWakes=*/0);
+    }
+
+    // verify result
+    EXPECT_EQ(50us, policy.getWindow());
+}
+
+TEST(BurstUtilsTest, pollingPolicyResumesPollingWhenWaitsShorten) {
+    // setup test
+    PollingPolicy policy(100us);
+    for (size_t i = 0; i < 16; ++i) {
+        policy.recordPacket(1ms, 0us, /*numFutexWakes=*/1);
+    }
+    ASSERT_EQ(0us, policy.getWindow());
+
+    // run test
+    for (size_t i = 0; i < 16; ++i) {
+        policy.recordPacket(8us, 0us, /*numFutexWakes=*/1);
+    }
+
+    // verify result
+    EXPECT_EQ(10us, policy.getWindow());
+}
+
+TEST(BurstUtilsTest, pollingPolicyDisabled) {
+    // setup test
+    PollingPolicy policy(0us);
+
+    // run test
+    policy.recordPacket(1us, 0us, /*numFutexWakes=*/1);
+
+    // verify result
+    EXPECT_EQ(0us, policy.getWindow());
+}
+
+TEST(BurstUtilsTest, pollingStatsCountPackets) {
+    // setup test
+    auto [sender, descriptor] = RequestChannelSender::create(kChannelLength).value();
+    const auto receiver = RequestChannelReceiver::create(*descriptor, 0us).value();
+
+    // run test
+    ASSERT_TRUE(sender->send(makeRequest(1), V1_2::MeasureTiming::NO, {}).has_value());
+    ASSERT_TRUE(receiver->getBlocking().has_value());
+    std::thread thread([&sender = sender] {
+        std::this_thread::sleep_for(1ms);
+        EXPECT_TRUE(sender->send(makeRequest(1), V1_2::MeasureTiming::NO, {}).has_value());
+    });
+    ASSERT_TRUE(receiver->getBlocking().has_value());
+    thread.join();
+    const auto stats = receiver->getPollingStats();
+
+    // verify result
+    EXPECT_EQ(2u, stats.numPackets);
+    EXPECT_EQ(1u, stats.numPolledPackets);
+    EXPECT_GE(stats.numFutexWakes, 1u);
+    EXPECT_EQ(0ns, stats.pollingTime);
+    EXPECT_EQ(0ns, stats.window);
+}
+
+}  // namespace
+}  // namespace android::hardware::neuralnetworks::V1_2::utils
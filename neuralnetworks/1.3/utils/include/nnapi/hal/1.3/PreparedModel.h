@@ -23,6 +23,7 @@
 #include <nnapi/Types.h>
 #include <nnapi/hal/1.0/ProtectCallback.h>
 #include <nnapi/hal/CommonUtils.h>
+#include <nnapi/hal/RelocationPool.h>
 
 #include <memory>
 #include <tuple>
@@ -93,6 +94,8 @@ class PreparedModel final : public nn::IPreparedModel,
     const bool kExecuteSynchronously;
     const sp<V1_3::IPreparedModel> kPreparedModel;
     const hal::utils::DeathHandler kDeathHandler;
+    // Shared memory for the pointer arguments of requests, reused across executions
+    const hal::utils::RelocationPool kRelocationPool;
 };
 
 }  // namespace android::hardware::neuralnetworks::V1_3::utils
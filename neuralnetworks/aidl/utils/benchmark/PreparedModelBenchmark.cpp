@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aidl/android/hardware/neuralnetworks/BnPreparedModel.h>
+#include <android/binder_interface_utils.h>
+#include <benchmark/benchmark.h>
+#include <nnapi/SharedMemory.h>
+#include <nnapi/Types.h>
+#include <nnapi/hal/CommonUtils.h>
+#include <nnapi/hal/RelocationPool.h>
+#include <nnapi/hal/aidl/PreparedModel.h>
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+/**
+ * Per inference latency of requests with pointer arguments, which are relocated to shared memory
+ * before being sent to the driver, with new shared memory per inference or memory from a
+ * RelocationPool, and through the PreparedModel and its reusable executions:
+ * adb shell /data/benchmarktest64/neuralnetworks_utils_hal_aidl_benchmark/neuralnetworks_utils_hal_aidl_benchmark
+ */
+namespace aidl::android::hardware::neuralnetworks::utils {
+namespace {
+
+// Completes every execution right away, so the benchmarks measure the overhead of the adapter
+class FakePreparedModel final : public BnPreparedModel {
+  public:
+    ndk::ScopedAStatus executeSynchronously(const Request& /*request*/, bool /*measureTiming*/,
+                                            int64_t /*deadline*/, int64_t /*loopTimeoutDuration*/,
+                                            ExecutionResult* executionResult) override {
+        *executionResult = {.outputSufficientSize = true,
+                            .timing = {.timeOnDeviceNs = -1, .timeInDriverNs = -1}};
+        return ndk::ScopedAStatus::ok();
+    }
+    ndk::ScopedAStatus executeFenced(const Request& /*request*/,
+                                     const std::vector<ndk::ScopedFileDescriptor>& /*waitFor*/,
+                                     bool /*measureTiming*/, int64_t /*deadline*/,
+                                     int64_t /*loopTimeoutDuration*/, int64_t /*duration*/,
+                                     FencedExecutionResult* /*fencedExecutionResult*/) override {
+        return unsupported();
+    }
+    ndk::ScopedAStatus executeSynchronouslyWithConfig(
+            const Request& /*request*/, const ExecutionConfig& /*config*/, int64_t /*deadline*/,
+            ExecutionResult* /*executionResult*/) override {
+        return unsupported();
+    }
+    ndk::ScopedAStatus executeFencedWithConfig(
+            const Request& /*request*/, const std::vector<ndk::ScopedFileDescriptor>& /*waitFor*/,
+            const ExecutionConfig& /*config*/, int64_t /*deadline*/, int64_t /*duration*/,
+            FencedExecutionResult* /*fencedExecutionResult*/) override {
+        return unsupported();
+    }
+    ndk::ScopedAStatus configureExecutionBurst(std::shared_ptr<IBurst>* /*burst*/) override {
+        return unsupported();
+    }
+    ndk::ScopedAStatus createReusableExecution(
+            const Request& /*request*/, const ExecutionConfig& /*config*/,
+            std::shared_ptr<IExecution>* /*execution*/) override {
+        return unsupported();
+    }
+
+  private:
+    static ndk::ScopedAStatus unsupported() {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+};
+
+// An input and an output of state.range(0) bytes each, both in client memory
+struct PointerRequest {
+    explicit PointerRequest(size_t size) : input(size), output(size) {
+        request.inputs = {{.lifetime = nn::Request::Argument::LifeTime::POINTER,
+                           .location = {.pointer = static_cast<const void*>(input.data()),
+                                        .length = static_cast<uint32_t>(size)}}};
+        request.outputs = {{.lifetime = nn::Request::Argument::LifeTime::POINTER,
+                            .location = {.pointer = static_cast<void*>(output.data()),
+                                         .length = static_cast<uint32_t>(size)}}};
+    }
+
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> output;
+    nn::Request request;
+};
+
+std::shared_ptr<const PreparedModel> createPreparedModel() {
+    return PreparedModel::create(ndk::SharedRefBase::make<FakePreparedModel>(),
+                                 nn::kVersionFeatureLevel7)
+            .value();
+}
+
+// Relocation with new shared memory per inference, as nn::convertRequestFromPointerToShared does
+void BM_UnpooledRelocation(benchmark::State& state) {
+    const PointerRequest pointerRequest(state.range(0));
+
+    for (auto _ : state) {
+        std::optional<nn::Request> maybeRequestInShared;
+        hal::utils::RequestRelocation relocation;
+        const auto result = hal::utils::convertRequestFromPointerToShared(
+                &pointerRequest.request, nn::kDefaultRequestMemoryAlignment,
+                nn::kDefaultRequestMemoryPadding, &maybeRequestInShared, &relocation);
+        if (!result.has_value()) {
+            state.SkipWithError("convertRequestFromPointerToShared failed");
+            break;
+        }
+        relocation.input->flush();
+        relocation.output->flush();
+    }
+}
+
+// Relocation with memory reused from a RelocationPool
+void BM_PooledRelocation(benchmark::State& state) {
+    const PointerRequest pointerRequest(state.range(0));
+    const hal::utils::RelocationPool pool;
+
+    for (auto _ : state) {
+        std::optional<nn::Request> maybeRequestInShared;
+        hal::utils::RequestRelocation relocation;
+        const auto result = pool.convertRequestFromPointerToShared(
+                &pointerRequest.request, nn::kDefaultRequestMemoryAlignment,
+                nn::kDefaultRequestMemoryPadding, &maybeRequestInShared, &relocation);
+        if (!result.has_value()) {
+            state.SkipWithError("convertRequestFromPointerToShared failed");
+            break;
+        }
+        relocation.input->flush();
+        relocation.output->flush();
+    }
+    state.counters["allocations"] = pool.getStats().numAllocations;
+}
+
+// A new execution per inference through the PreparedModel
+void BM_Execute(benchmark::State& state) {
+    const PointerRequest pointerRequest(state.range(0));
+    const auto preparedModel = createPreparedModel();
+
+    for (auto _ : state) {
+        const auto result = preparedModel->execute(pointerRequest.request,
+                                                   nn::MeasureTiming::NO, {}, {}, {}, {});
+        if (!result.has_value()) {
+            state.SkipWithError("execute failed");
+            break;
+        }
+    }
+}
+
+// The same reusable execution for every inference
+void BM_ReusableExecution(benchmark::State& state) {
+    const PointerRequest pointerRequest(state.range(0));
+    const auto preparedModel = createPreparedModel();
+    const auto execution =
+            preparedModel
+                    ->createReusableExecution(pointerRequest.request, nn::MeasureTiming::NO, {},
+                                              {}, {})
+                    .value();
+
+    for (auto _ : state) {
+        const auto result = execution->compute({});
+        if (!result.has_value()) {
+            state.SkipWithError("compute failed");
+            break;
+        }
+    }
+}
+
+BENCHMARK(BM_UnpooledRelocation)->ArgName("bytes")->Arg(64)->Arg(4 << 10)->Arg(1 << 20);
+BENCHMARK(BM_PooledRelocation)->ArgName("bytes")->Arg(64)->Arg(4 << 10)->Arg(1 << 20);
+BENCHMARK(BM_Execute)->ArgName("bytes")->Arg(64)->Arg(4 << 10)->Arg(1 << 20);
+BENCHMARK(BM_ReusableExecution)->ArgName("bytes")->Arg(64)->Arg(4 << 10)->Arg(1 << 20);
+
+}  // namespace
+}  // namespace aidl::android::hardware::neuralnetworks::utils
+
+BENCHMARK_MAIN();
@@ -23,6 +23,7 @@
 #include <nnapi/Result.h>
 #include <nnapi/Types.h>
 #include <nnapi/hal/CommonUtils.h>
+#include <nnapi/hal/RelocationPool.h>
 
 #include <memory>
 #include <tuple>
@@ -90,6 +91,8 @@ class PreparedModel final : public nn::IPreparedModel,
   private:
     const std::shared_ptr<aidl_hal::IPreparedModel> kPreparedModel;
     const nn::Version kFeatureLevel;
+    // Shared memory for the pointer arguments of requests, reused across executions
+    const hal::utils::RelocationPool kRelocationPool;
 };
 
 }  // namespace aidl::android::hardware::neuralnetworks::utils
@@ -134,7 +134,7 @@ nn::ExecutionResult<std::pair<std::vector<nn::OutputShape>, nn::Timing>> Prepare
     // Ensure that request is ready for IPC.
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared = NN_TRY(hal::utils::convertRequestFromPointerToShared(
+    const nn::Request& requestInShared = NN_TRY(kRelocationPool.convertRequestFromPointerToShared(
             &request, nn::kDefaultRequestMemoryAlignment, nn::kDefaultRequestMemoryPadding,
             &maybeRequestInShared, &relocation));
 
@@ -185,9 +185,18 @@ PreparedModel::executeFenced(
     // Ensure that request is ready for IPC.
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared = NN_TRY(hal::utils::convertRequestFromPointerToShared(
-            &request, nn::kDefaultRequestMemoryAlignment, nn::kDefaultRequestMemoryPadding,
-            &maybeRequestInShared, &relocation));
+    // The pooled memory is reused once the relocation is destroyed on return, so it is only used
+    // when executeFencedInternal waits for the execution to complete, that is for pointer outputs.
+    const nn::Request& requestInShared = NN_TRY(
+            hal::utils::hasPointerOutputs(request)
+                    ? kRelocationPool.convertRequestFromPointerToShared(
+                              &request, nn::kDefaultRequestMemoryAlignment,
+                              nn::kDefaultRequestMemoryPadding, &maybeRequestInShared,
+                              &relocation)
+                    : hal::utils::convertRequestFromPointerToShared(
+                              &request, nn::kDefaultRequestMemoryAlignment,
+                              nn::kDefaultRequestMemoryPadding, &maybeRequestInShared,
+                              &relocation));
 
     const auto aidlRequest = NN_TRY(convert(requestInShared));
     const auto aidlWaitFor = NN_TRY(convert(waitFor));
@@ -238,9 +247,19 @@ nn::GeneralResult<nn::SharedExecution> PreparedModel::createReusableExecution(
     // Ensure that request is ready for IPC.
     std::optional<nn::Request> maybeRequestInShared;
     hal::utils::RequestRelocation relocation;
-    const nn::Request& requestInShared = NN_TRY(hal::utils::convertRequestFromPointerToShared(
-            &request, nn::kDefaultRequestMemoryAlignment, nn::kDefaultRequestMemoryPadding,
-            &maybeRequestInShared, &relocation));
+    // An execution may be dropped while a fenced computation still reads its inputs, so as in
+    // executeFenced the pooled memory is only used when computeFenced waits for the computation to
+    // complete, that is for pointer outputs.
+    const nn::Request& requestInShared = NN_TRY(
+            hal::utils::hasPointerOutputs(request)
+                    ? kRelocationPool.convertRequestFromPointerToShared(
+                              &request, nn::kDefaultRequestMemoryAlignment,
+                              nn::kDefaultRequestMemoryPadding, &maybeRequestInShared,
+                              &relocation)
+                    : hal::utils::convertRequestFromPointerToShared(
+                              &request, nn::kDefaultRequestMemoryAlignment,
+                              nn::kDefaultRequestMemoryPadding, &maybeRequestInShared,
+                              &relocation));
 
     auto aidlRequest = NN_TRY(convert(requestInShared));
     auto aidlMeasure = NN_TRY(convert(measure));
@@ -43,6 +43,13 @@ using Task = std::function<void()>;
  */
 using Executor = std::function<void(Task, ::android::nn::OptionalTimePoint)>;
 
+/**
+ * A type-erased executor which executes a task asynchronously, like Executor, and which is also
+ * provided the priority of the task: the priority of the model being prepared.
+ */
+using PrioritizedExecutor =
+        std::function<void(Task, ::android::nn::Priority, ::android::nn::OptionalTimePoint)>;
+
 /**
  * Adapt an NNAPI canonical interface object to a AIDL NN HAL interface object.
  *
@@ -52,6 +59,15 @@ using Executor = std::function<void(Task, ::android::nn::OptionalTimePoint)>;
  */
 std::shared_ptr<BnDevice> adapt(::android::nn::SharedDevice device, Executor executor);
 
+/**
+ * Adapt an NNAPI canonical interface object to a AIDL NN HAL interface object.
+ *
+ * @param device NNAPI canonical IDevice interface object to be adapted.
+ * @param executor Type-erased executor to handle executing tasks asynchronously by priority.
+ * @return AIDL NN HAL IDevice interface object.
+ */
+std::shared_ptr<BnDevice> adapt(::android::nn::SharedDevice device, PrioritizedExecutor executor);
+
 /**
  * Adapt an NNAPI canonical interface object to a AIDL NN HAL interface object.
  *
@@ -62,6 +78,19 @@ std::shared_ptr<BnDevice> adapt(::android::nn::SharedDevice device, Executor exe
  */
 std::shared_ptr<BnDevice> adapt(::android::nn::SharedDevice device);
 
+/**
+ * Adapt an NNAPI canonical interface object to a AIDL NN HAL interface object.
+ *
+ * This function uses a pool of numThreads threads to execute tasks, instead of a thread per task.
+ * Queued tasks are run by priority, then by deadline.
+ *
+ * @param device NNAPI canonical IDevice interface object to be adapted.
+ * @param numThreads Number of threads executing tasks, must be at least 1.
+ * @return AIDL NN HAL IDevice interface object.
+ */
+std::shared_ptr<BnDevice> adaptWithThreadPool(::android::nn::SharedDevice device,
+                                              size_t numThreads);
+
 }  // namespace aidl::android::hardware::neuralnetworks::adapter
 
 #endif  // ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_ADAPTER_AIDL_ADAPTER_H
@@ -49,6 +49,7 @@ namespace aidl::android::hardware::neuralnetworks::adapter {
 class Device : public BnDevice {
   public:
     Device(::android::nn::SharedDevice device, Executor executor);
+    Device(::android::nn::SharedDevice device, PrioritizedExecutor executor);
 
     ndk::ScopedAStatus allocate(const BufferDesc& desc,
                                 const std::vector<IPreparedModelParcel>& preparedModels,
@@ -79,7 +80,7 @@ class Device : public BnDevice {
 
   protected:
     const ::android::nn::SharedDevice kDevice;
-    const Executor kExecutor;
+    const PrioritizedExecutor kExecutor;
 };
 
 }  // namespace aidl::android::hardware::neuralnetworks::adapter
@@ -22,6 +22,7 @@
 #include <android/binder_interface_utils.h>
 #include <nnapi/IDevice.h>
 #include <nnapi/Types.h>
+#include <nnapi/hal/ThreadPool.h>
 
 #include <functional>
 #include <memory>
@@ -36,6 +37,10 @@ std::shared_ptr<BnDevice> adapt(::android::nn::SharedDevice device, Executor exe
     return ndk::SharedRefBase::make<Device>(std::move(device), std::move(executor));
 }
 
+std::shared_ptr<BnDevice> adapt(::android::nn::SharedDevice device, PrioritizedExecutor executor) {
+    return ndk::SharedRefBase::make<Device>(std::move(device), std::move(executor));
+}
+
 std::shared_ptr<BnDevice> adapt(::android::nn::SharedDevice device) {
     Executor defaultExecutor = [](Task task, ::android::nn::OptionalTimePoint /*deadline*/) {
         std::thread(std::move(task)).detach();
@@ -43,4 +48,16 @@ std::shared_ptr<BnDevice> adapt(::android::nn::SharedDevice device) {
     return adapt(std::move(device), std::move(defaultExecutor));
 }
 
+std::shared_ptr<BnDevice> adaptWithThreadPool(::android::nn::SharedDevice device,
+                                              size_t numThreads) {
+    using ::android::hardware::neuralnetworks::utils::ThreadPool;
+    auto threadPool = std::make_shared<ThreadPool>(numThreads);
+    PrioritizedExecutor threadPoolExecutor =
+            [threadPool](Task task, ::android::nn::Priority priority,
+                         ::android::nn::OptionalTimePoint deadline) {
+                threadPool->schedule(std::move(task), priority, deadline);
+            };
+    return adapt(std::move(device), std::move(threadPoolExecutor));
+}
+
 }  // namespace aidl::android::hardware::neuralnetworks::adapter
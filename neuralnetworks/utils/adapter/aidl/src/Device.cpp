@@ -145,6 +145,17 @@ void notify(IPreparedModelCallback* callback, ErrorStatus status,
     }
 }
 
+// Fails the preparation without running it if its deadline passed while the task was queued
+bool notifyIfDeadlinePassed(IPreparedModelCallback* callback,
+                            const nn::OptionalTimePoint& deadline) {
+    if (!deadline.has_value() || nn::Clock::now() <= *deadline) {
+        return false;
+    }
+    LOG(ERROR) << "Deadline passed before the model preparation started";
+    notify(callback, ErrorStatus::MISSED_DEADLINE_PERSISTENT, nullptr);
+    return true;
+}
+
 void notify(IPreparedModelCallback* callback, PrepareModelResult result) {
     if (!result.has_value()) {
         const auto& [message, status] = result.error();
@@ -159,7 +170,7 @@ void notify(IPreparedModelCallback* callback, PrepareModelResult result) {
 }
 
 nn::GeneralResult<void> prepareModel(
-        const nn::SharedDevice& device, const Executor& executor, const Model& model,
+        const nn::SharedDevice& device, const PrioritizedExecutor& executor, const Model& model,
         ExecutionPreference preference, Priority priority, int64_t deadlineNs,
         const std::vector<ndk::ScopedFileDescriptor>& modelCache,
         const std::vector<ndk::ScopedFileDescriptor>& dataCache, const std::vector<uint8_t>& token,
@@ -184,18 +195,21 @@ nn::GeneralResult<void> prepareModel(
                  nnModelCache = std::move(nnModelCache), nnDataCache = std::move(nnDataCache),
                  nnToken, nnHints = std::move(nnHints),
                  nnExtensionNameToPrefix = std::move(nnExtensionNameToPrefix), callback] {
+        if (notifyIfDeadlinePassed(callback.get(), nnDeadline)) {
+            return;
+        }
         auto result =
                 device->prepareModel(nnModel, nnPreference, nnPriority, nnDeadline, nnModelCache,
                                      nnDataCache, nnToken, nnHints, nnExtensionNameToPrefix);
         notify(callback.get(), std::move(result));
     };
-    executor(std::move(task), nnDeadline);
+    executor(std::move(task), nnPriority, nnDeadline);
 
     return {};
 }
 
 nn::GeneralResult<void> prepareModelFromCache(
-        const nn::SharedDevice& device, const Executor& executor, int64_t deadlineNs,
+        const nn::SharedDevice& device, const PrioritizedExecutor& executor, int64_t deadlineNs,
         const std::vector<ndk::ScopedFileDescriptor>& modelCache,
         const std::vector<ndk::ScopedFileDescriptor>& dataCache, const std::vector<uint8_t>& token,
         const std::shared_ptr<IPreparedModelCallback>& callback) {
@@ -210,17 +224,31 @@ nn::GeneralResult<void> prepareModelFromCache(
 
     auto task = [device, nnDeadline, nnModelCache = std::move(nnModelCache),
                  nnDataCache = std::move(nnDataCache), nnToken, callback] {
+        if (notifyIfDeadlinePassed(callback.get(), nnDeadline)) {
+            return;
+        }
         auto result = device->prepareModelFromCache(nnDeadline, nnModelCache, nnDataCache, nnToken);
         notify(callback.get(), std::move(result));
     };
-    executor(std::move(task), nnDeadline);
+    executor(std::move(task), nn::Priority::DEFAULT, nnDeadline);
 
     return {};
 }
 
+PrioritizedExecutor ignorePriority(Executor executor) {
+    CHECK(executor != nullptr);
+    return [executor = std::move(executor)](Task task, nn::Priority /*priority*/,
+                                            nn::OptionalTimePoint deadline) {
+        executor(std::move(task), deadline);
+    };
+}
+
 }  // namespace
 
 Device::Device(::android::nn::SharedDevice device, Executor executor)
+    : Device(std::move(device), ignorePriority(std::move(executor))) {}
+
+Device::Device(::android::nn::SharedDevice device, PrioritizedExecutor executor)
     : kDevice(std::move(device)), kExecutor(std::move(executor)) {
     CHECK(kDevice != nullptr);
     CHECK(kExecutor != nullptr);
@@ -43,6 +43,12 @@ using Task = std::function<void()>;
  */
 using Executor = std::function<void(Task, nn::OptionalTimePoint)>;
 
+/**
+ * A type-erased executor which executes a task asynchronously, like Executor, and which is also
+ * provided the priority of the task: the priority of the model being prepared.
+ */
+using PrioritizedExecutor = std::function<void(Task, nn::Priority, nn::OptionalTimePoint)>;
+
 /**
  * Adapt an NNAPI canonical interface object to a HIDL NN HAL interface object.
  *
@@ -52,6 +58,15 @@ using Executor = std::function<void(Task, nn::OptionalTimePoint)>;
  */
 sp<V1_3::IDevice> adapt(nn::SharedDevice device, Executor executor);
 
+/**
+ * Adapt an NNAPI canonical interface object to a HIDL NN HAL interface object.
+ *
+ * @param device NNAPI canonical IDevice interface object to be adapted.
+ * @param executor Type-erased executor to handle executing tasks asynchronously by priority.
+ * @return HIDL NN HAL IDevice interface object.
+ */
+sp<V1_3::IDevice> adapt(nn::SharedDevice device, PrioritizedExecutor executor);
+
 /**
  * Adapt an NNAPI canonical interface object to a HIDL NN HAL interface object.
  *
@@ -62,6 +77,18 @@ sp<V1_3::IDevice> adapt(nn::SharedDevice device, Executor executor);
  */
 sp<V1_3::IDevice> adapt(nn::SharedDevice device);
 
+/**
+ * Adapt an NNAPI canonical interface object to a HIDL NN HAL interface object.
+ *
+ * This function uses a pool of numThreads threads to execute tasks, instead of a thread per task.
+ * Queued tasks are run by priority, then by deadline.
+ *
+ * @param device NNAPI canonical IDevice interface object to be adapted.
+ * @param numThreads Number of threads executing tasks, must be at least 1.
+ * @return HIDL NN HAL IDevice interface object.
+ */
+sp<V1_3::IDevice> adaptWithThreadPool(nn::SharedDevice device, size_t numThreads);
+
 }  // namespace android::hardware::neuralnetworks::adapter
 
 #endif  // ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_ADAPTER_ADAPTER_H
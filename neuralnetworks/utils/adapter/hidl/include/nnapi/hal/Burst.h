@@ -111,8 +111,9 @@ class Burst : public V1_2::IBurstContext {
      *     execution.
      * @param burstExecutor Object which maintains a local cache of the memory pools and executes
      *     using the cached memory pools.
-     * @param pollingTimeWindow How much time (in microseconds) the Burst is allowed to poll the FMQ
-     *     before waiting on the blocking futex. Polling may result in lower latencies at the
+     * @param pollingTimeWindow The most time (in microseconds) the Burst is allowed to poll the
+     *     FMQ before waiting on the blocking futex. Within it, the Burst polls as long as the next
+     *     request is expected to take to arrive. Polling may result in lower latencies at the
      *     potential cost of more power usage.
      * @return V1_2::IBurstContext Handle to the burst context.
      */
@@ -133,6 +134,9 @@ class Burst : public V1_2::IBurstContext {
     // V1_2::IBurstContext::freeMemory for more information.
     Return<void> freeMemory(int32_t slot) override;
 
+    // How the burst has waited for requests so far, for tuning its polling window.
+    V1_2::utils::PollingStats getPollingStats() const;
+
   private:
     // Work loop that will continue processing execution requests until the Burst object is freed.
     void task();
@@ -42,6 +42,7 @@ using CacheToken = hidl_array<uint8_t, nn::kByteSizeOfCacheToken>;
 class Device final : public V1_3::IDevice {
   public:
     Device(nn::SharedDevice device, Executor executor);
+    Device(nn::SharedDevice device, PrioritizedExecutor executor);
 
     Return<void> getCapabilities(getCapabilities_cb cb) override;
     Return<void> getCapabilities_1_1(getCapabilities_1_1_cb cb) override;
@@ -88,7 +89,7 @@ class Device final : public V1_3::IDevice {
 
   private:
     const nn::SharedDevice kDevice;
-    const Executor kExecutor;
+    const PrioritizedExecutor kExecutor;
 };
 
 }  // namespace android::hardware::neuralnetworks::adapter
@@ -21,6 +21,7 @@
 #include <android/hardware/neuralnetworks/1.3/IDevice.h>
 #include <nnapi/IDevice.h>
 #include <nnapi/Types.h>
+#include <nnapi/hal/ThreadPool.h>
 
 #include <functional>
 #include <memory>
@@ -35,6 +36,10 @@ sp<V1_3::IDevice> adapt(nn::SharedDevice device, Executor executor) {
     return sp<Device>::make(std::move(device), std::move(executor));
 }
 
+sp<V1_3::IDevice> adapt(nn::SharedDevice device, PrioritizedExecutor executor) {
+    return sp<Device>::make(std::move(device), std::move(executor));
+}
+
 sp<V1_3::IDevice> adapt(nn::SharedDevice device) {
     Executor defaultExecutor = [](Task task, nn::OptionalTimePoint /*deadline*/) {
         std::thread(std::move(task)).detach();
@@ -42,4 +47,13 @@ sp<V1_3::IDevice> adapt(nn::SharedDevice device) {
     return adapt(std::move(device), std::move(defaultExecutor));
 }
 
+sp<V1_3::IDevice> adaptWithThreadPool(nn::SharedDevice device, size_t numThreads) {
+    auto threadPool = std::make_shared<utils::ThreadPool>(numThreads);
+    PrioritizedExecutor threadPoolExecutor = [threadPool](Task task, nn::Priority priority,
+                                                          nn::OptionalTimePoint deadline) {
+        threadPool->schedule(std::move(task), priority, deadline);
+    };
+    return adapt(std::move(device), std::move(threadPoolExecutor));
+}
+
 }  // namespace android::hardware::neuralnetworks::adapter
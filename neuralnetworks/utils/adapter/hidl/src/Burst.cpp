@@ -191,7 +191,20 @@ Return<void> Burst::freeMemory(int32_t slot) {
     return Void();
 }
 
+V1_2::utils::PollingStats Burst::getPollingStats() const {
+    return mRequestChannelReceiver->getPollingStats();
+}
+
 void Burst::task() {
+    const auto sendResult = [this](V1_0::ErrorStatus status,
+                                   const std::vector<V1_2::OutputShape>& outputShapes,
+                                   V1_2::Timing timing) {
+        if (const auto result = mResultChannelSender->send(status, outputShapes, timing);
+            !result.has_value()) {
+            LOG(ERROR) << "Burst::task failed to send result: " << result.error();
+        }
+    };
+
     // loop until the burst object is being destroyed
     while (!mTeardown) {
         // receive request
@@ -203,7 +216,7 @@ void Burst::task() {
         // if the burst is being torn down, skip the execution so the "task" function can end
         if (!arguments.has_value()) {
             if (!mTeardown) {
-                mResultChannelSender->send(V1_0::ErrorStatus::GENERAL_FAILURE, {}, kTiming);
+                sendResult(V1_0::ErrorStatus::GENERAL_FAILURE, {}, kTiming);
             }
             continue;
         }
@@ -217,12 +230,12 @@ void Burst::task() {
         // return result
         if (result.has_value()) {
             const auto& [outputShapes, timing] = result.value();
-            mResultChannelSender->send(V1_0::ErrorStatus::NONE, outputShapes, timing);
+            sendResult(V1_0::ErrorStatus::NONE, outputShapes, timing);
         } else {
             const auto& [message, code, outputShapes] = result.error();
             LOG(ERROR) << "IBurst::execute failed with " << code << ": " << message;
-            mResultChannelSender->send(V1_2::utils::convert(code).value(),
-                                       V1_2::utils::convert(outputShapes).value(), kTiming);
+            sendResult(V1_2::utils::convert(code).value(),
+                       V1_2::utils::convert(outputShapes).value(), kTiming);
         }
     }
 }
@@ -117,6 +117,17 @@ void notify(CallbackType* callback, PrepareModelResult result) {
     }
 }
 
+// Fails the preparation without running it if its deadline passed while the task was queued
+template <typename CallbackType>
+bool notifyIfDeadlinePassed(CallbackType* callback, const nn::OptionalTimePoint& deadline) {
+    if (!deadline.has_value() || nn::Clock::now() <= *deadline) {
+        return false;
+    }
+    LOG(ERROR) << "Deadline passed before the model preparation started";
+    notify(callback, nn::ErrorStatus::MISSED_DEADLINE_PERSISTENT, nullptr);
+    return true;
+}
+
 template <typename ModelType>
 nn::GeneralResult<hidl_vec<bool>> getSupportedOperations(const nn::SharedDevice& device,
                                                          const ModelType& model) {
@@ -124,8 +135,8 @@ nn::GeneralResult<hidl_vec<bool>> getSupportedOperations(const nn::SharedDevice&
     return NN_TRY(device->getSupportedOperations(nnModel));
 }
 
-nn::GeneralResult<void> prepareModel(const nn::SharedDevice& device, const Executor& executor,
-                                     const V1_0::Model& model,
+nn::GeneralResult<void> prepareModel(const nn::SharedDevice& device,
+                                     const PrioritizedExecutor& executor, const V1_0::Model& model,
                                      const sp<V1_0::IPreparedModelCallback>& callback) {
     if (callback.get() == nullptr) {
         return NN_ERROR(nn::ErrorStatus::INVALID_ARGUMENT) << "Invalid callback";
@@ -138,12 +149,13 @@ nn::GeneralResult<void> prepareModel(const nn::SharedDevice& device, const Execu
                                            nn::Priority::DEFAULT, {}, {}, {}, {}, {}, {});
         notify(callback.get(), std::move(result));
     };
-    executor(std::move(task), {});
+    executor(std::move(task), nn::Priority::DEFAULT, {});
 
     return {};
 }
 
-nn::GeneralResult<void> prepareModel_1_1(const nn::SharedDevice& device, const Executor& executor,
+nn::GeneralResult<void> prepareModel_1_1(const nn::SharedDevice& device,
+                                         const PrioritizedExecutor& executor,
                                          const V1_1::Model& model,
                                          V1_1::ExecutionPreference preference,
                                          const sp<V1_0::IPreparedModelCallback>& callback) {
@@ -159,12 +171,13 @@ nn::GeneralResult<void> prepareModel_1_1(const nn::SharedDevice& device, const E
                                            {}, {}, {});
         notify(callback.get(), std::move(result));
     };
-    executor(std::move(task), {});
+    executor(std::move(task), nn::Priority::DEFAULT, {});
 
     return {};
 }
 
-nn::GeneralResult<void> prepareModel_1_2(const nn::SharedDevice& device, const Executor& executor,
+nn::GeneralResult<void> prepareModel_1_2(const nn::SharedDevice& device,
+                                         const PrioritizedExecutor& executor,
                                          const V1_2::Model& model,
                                          V1_1::ExecutionPreference preference,
                                          const hidl_vec<hidl_handle>& modelCache,
@@ -188,14 +201,14 @@ nn::GeneralResult<void> prepareModel_1_2(const nn::SharedDevice& device, const E
                                            nnModelCache, nnDataCache, nnToken, {}, {});
         notify(callback.get(), std::move(result));
     };
-    executor(std::move(task), {});
+    executor(std::move(task), nn::Priority::DEFAULT, {});
 
     return {};
 }
 
 nn::GeneralResult<void> prepareModel_1_3(
-        const nn::SharedDevice& device, const Executor& executor, const V1_3::Model& model,
-        V1_1::ExecutionPreference preference, V1_3::Priority priority,
+        const nn::SharedDevice& device, const PrioritizedExecutor& executor,
+        const V1_3::Model& model, V1_1::ExecutionPreference preference, V1_3::Priority priority,
         const V1_3::OptionalTimePoint& deadline, const hidl_vec<hidl_handle>& modelCache,
         const hidl_vec<hidl_handle>& dataCache, const CacheToken& token,
         const sp<V1_3::IPreparedModelCallback>& callback) {
@@ -214,17 +227,20 @@ nn::GeneralResult<void> prepareModel_1_3(
     Task task = [device, nnModel = std::move(nnModel), nnPreference, nnPriority, nnDeadline,
                  nnModelCache = std::move(nnModelCache), nnDataCache = std::move(nnDataCache),
                  nnToken, callback] {
+        if (notifyIfDeadlinePassed(callback.get(), nnDeadline)) {
+            return;
+        }
         auto result = device->prepareModel(nnModel, nnPreference, nnPriority, nnDeadline,
                                            nnModelCache, nnDataCache, nnToken, {}, {});
         notify(callback.get(), std::move(result));
     };
-    executor(std::move(task), nnDeadline);
+    executor(std::move(task), nnPriority, nnDeadline);
 
     return {};
 }
 
 nn::GeneralResult<void> prepareModelFromCache(const nn::SharedDevice& device,
-                                              const Executor& executor,
+                                              const PrioritizedExecutor& executor,
                                               const hidl_vec<hidl_handle>& modelCache,
                                               const hidl_vec<hidl_handle>& dataCache,
                                               const CacheToken& token,
@@ -242,13 +258,13 @@ nn::GeneralResult<void> prepareModelFromCache(const nn::SharedDevice& device,
         auto result = device->prepareModelFromCache({}, nnModelCache, nnDataCache, nnToken);
         notify(callback.get(), std::move(result));
     };
-    executor(std::move(task), {});
+    executor(std::move(task), nn::Priority::DEFAULT, {});
 
     return {};
 }
 
 nn::GeneralResult<void> prepareModelFromCache_1_3(
-        const nn::SharedDevice& device, const Executor& executor,
+        const nn::SharedDevice& device, const PrioritizedExecutor& executor,
         const V1_3::OptionalTimePoint& deadline, const hidl_vec<hidl_handle>& modelCache,
         const hidl_vec<hidl_handle>& dataCache, const CacheToken& token,
         const sp<V1_3::IPreparedModelCallback>& callback) {
@@ -263,10 +279,13 @@ nn::GeneralResult<void> prepareModelFromCache_1_3(
 
     auto task = [device, nnDeadline, nnModelCache = std::move(nnModelCache),
                  nnDataCache = std::move(nnDataCache), nnToken, callback] {
+        if (notifyIfDeadlinePassed(callback.get(), nnDeadline)) {
+            return;
+        }
         auto result = device->prepareModelFromCache(nnDeadline, nnModelCache, nnDataCache, nnToken);
         notify(callback.get(), std::move(result));
     };
-    executor(std::move(task), nnDeadline);
+    executor(std::move(task), nn::Priority::DEFAULT, nnDeadline);
 
     return {};
 }
@@ -312,9 +331,20 @@ nn::GeneralResult<std::pair<sp<V1_3::IBuffer>, uint32_t>> allocate(
     return std::make_pair(std::move(hidlBuffer), static_cast<uint32_t>(token));
 }
 
+PrioritizedExecutor ignorePriority(Executor executor) {
+    CHECK(executor != nullptr);
+    return [executor = std::move(executor)](Task task, nn::Priority /*priority*/,
+                                            nn::OptionalTimePoint deadline) {
+        executor(std::move(task), deadline);
+    };
+}
+
 }  // namespace
 
 Device::Device(nn::SharedDevice device, Executor executor)
+    : Device(std::move(device), ignorePriority(std::move(executor))) {}
+
+Device::Device(nn::SharedDevice device, PrioritizedExecutor executor)
     : kDevice(std::move(device)), kExecutor(std::move(executor)) {
     CHECK(kDevice != nullptr);
     CHECK(kExecutor != nullptr);
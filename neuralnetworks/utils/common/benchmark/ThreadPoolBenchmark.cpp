@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <nnapi/Types.h>
+#include <nnapi/hal/ThreadPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Latency of bursts of model preparations scheduled by several clients at once, executed by a
+ * detached thread per task, as the default adapter executor does, or by a ThreadPool:
+ * adb shell /data/benchmarktest64/neuralnetworks_utils_hal_common_benchmark/neuralnetworks_utils_hal_common_benchmark
+ */
+namespace android::hardware::neuralnetworks::utils {
+namespace {
+
+using Task = std::function<void()>;
+using Executor = std::function<void(Task, nn::Priority, nn::OptionalTimePoint)>;
+
+constexpr size_t kNumClients = 4;
+constexpr auto kTaskWork = std::chrono::microseconds(500);
+constexpr size_t kNumPoolThreads = 4;
+
+// Stands in for a model preparation: keeps a CPU busy for kTaskWork
+void work() {
+    const auto end = std::chrono::steady_clock::now() + kTaskWork;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+class Latch {
+  public:
+    explicit Latch(size_t count) : mCount(count) {}
+    void countDown() {
+        std::lock_guard guard(mMutex);
+        if (--mCount == 0) {
+            mCondition.notify_all();
+        }
+    }
+    void wait() {
+        std::unique_lock lock(mMutex);
+        mCondition.wait(lock, [this] { return mCount == 0; });
+    }
+
+  private:
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    size_t mCount;
+};
+
+// Each iteration, kNumClients threads each schedule state.range(0) tasks at once, then wait until
+// all of them are done
+void runBursts(benchmark::State& state, const Executor& executor) {
+    const size_t tasksPerClient = state.range(0);
+    const size_t numTasks = tasksPerClient * kNumClients;
+    std::vector<std::chrono::nanoseconds> latencies;
+    std::mutex latenciesMutex;
+    std::atomic<size_t> numRunning = 0;
+    std::atomic<size_t> maxRunning = 0;
+
+    for (auto _ : state) {
+        // Shared with the tasks, which may still be releasing it after wait() returns
+        auto done = std::make_shared<Latch>(numTasks);
+        std::vector<std::thread> clients;
+        for (size_t c = 0; c < kNumClients; ++c) {
+            clients.emplace_back([&] {
+                for (size_t i = 0; i < tasksPerClient; ++i) {
+                    const auto start = std::chrono::steady_clock::now();
+                    executor(
+                            [&, done, start] {
+                                size_t running = ++numRunning;
+                                size_t max = maxRunning;
+                                while (running > max &&
+                                       !maxRunning.compare_exchange_weak(max, running)) {
+                                }
+                                work();
+                                --numRunning;
+                                const auto latency = std::chrono::steady_clock::now() - start;
+                                {
+                                    std::lock_guard guard(latenciesMutex);
+                                    latencies.push_back(latency);
+                                }
+                                done->countDown();
+                            },
+                            nn::Priority::MEDIUM, {});
+                }
+            });
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+        done->wait();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentileMs = [&](size_t p) {
+        return latencies.empty()
+                       ? 0.0
+                       : std::chrono::duration<double, std::milli>(
+                                 latencies[(latencies.size() - 1) * p / 100])
+                                 .count();
+    };
+    state.counters["p50_ms"] = percentileMs(50);
+    state.counters["p99_ms"] = percentileMs(99);
+    state.counters["max_concurrent_tasks"] = maxRunning.load();
+    state.counters["tasks"] = benchmark::Counter(latencies.size(), benchmark::Counter::kIsRate);
+}
+
+void BM_DetachedThreadExecutor(benchmark::State& state) {
+    const Executor executor = [](Task task, nn::Priority /*priority*/,
+                                 nn::OptionalTimePoint /*deadline*/) {
+        std::thread(std::move(task)).detach();
+    };
+    runBursts(state, executor);
+}
+
+void BM_ThreadPoolExecutor(benchmark::State& state) {
+    auto threadPool = std::make_shared<ThreadPool>(kNumPoolThreads);
+    const Executor executor = [threadPool](Task task, nn::Priority priority,
+                                           nn::OptionalTimePoint deadline) {
+        threadPool->schedule(std::move(task), priority, deadline);
+    };
+    runBursts(state, executor);
+}
+
+BENCHMARK(BM_DetachedThreadExecutor)
+        ->ArgName("tasks_per_client")
+        ->Arg(1)
+        ->Arg(8)
+        ->Arg(32)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+BENCHMARK(BM_ThreadPoolExecutor)
+        ->ArgName("tasks_per_client")
+        ->Arg(1)
+        ->Arg(8)
+        ->Arg(32)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+}  // namespace
+}  // namespace android::hardware::neuralnetworks::utils
+
+BENCHMARK_MAIN();
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_COMMON_RELOCATION_POOL_H
+#define ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_COMMON_RELOCATION_POOL_H
+
+#include <nnapi/Result.h>
+#include <nnapi/SharedMemory.h>
+#include <nnapi/Types.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+
+namespace android::hardware::neuralnetworks::utils {
+
+/**
+ * Shared memory for the pointer arguments of requests, reused across executions.
+ *
+ * nn::convertRequestFromPointerToShared creates and maps new shared memory for every request with
+ * pointer arguments, which dominates the cost of small executions. The pool instead keeps mapped
+ * memory in buckets of power of two sizes. The memory of a conversion is taken from the pool and
+ * goes back to it when the RelocationTrackers of the RequestRelocation are destroyed, so the
+ * RequestRelocation must outlive every use of the converted request by the driver. Reused memory
+ * is zeroed as far as it was handed out before, so it reads the same as new shared memory.
+ *
+ * All methods are thread-safe.
+ */
+class RelocationPool final {
+  public:
+    struct Stats {
+        // Shared memory created because no idle memory of the bucket was available
+        size_t numAllocations = 0;
+        // Idle shared memory taken from the pool
+        size_t numReuses = 0;
+        // Shared memory currently waiting in the pool
+        size_t numIdle = 0;
+        // Total size of the shared memory currently waiting in the pool
+        size_t idleBytes = 0;
+    };
+
+    static constexpr size_t kDefaultMaxIdlePerBucket = 4;
+    static constexpr size_t kDefaultMaxIdleBytes = 16 << 20;
+
+    /**
+     * @param maxIdlePerBucket Maximum number of idle shared memory regions kept per bucket. Memory
+     *     released to a full bucket is freed.
+     * @param maxIdleBytes Maximum total size of the idle shared memory of all buckets. Memory
+     *     released to a pool that would exceed it is freed.
+     */
+    explicit RelocationPool(size_t maxIdlePerBucket = kDefaultMaxIdlePerBucket,
+                            size_t maxIdleBytes = kDefaultMaxIdleBytes);
+
+    /**
+     * Same as nn::convertRequestFromPointerToShared, with the shared memory taken from the pool.
+     */
+    nn::GeneralResult<std::reference_wrapper<const nn::Request>> convertRequestFromPointerToShared(
+            const nn::Request* request, uint32_t alignment, uint32_t padding,
+            std::optional<nn::Request>* maybeRequestInSharedOut,
+            nn::RequestRelocation* relocationOut) const;
+
+    Stats getStats() const;
+
+  private:
+    struct State;
+    const std::shared_ptr<State> kState;
+};
+
+/**
+ * Whether the request has an output in client memory.
+ *
+ * Fenced executions of such requests wait for the fence before flushing the output back, so the
+ * relocation memory is no longer used by the driver once they return.
+ */
+bool hasPointerOutputs(const nn::Request& request);
+
+}  // namespace android::hardware::neuralnetworks::utils
+
+#endif  // ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_COMMON_RELOCATION_POOL_H
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_COMMON_THREAD_POOL_H
+#define ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_COMMON_THREAD_POOL_H
+
+#include <android-base/thread_annotations.h>
+#include <nnapi/Types.h>
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace android::hardware::neuralnetworks::utils {
+
+/**
+ * A fixed number of threads executing tasks asynchronously, by priority.
+ *
+ * Each nn::Priority has its own queue. A free thread takes the next task from the highest priority
+ * queue that is not empty. Within a queue, tasks run in order of deadline, and tasks without a
+ * deadline run after those with one, in the order they were scheduled.
+ *
+ * Tasks scheduled before the pool is destroyed are all run: the destructor waits for the queues to
+ * drain before joining the threads.
+ */
+class ThreadPool final {
+  public:
+    using Task = std::function<void()>;
+
+    /**
+     * Start the threads of the pool.
+     *
+     * @param numThreads Number of threads executing the tasks, must be at least 1.
+     */
+    explicit ThreadPool(size_t numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Queue a task to be run by one of the threads of the pool.
+     *
+     * @param task Task to run.
+     * @param priority Priority of the task relative to the other queued tasks.
+     * @param deadline Optional deadline of the task, earlier deadlines run first.
+     */
+    void schedule(Task task, nn::Priority priority, nn::OptionalTimePoint deadline);
+
+    size_t getNumThreads() const { return mThreads.size(); }
+
+  private:
+    // Tasks by deadline, then by order of scheduling
+    using Queue = std::map<std::pair<nn::TimePoint, uint64_t>, Task>;
+    static constexpr size_t kNumPriorities = 3;
+
+    static size_t getQueueIndex(nn::Priority priority);
+    void threadLoop();
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    // Indexed by getQueueIndex, the highest priority first
+    std::array<Queue, kNumPriorities> mQueues GUARDED_BY(mMutex);
+    uint64_t mNextSequence GUARDED_BY(mMutex) = 0;
+    bool mStopping GUARDED_BY(mMutex) = false;
+    std::vector<std::thread> mThreads;
+};
+
+}  // namespace android::hardware::neuralnetworks::utils
+
+#endif  // ANDROID_HARDWARE_INTERFACES_NEURALNETWORKS_UTILS_COMMON_THREAD_POOL_H
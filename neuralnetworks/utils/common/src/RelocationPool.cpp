@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RelocationPool.h"
+
+#include <android-base/logging.h>
+#include <android-base/thread_annotations.h>
+#include <nnapi/Result.h>
+#include <nnapi/SharedMemory.h>
+#include <nnapi/Types.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace android::hardware::neuralnetworks::utils {
+namespace {
+
+// The smallest bucket is a page, the largest 128 MiB. Larger memory is not pooled.
+constexpr size_t kMinBucketSizeLog2 = 12;
+constexpr size_t kNumBuckets = 16;
+
+constexpr size_t getBucketSize(size_t bucket) {
+    return size_t{1} << (kMinBucketSizeLog2 + bucket);
+}
+
+// Index of the smallest bucket that fits size, kNumBuckets if none does
+size_t getBucket(size_t size) {
+    size_t bucket = 0;
+    while (bucket < kNumBuckets && getBucketSize(bucket) < size) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+size_t roundUp(size_t size, size_t multiple) {
+    return multiple == 0 ? size : (size + multiple - 1) / multiple * multiple;
+}
+
+// Moves the pointer arguments into pool poolIndex, laid out as nn::MutableMemoryBuilder does, and
+// returns the size of the pool, 0 if there are no pointer arguments.
+template <typename PointerType>
+nn::GeneralResult<size_t> relocate(std::vector<nn::Request::Argument>* arguments,
+                                   uint32_t poolIndex, uint32_t alignment, uint32_t padding,
+                                   std::vector<nn::RelocationInfo<PointerType>>* infos) {
+    size_t size = 0;
+    for (auto& argument : *arguments) {
+        if (argument.lifetime != nn::Request::Argument::LifeTime::POINTER) {
+            continue;
+        }
+        PointerType data = nullptr;
+        if constexpr (std::is_same_v<PointerType, const void*>) {
+            data = std::visit([](auto ptr) { return static_cast<const void*>(ptr); },
+                              argument.location.pointer);
+        } else {
+            const auto* ptr = std::get_if<void*>(&argument.location.pointer);
+            if (ptr == nullptr) {
+                return NN_ERROR(nn::ErrorStatus::INVALID_ARGUMENT)
+                       << "output argument has a pointer to const data";
+            }
+            data = *ptr;
+        }
+
+        const size_t length = argument.location.length;
+        const size_t offset = roundUp(size, alignment);
+        const size_t paddedLength = roundUp(length, padding);
+        if (offset + paddedLength > std::numeric_limits<uint32_t>::max()) {
+            return NN_ERROR(nn::ErrorStatus::INVALID_ARGUMENT)
+                   << "pointer arguments do not fit in a single memory pool";
+        }
+        infos->push_back({.data = data, .length = length, .offset = offset});
+        argument.lifetime = nn::Request::Argument::LifeTime::POOL;
+        argument.location = {.poolIndex = poolIndex,
+                             .offset = static_cast<uint32_t>(offset),
+                             .length = static_cast<uint32_t>(length),
+                             .padding = static_cast<uint32_t>(paddedLength - length)};
+        size = offset + paddedLength;
+    }
+    return size;
+}
+
+}  // namespace
+
+struct RelocationPool::State {
+    struct Memory {
+        nn::SharedMemory memory;
+        nn::Mapping mapping;
+        // Size of the prefix of the memory which was handed out since it was last zeroed
+        size_t dirtySize = 0;
+    };
+
+    // Memory taken from the pool, given back when the last copy of the mapping holding it goes away
+    class Lease final {
+      public:
+        Lease(std::shared_ptr<State> state, size_t bucket, Memory memory)
+            : kState(std::move(state)), kBucket(bucket), mMemory(std::move(memory)) {}
+        ~Lease() { kState->release(kBucket, std::move(mMemory)); }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+      private:
+        const std::shared_ptr<State> kState;
+        const size_t kBucket;
+        Memory mMemory;
+    };
+
+    State(size_t maxIdlePerBucket, size_t maxIdleBytes)
+        : kMaxIdlePerBucket(maxIdlePerBucket), kMaxIdleBytes(maxIdleBytes) {}
+
+    // Returns memory of at least size bytes and a mapping of it that holds the lease on the memory
+    static nn::GeneralResult<std::pair<nn::SharedMemory, nn::Mapping>> acquire(
+            const std::shared_ptr<State>& state, size_t size) {
+        const size_t bucket = getBucket(size);
+        std::optional<Memory> memory = state->takeIdle(bucket);
+        if (!memory.has_value()) {
+            auto sharedMemory =
+                    NN_TRY(nn::createSharedMemory(bucket < kNumBuckets ? getBucketSize(bucket)
+                                                                       : size));
+            auto mapping = NN_TRY(nn::map(sharedMemory));
+            memory.emplace(
+                    Memory{.memory = std::move(sharedMemory), .mapping = std::move(mapping)});
+        } else {
+            // The driver may leave parts of an output unwritten, which must not show what the
+            // previous execution left there.
+            void* const* pointer = std::get_if<void*>(&memory->mapping.pointer);
+            CHECK(pointer != nullptr);
+            std::memset(*pointer, 0, memory->dirtySize);
+        }
+        memory->dirtySize = size;
+
+        auto sharedMemory = memory->memory;
+        auto mapping = nn::Mapping{.pointer = memory->mapping.pointer,
+                                   .size = memory->mapping.size};
+        mapping.context = std::make_shared<Lease>(state, bucket, std::move(memory).value());
+        return std::make_pair(std::move(sharedMemory), std::move(mapping));
+    }
+
+    std::optional<Memory> takeIdle(size_t bucket) {
+        std::lock_guard guard(mMutex);
+        if (bucket < kNumBuckets && !mIdle[bucket].empty()) {
+            auto memory = std::move(mIdle[bucket].back());
+            mIdle[bucket].pop_back();
+            mIdleBytes -= getBucketSize(bucket);
+            ++mNumReuses;
+            return memory;
+        }
+        ++mNumAllocations;
+        return std::nullopt;
+    }
+
+    void release(size_t bucket, Memory memory) {
+        std::lock_guard guard(mMutex);
+        if (bucket < kNumBuckets && mIdle[bucket].size() < kMaxIdlePerBucket &&
+            mIdleBytes + getBucketSize(bucket) <= kMaxIdleBytes) {
+            mIdle[bucket].push_back(std::move(memory));
+            mIdleBytes += getBucketSize(bucket);
+        }
+    }
+
+    Stats getStats() const {
+        std::lock_guard guard(mMutex);
+        size_t numIdle = 0;
+        for (const auto& idle : mIdle) {
+            numIdle += idle.size();
+        }
+        return {.numAllocations = mNumAllocations,
+                .numReuses = mNumReuses,
+                .numIdle = numIdle,
+                .idleBytes = mIdleBytes};
+    }
+
+    const size_t kMaxIdlePerBucket;
+    const size_t kMaxIdleBytes;
+    mutable std::mutex mMutex;
+    std::array<std::vector<Memory>, kNumBuckets> mIdle GUARDED_BY(mMutex);
+    size_t mIdleBytes GUARDED_BY(mMutex) = 0;
+    size_t mNumAllocations GUARDED_BY(mMutex) = 0;
+    size_t mNumReuses GUARDED_BY(mMutex) = 0;
+};
+
+RelocationPool::RelocationPool(size_t maxIdlePerBucket, size_t maxIdleBytes)
+    : kState(std::make_shared<State>(maxIdlePerBucket, maxIdleBytes)) {}
+
+nn::GeneralResult<std::reference_wrapper<const nn::Request>>
+RelocationPool::convertRequestFromPointerToShared(
+        const nn::Request* request, uint32_t alignment, uint32_t padding,
+        std::optional<nn::Request>* maybeRequestInSharedOut,
+        nn::RequestRelocation* relocationOut) const {
+    CHECK(request != nullptr);
+    CHECK(maybeRequestInSharedOut != nullptr);
+    CHECK(relocationOut != nullptr);
+
+    if (nn::hasNoPointerData(*request)) {
+        return *request;
+    }
+
+    // make a copy if the request does not have it already
+    if (!maybeRequestInSharedOut->has_value()) {
+        *maybeRequestInSharedOut = *request;
+    }
+    nn::Request& requestInShared = maybeRequestInSharedOut->value();
+
+    std::vector<nn::RelocationInfo<const void*>> inputInfos;
+    const size_t inputSize =
+            NN_TRY(relocate(&requestInShared.inputs,
+                            static_cast<uint32_t>(requestInShared.pools.size()), alignment,
+                            padding, &inputInfos));
+    if (!inputInfos.empty()) {
+        auto [memory, mapping] = NN_TRY(State::acquire(kState, inputSize));
+        requestInShared.pools.push_back(std::move(memory));
+        relocationOut->input = std::make_unique<nn::InputRelocationTracker>(std::move(inputInfos),
+                                                                            std::move(mapping));
+    }
+
+    std::vector<nn::RelocationInfo<void*>> outputInfos;
+    const size_t outputSize =
+            NN_TRY(relocate(&requestInShared.outputs,
+                            static_cast<uint32_t>(requestInShared.pools.size()), alignment,
+                            padding, &outputInfos));
+    if (!outputInfos.empty()) {
+        auto [memory, mapping] = NN_TRY(State::acquire(kState, outputSize));
+        requestInShared.pools.push_back(std::move(memory));
+        relocationOut->output = std::make_unique<nn::OutputRelocationTracker>(
+                std::move(outputInfos), std::move(mapping));
+    }
+
+    return requestInShared;
+}
+
+RelocationPool::Stats RelocationPool::getStats() const {
+    return kState->getStats();
+}
+
+bool hasPointerOutputs(const nn::Request& request) {
+    return std::any_of(request.outputs.begin(), request.outputs.end(), [](const auto& output) {
+        return output.lifetime == nn::Request::Argument::LifeTime::POINTER;
+    });
+}
+
+}  // namespace android::hardware::neuralnetworks::utils
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ThreadPool.h"
+
+#include <android-base/logging.h>
+#include <android-base/thread_annotations.h>
+#include <nnapi/Types.h>
+
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace android::hardware::neuralnetworks::utils {
+
+ThreadPool::ThreadPool(size_t numThreads) {
+    CHECK_GT(numThreads, 0u);
+    mThreads.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; ++i) {
+        mThreads.emplace_back([this] { threadLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard guard(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::schedule(Task task, nn::Priority priority, nn::OptionalTimePoint deadline) {
+    CHECK(task != nullptr);
+    {
+        std::lock_guard guard(mMutex);
+        auto& queue = mQueues[getQueueIndex(priority)];
+        queue.emplace(std::make_pair(deadline.value_or(nn::TimePoint::max()), mNextSequence++),
+                      std::move(task));
+    }
+    mCondition.notify_one();
+}
+
+size_t ThreadPool::getQueueIndex(nn::Priority priority) {
+    switch (priority) {
+        case nn::Priority::HIGH:
+            return 0;
+        case nn::Priority::MEDIUM:
+            return 1;
+        case nn::Priority::LOW:
+            return 2;
+    }
+    return 1;
+}
+
+void ThreadPool::threadLoop() {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock lock(mMutex);
+            base::ScopedLockAssertion lockAssertion(mMutex);
+            Queue* queue = nullptr;
+            mCondition.wait(lock, [this, &queue]() REQUIRES(mMutex) {
+                for (auto& candidate : mQueues) {
+                    if (!candidate.empty()) {
+                        queue = &candidate;
+                        return true;
+                    }
+                }
+                return mStopping;
+            });
+            if (queue == nullptr) {
+                // Stopping and every queue is drained
+                return;
+            }
+            task = std::move(queue->extract(queue->begin()).mapped());
+        }
+        task();
+    }
+}
+
+}  // namespace android::hardware::neuralnetworks::utils
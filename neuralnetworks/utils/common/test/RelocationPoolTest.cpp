@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gmock/gmock.h>
+#include <nnapi/SharedMemory.h>
+#include <nnapi/Types.h>
+#include <nnapi/hal/RelocationPool.h>
+
+#include <array>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+namespace android::hardware::neuralnetworks::utils {
+namespace {
+
+using LifeTime = nn::Request::Argument::LifeTime;
+
+constexpr uint32_t kAlignment = 64;
+constexpr uint32_t kPadding = 8;
+
+// Pointer arguments around a pool argument, as the runtime passes client buffers
+struct PointerRequest {
+    PointerRequest() {
+        request.pools.push_back(nn::createSharedMemory(4).value());
+        request.inputs = {
+                {.lifetime = LifeTime::POINTER,
+                 .location = {.pointer = static_cast<const void*>(input0.data()), .length = 16}},
+                {.lifetime = LifeTime::POOL, .location = {.poolIndex = 0, .length = 4}},
+                {.lifetime = LifeTime::POINTER,
+                 .location = {.pointer = static_cast<void*>(input1.data()), .length = 12}},
+        };
+        request.outputs = {
+                {.lifetime = LifeTime::POINTER,
+                 .location = {.pointer = static_cast<void*>(output.data()), .length = 16}},
+        };
+    }
+
+    std::array<float, 4> input0 = {1, 2, 3, 4};
+    std::array<float, 3> input1 = {5, 6, 7};
+    std::array<float, 4> output = {};
+    nn::Request request;
+};
+
+uint8_t* getPointer(const nn::Request& request, uint32_t poolIndex, nn::Mapping* mapping) {
+    *mapping = nn::map(std::get<nn::SharedMemory>(request.pools[poolIndex])).value();
+    return static_cast<uint8_t*>(std::get<void*>(mapping->pointer));
+}
+
+TEST(RelocationPoolTest, relocatesPointerArguments) {
+    // setup test
+    const RelocationPool pool;
+    PointerRequest pointerRequest;
+    std::optional<nn::Request> maybeRequestInShared;
+    nn::RequestRelocation relocation;
+
+    // run test
+    const auto result = pool.convertRequestFromPointerToShared(
+            &pointerRequest.request, kAlignment, kPadding, &maybeRequestInShared, &relocation);
+
+    // verify result
+    ASSERT_TRUE(result.has_value()) << result.error().message;
+    const nn::Request& requestInShared = result.value();
+    ASSERT_EQ(3u, requestInShared.pools.size());
+    EXPECT_EQ(LifeTime::POOL, requestInShared.inputs[0].lifetime);
+    EXPECT_EQ(1u, requestInShared.inputs[0].location.poolIndex);
+    EXPECT_EQ(0u, requestInShared.inputs[0].location.offset);
+    EXPECT_EQ(0u, requestInShared.inputs[1].location.poolIndex);
+    EXPECT_EQ(1u, requestInShared.inputs[2].location.poolIndex);
+    EXPECT_EQ(kAlignment, requestInShared.inputs[2].location.offset);
+    EXPECT_EQ(12u, requestInShared.inputs[2].location.length);
+    EXPECT_EQ(4u, requestInShared.inputs[2].location.padding);
+    EXPECT_EQ(2u, requestInShared.outputs[0].location.poolIndex);
+    ASSERT_NE(nullptr, relocation.input);
+    ASSERT_NE(nullptr, relocation.output);
+}
+
+TEST(RelocationPoolTest, flushesThroughPooledMemory) {
+    // setup test
+    const RelocationPool pool;
+    PointerRequest pointerRequest;
+    std::optional<nn::Request> maybeRequestInShared;
+    nn::RequestRelocation relocation;
+    const nn::Request& requestInShared =
+            pool.convertRequestFromPointerToShared(&pointerRequest.request, kAlignment, kPadding,
+                                                   &maybeRequestInShared, &relocation)
+                    .value();
+    nn::Mapping inputMapping;
+    nn::Mapping outputMapping;
+    const uint8_t* inputPointer = getPointer(requestInShared, 1, &inputMapping);
+    uint8_t* outputPointer = getPointer(requestInShared, 2, &outputMapping);
+
+    // run test
+    relocation.input->flush();
+    std::memcpy(outputPointer, pointerRequest.input0.data(), 16);
+    relocation.output->flush();
+
+    // verify result
+    EXPECT_EQ(0, std::memcmp(inputPointer, pointerRequest.input0.data(), 16));
+    EXPECT_EQ(0, std::memcmp(inputPointer + kAlignment, pointerRequest.input1.data(), 12));
+    EXPECT_EQ(pointerRequest.input0, pointerRequest.output);
+}
+
+TEST(RelocationPoolTest, reusesReleasedMemory) {
+    // setup test
+    const RelocationPool pool;
+    PointerRequest pointerRequest;
+
+    // run test
+    for (size_t i = 0; i < 3; ++i) {
+        std::optional<nn::Request> maybeRequestInShared;
+        nn::RequestRelocation relocation;
+        ASSERT_TRUE(pool.convertRequestFromPointerToShared(&pointerRequest.request, kAlignment,
+                                                           kPadding, &maybeRequestInShared,
+                                                           &relocation)
+                            .has_value());
+    }
+
+    // verify result
+    const auto stats = pool.getStats();
+    EXPECT_EQ(2u, stats.numAllocations);
+    EXPECT_EQ(4u, stats.numReuses);
+    EXPECT_EQ(2u, stats.numIdle);
+}
+
+TEST(RelocationPoolTest, doesNotReuseMemoryInUse) {
+    // setup test
+    const RelocationPool pool;
+    PointerRequest pointerRequest;
+    std::optional<nn::Request> maybeRequestInShared0;
+    std::optional<nn::Request> maybeRequestInShared1;
+    nn::RequestRelocation relocation0;
+    nn::RequestRelocation relocation1;
+
+    // run test
+    const nn::Request& requestInShared0 =
+            pool.convertRequestFromPointerToShared(&pointerRequest.request, kAlignment, kPadding,
+                                                   &maybeRequestInShared0, &relocation0)
+                    .value();
+    const nn::Request& requestInShared1 =
+            pool.convertRequestFromPointerToShared(&pointerRequest.request, kAlignment, kPadding,
+                                                   &maybeRequestInShared1, &relocation1)
+                    .value();
+
+    // verify result
+    EXPECT_NE(std::get<nn::SharedMemory>(requestInShared0.pools[1]),
+              std::get<nn::SharedMemory>(requestInShared1.pools[1]));
+    EXPECT_EQ(4u, pool.getStats().numAllocations);
+    EXPECT_EQ(0u, pool.getStats().numIdle);
+}
+
+TEST(RelocationPoolTest, limitsIdleMemory) {
+    // setup test
+    const RelocationPool pool(/*maxIdlePerBucket=*/1);
+    PointerRequest pointerRequest;
+
+    // run test
+    {
+        std::array<std::optional<nn::Request>, 3> maybeRequestsInShared;
+        std::array<nn::RequestRelocation, 3> relocations;
+        for (size_t i = 0; i < relocations.size(); ++i) {
+            ASSERT_TRUE(pool.convertRequestFromPointerToShared(
+                                    &pointerRequest.request, kAlignment, kPadding,
+                                    &maybeRequestsInShared[i], &relocations[i])
+                                .has_value());
+        }
+    }
+
+    // verify result
+    EXPECT_EQ(1u, pool.getStats().numIdle);
+}
+
+TEST(RelocationPoolTest, limitsIdleBytes) {
+    // setup test
+    const RelocationPool pool(RelocationPool::kDefaultMaxIdlePerBucket, /*maxIdleBytes=*/4096);
+    PointerRequest pointerRequest;
+
+    // run test
+    {
+        std::optional<nn::Request> maybeRequestInShared;
+        nn::RequestRelocation relocation;
+        ASSERT_TRUE(pool.convertRequestFromPointerToShared(&pointerRequest.request, kAlignment,
+                                                           kPadding, &maybeRequestInShared,
+                                                           &relocation)
+                            .has_value());
+    }
+
+    // verify result
+    EXPECT_EQ(1u, pool.getStats().numIdle);
+    EXPECT_EQ(4096u, pool.getStats().idleBytes);
+}
+
+TEST(RelocationPoolTest, zeroesReusedMemory) {
+    // setup test
+    const RelocationPool pool;
+    PointerRequest pointerRequest;
+    {
+        std::optional<nn::Request> maybeRequestInShared;
+        nn::RequestRelocation relocation;
+        const nn::Request& requestInShared =
+                pool.convertRequestFromPointerToShared(&pointerRequest.request, kAlignment,
+                                                       kPadding, &maybeRequestInShared,
+                                                       &relocation)
+                        .value();
+        nn::Mapping outputMapping;
+        std::memset(getPointer(requestInShared, 2, &outputMapping), 0xff, 16);
+    }
+    std::optional<nn::Request> maybeRequestInShared;
+    nn::RequestRelocation relocation;
+
+    // run test
+    const nn::Request& requestInShared =
+            pool.convertRequestFromPointerToShared(&pointerRequest.request, kAlignment, kPadding,
+                                                   &maybeRequestInShared, &relocation)
+                    .value();
+
+    // verify result
+    ASSERT_EQ(2u, pool.getStats().numReuses);
+    nn::Mapping outputMapping;
+    const uint8_t* outputPointer = getPointer(requestInShared, 2, &outputMapping);
+    const std::array<uint8_t, 16> zeros = {};
+    EXPECT_EQ(0, std::memcmp(outputPointer, zeros.data(), zeros.size()));
+}
+
+TEST(RelocationPoolTest, keepsRequestWithoutPointers) {
+    // setup test
+    const RelocationPool pool;
+    nn::Request request;
+    request.pools.push_back(nn::createSharedMemory(4).value());
+    request.inputs = {{.lifetime = LifeTime::POOL, .location = {.poolIndex = 0, .length = 4}}};
+    std::optional<nn::Request> maybeRequestInShared;
+    nn::RequestRelocation relocation;
+
+    // run test
+    const auto result = pool.convertRequestFromPointerToShared(
+            &request, kAlignment, kPadding, &maybeRequestInShared, &relocation);
+
+    // verify result
+    ASSERT_TRUE(result.has_value()) << result.error().message;
+    EXPECT_EQ(&request, &result.value().get());
+    EXPECT_FALSE(maybeRequestInShared.has_value());
+    EXPECT_EQ(nullptr, relocation.input);
+    EXPECT_EQ(nullptr, relocation.output);
+    EXPECT_EQ(0u, pool.getStats().numAllocations);
+}
+
+TEST(RelocationPoolTest, rejectsConstOutputPointer) {
+    // setup test
+    const RelocationPool pool;
+    PointerRequest pointerRequest;
+    pointerRequest.request.outputs[0].location.pointer =
+            static_cast<const void*>(pointerRequest.output.data());
+    std::optional<nn::Request> maybeRequestInShared;
+    nn::RequestRelocation relocation;
+
+    // run test
+    const auto result = pool.convertRequestFromPointerToShared(
+            &pointerRequest.request, kAlignment, kPadding, &maybeRequestInShared, &relocation);
+
+    // verify result
+    ASSERT_FALSE(result.has_value());
+    EXPECT_EQ(nn::ErrorStatus::INVALID_ARGUMENT, result.error().code);
+}
+
+TEST(RelocationPoolTest, hasPointerOutputs) {
+    // setup test
+    PointerRequest pointerRequest;
+    nn::Request request = pointerRequest.request;
+    request.outputs[0].lifetime = LifeTime::NO_VALUE;
+
+    // run test and verify result
+    EXPECT_TRUE(utils::hasPointerOutputs(pointerRequest.request));
+    EXPECT_FALSE(utils::hasPointerOutputs(request));
+}
+
+}  // namespace
+}  // namespace android::hardware::neuralnetworks::utils
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gmock/gmock.h>
+#include <nnapi/Types.h>
+#include <nnapi/hal/ThreadPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android::hardware::neuralnetworks::utils {
+namespace {
+
+using ::testing::ElementsAre;
+using namespace std::chrono_literals;
+
+// Occupies the only thread of a pool until released, so the tasks queued behind it can be ordered
+class Blocker {
+  public:
+    explicit Blocker(ThreadPool* pool) {
+        pool->schedule([future = mRelease.get_future().share()] { future.wait(); },
+                       nn::Priority::HIGH, {});
+    }
+    ~Blocker() { release(); }
+
+    void release() {
+        if (!mReleased) {
+            mReleased = true;
+            mRelease.set_value();
+        }
+    }
+
+  private:
+    std::promise<void> mRelease;
+    bool mReleased = false;
+};
+
+TEST(ThreadPoolTest, runsEveryTaskBeforeDestruction) {
+    // setup test
+    constexpr size_t kNumTasks = 100;
+    std::atomic<size_t> numRun = 0;
+
+    // run test
+    {
+        ThreadPool pool(4);
+        for (size_t i = 0; i < kNumTasks; ++i) {
+            pool.schedule([&numRun] { ++numRun; }, nn::Priority::MEDIUM, {});
+        }
+    }
+
+    // verify result
+    EXPECT_EQ(kNumTasks, numRun);
+}
+
+TEST(ThreadPoolTest, runsHigherPriorityFirst) {
+    // setup test
+    std::vector<nn::Priority> order;
+    ThreadPool pool(1);
+    Blocker blocker(&pool);
+    for (auto priority : {nn::Priority::LOW, nn::Priority::MEDIUM, nn::Priority::HIGH}) {
+        pool.schedule([&order, priority] { order.push_back(priority); }, priority, {});
+    }
+    std::promise<void> done;
+    pool.schedule([&done] { done.set_value(); }, nn::Priority::LOW, {});
+
+    // run test
+    blocker.release();
+    done.get_future().wait();
+
+    // verify result
+    EXPECT_THAT(order, ElementsAre(nn::Priority::HIGH, nn::Priority::MEDIUM, nn::Priority::LOW));
+}
+
+TEST(ThreadPoolTest, runsEarlierDeadlineFirst) {
+    // setup test
+    const auto now = nn::Clock::now();
+    std::vector<int> order;
+    ThreadPool pool(1);
+    Blocker blocker(&pool);
+    pool.schedule([&order] { order.push_back(0); }, nn::Priority::MEDIUM, {});
+    pool.schedule([&order] { order.push_back(1); }, nn::Priority::MEDIUM, now + 2s);
+    pool.schedule([&order] { order.push_back(2); }, nn::Priority::MEDIUM, now + 1s);
+    pool.schedule([&order] { order.push_back(3); }, nn::Priority::MEDIUM, {});
+    std::promise<void> done;
+    pool.schedule([&done] { done.set_value(); }, nn::Priority::LOW, {});
+
+    // run test
+    blocker.release();
+    done.get_future().wait();
+
+    // verify result
+    EXPECT_THAT(order, ElementsAre(2, 1, 0, 3));
+}
+
+TEST(ThreadPoolTest, boundsConcurrentTasks) {
+    // setup test
+    constexpr size_t kNumThreads = 2;
+    constexpr size_t kNumTasks = 16;
+    std::mutex mutex;
+    size_t numRunning = 0;
+    size_t maxRunning = 0;
+
+    // run test
+    {
+        ThreadPool pool(kNumThreads);
+        ASSERT_EQ(kNumThreads, pool.getNumThreads());
+        for (size_t i = 0; i < kNumTasks; ++i) {
+            pool.schedule(
+                    [&] {
+                        {
+                            std::lock_guard guard(mutex);
+                            maxRunning = std::max(maxRunning, ++numRunning);
+                        }
+                        std::this_thread::sleep_for(1ms);
+                        std::lock_guard guard(mutex);
+                        --numRunning;
+                    },
+                    nn::Priority::MEDIUM, {});
+        }
+    }
+
+    // verify result
+    EXPECT_LE(maxRunning, kNumThreads);
+}
+
+}  // namespace
+}  // namespace android::hardware::neuralnetworks::utils
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sensors-impl/DirectChannel.h"
+
+#include <log/log.h>
+#include <sys/mman.h>
+
+#include <cstring>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace sensors {
+
+using EventPayload = Event::EventPayload;
+
+static constexpr size_t kEventSize =
+        static_cast<size_t>(BnSensors::DIRECT_REPORT_SENSOR_EVENT_TOTAL_LENGTH);
+static constexpr size_t kDataSize =
+        static_cast<size_t>(BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_RESERVED -
+                            BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_DATA);
+
+std::shared_ptr<DirectChannel> DirectChannel::create(int fd, size_t size) {
+    void* buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED) {
+        ALOGE("Failed to map direct channel memory of size %zu: %s", size, strerror(errno));
+        return nullptr;
+    }
+    memset(buffer, 0, size);
+    return std::shared_ptr<DirectChannel>(new DirectChannel(static_cast<uint8_t*>(buffer), size));
+}
+
+DirectChannel::DirectChannel(uint8_t* buffer, size_t size)
+    : mBuffer(buffer), mSize(size), mWriteOffset(0), mCounter(1) {}
+
+DirectChannel::~DirectChannel() {
+    munmap(mBuffer, mSize);
+}
+
+void DirectChannel::write(const Event& event, int32_t reportToken) {
+    // The data field has the layout of the sensors_event_t union. Only the payloads reported by
+    // the simulated sensors are converted.
+    uint8_t data[kDataSize] = {};
+    switch (event.payload.getTag()) {
+        case EventPayload::Tag::vec3: {
+            const EventPayload::Vec3& vec3 = event.payload.get<EventPayload::Tag::vec3>();
+            float values[3] = {vec3.x, vec3.y, vec3.z};
+            int8_t status = static_cast<int8_t>(vec3.status);
+            memcpy(data, values, sizeof(values));
+            memcpy(data + sizeof(values), &status, sizeof(status));
+            break;
+        }
+        case EventPayload::Tag::scalar: {
+            float value = event.payload.get<EventPayload::Tag::scalar>();
+            memcpy(data, &value, sizeof(value));
+            break;
+        }
+        default:
+            break;
+    }
+
+    int32_t size = static_cast<int32_t>(kEventSize);
+    int32_t type = static_cast<int32_t>(event.sensorType);
+
+    std::lock_guard<std::mutex> lock(mWriteLock);
+    uint8_t* record = mBuffer + mWriteOffset;
+    memcpy(record + BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_FIELD, &size, sizeof(size));
+    memcpy(record + BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_REPORT_TOKEN, &reportToken,
+           sizeof(reportToken));
+    memcpy(record + BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_SENSOR_TYPE, &type,
+           sizeof(type));
+    memcpy(record + BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_TIMESTAMP, &event.timestamp,
+           sizeof(event.timestamp));
+    memcpy(record + BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_DATA, data, sizeof(data));
+    memset(record + BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_RESERVED, 0,
+           kEventSize - BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_RESERVED);
+    uint32_t* counter = reinterpret_cast<uint32_t*>(
+            record + BnSensors::DIRECT_REPORT_SENSOR_EVENT_OFFSET_SIZE_ATOMIC_COUNTER);
+    __atomic_store_n(counter, mCounter, __ATOMIC_RELEASE);
+
+    // The counter skips 0 when it wraps around.
+    mCounter = mCounter == UINT32_MAX ? 1 : mCounter + 1;
+    mWriteOffset += kEventSize;
+    if (mWriteOffset + kEventSize > mSize) {
+        mWriteOffset = 0;
+    }
+}
+
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
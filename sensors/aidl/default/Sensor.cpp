@@ -18,8 +18,11 @@
 
 #include "utils/SystemClock.h"
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
+using ::android::hardware::sensors::common::SensorScheduler;
 using ::ndk::ScopedAStatus;
 
 namespace aidl {
@@ -28,52 +31,88 @@ namespace hardware {
 namespace sensors {
 
 static constexpr int32_t kDefaultMaxDelayUs = 10 * 1000 * 1000;
+// FIFO size of continuous sensors, which support batching.
+static constexpr int32_t kDefaultFifoMaxEventCount = 300;
+
+// Sampling period of direct reports at each rate level, from the nominal rates of 50Hz, 200Hz and
+// 800Hz documented in ISensors.aidl.
+static int64_t directReportSamplingPeriodNs(ISensors::RateLevel rate) {
+    switch (rate) {
+        case ISensors::RateLevel::NORMAL:
+            return 20 * 1000 * 1000;
+        case ISensors::RateLevel::FAST:
+            return 5 * 1000 * 1000;
+        case ISensors::RateLevel::VERY_FAST:
+            return 1250 * 1000;
+        default:
+            return 0;
+    }
+}
 
 Sensor::Sensor(ISensorsEventCallback* callback)
     : mIsEnabled(false),
       mSamplingPeriodNs(0),
+      mMaxReportLatencyNs(0),
       mLastSampleTimeNs(0),
+      mFifoDeadlineNs(0),
       mCallback(callback),
-      mMode(OperationMode::NORMAL) {
-    mRunThread = std::thread(startThread, this);
-}
+      mMode(OperationMode::NORMAL) {}
 
 Sensor::~Sensor() {
-    std::unique_lock<std::mutex> lock(mRunMutex);
-    mStopThread = true;
-    mIsEnabled = false;
-    mWaitCV.notify_all();
-    lock.release();
-    mRunThread.join();
+    SensorScheduler::getInstance().remove(this);
 }
 
 const SensorInfo& Sensor::getSensorInfo() const {
     return mSensorInfo;
 }
 
-void Sensor::batch(int64_t samplingPeriodNs) {
+void Sensor::batch(int64_t samplingPeriodNs, int64_t maxReportLatencyNs) {
     if (samplingPeriodNs < mSensorInfo.minDelayUs * 1000LL) {
         samplingPeriodNs = mSensorInfo.minDelayUs * 1000LL;
     } else if (samplingPeriodNs > mSensorInfo.maxDelayUs * 1000LL) {
         samplingPeriodNs = mSensorInfo.maxDelayUs * 1000LL;
     }
 
-    if (mSamplingPeriodNs != samplingPeriodNs) {
-        mSamplingPeriodNs = samplingPeriodNs;
-        // Wake up the 'run' thread to check if a new event should be generated now
-        mWaitCV.notify_all();
+    // Sensors without a FIFO report every event right away.
+    if (mSensorInfo.fifoMaxEventCount == 0 || maxReportLatencyNs < 0) {
+        maxReportLatencyNs = 0;
+    }
+
+    std::unique_lock<std::mutex> lock(mRunMutex);
+    if (mSamplingPeriodNs == samplingPeriodNs && mMaxReportLatencyNs == maxReportLatencyNs) {
+        return;
+    }
+    mSamplingPeriodNs = samplingPeriodNs;
+    mMaxReportLatencyNs = maxReportLatencyNs;
+    if (mMaxReportLatencyNs == 0) {
+        flushFifoLocked();
+    } else if (!mFifo.empty()) {
+        mFifoDeadlineNs = std::min(mFifoDeadlineNs, mFifo.front().timestamp + mMaxReportLatencyNs);
+    }
+
+    if (isRunningLocked()) {
+        // Wake up the scheduler to check if a new event should be generated now
+        SensorScheduler::getInstance().schedule(this, ::android::elapsedRealtimeNano());
     }
 }
 
 void Sensor::activate(bool enable) {
-    if (mIsEnabled != enable) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
-        mIsEnabled = enable;
-        mWaitCV.notify_all();
+    std::unique_lock<std::mutex> lock(mRunMutex);
+    if (mIsEnabled == enable) {
+        return;
+    }
+    mIsEnabled = enable;
+    if (!enable) {
+        // Batched events of a disabled sensor are dropped.
+        mFifo.clear();
+    } else if (isRunningLocked()) {
+        SensorScheduler::getInstance().schedule(this, ::android::elapsedRealtimeNano());
     }
 }
 
 ScopedAStatus Sensor::flush() {
+    std::unique_lock<std::mutex> lock(mRunMutex);
+
     // Only generate a flush complete event if the sensor is enabled and if the sensor is not a
     // one-shot sensor.
     if (!mIsEnabled ||
@@ -82,8 +121,10 @@ ScopedAStatus Sensor::flush() {
                 static_cast<int32_t>(BnSensors::ERROR_BAD_VALUE));
     }
 
-    // Note: If a sensor supports batching, write all of the currently batched events for the sensor
-    // to the Event FMQ prior to writing the flush complete event.
+    // Write all of the currently batched events for the sensor to the Event FMQ prior to writing
+    // the flush complete event.
+    flushFifoLocked();
+
     Event ev;
     ev.sensorHandle = mSensorInfo.sensorHandle;
     ev.sensorType = SensorType::META_DATA;
@@ -97,34 +138,70 @@ ScopedAStatus Sensor::flush() {
     return ScopedAStatus::ok();
 }
 
-void Sensor::startThread(Sensor* sensor) {
-    sensor->run();
+bool Sensor::isRunningLocked() const {
+    return (mIsEnabled || !mDirectReports.empty()) && mMode == OperationMode::NORMAL;
+}
+
+void Sensor::flushFifoLocked() {
+    if (mFifo.empty()) {
+        return;
+    }
+    mCallback->postEvents(mFifo, isWakeUpSensor());
+    mFifo.clear();
 }
 
-void Sensor::run() {
-    std::unique_lock<std::mutex> runLock(mRunMutex);
-    constexpr int64_t kNanosecondsInSeconds = 1000 * 1000 * 1000;
-
-    while (!mStopThread) {
-        if (!mIsEnabled || mMode == OperationMode::DATA_INJECTION) {
-            mWaitCV.wait(runLock, [&] {
-                return ((mIsEnabled && mMode == OperationMode::NORMAL) || mStopThread);
-            });
-        } else {
-            timespec curTime;
-            clock_gettime(CLOCK_BOOTTIME, &curTime);
-            int64_t now = (curTime.tv_sec * kNanosecondsInSeconds) + curTime.tv_nsec;
-            int64_t nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-
-            if (now >= nextSampleTime) {
-                mLastSampleTimeNs = now;
-                nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-                mCallback->postEvents(readEvents(), isWakeUpSensor());
+int64_t Sensor::onDeadline(int64_t now) {
+    std::unique_lock<std::mutex> lock(mRunMutex);
+    if (!isRunningLocked()) {
+        return SensorScheduler::kNoDeadline;
+    }
+
+    int64_t nextDeadline = std::numeric_limits<int64_t>::max();
+    if (mIsEnabled) {
+        int64_t nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
+        if (now >= nextSampleTime) {
+            mLastSampleTimeNs = now;
+            nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
+            std::vector<Event> events = readEvents();
+
+            if (mMaxReportLatencyNs == 0) {
+                if (!events.empty()) {
+                    mCallback->postEvents(events, isWakeUpSensor());
+                }
+            } else if (!events.empty()) {
+                if (mFifo.empty()) {
+                    mFifoDeadlineNs = now + mMaxReportLatencyNs;
+                }
+                mFifo.insert(mFifo.end(), events.begin(), events.end());
             }
+        }
 
-            mWaitCV.wait_for(runLock, std::chrono::nanoseconds(nextSampleTime - now));
+        if (!mFifo.empty() &&
+            (now >= mFifoDeadlineNs ||
+             mFifo.size() >= static_cast<size_t>(mSensorInfo.fifoMaxEventCount))) {
+            flushFifoLocked();
         }
+
+        nextDeadline = mFifo.empty() ? nextSampleTime : std::min(nextSampleTime, mFifoDeadlineNs);
     }
+
+    for (auto& [channelHandle, report] : mDirectReports) {
+        int64_t nextSampleTime = report.lastSampleTimeNs + report.samplingPeriodNs;
+        if (now >= nextSampleTime) {
+            // The rate of a direct report must remain steady, so samples stay on the period grid
+            // unless a whole period was missed.
+            report.lastSampleTimeNs =
+                    now - nextSampleTime < report.samplingPeriodNs ? nextSampleTime : now;
+            nextSampleTime = report.lastSampleTimeNs + report.samplingPeriodNs;
+            // Direct reports are only supported by continuous sensors, which report every sample.
+            for (const Event& event : Sensor::readEvents()) {
+                report.channel->write(event, mSensorInfo.sensorHandle);
+            }
+        }
+        nextDeadline = std::min(nextDeadline, nextSampleTime);
+    }
+
+    return nextDeadline;
 }
 
 bool Sensor::isWakeUpSensor() {
@@ -144,10 +221,13 @@ std::vector<Event> Sensor::readEvents() {
 }
 
 void Sensor::setOperationMode(OperationMode mode) {
-    if (mMode != mode) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
-        mMode = mode;
-        mWaitCV.notify_all();
+    std::unique_lock<std::mutex> lock(mRunMutex);
+    if (mMode == mode) {
+        return;
+    }
+    mMode = mode;
+    if (isRunningLocked()) {
+        SensorScheduler::getInstance().schedule(this, ::android::elapsedRealtimeNano());
     }
 }
 
@@ -175,6 +255,45 @@ ScopedAStatus Sensor::injectEvent(const Event& event) {
             static_cast<int32_t>(BnSensors::ERROR_BAD_VALUE));
 }
 
+bool Sensor::supportsDirectReport(RateLevel rate) const {
+    int32_t maxRate = (mSensorInfo.flags & SensorInfo::SENSOR_FLAG_BITS_MASK_DIRECT_REPORT) >>
+                      SensorInfo::SENSOR_FLAG_SHIFT_DIRECT_REPORT;
+    return (mSensorInfo.flags & SensorInfo::SENSOR_FLAG_BITS_DIRECT_CHANNEL_ASHMEM) &&
+           static_cast<int32_t>(rate) <= maxRate;
+}
+
+void Sensor::configDirectReport(int32_t channelHandle, std::shared_ptr<DirectChannel> channel,
+                                RateLevel rate) {
+    std::unique_lock<std::mutex> lock(mRunMutex);
+    if (rate == RateLevel::STOP) {
+        mDirectReports.erase(channelHandle);
+        return;
+    }
+
+    mDirectReports[channelHandle] = {
+            .channel = std::move(channel),
+            .samplingPeriodNs = directReportSamplingPeriodNs(rate),
+            .lastSampleTimeNs = 0,
+    };
+    if (isRunningLocked()) {
+        SensorScheduler::getInstance().schedule(this, ::android::elapsedRealtimeNano());
+    }
+}
+
+void Sensor::setDirectReportFlags() {
+    int32_t maxRate = static_cast<int32_t>(RateLevel::STOP);
+    for (RateLevel rate : {RateLevel::NORMAL, RateLevel::FAST, RateLevel::VERY_FAST}) {
+        if (directReportSamplingPeriodNs(rate) >= mSensorInfo.minDelayUs * 1000LL) {
+            maxRate = static_cast<int32_t>(rate);
+        }
+    }
+    if (maxRate == static_cast<int32_t>(RateLevel::STOP)) {
+        return;
+    }
+    mSensorInfo.flags |= (maxRate << SensorInfo::SENSOR_FLAG_SHIFT_DIRECT_REPORT) |
+                         SensorInfo::SENSOR_FLAG_BITS_DIRECT_CHANNEL_ASHMEM;
+}
+
 OnChangeSensor::OnChangeSensor(ISensorsEventCallback* callback)
     : Sensor(callback), mPreviousEventSet(false) {}
 
@@ -214,9 +333,10 @@ AccelSensor::AccelSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
     mSensorInfo.minDelayUs = 10 * 1000;  // microseconds
     mSensorInfo.maxDelayUs = kDefaultMaxDelayUs;
     mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = static_cast<uint32_t>(SensorInfo::SENSOR_FLAG_BITS_DATA_INJECTION);
+    setDirectReportFlags();
 };
 
 void AccelSensor::readEventPayload(EventPayload& payload) {
@@ -243,7 +363,7 @@ PressureSensor::PressureSensor(int32_t sensorHandle, ISensorsEventCallback* call
     mSensorInfo.minDelayUs = 100 * 1000;  // microseconds
     mSensorInfo.maxDelayUs = kDefaultMaxDelayUs;
     mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = 0;
 };
@@ -266,9 +386,10 @@ MagnetometerSensor::MagnetometerSensor(int32_t sensorHandle, ISensorsEventCallba
     mSensorInfo.minDelayUs = 20 * 1000;  // microseconds
     mSensorInfo.maxDelayUs = kDefaultMaxDelayUs;
     mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = static_cast<uint32_t>(SensorInfo::SENSOR_FLAG_BITS_DATA_INJECTION);
+    setDirectReportFlags();
 };
 
 void MagnetometerSensor::readEventPayload(EventPayload& payload) {
@@ -341,9 +462,10 @@ GyroSensor::GyroSensor(int32_t sensorHandle, ISensorsEventCallback* callback) :
     mSensorInfo.minDelayUs = 10 * 1000;  // microseconds
     mSensorInfo.maxDelayUs = kDefaultMaxDelayUs;
     mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = static_cast<uint32_t>(SensorInfo::SENSOR_FLAG_BITS_DATA_INJECTION);
+    setDirectReportFlags();
 };
 
 void GyroSensor::readEventPayload(EventPayload& payload) {
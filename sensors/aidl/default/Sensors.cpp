@@ -42,23 +42,43 @@ ScopedAStatus Sensors::activate(int32_t in_sensorHandle, bool in_enabled) {
 }
 
 ScopedAStatus Sensors::batch(int32_t in_sensorHandle, int64_t in_samplingPeriodNs,
-                             int64_t /* in_maxReportLatencyNs */) {
+                             int64_t in_maxReportLatencyNs) {
     auto sensor = mSensors.find(in_sensorHandle);
     if (sensor != mSensors.end()) {
-        sensor->second->batch(in_samplingPeriodNs);
+        sensor->second->batch(in_samplingPeriodNs, in_maxReportLatencyNs);
         return ScopedAStatus::ok();
     }
 
     return ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
 }
 
-ScopedAStatus Sensors::configDirectReport(int32_t /* in_sensorHandle */,
-                                          int32_t /* in_channelHandle */,
-                                          ISensors::RateLevel /* in_rate */,
-                                          int32_t* _aidl_return) {
-    *_aidl_return = EX_UNSUPPORTED_OPERATION;
+ScopedAStatus Sensors::configDirectReport(int32_t in_sensorHandle, int32_t in_channelHandle,
+                                          ISensors::RateLevel in_rate, int32_t* _aidl_return) {
+    std::lock_guard<std::mutex> lock(mDirectChannelLock);
+    auto channel = mDirectChannels.find(in_channelHandle);
+    if (channel == mDirectChannels.end()) {
+        return ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+    }
+
+    if (in_sensorHandle == -1) {
+        // Stopping all sensors is the only operation allowed on all sensors.
+        if (in_rate != ISensors::RateLevel::STOP) {
+            return ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+        }
+        for (const auto& sensor : mSensors) {
+            sensor.second->configDirectReport(in_channelHandle, nullptr, in_rate);
+        }
+        *_aidl_return = 0;
+        return ScopedAStatus::ok();
+    }
 
-    return ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    auto sensor = mSensors.find(in_sensorHandle);
+    if (sensor == mSensors.end() || !sensor->second->supportsDirectReport(in_rate)) {
+        return ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+    }
+    sensor->second->configDirectReport(in_channelHandle, channel->second, in_rate);
+    *_aidl_return = in_rate == ISensors::RateLevel::STOP ? 0 : in_sensorHandle;
+    return ScopedAStatus::ok();
 }
 
 ScopedAStatus Sensors::flush(int32_t in_sensorHandle) {
@@ -133,11 +153,26 @@ ScopedAStatus Sensors::injectSensorData(const Event& in_event) {
     return ScopedAStatus::fromServiceSpecificError(static_cast<int32_t>(ERROR_BAD_VALUE));
 }
 
-ScopedAStatus Sensors::registerDirectChannel(const ISensors::SharedMemInfo& /* in_mem */,
+ScopedAStatus Sensors::registerDirectChannel(const ISensors::SharedMemInfo& in_mem,
                                              int32_t* _aidl_return) {
-    *_aidl_return = EX_UNSUPPORTED_OPERATION;
+    // Only ashmem (or memfd) backed memory is supported.
+    if (in_mem.type != ISensors::SharedMemInfo::SharedMemType::ASHMEM ||
+        in_mem.format != ISensors::SharedMemInfo::SharedMemFormat::SENSORS_EVENT ||
+        in_mem.size < ISensors::DIRECT_REPORT_SENSOR_EVENT_TOTAL_LENGTH ||
+        in_mem.memoryHandle.fds.empty()) {
+        return ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+    }
+
+    std::shared_ptr<DirectChannel> channel =
+            DirectChannel::create(in_mem.memoryHandle.fds[0].get(), in_mem.size);
+    if (channel == nullptr) {
+        return ScopedAStatus::fromServiceSpecificError(static_cast<int32_t>(ERROR_NO_MEMORY));
+    }
 
-    return ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    std::lock_guard<std::mutex> lock(mDirectChannelLock);
+    *_aidl_return = mNextDirectChannelHandle++;
+    mDirectChannels[*_aidl_return] = std::move(channel);
+    return ScopedAStatus::ok();
 }
 
 ScopedAStatus Sensors::setOperationMode(OperationMode in_mode) {
@@ -147,8 +182,15 @@ ScopedAStatus Sensors::setOperationMode(OperationMode in_mode) {
     return ScopedAStatus::ok();
 }
 
-ScopedAStatus Sensors::unregisterDirectChannel(int32_t /* in_channelHandle */) {
-    return ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ScopedAStatus Sensors::unregisterDirectChannel(int32_t in_channelHandle) {
+    std::lock_guard<std::mutex> lock(mDirectChannelLock);
+    if (mDirectChannels.erase(in_channelHandle) > 0) {
+        // The memory is unmapped once the last sensor reporting to the channel lets it go.
+        for (const auto& sensor : mSensors) {
+            sensor.second->configDirectReport(in_channelHandle, nullptr, ISensors::RateLevel::STOP);
+        }
+    }
+    return ScopedAStatus::ok();
 }
 
 }  // namespace sensors
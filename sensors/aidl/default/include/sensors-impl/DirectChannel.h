@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include <aidl/android/hardware/sensors/BnSensors.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace sensors {
+
+// A direct report channel backed by client provided shared memory (ashmem or memfd).
+//
+// Events are written to the memory as a ring of DIRECT_REPORT_SENSOR_EVENT_TOTAL_LENGTH byte
+// records in the format described in ISensors.aidl. The atomic counter of a record is written last,
+// so that a client polling the counters never sees a partially written event.
+class DirectChannel {
+  public:
+    using Event = ::aidl::android::hardware::sensors::Event;
+
+    // Maps size bytes of the shared memory referred to by fd and resets them to zero. Returns
+    // nullptr if the memory can't be mapped.
+    static std::shared_ptr<DirectChannel> create(int fd, size_t size);
+
+    ~DirectChannel();
+
+    // Writes an event to the next record of the ring. Thread safe, as several sensors may report
+    // to the same channel.
+    void write(const Event& event, int32_t reportToken);
+
+  private:
+    DirectChannel(uint8_t* buffer, size_t size);
+
+    uint8_t* const mBuffer;
+    const size_t mSize;
+
+    std::mutex mWriteLock;
+    // Offset of the next record to write.
+    size_t mWriteOffset;
+    // Atomic counter of the next record. Starts at 1, as zeroed records have never been written.
+    uint32_t mCounter;
+};
+
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -14,10 +14,17 @@
  * limitations under the License.
  */
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include <aidl/android/hardware/sensors/BnSensors.h>
 
+#include "DirectChannel.h"
+#include "SensorScheduler.h"
+
 namespace aidl {
 namespace android {
 namespace hardware {
@@ -31,9 +38,10 @@ class ISensorsEventCallback {
     virtual void postEvents(const std::vector<Event>& events, bool wakeup) = 0;
 };
 
-class Sensor {
+class Sensor : public ::android::hardware::sensors::common::ScheduledSensor {
   public:
     using OperationMode = ::aidl::android::hardware::sensors::ISensors::OperationMode;
+    using RateLevel = ::aidl::android::hardware::sensors::ISensors::RateLevel;
     using Event = ::aidl::android::hardware::sensors::Event;
     using EventPayload = ::aidl::android::hardware::sensors::Event::EventPayload;
     using SensorInfo = ::aidl::android::hardware::sensors::SensorInfo;
@@ -45,7 +53,7 @@ class Sensor {
     virtual ~Sensor();
 
     const SensorInfo& getSensorInfo() const;
-    void batch(int64_t samplingPeriodNs);
+    void batch(int64_t samplingPeriodNs, int64_t maxReportLatencyNs);
     virtual void activate(bool enable);
     ndk::ScopedAStatus flush();
 
@@ -53,23 +61,49 @@ class Sensor {
     bool supportsDataInjection() const;
     ndk::ScopedAStatus injectEvent(const Event& event);
 
+    bool supportsDirectReport(RateLevel rate) const;
+    // Starts, changes the rate of or stops (RateLevel::STOP) reporting to a direct channel.
+    // Events are reported with the sensor handle as report token.
+    void configDirectReport(int32_t channelHandle, std::shared_ptr<DirectChannel> channel,
+                            RateLevel rate);
+
+    // Called by SensorScheduler when the sensor's deadline expires. Generates a sample if one is
+    // due and reports batched events if the max report latency has expired or the FIFO is full.
+    // Returns the next deadline, or SensorScheduler::kNoDeadline.
+    int64_t onDeadline(int64_t now) override;
+
   protected:
-    void run();
     virtual std::vector<Event> readEvents();
     virtual void readEventPayload(EventPayload&) = 0;
-    static void startThread(Sensor* sensor);
 
     bool isWakeUpSensor();
+    bool isRunningLocked() const;
+    void flushFifoLocked();
+
+    // Advertises direct report over ashmem, at the highest rate level the sensor's minDelayUs
+    // allows. Must be called after mSensorInfo is set up.
+    void setDirectReportFlags();
 
     bool mIsEnabled;
     int64_t mSamplingPeriodNs;
+    int64_t mMaxReportLatencyNs;
     int64_t mLastSampleTimeNs;
     SensorInfo mSensorInfo;
 
-    std::atomic_bool mStopThread;
-    std::condition_variable mWaitCV;
     std::mutex mRunMutex;
-    std::thread mRunThread;
+
+    // Events waiting to be reported, while batching.
+    std::vector<Event> mFifo;
+    // Time at which the oldest event in the FIFO must be reported.
+    int64_t mFifoDeadlineNs;
+
+    struct DirectReport {
+        std::shared_ptr<DirectChannel> channel;
+        int64_t samplingPeriodNs;
+        int64_t lastSampleTimeNs;
+    };
+    // Active direct reports, by channel handle. Direct reports are independent of activate().
+    std::map<int32_t, DirectReport> mDirectReports;
 
     ISensorsEventCallback* mCallback;
 
@@ -41,6 +41,7 @@ class Sensors : public BnSensors, public ISensorsEventCallback {
     Sensors()
         : mEventQueueFlag(nullptr),
           mNextHandle(1),
+          mNextDirectChannelHandle(1),
           mOutstandingWakeUpEvents(0),
           mReadWakeLockQueueRun(false),
           mAutoReleaseWakeLockTime(0),
@@ -194,6 +195,12 @@ class Sensors : public BnSensors, public ISensorsEventCallback {
     std::map<int32_t, std::shared_ptr<Sensor>> mSensors;
     // The next available sensor handle.
     int32_t mNextHandle;
+    // Lock to protect the direct channels.
+    std::mutex mDirectChannelLock;
+    // A map of the registered direct channels.
+    std::map<int32_t, std::shared_ptr<DirectChannel>> mDirectChannels;
+    // The next available direct channel handle.
+    int32_t mNextDirectChannelHandle;
     // Lock to protect writes to the FMQs.
     std::mutex mWriteLock;
     // Lock to protect acquiring and releasing the wake lock
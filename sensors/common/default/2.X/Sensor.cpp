@@ -18,6 +18,7 @@
 
 #include <utils/SystemClock.h>
 
+#include <algorithm>
 #include <cmath>
 
 namespace android {
@@ -39,57 +40,77 @@ using ::android::hardware::sensors::V2_1::SensorType;
 Sensor::Sensor(ISensorsEventCallback* callback)
     : mIsEnabled(false),
       mSamplingPeriodNs(0),
+      mMaxReportLatencyNs(0),
       mLastSampleTimeNs(0),
-      mStopThread(false),
+      mFifoDeadlineNs(0),
       mCallback(callback),
-      mMode(OperationMode::NORMAL) {
-    mRunThread = std::thread(startThread, this);
-}
+      mMode(OperationMode::NORMAL) {}
 
 Sensor::~Sensor() {
-    std::unique_lock<std::mutex> lock(mRunMutex);
-    mStopThread = true;
-    mIsEnabled = false;
-    mWaitCV.notify_all();
-    lock.release();
-    mRunThread.join();
+    common::SensorScheduler::getInstance().remove(this);
 }
 
 const SensorInfo& Sensor::getSensorInfo() const {
     return mSensorInfo;
 }
 
-void Sensor::batch(int64_t samplingPeriodNs) {
+void Sensor::batch(int64_t samplingPeriodNs, int64_t maxReportLatencyNs) {
     if (samplingPeriodNs < mSensorInfo.minDelay * 1000LL) {
         samplingPeriodNs = mSensorInfo.minDelay * 1000LL;
     } else if (samplingPeriodNs > mSensorInfo.maxDelay * 1000LL) {
         samplingPeriodNs = mSensorInfo.maxDelay * 1000LL;
     }
 
-    if (mSamplingPeriodNs != samplingPeriodNs) {
-        mSamplingPeriodNs = samplingPeriodNs;
-        // Wake up the 'run' thread to check if a new event should be generated now
-        mWaitCV.notify_all();
+    // Sensors without a FIFO report every event right away.
+    if (mSensorInfo.fifoMaxEventCount == 0 || maxReportLatencyNs < 0) {
+        maxReportLatencyNs = 0;
+    }
+
+    std::unique_lock<std::mutex> lock(mRunMutex);
+    if (mSamplingPeriodNs == samplingPeriodNs && mMaxReportLatencyNs == maxReportLatencyNs) {
+        return;
+    }
+    mSamplingPeriodNs = samplingPeriodNs;
+    mMaxReportLatencyNs = maxReportLatencyNs;
+    if (mMaxReportLatencyNs == 0) {
+        flushFifoLocked();
+    } else if (!mFifo.empty()) {
+        mFifoDeadlineNs = std::min(mFifoDeadlineNs, mFifo.front().timestamp + mMaxReportLatencyNs);
+    }
+
+    if (isRunningLocked()) {
+        // Wake up the scheduler to check if a new event should be generated now
+        common::SensorScheduler::getInstance().schedule(this, ::android::elapsedRealtimeNano());
     }
 }
 
 void Sensor::activate(bool enable) {
-    if (mIsEnabled != enable) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
-        mIsEnabled = enable;
-        mWaitCV.notify_all();
+    std::unique_lock<std::mutex> lock(mRunMutex);
+    if (mIsEnabled == enable) {
+        return;
+    }
+    mIsEnabled = enable;
+    if (!enable) {
+        // Batched events of a disabled sensor are dropped.
+        mFifo.clear();
+    } else if (isRunningLocked()) {
+        common::SensorScheduler::getInstance().schedule(this, ::android::elapsedRealtimeNano());
     }
 }
 
 Result Sensor::flush() {
+    std::unique_lock<std::mutex> lock(mRunMutex);
+
     // Only generate a flush complete event if the sensor is enabled and if the sensor is not a
     // one-shot sensor.
     if (!mIsEnabled || (mSensorInfo.flags & static_cast<uint32_t>(SensorFlagBits::ONE_SHOT_MODE))) {
         return Result::BAD_VALUE;
     }
 
-    // Note: If a sensor supports batching, write all of the currently batched events for the sensor
-    // to the Event FMQ prior to writing the flush complete event.
+    // Write all of the currently batched events for the sensor to the Event FMQ prior to writing
+    // the flush complete event.
+    flushFifoLocked();
+
     Event ev;
     ev.sensorHandle = mSensorInfo.sensorHandle;
     ev.sensorType = SensorType::META_DATA;
@@ -100,34 +121,52 @@ Result Sensor::flush() {
     return Result::OK;
 }
 
-void Sensor::startThread(Sensor* sensor) {
-    sensor->run();
+bool Sensor::isRunningLocked() const {
+    return mIsEnabled && mMode == OperationMode::NORMAL;
 }
 
-void Sensor::run() {
-    std::unique_lock<std::mutex> runLock(mRunMutex);
-    constexpr int64_t kNanosecondsInSeconds = 1000 * 1000 * 1000;
-
-    while (!mStopThread) {
-        if (!mIsEnabled || mMode == OperationMode::DATA_INJECTION) {
-            mWaitCV.wait(runLock, [&] {
-                return ((mIsEnabled && mMode == OperationMode::NORMAL) || mStopThread);
-            });
-        } else {
-            timespec curTime;
-            clock_gettime(CLOCK_BOOTTIME, &curTime);
-            int64_t now = (curTime.tv_sec * kNanosecondsInSeconds) + curTime.tv_nsec;
-            int64_t nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-
-            if (now >= nextSampleTime) {
-                mLastSampleTimeNs = now;
-                nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-                mCallback->postEvents(readEvents(), isWakeUpSensor());
-            }
+void Sensor::flushFifoLocked() {
+    if (mFifo.empty()) {
+        return;
+    }
+    mCallback->postEvents(mFifo, isWakeUpSensor());
+    mFifo.clear();
+}
 
-            mWaitCV.wait_for(runLock, std::chrono::nanoseconds(nextSampleTime - now));
+int64_t Sensor::onDeadline(int64_t now) {
+    std::unique_lock<std::mutex> lock(mRunMutex);
+    if (!isRunningLocked()) {
+        return common::SensorScheduler::kNoDeadline;
+    }
+
+    int64_t nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
+    if (now >= nextSampleTime) {
+        mLastSampleTimeNs = now;
+        nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
+        std::vector<Event> events = readEvents();
+
+        if (mMaxReportLatencyNs == 0) {
+            if (!events.empty()) {
+                mCallback->postEvents(events, isWakeUpSensor());
+            }
+        } else if (!events.empty()) {
+            if (mFifo.empty()) {
+                mFifoDeadlineNs = now + mMaxReportLatencyNs;
+            }
+            mFifo.insert(mFifo.end(), events.begin(), events.end());
         }
     }
+
+    if (!mFifo.empty() &&
+        (now >= mFifoDeadlineNs ||
+         mFifo.size() >= static_cast<size_t>(mSensorInfo.fifoMaxEventCount))) {
+        flushFifoLocked();
+    }
+
+    if (!mFifo.empty()) {
+        return std::min(nextSampleTime, mFifoDeadlineNs);
+    }
+    return nextSampleTime;
 }
 
 bool Sensor::isWakeUpSensor() {
@@ -147,10 +186,13 @@ std::vector<Event> Sensor::readEvents() {
 }
 
 void Sensor::setOperationMode(OperationMode mode) {
-    if (mMode != mode) {
-        std::unique_lock<std::mutex> lock(mRunMutex);
-        mMode = mode;
-        mWaitCV.notify_all();
+    std::unique_lock<std::mutex> lock(mRunMutex);
+    if (mMode == mode) {
+        return;
+    }
+    mMode = mode;
+    if (isRunningLocked()) {
+        common::SensorScheduler::getInstance().schedule(this, ::android::elapsedRealtimeNano());
     }
 }
 
@@ -211,7 +253,7 @@ AccelSensor::AccelSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
     mSensorInfo.minDelay = 10 * 1000;  // microseconds
     mSensorInfo.maxDelay = kDefaultMaxDelayUs;
     mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = static_cast<uint32_t>(SensorFlagBits::DATA_INJECTION);
 };
@@ -237,7 +279,7 @@ PressureSensor::PressureSensor(int32_t sensorHandle, ISensorsEventCallback* call
     mSensorInfo.minDelay = 100 * 1000;  // microseconds
     mSensorInfo.maxDelay = kDefaultMaxDelayUs;
     mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = 0;
 };
@@ -260,7 +302,7 @@ MagnetometerSensor::MagnetometerSensor(int32_t sensorHandle, ISensorsEventCallba
     mSensorInfo.minDelay = 20 * 1000;  // microseconds
     mSensorInfo.maxDelay = kDefaultMaxDelayUs;
     mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = 0;
 };
@@ -317,7 +359,7 @@ GyroSensor::GyroSensor(int32_t sensorHandle, ISensorsEventCallback* callback) :
     mSensorInfo.minDelay = 10 * 1000;  // microseconds
     mSensorInfo.maxDelay = kDefaultMaxDelayUs;
     mSensorInfo.fifoReservedEventCount = 0;
-    mSensorInfo.fifoMaxEventCount = 0;
+    mSensorInfo.fifoMaxEventCount = kDefaultFifoMaxEventCount;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = 0;
 };
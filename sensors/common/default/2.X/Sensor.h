@@ -20,7 +20,8 @@
 #include <android/hardware/sensors/1.0/types.h>
 #include <android/hardware/sensors/2.1/types.h>
 
-#include <condition_variable>
+#include "SensorScheduler.h"
+
 #include <memory>
 #include <mutex>
 #include <thread>
@@ -33,6 +34,8 @@ namespace V2_X {
 namespace implementation {
 
 static constexpr int32_t kDefaultMaxDelayUs = 10 * 1000 * 1000;
+// FIFO size of continuous sensors, which support batching.
+static constexpr int32_t kDefaultFifoMaxEventCount = 300;
 
 class ISensorsEventCallback {
   public:
@@ -42,7 +45,7 @@ class ISensorsEventCallback {
     virtual void postEvents(const std::vector<Event>& events, bool wakeup) = 0;
 };
 
-class Sensor {
+class Sensor : public common::ScheduledSensor {
   public:
     using OperationMode = ::android::hardware::sensors::V1_0::OperationMode;
     using Result = ::android::hardware::sensors::V1_0::Result;
@@ -55,7 +58,7 @@ class Sensor {
     virtual ~Sensor();
 
     const SensorInfo& getSensorInfo() const;
-    void batch(int64_t samplingPeriodNs);
+    void batch(int64_t samplingPeriodNs, int64_t maxReportLatencyNs);
     virtual void activate(bool enable);
     Result flush();
 
@@ -63,23 +66,33 @@ class Sensor {
     bool supportsDataInjection() const;
     Result injectEvent(const Event& event);
 
+    /**
+     * Called by SensorScheduler when the sensor's deadline expires. Generates a sample if one is
+     * due and reports batched events if the max report latency has expired or the FIFO is full.
+     * Returns the next deadline, or SensorScheduler::kNoDeadline.
+     */
+    int64_t onDeadline(int64_t now) override;
+
   protected:
-    void run();
     virtual std::vector<Event> readEvents();
     virtual void readEventPayload(EventPayload&) {}
-    static void startThread(Sensor* sensor);
 
     bool isWakeUpSensor();
+    bool isRunningLocked() const;
+    void flushFifoLocked();
 
     bool mIsEnabled;
     int64_t mSamplingPeriodNs;
+    int64_t mMaxReportLatencyNs;
     int64_t mLastSampleTimeNs;
     SensorInfo mSensorInfo;
 
-    std::atomic_bool mStopThread;
-    std::condition_variable mWaitCV;
     std::mutex mRunMutex;
-    std::thread mRunThread;
+
+    // Events waiting to be reported, while batching.
+    std::vector<Event> mFifo;
+    // Time at which the oldest event in the FIFO must be reported.
+    int64_t mFifoDeadlineNs;
 
     ISensorsEventCallback* mCallback;
 
@@ -154,10 +154,10 @@ struct Sensors : public ISensorsInterface, public ISensorsEventCallback {
     }
 
     Return<Result> batch(int32_t sensorHandle, int64_t samplingPeriodNs,
-                         int64_t /* maxReportLatencyNs */) override {
+                         int64_t maxReportLatencyNs) override {
         auto sensor = mSensors.find(sensorHandle);
         if (sensor != mSensors.end()) {
-            sensor->second->batch(samplingPeriodNs);
+            sensor->second->batch(samplingPeriodNs, maxReportLatencyNs);
             return Result::OK;
         }
         return Result::BAD_VALUE;
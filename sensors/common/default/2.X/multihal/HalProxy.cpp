@@ -19,6 +19,7 @@
 #include <android/hardware/sensors/2.0/types.h>
 
 #include <android-base/file.h>
+#include <utils/SystemClock.h>
 #include "hardware_legacy/power.h"
 
 #include <dlfcn.h>
@@ -27,6 +28,7 @@
 #include <cmath>
 #include <fstream>
 #include <functional>
+#include <iomanip>
 #include <thread>
 
 namespace android {
@@ -223,9 +225,9 @@ Return<Result> HalProxy::initializeCommon(
     // again we do not get new events until after initialize resets the subhals.
     disableAllSensors();
 
-    // Clears the queue if any events were pending write before.
-    mPendingWriteEventsQueue = std::queue<std::pair<std::vector<V2_1::Event>, size_t>>();
-    mSizePendingWriteEventsQueue = 0;
+    // Clears the queue if any events were pending write before. Positions are never reset, so
+    // that slots published before can't be mistaken for new ones.
+    mPendingWriteEventsHead.store(mPendingWriteEventsTail.load());
 
     // Clears previously connected dynamic sensors
     mDynamicSensors.clear();
@@ -370,16 +372,42 @@ Return<void> HalProxy::debug(const hidl_handle& fd, const hidl_vec<hidl_string>&
            << " ms ago" << std::endl;
     // TODO(b/142969448): Add logging for history of wakelock acquisition per subhal.
     stream << "  Wakelock ref count: " << mWakelockRefCount << std::endl;
-    stream << "  # of events on pending write writes queue: " << mSizePendingWriteEventsQueue
-           << std::endl;
+    stream << "  # of events on pending write writes queue: "
+           << mPendingWriteEventsTail.load() - mPendingWriteEventsHead.load() << std::endl;
     stream << " Most events seen on pending write events queue: "
-           << mMostEventsObservedPendingWriteEventsQueue << std::endl;
-    if (!mPendingWriteEventsQueue.empty()) {
-        stream << "  Size of events list on front of pending writes queue: "
-               << mPendingWriteEventsQueue.front().first.size() << std::endl;
-    }
+           << mMostEventsObservedPendingWriteEventsQueue.load() << std::endl;
+    stream << "  # of events dropped due to full pending write events queue: "
+           << mNumDroppedPendingWriteEvents.load() << std::endl;
     stream << "  # of non-dynamic sensors across all subhals: " << mSensors.size() << std::endl;
     stream << "  # of dynamic sensors across all subhals: " << mDynamicSensors.size() << std::endl;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mWakelockMutex);
+        stream << "  Wakelock hold time (ms): ";
+        mWakelockHoldTimeMs.dump(stream);
+        stream << std::endl;
+    }
+    stream << "  Pending write events queue depth: ";
+    mPendingWriteEventsQueueDepth.dump(stream);
+    stream << std::endl;
+    stream << "Event latency by sensor handle (us):" << std::endl;
+    auto dumpLatencyStats = [&stream](const SensorLatencyStats& stats) {
+        stream << "    Timestamp to enqueue: ";
+        stats.timestampToEnqueueUs.dump(stream);
+        stream << std::endl;
+        stream << "    Enqueue to fmq write: ";
+        stats.enqueueToWriteUs.dump(stream);
+        stream << std::endl;
+    };
+    for (const auto& [sensorHandle, stats] : mSensorLatencyStats) {
+        if (stats.timestampToEnqueueUs.count() == 0 && stats.enqueueToWriteUs.count() == 0) {
+            continue;
+        }
+        stream << "  0x" << std::hex << std::setw(8) << std::setfill('0') << sensorHandle
+               << std::dec << std::setfill(' ') << std::endl;
+        dumpLatencyStats(stats);
+    }
+    stream << "  Dynamic sensors" << std::endl;
+    dumpLatencyStats(mDynamicSensorLatencyStats);
     stream << "SubHals (" << mSubHalList.size() << "):" << std::endl;
     for (auto& subHal : mSubHalList) {
         stream << "  Name: " << subHal->getName() << std::endl;
@@ -527,7 +555,16 @@ void* HalProxy::getHandleForSubHalSharedObject(const std::string& filename) {
 }
 
 void HalProxy::init() {
+    // Allocated once so that posting events never allocates. The writers cycle through every slot,
+    // so the whole ring ends up resident.
+    mPendingWriteEvents.reset(new Event[kMaxSizePendingWriteEventsQueue]);
+    mPendingWriteEventsPublished.reset(
+            new std::atomic<uint64_t>[kMaxSizePendingWriteEventsQueue]());
+    mPendingWriteEventsEnqueueTimeNs.reset(new int64_t[kMaxSizePendingWriteEventsQueue]);
     initializeSensorList();
+    for (const auto& [sensorHandle, sensor] : mSensors) {
+        mSensorLatencyStats.try_emplace(sensorHandle);
+    }
 }
 
 void HalProxy::stopThreads() {
@@ -544,7 +581,10 @@ void HalProxy::stopThreads() {
         mWakelockQueueFlag->wake(static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN));
     }
     mWakelockCV.notify_one();
-    mEventQueueWriteCV.notify_one();
+    {
+        std::lock_guard<std::mutex> lock(mPendingWritesWaitMutex);
+        mEventQueueWriteCV.notify_one();
+    }
     if (mPendingWritesThread.joinable()) {
         mPendingWritesThread.join();
     }
@@ -570,45 +610,85 @@ void HalProxy::startPendingWritesThread(HalProxy* halProxy) {
 }
 
 void HalProxy::handlePendingWrites() {
-    // TODO(b/143302327): Find a way to optimize locking strategy maybe using two mutexes instead of
-    // one.
-    std::unique_lock<std::mutex> lock(mEventQueueWriteMutex);
     while (mThreadsRun.load()) {
-        mEventQueueWriteCV.wait(
-                lock, [&] { return !mPendingWriteEventsQueue.empty() || !mThreadsRun.load(); });
-        if (mThreadsRun.load()) {
-            std::vector<Event>& pendingWriteEvents = mPendingWriteEventsQueue.front().first;
-            size_t numWakeupEvents = mPendingWriteEventsQueue.front().second;
-            size_t eventQueueSize = mEventQueue->getQuantumCount();
-            size_t numToWrite = std::min(pendingWriteEvents.size(), eventQueueSize);
-            lock.unlock();
-            if (!mEventQueue->writeBlocking(
-                        pendingWriteEvents.data(), numToWrite,
-                        static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ),
-                        static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS),
-                        kPendingWriteTimeoutNs, mEventQueueFlag)) {
-                ALOGE("Dropping %zu events after blockingWrite failed.", numToWrite);
-                if (numWakeupEvents > 0) {
-                    if (pendingWriteEvents.size() > eventQueueSize) {
-                        decrementRefCountAndMaybeReleaseWakelock(
-                                countNumWakeupEvents(pendingWriteEvents, eventQueueSize));
-                    } else {
-                        decrementRefCountAndMaybeReleaseWakelock(numWakeupEvents);
-                    }
-                }
-            }
-            lock.lock();
-            mSizePendingWriteEventsQueue -= numToWrite;
-            if (pendingWriteEvents.size() > eventQueueSize) {
-                // TODO(b/143302327): Check if this erase operation is too inefficient. It will copy
-                // all the events ahead of it down to fill gap off array at front after the erase.
-                pendingWriteEvents.erase(pendingWriteEvents.begin(),
-                                         pendingWriteEvents.begin() + eventQueueSize);
-            } else {
-                mPendingWriteEventsQueue.pop();
+        uint64_t head = mPendingWriteEventsHead.load(std::memory_order_relaxed);
+        size_t start = head & (kMaxSizePendingWriteEventsQueue - 1);
+        size_t eventQueueSize = mEventQueue->getQuantumCount();
+        // Only a contiguous part of the ring can be written at once.
+        size_t maxToWrite = std::min(kMaxSizePendingWriteEventsQueue - start, eventQueueSize);
+
+        size_t numToWrite = 0;
+        while (numToWrite < maxToWrite &&
+               mPendingWriteEventsPublished[start + numToWrite].load() == head + numToWrite + 1) {
+            numToWrite++;
+        }
+
+        if (numToWrite == 0) {
+            std::unique_lock<std::mutex> lock(mPendingWritesWaitMutex);
+            mPendingWritesThreadWaiting.store(true);
+            mEventQueueWriteCV.wait(lock, [&] {
+                return mPendingWriteEventsPublished[start].load() == head + 1 ||
+                       !mThreadsRun.load();
+            });
+            mPendingWritesThreadWaiting.store(false);
+            continue;
+        }
+
+        bool written;
+        int64_t writeTimeNs;
+        {
+            std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
+            written = mEventQueue->writeBlocking(
+                    &mPendingWriteEvents[start], numToWrite,
+                    static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ),
+                    static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS),
+                    kPendingWriteTimeoutNs, mEventQueueFlag);
+            writeTimeNs = elapsedRealtimeNano();
+        }
+        if (written) {
+            recordPendingWriteStats(start, numToWrite, writeTimeNs);
+        } else {
+            ALOGE("Dropping %zu events after blockingWrite failed.", numToWrite);
+            size_t numWakeupEvents = countNumWakeupEvents(&mPendingWriteEvents[start], numToWrite);
+            if (numWakeupEvents > 0) {
+                decrementRefCountAndMaybeReleaseWakelock(numWakeupEvents);
             }
         }
+        // Frees the slots for sub-HAL callbacks, only after the events were copied to the fmq.
+        mPendingWriteEventsHead.store(head + numToWrite);
+    }
+}
+
+bool HalProxy::enqueuePendingWriteEvents(const Event* events, size_t n, int64_t enqueueTimeNs) {
+    uint64_t tail = mPendingWriteEventsTail.load(std::memory_order_relaxed);
+    uint64_t head;
+    do {
+        head = mPendingWriteEventsHead.load();
+        if (tail + n - head > kMaxSizePendingWriteEventsQueue) {
+            return false;
+        }
+    } while (!mPendingWriteEventsTail.compare_exchange_weak(tail, tail + n));
+
+    for (size_t i = 0; i < n; i++) {
+        size_t slot = (tail + i) & (kMaxSizePendingWriteEventsQueue - 1);
+        mPendingWriteEvents[slot] = events[i];
+        mPendingWriteEventsEnqueueTimeNs[slot] = enqueueTimeNs;
+        mPendingWriteEventsPublished[slot].store(tail + i + 1);
     }
+
+    size_t size = tail + n - head;
+    size_t mostObserved = mMostEventsObservedPendingWriteEventsQueue.load();
+    while (size > mostObserved &&
+           !mMostEventsObservedPendingWriteEventsQueue.compare_exchange_weak(mostObserved, size)) {
+    }
+
+    // The thread sets the flag before checking for published events, so that either it sees the
+    // events or this sees the flag.
+    if (mPendingWritesThreadWaiting.load()) {
+        std::lock_guard<std::mutex> lock(mPendingWritesWaitMutex);
+        mEventQueueWriteCV.notify_one();
+    }
+    return true;
 }
 
 void HalProxy::startWakelockThread(HalProxy* halProxy) {
@@ -660,33 +740,73 @@ void HalProxy::resetSharedWakelock() {
 
 void HalProxy::postEventsToMessageQueue(const std::vector<Event>& events, size_t numWakeupEvents,
                                         V2_0::implementation::ScopedWakelock wakelock) {
+    int64_t enqueueTimeNs = elapsedRealtimeNano();
+    int64_t writeTimeNs = 0;
     size_t numToWrite = 0;
-    std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
     if (wakelock.isLocked()) {
         incrementRefCountAndMaybeAcquireWakelock(numWakeupEvents);
     }
-    if (mPendingWriteEventsQueue.empty()) {
-        numToWrite = std::min(events.size(), mEventQueue->availableToWrite());
-        if (numToWrite > 0) {
-            if (mEventQueue->write(events.data(), numToWrite)) {
-                // TODO(b/143302327): While loop if mEventQueue->avaiableToWrite > 0 to possibly fit
-                // in more writes immediately
-                mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
-            } else {
-                numToWrite = 0;
+    // Events may only bypass the pending write events queue if it is empty (including the events
+    // being written by the background thread), otherwise they would be reordered. If the fmq is
+    // busy, the events are queued instead of waiting for it.
+    if (mPendingWriteEventsTail.load() == mPendingWriteEventsHead.load() &&
+        mEventQueueWriteMutex.try_lock()) {
+        std::lock_guard<std::mutex> lock(mEventQueueWriteMutex, std::adopt_lock);
+        if (mPendingWriteEventsTail.load() == mPendingWriteEventsHead.load()) {
+            numToWrite = std::min(events.size(), mEventQueue->availableToWrite());
+            if (numToWrite > 0) {
+                if (mEventQueue->write(events.data(), numToWrite)) {
+                    mEventQueueFlag->wake(
+                            static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
+                    writeTimeNs = elapsedRealtimeNano();
+                } else {
+                    numToWrite = 0;
+                }
             }
         }
     }
     size_t numLeft = events.size() - numToWrite;
-    if (numToWrite < events.size() &&
-        mSizePendingWriteEventsQueue + numLeft <= kMaxSizePendingWriteEventsQueue) {
-        std::vector<Event> eventsLeft(events.begin() + numToWrite, events.end());
-        mPendingWriteEventsQueue.push({eventsLeft, numWakeupEvents});
-        mSizePendingWriteEventsQueue += numLeft;
-        mMostEventsObservedPendingWriteEventsQueue =
-                std::max(mMostEventsObservedPendingWriteEventsQueue, mSizePendingWriteEventsQueue);
-        mEventQueueWriteCV.notify_one();
+    if (numLeft > 0 &&
+        !enqueuePendingWriteEvents(events.data() + numToWrite, numLeft, enqueueTimeNs)) {
+        mNumDroppedPendingWriteEvents += numLeft;
+        ALOGE("Dropping %zu events, pending write events queue is full.", numLeft);
+        if (wakelock.isLocked()) {
+            size_t numDroppedWakeupEvents =
+                    countNumWakeupEvents(events.data() + numToWrite, numLeft);
+            if (numDroppedWakeupEvents > 0) {
+                decrementRefCountAndMaybeReleaseWakelock(numDroppedWakeupEvents);
+            }
+        }
     }
+    recordPostedEventStats(events, enqueueTimeNs, numToWrite, writeTimeNs);
+}
+
+void HalProxy::recordPostedEventStats(const std::vector<Event>& events, int64_t enqueueTimeNs,
+                                      size_t numWritten, int64_t writeTimeNs) {
+    mPendingWriteEventsQueueDepth.add(mPendingWriteEventsTail.load(std::memory_order_relaxed) -
+                                      mPendingWriteEventsHead.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < events.size(); i++) {
+        SensorLatencyStats& stats = getSensorLatencyStats(events[i].sensorHandle);
+        // Metadata events, such as flush complete events, don't carry a sample timestamp.
+        if (events[i].sensorType != SensorType::META_DATA) {
+            stats.timestampToEnqueueUs.add((enqueueTimeNs - events[i].timestamp) / 1000);
+        }
+        if (i < numWritten) {
+            stats.enqueueToWriteUs.add((writeTimeNs - enqueueTimeNs) / 1000);
+        }
+    }
+}
+
+void HalProxy::recordPendingWriteStats(size_t start, size_t n, int64_t writeTimeNs) {
+    for (size_t i = start; i < start + n; i++) {
+        getSensorLatencyStats(mPendingWriteEvents[i].sensorHandle)
+                .enqueueToWriteUs.add((writeTimeNs - mPendingWriteEventsEnqueueTimeNs[i]) / 1000);
+    }
+}
+
+HalProxy::SensorLatencyStats& HalProxy::getSensorLatencyStats(int32_t sensorHandle) {
+    auto it = mSensorLatencyStats.find(sensorHandle);
+    return it != mSensorLatencyStats.end() ? it->second : mDynamicSensorLatencyStats;
 }
 
 bool HalProxy::incrementRefCountAndMaybeAcquireWakelock(size_t delta,
@@ -695,6 +815,7 @@ bool HalProxy::incrementRefCountAndMaybeAcquireWakelock(size_t delta,
     std::lock_guard<std::recursive_mutex> lockGuard(mWakelockMutex);
     if (mWakelockRefCount == 0) {
         acquire_wake_lock(PARTIAL_WAKE_LOCK, kWakelockName);
+        mWakelockAcquireTime = getTimeNow();
         mWakelockCV.notify_one();
     }
     mWakelockTimeoutStartTime = getTimeNow();
@@ -718,6 +839,7 @@ void HalProxy::decrementRefCountAndMaybeReleaseWakelock(size_t delta,
     mWakelockRefCount -= std::min(mWakelockRefCount, delta);
     if (mWakelockRefCount == 0) {
         release_wake_lock(kWakelockName);
+        mWakelockHoldTimeMs.add(msFromNs(getTimeNow() - mWakelockAcquireTime));
     }
 }
 
@@ -744,7 +866,7 @@ bool HalProxy::isSubHalIndexValid(int32_t sensorHandle) {
     return extractSubHalIndex(sensorHandle) < mSubHalList.size();
 }
 
-size_t HalProxy::countNumWakeupEvents(const std::vector<Event>& events, size_t n) {
+size_t HalProxy::countNumWakeupEvents(const Event* events, size_t n) {
     size_t numWakeupEvents = 0;
     for (size_t i = 0; i < n; i++) {
         int32_t sensorHandle = events[i].sensorHandle;
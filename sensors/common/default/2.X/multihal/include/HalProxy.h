@@ -18,6 +18,7 @@
 
 #include "EventMessageQueueWrapper.h"
 #include "HalProxyCallback.h"
+#include "Histogram.h"
 #include "ISensorsCallbackWrapper.h"
 #include "SubHalWrapper.h"
 #include "V2_0/ScopedWakelock.h"
@@ -37,7 +38,7 @@
 #include <condition_variable>
 #include <map>
 #include <mutex>
-#include <queue>
+#include <memory>
 #include <thread>
 #include <utility>
 
@@ -70,6 +71,16 @@ class HalProxy : public V2_0::implementation::IScopedWakelockRefCounter,
     using ISensorsV2_1 = V2_1::ISensors;
     using HalProxyCallbackBase = V2_0::implementation::HalProxyCallbackBase;
 
+    /**
+     * The max number of events allowed in the pending write events queue. Every slot of the ring
+     * becomes resident once it has wrapped, so this is sized for the backlog of a few full sensor
+     * FIFO flushes (~1.5MB) rather than an arbitrary bound, and is a power of two so positions map
+     * to slots with a mask.
+     */
+    static constexpr size_t kMaxSizePendingWriteEventsQueue = 1 << 14;
+    static_assert((kMaxSizePendingWriteEventsQueue & (kMaxSizePendingWriteEventsQueue - 1)) == 0,
+                  "kMaxSizePendingWriteEventsQueue must be a power of two");
+
     explicit HalProxy();
     // Test only constructor.
     explicit HalProxy(std::vector<ISensorsSubHalV2_0*>& subHalList);
@@ -202,25 +213,52 @@ class HalProxy : public V2_0::implementation::IScopedWakelockRefCounter,
     static constexpr int32_t kSensorHandleSubHalIndexMask = 0xFF000000;
 
     /**
-     * A FIFO queue of pairs of vector of events and the number of wakeup events in that vector
-     * which are waiting to be written to the events fmq in the background thread.
+     * Preallocated ring of events waiting to be written to the event fmq by the background thread.
+     *
+     * Sub-HAL callbacks claim slots by advancing mPendingWriteEventsTail, copy their events in and
+     * publish each slot by storing its position + 1 in mPendingWriteEventsPublished. The pending
+     * writes thread writes published events to the fmq straight from the ring and only then
+     * advances mPendingWriteEventsHead, which frees the slots. No lock is taken on either side.
      */
-    std::queue<std::pair<std::vector<Event>, size_t>> mPendingWriteEventsQueue;
+    std::unique_ptr<Event[]> mPendingWriteEvents;
+    std::unique_ptr<std::atomic<uint64_t>[]> mPendingWriteEventsPublished;
+    //! The time (elapsedRealtimeNano) each event of mPendingWriteEvents was posted at.
+    std::unique_ptr<int64_t[]> mPendingWriteEventsEnqueueTimeNs;
+    std::atomic<uint64_t> mPendingWriteEventsHead = 0;
+    std::atomic<uint64_t> mPendingWriteEventsTail = 0;
 
     //! The most events observed on the pending write events queue for debug purposes.
-    size_t mMostEventsObservedPendingWriteEventsQueue = 0;
+    std::atomic<size_t> mMostEventsObservedPendingWriteEventsQueue = 0;
 
-    //! The max number of events allowed in the pending write events queue
-    static constexpr size_t kMaxSizePendingWriteEventsQueue = 100000;
+    //! The number of events dropped because the pending write events queue was full.
+    std::atomic<uint64_t> mNumDroppedPendingWriteEvents = 0;
 
-    //! The number of events in the pending write events queue
-    size_t mSizePendingWriteEventsQueue = 0;
-
-    //! The mutex protecting writing to the fmq and the pending events queue
+    //! The mutex protecting writing to the event fmq
     std::mutex mEventQueueWriteMutex;
 
-    //! The condition variable waiting on pending write events to stack up
+    //! The mutex and condition variable used by the pending writes thread to wait for events
+    std::mutex mPendingWritesWaitMutex;
     std::condition_variable mEventQueueWriteCV;
+    std::atomic_bool mPendingWritesThreadWaiting = false;
+
+    //! Latency statistics of the events of one sensor handle, in microseconds.
+    struct SensorLatencyStats {
+        //! From the event timestamp to the event being posted by the subhal.
+        Histogram timestampToEnqueueUs;
+        //! From the event being posted by the subhal to it being written to the event fmq.
+        Histogram enqueueToWriteUs;
+    };
+
+    //! The event latency statistics by static sensor handle. Filled in by init() and never
+    //! modified afterwards, so the subhal threads and the pending writes thread update the
+    //! histograms without any locking.
+    std::map<int32_t, SensorLatencyStats> mSensorLatencyStats;
+
+    //! The event latency statistics of the dynamic sensors, which connect after init().
+    SensorLatencyStats mDynamicSensorLatencyStats;
+
+    //! The size of the pending write events queue, sampled whenever events are posted.
+    Histogram mPendingWriteEventsQueueDepth;
 
     //! The thread object ptr that handles pending writes
     std::thread mPendingWritesThread;
@@ -249,6 +287,12 @@ class HalProxy : public V2_0::implementation::IScopedWakelockRefCounter,
 
     int64_t mWakelockTimeoutResetTime = V2_0::implementation::getTimeNow();
 
+    //! The time the wakelock was last acquired at.
+    int64_t mWakelockAcquireTime = 0;
+
+    //! How long the wakelock was held for, in milliseconds.
+    Histogram mWakelockHoldTimeMs;
+
     const char* kWakelockName = "SensorsHAL_WAKEUP";
 
     /**
@@ -303,6 +347,44 @@ class HalProxy : public V2_0::implementation::IScopedWakelockRefCounter,
     //! Handles the pending writes on events to eventqueue.
     void handlePendingWrites();
 
+    /**
+     * Add events to the pending write events queue and wake up the pending writes thread.
+     *
+     * @param events The events to add.
+     * @param n The number of events to add.
+     * @param enqueueTimeNs The time the events were posted at.
+     *
+     * @return false if there was not enough room for all the events, in which case none is added.
+     */
+    bool enqueuePendingWriteEvents(const Event* events, size_t n, int64_t enqueueTimeNs);
+
+    /**
+     * Record the latency statistics of events posted by a subhal.
+     *
+     * @param events The posted events.
+     * @param enqueueTimeNs The time the events were posted at.
+     * @param numWritten The number of events that were written to the event fmq right away.
+     * @param writeTimeNs The time these events were written to the event fmq at.
+     */
+    void recordPostedEventStats(const std::vector<Event>& events, int64_t enqueueTimeNs,
+                                size_t numWritten, int64_t writeTimeNs);
+
+    /**
+     * Record the latency statistics of events written to the event fmq by the background thread.
+     *
+     * @param start The index of the first written event of the pending write events queue.
+     * @param n The number of events written.
+     * @param writeTimeNs The time the events were written at.
+     */
+    void recordPendingWriteStats(size_t start, size_t n, int64_t writeTimeNs);
+
+    /**
+     * Get the latency statistics of a sensor handle, shared by all dynamic sensors.
+     *
+     * @param sensorHandle The sensor handle of an event.
+     */
+    SensorLatencyStats& getSensorLatencyStats(int32_t sensorHandle);
+
     /**
      * Starts the thread that handles decrementing the ref count on wakeup events processed by the
      * framework and timing out wakelocks.
@@ -357,14 +439,14 @@ class HalProxy : public V2_0::implementation::IScopedWakelockRefCounter,
     bool isSubHalIndexValid(int32_t sensorHandle);
 
     /**
-     * Count the number of wakeup events in the first n events of the vector.
+     * Count the number of wakeup events in the first n events of the array.
      *
-     * @param events The vector of Event objects.
+     * @param events The array of Event objects.
      * @param n The end index not inclusive of events to consider.
      *
      * @return The number of wakeup events of the considered events.
      */
-    size_t countNumWakeupEvents(const std::vector<Event>& events, size_t n);
+    size_t countNumWakeupEvents(const Event* events, size_t n);
 
     /*
      * Clear out the subhal index bytes from a sensorHandle.
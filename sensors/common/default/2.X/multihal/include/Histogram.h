@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * A histogram of non-negative values with power of two buckets, cheap enough to be updated for
+ * every sensor event. Bucket 0 counts the value 0 and bucket i > 0 counts the values in
+ * [2^(i-1), 2^i).
+ *
+ * Thread safe without locking: the counters are relaxed atomics, so a dump running concurrently
+ * with updates may see a sample in some counters and not in others yet.
+ */
+class Histogram {
+  public:
+    void add(int64_t value) {
+        uint64_t v = static_cast<uint64_t>(std::max<int64_t>(value, 0));
+        size_t bucket = v == 0 ? 0 : 64 - __builtin_clzll(v);
+        mBuckets[std::min(bucket, kNumBuckets - 1)].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+        mSum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t max = mMax.load(std::memory_order_relaxed);
+        while (v > max && !mMax.compare_exchange_weak(max, v, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+
+    /**
+     * Write the count, mean and max of the values and the upper bounds of the buckets containing
+     * the 50th, 90th and 99th percentiles.
+     */
+    void dump(std::ostream& stream) const {
+        std::array<uint64_t, kNumBuckets> buckets;
+        uint64_t count = 0;
+        for (size_t i = 0; i < kNumBuckets; i++) {
+            buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+            count += buckets[i];
+        }
+        stream << "count=" << count;
+        if (count == 0) {
+            return;
+        }
+        uint64_t max = mMax.load(std::memory_order_relaxed);
+        stream << " mean=" << mSum.load(std::memory_order_relaxed) / count
+               << " p50<=" << percentileUpperBound(buckets, count, max, 50)
+               << " p90<=" << percentileUpperBound(buckets, count, max, 90)
+               << " p99<=" << percentileUpperBound(buckets, count, max, 99) << " max=" << max;
+    }
+
+  private:
+    static constexpr size_t kNumBuckets = 48;
+
+    static uint64_t percentileUpperBound(const std::array<uint64_t, kNumBuckets>& buckets,
+                                         uint64_t count, uint64_t max, uint64_t percentile) {
+        uint64_t rank = (count * percentile + 99) / 100;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kNumBuckets; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::min(max, i == 0 ? 0 : (uint64_t(1) << i) - 1);
+            }
+        }
+        return max;
+    }
+
+    std::array<std::atomic<uint64_t>, kNumBuckets> mBuckets = {};
+    std::atomic<uint64_t> mCount = 0;
+    std::atomic<uint64_t> mSum = 0;
+    std::atomic<uint64_t> mMax = 0;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
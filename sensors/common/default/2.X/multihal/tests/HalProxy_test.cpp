@@ -25,6 +25,7 @@
 #include "V2_0/ScopedWakelock.h"
 #include "convertV2_1.h"
 
+#include <algorithm>
 #include <chrono>
 #include <set>
 #include <thread>
@@ -760,9 +761,9 @@ TEST(HalProxyTest, PostedEventSensorHandleSubHalIndexValid) {
 }
 
 TEST(HalProxyTest, FillAndDrainPendingQueueTest) {
-    constexpr size_t kQueueSize = 5;
-    // TODO: Make this constant linked to same limit in HalProxy.h
-    constexpr size_t kMaxPendingQueueSize = 100000;
+    // Divides the pending queue size, so the drain loop below reads it out exactly.
+    constexpr size_t kQueueSize = 4;
+    constexpr size_t kMaxPendingQueueSize = HalProxy::kMaxSizePendingWriteEventsQueue;
     AllSensorsSubHal<SensorsSubHalV2_0> subhal;
     std::vector<ISensorsSubHal*> subHals{&subhal};
 
@@ -798,6 +799,87 @@ TEST(HalProxyTest, FillAndDrainPendingQueueTest) {
     EXPECT_TRUE(readEventsOutOfQueue(1, eventQueue, eventQueueFlag));
 }
 
+TEST(HalProxyTest, PostEventsStressTest) {
+    constexpr size_t kQueueSize = 128;
+    constexpr size_t kNumSubHals = 4;
+    constexpr size_t kNumPostsPerSubHal = 400;
+    constexpr size_t kNumEventsPerPost = 10;
+    constexpr size_t kTotalEvents = kNumSubHals * kNumPostsPerSubHal * kNumEventsPerPost;
+    // No event may be dropped, even if the reader falls behind all posters.
+    static_assert(kTotalEvents <= HalProxy::kMaxSizePendingWriteEventsQueue);
+    constexpr int64_t kMaxMedianLatencyUs = 100 * 1000;
+    AllSensorsSubHal<SensorsSubHalV2_0> subHals[kNumSubHals];
+    std::vector<ISensorsSubHal*> subHalPtrs;
+    for (auto& subHal : subHals) {
+        subHalPtrs.push_back(&subHal);
+    }
+    HalProxy proxy(subHalPtrs);
+    std::unique_ptr<EventMessageQueueV2_0> eventQueue = makeEventFMQ(kQueueSize);
+    std::unique_ptr<WakeupMessageQueue> wakeLockQueue = makeWakelockFMQ(kQueueSize);
+    ::android::sp<ISensorsCallbackV2_0> callback = new SensorsCallback();
+    proxy.initialize(*eventQueue->getDesc(), *wakeLockQueue->getDesc(), callback);
+
+    EventFlag* eventQueueFlag;
+    EventFlag::createEventFlag(eventQueue->getEventFlagWord(), &eventQueueFlag);
+
+    auto nowNs = [] {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+    };
+
+    // Events carry the time they were posted at, so the reader can measure the latency.
+    std::vector<int64_t> latenciesNs;
+    latenciesNs.reserve(kTotalEvents);
+    std::thread reader([&] {
+        std::vector<EventV1_0> events(kQueueSize);
+        while (latenciesNs.size() < kTotalEvents) {
+            size_t numToRead = std::clamp(eventQueue->availableToRead(), size_t(1), kQueueSize);
+            if (!eventQueue->readBlocking(
+                        events.data(), numToRead,
+                        static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ),
+                        static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS),
+                        INT64_C(500000000) /* timeoutNanoSeconds */, eventQueueFlag)) {
+                break;
+            }
+            int64_t now = nowNs();
+            for (size_t i = 0; i < numToRead; i++) {
+                latenciesNs.push_back(now - events[i].timestamp);
+            }
+        }
+    });
+
+    std::vector<std::thread> posters;
+    for (auto& subHal : subHals) {
+        posters.emplace_back([&] {
+            for (size_t i = 0; i < kNumPostsPerSubHal; i++) {
+                std::vector<EventV1_0> events = makeMultipleAccelerometerEvents(kNumEventsPerPost);
+                for (EventV1_0& event : events) {
+                    event.timestamp = nowNs();
+                }
+                subHal.postEvents(convertToNewEvents(events), false /* wakeup */);
+            }
+        });
+    }
+    for (std::thread& poster : posters) {
+        poster.join();
+    }
+    reader.join();
+
+    ASSERT_EQ(latenciesNs.size(), kTotalEvents);
+    std::sort(latenciesNs.begin(), latenciesNs.end());
+    int64_t p50Us = latenciesNs[kTotalEvents / 2] / 1000;
+    int64_t p99Us = latenciesNs[kTotalEvents * 99 / 100] / 1000;
+    int64_t maxUs = latenciesNs.back() / 1000;
+    RecordProperty("latency_p50_us", std::to_string(p50Us));
+    RecordProperty("latency_p99_us", std::to_string(p99Us));
+    RecordProperty("latency_max_us", std::to_string(maxUs));
+
+    // Loose bound, so the test isn't flaky on loaded devices, but catches events that wait for a
+    // later post or a full reader timeout before being written to the queue.
+    EXPECT_LT(p50Us, kMaxMedianLatencyUs);
+}
+
 TEST(HalProxyTest, PostEventsMultipleSubhalsThreadedV2_1) {
     constexpr size_t kQueueSize = 5;
     constexpr size_t kNumEvents = 2;
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SensorScheduler.h"
+
+#include <pthread.h>
+#include <utils/SystemClock.h>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace common {
+
+SensorScheduler& SensorScheduler::getInstance() {
+    // Never destroyed, sensors may be torn down during static destruction.
+    static SensorScheduler* instance = new SensorScheduler();
+    return *instance;
+}
+
+SensorScheduler::SensorScheduler() : mNextGeneration(0), mRunningSensor(nullptr) {
+    mThread = std::thread(&SensorScheduler::run, this);
+    pthread_setname_np(mThread.native_handle(), "SensorScheduler");
+    mThread.detach();
+}
+
+void SensorScheduler::schedule(ScheduledSensor* sensor, int64_t deadlineNs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const uint64_t generation = mNextGeneration++;
+    mGenerations[sensor] = generation;
+    mDeadlines.push({deadlineNs, sensor, generation});
+    mWakeCV.notify_one();
+}
+
+void SensorScheduler::remove(ScheduledSensor* sensor) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mGenerations.erase(sensor);
+    mRunDoneCV.wait(lock, [&] { return mRunningSensor != sensor; });
+}
+
+void SensorScheduler::run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        if (mDeadlines.empty()) {
+            mWakeCV.wait(lock);
+            continue;
+        }
+
+        const Entry entry = mDeadlines.top();
+        auto generation = mGenerations.find(entry.sensor);
+        if (generation == mGenerations.end() || generation->second != entry.generation) {
+            mDeadlines.pop();
+            continue;
+        }
+
+        int64_t now = ::android::elapsedRealtimeNano();
+        if (entry.deadlineNs > now) {
+            mWakeCV.wait_for(lock, std::chrono::nanoseconds(entry.deadlineNs - now));
+            continue;
+        }
+        mDeadlines.pop();
+
+        mRunningSensor = entry.sensor;
+        lock.unlock();
+        const int64_t nextDeadlineNs = entry.sensor->onDeadline(now);
+        lock.lock();
+        mRunningSensor = nullptr;
+        mRunDoneCV.notify_all();
+
+        // Don't reschedule if the sensor was removed or rescheduled while running.
+        generation = mGenerations.find(entry.sensor);
+        if (generation == mGenerations.end() || generation->second != entry.generation) {
+            continue;
+        }
+        if (nextDeadlineNs == kNoDeadline) {
+            mGenerations.erase(generation);
+            continue;
+        }
+        generation->second = mNextGeneration++;
+        mDeadlines.push({nextDeadlineNs, entry.sensor, generation->second});
+    }
+}
+
+}  // namespace common
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
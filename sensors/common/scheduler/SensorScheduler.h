@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_SENSORS_COMMON_SENSOR_SCHEDULER_H
+#define ANDROID_HARDWARE_SENSORS_COMMON_SENSOR_SCHEDULER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace common {
+
+// Sensor driven by the SensorScheduler.
+class ScheduledSensor {
+  public:
+    virtual ~ScheduledSensor() = default;
+
+    // Called by the scheduler thread when the sensor's deadline expires, without holding any
+    // scheduler lock. Returns the next deadline, or SensorScheduler::kNoDeadline.
+    virtual int64_t onDeadline(int64_t now) = 0;
+};
+
+// A single thread driving all simulated sensors.
+//
+// Shared by the HIDL and AIDL default implementations. Each sensor has at most one pending
+// deadline. When the deadline expires, the scheduler calls ScheduledSensor::onDeadline(), which
+// generates samples or flushes the sensor's FIFO and returns the next deadline.
+class SensorScheduler {
+  public:
+    // Value returned by ScheduledSensor::onDeadline() when the sensor doesn't need to be woken up
+    // again.
+    static constexpr int64_t kNoDeadline = -1;
+
+    static SensorScheduler& getInstance();
+
+    // Wake up the sensor at deadlineNs (CLOCK_BOOTTIME), replacing its pending deadline.
+    void schedule(ScheduledSensor* sensor, int64_t deadlineNs);
+
+    // Stop scheduling the sensor. Blocks while the sensor's onDeadline() is being executed, so it
+    // is safe to destroy the sensor afterwards.
+    void remove(ScheduledSensor* sensor);
+
+  private:
+    struct Entry {
+        int64_t deadlineNs;
+        ScheduledSensor* sensor;
+        uint64_t generation;
+
+        bool operator>(const Entry& other) const { return deadlineNs > other.deadlineNs; }
+    };
+
+    SensorScheduler();
+    void run();
+
+    std::mutex mMutex;
+    std::condition_variable mWakeCV;
+    std::condition_variable mRunDoneCV;
+    // Deadline heap. Entries superseded by a later schedule() or remove() call are skipped.
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> mDeadlines;
+    // Generation of the only valid heap entry for each scheduled sensor.
+    std::unordered_map<ScheduledSensor*, uint64_t> mGenerations;
+    uint64_t mNextGeneration;
+    // Sensor whose onDeadline() is being executed.
+    ScheduledSensor* mRunningSensor;
+    std::thread mThread;
+};
+
+}  // namespace common
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_SENSORS_COMMON_SENSOR_SCHEDULER_H